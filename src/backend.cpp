@@ -2,8 +2,14 @@
 
 #include <chrono>
 #include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include <jack/midiport.h>
 
 #include "backend.h"
+#include "trace.h"
+#include "log.h"
 
 #define ASSERT(cond, msg)              \
     if (!(cond)) {                     \
@@ -15,23 +21,46 @@
 ///
 /// Constructor:
 ///     @param client_name the display name of the jack client
+///     @param config_path the config file (its journal and binary cache sit next to it)
 ///
-Backend::Backend(const std::string client_name) : m_client_name(client_name),
-                                                  settings(Settings(CONFIG_PATH)) {
+Backend::Backend(const std::string client_name, const std::string config_path)
+                                                : m_client_name(client_name),
+                                                  m_client(nullptr),
+                                                  m_pool(PORT_POOL_SIZE),
+                                                  m_mix(nullptr),
+                                                  m_fade(0),
+                                                  m_timed_applied(0),
+                                                  m_resend(false),
+                                                  m_learn(false),
+                                                  m_closing(false),
+                                                  settings(config_path) {
     settings.load();
 }
 
 ///
-/// setup jack client, set callbacks, create ports,
+/// Name of the main jack client (names the instance)
 ///
-void Backend::setup() {
+const std::string& Backend::name() const {
+    return m_client_name;
+}
 
-    // Open client
-    m_client = jack_client_open(m_client_name.c_str(), JackNoStartServer, NULL);
-    /* m_client = jack_client_new(m_client_name.c_str()); */
-    /* ASSERT(m_client == 0, "Jack server not running?"); */
-    if (m_client == 0)
-        throw JackServerIsDown();
+///
+/// Open a jack client with its callbacks (nullptr if jack is down)
+///
+Backend::Engine* Backend::open_engine(const std::string& name, const unsigned int shard) {
+    jack_client_t* client = jack_client_open(name.c_str(), JackNoStartServer, NULL);
+    if (client == 0)
+        return nullptr;
+
+    Engine* engine = new Engine(this, client, shard);
+    {
+        std::lock_guard<std::mutex> lock(m_metrics_lock);
+        m_engines.push_back(std::unique_ptr<Engine>(engine));
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_event_lock);
+        m_client_names.insert(jack_get_client_name(client));
+    }
 
     // === Set callbacks ===
     //
@@ -39,19 +68,117 @@ void Backend::setup() {
     // need to create intermediate anonymous functions
     //
     // = Set process callback =
-    int (*process_callback)(jack_nframes_t, void*) = [](jack_nframes_t n, void* b){
-            return ((Backend *)b)->callback(n);
+    int (*process_callback)(jack_nframes_t, void*) = [](jack_nframes_t n, void* e){
+            return ((Engine *)e)->backend->callback(*(Engine *)e, n);
         };
-    jack_set_process_callback(m_client, process_callback, this);
+    jack_set_process_callback(client, process_callback, engine);
 
     // = Set shutdown callback =
-    void (*shutdown_callback)(void*) = [](void* b){
-            std::cout << "Server is shutting down..." << std::endl;
-            ((Backend *)b)->m_client = 0;
+    // (wakes the event thread up to reconnect)
+    void (*shutdown_callback)(jack_status_t, const char*, void*) = [](jack_status_t, const char* reason, void* e){
+            LOG_WARN("Server is shutting down... (%s)", reason);
+            ((Engine *)e)->backend->on_shutdown();
+    };
+    jack_on_info_shutdown(client, shutdown_callback, engine);
+
+    // = Set buffer size callback =
+    // (the main client has the mixes recompiled for the new size)
+    int (*buffer_size_callback)(jack_nframes_t, void*) = [](jack_nframes_t n, void* e){
+            ((Engine *)e)->scratch[0].resize(n);
+            ((Engine *)e)->scratch[1].resize(n);
+            if (!((Engine *)e)->shard)
+                ((Engine *)e)->backend->on_buffer_size(n);
+            return 0;
+        };
+    jack_set_buffer_size_callback(client, buffer_size_callback, engine);
+
+    // = Set xrun callback =
+    int (*xrun_callback)(void*) = [](void* e){
+            ((Engine *)e)->xruns.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        };
+    jack_set_xrun_callback(client, xrun_callback, engine);
+
+    // = Set thread init callback =
+    // (gives the process thread its trace ring and log queue before it runs)
+    void (*thread_init_callback)(void*) = [](void* e){
+            const std::string name = std::string("jack ") + jack_get_client_name(((Engine *)e)->client);
+            Trace::register_thread(name);
+            Log::register_thread(name);
+        };
+    jack_set_thread_init_callback(client, thread_init_callback, engine);
+
+    engine->scratch[0].resize(jack_get_buffer_size(client));
+    engine->scratch[1].resize(jack_get_buffer_size(client));
+    return engine;
+}
+
+///
+/// setup jack client, set callbacks, create ports,
+///
+void Backend::setup() {
+    // (callbacks aren't running: forget about the mixes of the old clients)
+    forget_timed();
+    {
+        std::lock_guard<std::mutex> lock(m_metrics_lock);
+        m_engines.clear();
+    }
+    m_retired.clear();
+    {
+        std::lock_guard<std::mutex> lock(m_use_lock);
+        m_port_use.clear();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_event_lock);
+        m_client_names.clear();
+    }
+
+    // Open client
+    Engine* main = open_engine(m_client_name, 0);
+    /* m_client = jack_client_new(m_client_name.c_str()); */
+    /* ASSERT(m_client == 0, "Jack server not running?"); */
+    if (!main)
+        throw JackServerIsDown();
+    m_client = main->client;
+
+    // = Set port connect and registration callbacks =
+    // (track connections made by other clients to our ports)
+    void (*connect_callback)(jack_port_id_t, jack_port_id_t, int, void*) = [](jack_port_id_t a, jack_port_id_t b, int c, void* arg){
+            ((Backend *)arg)->on_port_connect(a, b, c);
     };
-    jack_on_shutdown(m_client, shutdown_callback, this);
+    jack_set_port_connect_callback(m_client, connect_callback, this);
+    void (*registration_callback)(jack_port_id_t, int, void*) = [](jack_port_id_t p, int r, void* arg){
+            ((Backend *)arg)->on_port_registration(p, r);
+    };
+    jack_set_port_registration_callback(m_client, registration_callback, this);
+    m_closing = false;
+
+    m_sample_rate = jack_get_sample_rate(m_client);
+    m_block = jack_get_buffer_size(m_client);
+    // (ports of the old clients, ids may have been renumbered since)
+    m_input_ports.clear();
+    m_implicit_output_ports.clear();
+    m_explicit_output_ports.clear();
+    m_inserts.clear();
+    m_envelopes.clear();
+    m_duck_gains.clear();
+    m_returns.clear();
+
+    // === Open shards ===
+    // (one more client per share of the buses, jackd2 runs them in parallel)
+    for (unsigned int k=1; k<=settings.shard_count(); k++) {
+        if (!open_engine(m_client_name + "-" + std::to_string(k), k)) {
+            LOG_ERROR("Could not open shard %u", k);
+            break;
+        }
+    }
+    assign_shards();
 
     // === Register ports ===
+    // (all of them before activating, the pool is only filled afterwards
+    // so it doesn't compete with startup)
+    m_pool.detach();
+    const PortPool::Stats before = m_pool.stats();
     // Inputs
     for (std::string i : settings.get_inputs()) {
         register_port(i, true);
@@ -63,32 +190,234 @@ void Backend::setup() {
     // Monitor
     const std::string name =std::string("MONITOR");
     m_monitor_port = {
-        jack_port_register(m_client, (name+LEFT_SUFFIX ).c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0),
-        jack_port_register(m_client, (name+RIGHT_SUFFIX).c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0),
+        m_pool.take(m_client, name+LEFT_SUFFIX,  false),
+        m_pool.take(m_client, name+RIGHT_SUFFIX, false),
     };
+    // MIDI control surface (feedback starts over on the new client)
+    m_midi_in  = jack_port_register(m_client, MIDI_IN_PORT,  JACK_DEFAULT_MIDI_TYPE, JackPortIsInput,  0);
+    m_midi_out = jack_port_register(m_client, MIDI_OUT_PORT, JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput, 0);
+    if (!m_midi_in || !m_midi_out)
+        LOG_ERROR("Could not register the MIDI ports");
+    m_resend = true;
+    const PortPool::Stats after = m_pool.stats();
+    LOG_INFO("Registered %lu ports in %.1f ms", after.registered - before.registered,
+             after.register_ms - before.register_ms);
+
+    // === Compile mix and scenes ===
+    commit();
+    prepare_scenes();
+
+    // === Activate clients ===
+    for (const auto& engine : m_engines) {
+        int active = jack_activate(engine->client);
+        ASSERT(!active, "Could not activate client")
+    }
+
+    m_active = true;
+
+    // === Feed the shards ===
+    for (const auto& p : m_input_ports)
+        connect_taps(p.first);
+
+    // === Fill the port pool in the background ===
+    m_pool.start();
+    m_pool.attach(m_client);
+}
+
+///
+/// Spread the buses over the shards: pinned ones where the config says,
+/// the others biggest first onto the least loaded shard (load: number
+/// of connected inputs)
+///
+void Backend::assign_shards() {
+    m_bus_shard.clear();
+    const unsigned int shards = m_engines.size() - 1;
+    if (!shards)
+        return;
+
+    std::vector<size_t> load(shards + 1, 0);
+    std::vector<std::pair<size_t, channel_id_t>> automatic;
+    for (const std::string& o : settings.get_outputs()) {
+        const channel_id_t id = settings.find_output(o);
+        const size_t cost = settings.get_sources(id).size() + 1;
+        const int pinned = settings.channel(id).shard;
+        if (pinned >= 1 && pinned <= (int) shards) {
+            m_bus_shard[id] = pinned;
+            load[pinned] += cost;
+        } else {
+            automatic.push_back({cost, id});
+        }
+    }
+
+    std::sort(automatic.rbegin(), automatic.rend());
+    for (const auto& a : automatic) {
+        const unsigned int k = std::min_element(load.begin() + 1, load.end()) - load.begin();
+        m_bus_shard[a.second] = k;
+        load[k] += a.first;
+    }
+}
+
+///
+/// Shard of an output added while running (pinned or least busy)
+///
+const unsigned int Backend::assign_shard(const channel_id_t output) {
+    const unsigned int shards = m_engines.size() - 1;
+    if (!shards)
+        return 0;
+
+    const int pinned = settings.channel(output).shard;
+    unsigned int k = 1;
+    if (pinned >= 1 && pinned <= (int) shards) {
+        k = pinned;
+    } else {
+        std::vector<size_t> buses(shards + 1, 0);
+        for (const auto& p : m_bus_shard)
+            buses[p.second]++;
+        k = std::min_element(buses.begin() + 1, buses.end()) - buses.begin();
+    }
+    m_bus_shard[output] = k;
+    return k;
+}
 
+///
+/// Jack client owning the ports of an output
+///
+jack_client_t* Backend::bus_client(const channel_id_t output) {
+    const auto shard = m_bus_shard.find(output);
+    return shard == m_bus_shard.end() ? m_client.load() : m_engines[shard->second]->client;
+}
+
+///
+/// Connect the implicit output of an input to its taps in every shard
+///
+void Backend::connect_taps(const channel_id_t input) {
+    const auto out = m_implicit_output_ports.find(input);
+    if (out == m_implicit_output_ports.end())
+        return;
+
+    for (size_t k=1; k<m_engines.size(); k++) {
+        const auto tap = m_engines[k]->taps.find(input);
+        if (tap == m_engines[k]->taps.end())
+            continue;
+        for (int c=0; c<2; c++)
+            jack_connect(m_client, jack_port_name(out->second[c]), jack_port_name(tap->second[c]));
+    }
+}
+
+///
+/// Output to shard assignment
+///
+const std::map<std::string, unsigned int> Backend::shards() {
+    std::map<std::string, unsigned int> shards;
+    for (const std::string& o : settings.get_outputs()) {
+        const auto shard = m_bus_shard.find(settings.find_output(o));
+        shards[o] = shard == m_bus_shard.end() ? 0 : shard->second;
+    }
+    return shards;
+}
+
+///
+/// A jack client of ours died: close them all and reconnect
+/// (any thread, usually a jack shutdown callback)
+///
+void Backend::on_shutdown() {
+    m_pool.detach();
+    std::lock_guard<std::mutex> lock(m_event_lock);
+    if (!m_client)
+        return;
+    for (const auto& engine : m_engines)
+        m_dead_clients.push_back(engine->client);
+    m_client = 0;
+    m_event_wake.notify_all();
+}
+
+///
+/// The jack buffer size changed: let the event thread size the mixes for
+/// it (until then the callbacks render in blocks of the old size)
+///
+void Backend::on_buffer_size(jack_nframes_t nframes) {
+    std::lock_guard<std::mutex> lock(m_event_lock);
+    m_new_block = nframes;
+    m_event_wake.notify_all();
+}
 
-    // === Activate client ===
-    int active = jack_activate(m_client);
-    ASSERT(!active, "Could not activate client")
+///
+/// Close the jack clients and let the event thread set everything up
+/// again (to apply a new shard layout)
+///
+void Backend::restart() {
+    shutdown();
+    std::lock_guard<std::mutex> lock(m_event_lock);
+    m_event_wake.notify_all();
 }
 
 ///
-/// Reconnection to jack in case the server stops
+/// Start the jack event thread. It (re)connects to jack, retrying with
+/// an exponential backoff while the server is down, and sleeps until the
+/// server goes away or a port event needs handling.
 ///
 void Backend::start_recon_loop() {
     auto recon = [this](){
+        Trace::register_thread("jack events " + m_client_name);
+        Log::register_thread("jack events " + m_client_name);
+        std::chrono::milliseconds backoff(RECON_BACKOFF_MIN_MS);
+        std::unique_lock<std::mutex> lock(m_event_lock);
         while (m_try_recon) {
-            if (!m_client) {
+            if (!m_dead_clients.empty()) {
+                // can't be closed from their own shutdown callback
+                std::vector<jack_client_t*> dead;
+                dead.swap(m_dead_clients);
+                lock.unlock();
+                {
+                    std::lock_guard<std::mutex> metrics(m_metrics_lock);
+                    for (jack_client_t* client : dead)
+                        jack_client_close(client);
+                }
+                lock.lock();
+            } else if (!m_client) {
+                m_port_events.clear();
+                lock.unlock();
+                bool up = false;
                 try {
-                    std::cout << "Attempting (re)connection..." << std::endl;
+                    LOG_INFO("Attempting (re)connection...");
+                    std::lock_guard<std::mutex> command(command_lock);
                     setup();
+                    restore_connections();
+                    up = true;
                 } catch (JackServerIsDown& e) {
-                    std::cout << "Jack server is down" << std::endl;
+                    LOG_WARN("Jack server is down");
+                }
+                lock.lock();
+
+                if (up) {
+                    backoff = std::chrono::milliseconds(RECON_BACKOFF_MIN_MS);
+                } else {
+                    m_event_wake.wait_for(lock, backoff);
+                    backoff = std::min(backoff * 2, std::chrono::milliseconds(RECON_BACKOFF_MAX_MS));
+                }
+            } else if (m_new_block) {
+                const jack_nframes_t block = m_new_block;
+                m_new_block = 0;
+                lock.unlock();
+                {
+                    std::lock_guard<std::mutex> command(command_lock);
+                    if (block != m_block) {
+                        LOG_INFO("Buffer size is now %u frames", block);
+                        m_block = block;
+                        m_layout++;
+                        commit();
+                    }
                 }
+                lock.lock();
+            } else if (!m_port_events.empty()) {
+                std::vector<PortEvent> events;
+                events.swap(m_port_events);
+                lock.unlock();
+                handle_port_events(events);
+                lock.lock();
+            } else {
+                m_event_wake.wait(lock);
             }
-            /* std::cout << m_client << std::endl; */
-            std::this_thread::sleep_for(std::chrono::seconds(2));
         }
     };
 
@@ -97,182 +426,2490 @@ void Backend::start_recon_loop() {
 }
 
 ///
-/// Stop reconnection loop
+/// Stop the jack event thread
 ///
 void Backend::stop_recon_loop() {
-    m_try_recon = false;
+    {
+        std::lock_guard<std::mutex> lock(m_event_lock);
+        m_try_recon = false;
+    }
+    m_event_wake.notify_all();
     m_recon_loop.join();
 }
 
+///
+/// Start the thread running timed commands
+///
+void Backend::start_scheduler() {
+    m_run_scheduler = true;
+    m_scheduler = std::thread([this](){ scheduler_loop(); });
+}
+
+///
+/// Stop the timed commands thread (pending commands are dropped)
+///
+void Backend::stop_scheduler() {
+    {
+        std::lock_guard<std::mutex> lock(m_schedule_lock);
+        m_run_scheduler = false;
+    }
+    m_schedule_wake.notify_all();
+    m_scheduler.join();
+}
+
+///
+/// Start the thread storing the volumes moved from MIDI and the controls
+/// learned
+///
+void Backend::start_midi() {
+    m_run_midi = true;
+    m_midi_thread = std::thread([this](){ midi_loop(); });
+}
+
+///
+/// Stop the MIDI thread, storing the last moves
+///
+void Backend::stop_midi() {
+    {
+        std::lock_guard<std::mutex> lock(m_midi_lock);
+        m_run_midi = false;
+    }
+    m_midi_wake.notify_all();
+    m_midi_thread.join();
+    sync_midi();
+}
+
+///
+/// Jack frame time `ms` milliseconds from now
+///
+const jack_nframes_t Backend::frame_in(const float ms) {
+    jack_client_t* client = m_client;
+    if (!client)
+        throw JackServerIsDown();
+    return jack_frame_time(client) + (jack_nframes_t)(ms * m_sample_rate / 1000);
+}
+
+///
+/// Run `action` (a command followed by a commit) so that the mix it
+/// publishes takes effect at jack frame time `frame`
+///
+void Backend::schedule(const jack_nframes_t frame, std::function<void()> action) {
+    jack_client_t* client = m_client;
+    if (!client)
+        throw JackServerIsDown();
+
+    std::lock_guard<std::mutex> lock(m_schedule_lock);
+    m_schedule.insert({jack_frames_to_time(client, frame), {frame, action}});
+    m_schedule_wake.notify_all();
+}
+
+///
+/// Timed commands thread: run each command TIMED_LOOKAHEAD_MS before it
+/// is due, its mix is queued for the callback with the exact frame
+///
+void Backend::scheduler_loop() {
+    Trace::register_thread("scheduler " + m_client_name);
+    Log::register_thread("scheduler " + m_client_name);
+    std::unique_lock<std::mutex> lock(m_schedule_lock);
+    while (m_run_scheduler) {
+        if (m_schedule.empty()) {
+            m_schedule_wake.wait(lock);
+            continue;
+        }
+
+        const auto next = m_schedule.begin();
+        const jack_time_t now  = jack_get_time();
+        const jack_time_t lead = TIMED_LOOKAHEAD_MS * 1000;
+        if (next->first > now + lead) {
+            m_schedule_wake.wait_for(lock, std::chrono::microseconds(next->first - lead - now));
+            continue;
+        }
+
+        const jack_nframes_t frame = next->second.first;
+        const std::function<void()> action = next->second.second;
+        m_schedule.erase(next);
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> command(command_lock);
+            m_timing = true;
+            m_timed_frame = frame;
+            try {
+                action();
+            } catch (std::exception& e) {
+                LOG_ERROR("Timed command failed: %s", e.what());
+            }
+            m_timing = false;
+        }
+        settle_timed();
+        lock.lock();
+    }
+}
+
+///
+/// MIDI thread: every MIDI_SYNC_MS, map the control learned and store the
+/// volumes moved from MIDI
+///
+void Backend::midi_loop() {
+    Trace::register_thread("midi " + m_client_name);
+    Log::register_thread("midi " + m_client_name);
+    std::unique_lock<std::mutex> lock(m_midi_lock);
+    while (m_run_midi) {
+        m_midi_wake.wait_for(lock, std::chrono::milliseconds(MIDI_SYNC_MS));
+        if (!m_run_midi)
+            break;
+        lock.unlock();
+        sync_midi();
+        lock.lock();
+    }
+}
+
+///
+/// Bring the settings in line with the MIDI surface (MIDI thread). A
+/// moved volume is stored (journaled, sent to its listeners) and
+/// published; once the callbacks picked that mix up, its fader stops
+/// overriding it.
+///
+void Backend::sync_midi() {
+    const MidiControl* learned = m_learned.front();
+    if (learned) {
+        const MidiControl control = *learned;
+        m_learned.pop();
+        std::lock_guard<std::mutex> command(command_lock);
+        if (control.type == MidiControl::NOTE && !m_learning.mute) {
+            LOG_WARN("MIDI learn: a note can only mute, move a controller");
+            m_learn = true;
+        } else {
+            settings.set_midi(control.name(), m_learning);
+            commit();
+            LOG_INFO("MIDI learn: %s -> %s", control.name().c_str(), m_learning.target.c_str());
+        }
+    }
+
+    std::vector<std::pair<std::shared_ptr<Fader>, unsigned long>> moved;
+    {
+        std::lock_guard<std::mutex> command(command_lock);
+        std::vector<channel_id_t> ids;
+        {
+            std::lock_guard<std::mutex> lock(m_control_lock);
+            for (const auto& p : m_faders) {
+                const unsigned long moves = p.second->moves.load(std::memory_order_acquire);
+                if (moves == p.second->settled.load(std::memory_order_relaxed))
+                    continue;
+                // (at least as recent as `moves`)
+                p.second->stored = p.second->gain.load(std::memory_order_relaxed);
+                moved.push_back({p.second, moves});
+                ids.push_back(p.first);
+            }
+        }
+        if (moved.empty())
+            return;
+
+        for (size_t i=0; i<ids.size(); i++) {
+            const Channel& channel = settings.channel(ids[i]);
+            if (channel.input)
+                settings.set_input_volume(channel.name, moved[i].first->stored);
+            else
+                settings.set_output_volume(channel.name, moved[i].first->stored);
+        }
+        commit();
+    }
+
+    sync();
+    std::lock_guard<std::mutex> lock(m_control_lock);
+    for (const auto& m : moved)
+        if (m.first->settled.load(std::memory_order_relaxed) < m.second)
+            m.first->settled.store(m.second, std::memory_order_relaxed);
+}
+
+///
+/// True if a full port name belongs to the main client or a shard
+/// (call with `m_event_lock` held)
+///
+const bool Backend::is_ours(const std::string& port_name) {
+    return m_client_names.count(port_name.substr(0, port_name.find(':')));
+}
+
+///
+/// Port connect callback (jack notification thread): queue connections
+/// between one of our ports and a port of another client
+///
+void Backend::on_port_connect(jack_port_id_t a, jack_port_id_t b, const bool connected) {
+    jack_client_t* client = m_client;
+    if (!client || m_closing)
+        return;
+
+    jack_port_t* port_a = jack_port_by_id(client, a);
+    jack_port_t* port_b = jack_port_by_id(client, b);
+    if (!port_a || !port_b)
+        return;
+    update_use(port_a);
+    update_use(port_b);
+    if (connected && (port_a == m_midi_out || port_b == m_midi_out))
+        m_resend = true;
+
+    const std::string name_a = jack_port_name(port_a);
+    const std::string name_b = jack_port_name(port_b);
+
+    std::lock_guard<std::mutex> lock(m_event_lock);
+    const bool mine_a = is_ours(name_a);
+    if (mine_a == is_ours(name_b))
+        return;
+
+    jack_port_t* mine = mine_a ? port_a : port_b;
+    const std::string port = jack_port_short_name(mine);
+    if (port.compare(0, std::strlen(PORT_POOL_PREFIX), PORT_POOL_PREFIX) == 0)
+        return;
+    // the only inputs of a shard are its taps
+    if (!jack_port_is_mine(client, mine) && (jack_port_flags(mine) & JackPortIsInput))
+        return;
+
+    m_port_events.push_back({port, mine_a ? name_b : name_a, connected});
+    m_event_wake.notify_all();
+}
+
+///
+/// Follow whether anything reads an output port pair
+///
+void Backend::track_use(const std::vector<jack_port_t*>& ports) {
+    std::shared_ptr<PortUse> use = std::make_shared<PortUse>(ports[0], ports[1]);
+    use->connected = jack_port_connected(ports[0]) || jack_port_connected(ports[1]);
+
+    std::lock_guard<std::mutex> lock(m_use_lock);
+    m_port_use[ports[0]] = use;
+    m_port_use[ports[1]] = use;
+}
+
+///
+/// Refresh the connection state of the pair `port` belongs to, if it's one
+/// of our output ports (jack notification thread)
+///
+void Backend::update_use(jack_port_t* port) {
+    std::lock_guard<std::mutex> lock(m_use_lock);
+    const auto use = m_port_use.find(port);
+    if (use == m_port_use.end())
+        return;
+    const PortUse& pair = *use->second;
+    use->second->connected.store(jack_port_connected(pair.ports[0]) || jack_port_connected(pair.ports[1]),
+                                 std::memory_order_release);
+}
+
+///
+/// Stop following an output port pair (the mixes using it keep it alive)
+///
+void Backend::forget_use(const std::vector<jack_port_t*>& ports) {
+    std::lock_guard<std::mutex> lock(m_use_lock);
+    for (jack_port_t* port : ports)
+        m_port_use.erase(port);
+}
+
+///
+/// Port registration callback (jack notification thread): a port of
+/// another client showed up, it may have connections to restore
+///
+void Backend::on_port_registration(jack_port_id_t id, const bool registered) {
+    jack_client_t* client = m_client;
+    if (!client || m_closing || !registered)
+        return;
+
+    jack_port_t* port = jack_port_by_id(client, id);
+    if (!port)
+        return;
+    const std::string name = jack_port_name(port);
+
+    std::lock_guard<std::mutex> lock(m_event_lock);
+    if (is_ours(name))
+        return;
+    m_port_events.push_back({"", name, true});
+    m_event_wake.notify_all();
+}
+
+///
+/// Apply queued port events to the settings (event thread)
+///
+void Backend::handle_port_events(const std::vector<PortEvent>& events) {
+    std::lock_guard<std::mutex> command(command_lock);
+    for (const PortEvent& e : events) {
+        if (e.port.empty()) {
+            restore_connections(e.other);
+        } else if (e.connected) {
+            settings.set_external(e.port, e.other, true);
+        } else if (m_client && jack_port_by_name(m_client, e.other.c_str())) {
+            // a port that went away with its client keeps its connections,
+            // they come back when it registers again
+            settings.set_external(e.port, e.other, false);
+        }
+    }
+}
+
+///
+/// Connect our ports to the ports of other clients they were connected
+/// to (only to `other` if given). Call with `command_lock` held.
+///
+void Backend::restore_connections(const std::string& other) {
+    jack_client_t* client = m_client;
+    if (!client)
+        return;
+
+    size_t restored = 0;
+    for (const auto& p : settings.get_external()) {
+        // owned by the main client, or by a shard for outputs
+        std::string name;
+        jack_port_t* port = nullptr;
+        for (size_t k=0; k<m_engines.size() && !port; k++) {
+            name = std::string(jack_get_client_name(m_engines[k]->client)) + ":" + p.first;
+            port = jack_port_by_name(client, name.c_str());
+            if (port && k && (jack_port_flags(port) & JackPortIsInput))
+                port = nullptr;
+        }
+        if (!port)
+            continue;
+        const bool input = jack_port_flags(port) & JackPortIsInput;
+
+        for (const std::string& o : p.second) {
+            if (!other.empty() && o != other)
+                continue;
+            const int err = input ? jack_connect(client, o.c_str(), name.c_str())
+                                  : jack_connect(client, name.c_str(), o.c_str());
+            restored += err == 0;
+        }
+    }
+    if (restored)
+        LOG_INFO("Restored %zu connections", restored);
+}
+
 ///
 /// Register a new jack port. (Also adds the input/ouput to settings in needed)
+/// Ports come from the spare pool when it has some.
 ///
 void Backend::register_port(const std::string name, const bool input) {
+    TRACE_SCOPE("register port");
     if (input) {
+        if (!settings.is_input(name, true)) {
+            settings.add_input(name, 1);
+        }
+        const channel_id_t id = settings.find_input(name);
+        const std::string port_name = settings.channel(id).name;
+
         // explicit input:
-        m_input_ports[name] = {
-            jack_port_register(m_client, (name+LEFT_SUFFIX ).c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0),
-            jack_port_register(m_client, (name+RIGHT_SUFFIX).c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0),
+        m_input_ports[id] = {
+            m_pool.take(m_client, port_name+LEFT_SUFFIX,  true),
+            m_pool.take(m_client, port_name+RIGHT_SUFFIX, true),
         };
         // implicit output:
-        m_implicit_output_ports[name] = {
-            jack_port_register(m_client, (name+OUT_SUFFIX+LEFT_SUFFIX ).c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0),
-            jack_port_register(m_client, (name+OUT_SUFFIX+RIGHT_SUFFIX).c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0),
+        m_implicit_output_ports[id] = {
+            m_pool.take(m_client, port_name+OUT_SUFFIX+LEFT_SUFFIX,  false),
+            m_pool.take(m_client, port_name+OUT_SUFFIX+RIGHT_SUFFIX, false),
         };
-        if (!settings.is_input(name)) {
-            settings.add_input(name, 1);
+        track_use(m_implicit_output_ports[id]);
+        // taps of the shards:
+        for (size_t k=1; k<m_engines.size(); k++) {
+            jack_client_t* client = m_engines[k]->client;
+            m_engines[k]->taps[id] = {
+                m_pool.take(client, port_name+LEFT_SUFFIX,  true),
+                m_pool.take(client, port_name+RIGHT_SUFFIX, true),
+            };
         }
+        if (m_active)
+            connect_taps(id);
     } else {
-        // explicit output:
-        m_explicit_output_ports[name] = {
-            jack_port_register(m_client, (name+LEFT_SUFFIX ).c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0),
-            jack_port_register(m_client, (name+RIGHT_SUFFIX).c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0),
-        };
-        if (!settings.is_output(name)) {
+        if (!settings.is_output(name, true)) {
             settings.add_output(name, 1);
         }
+        const channel_id_t id = settings.find_output(name);
+        const std::string port_name = settings.channel(id).name;
+        if (m_engines.size() > 1 && !m_bus_shard.count(id))
+            assign_shard(id);
+        jack_client_t* client = bus_client(id);
+
+        // explicit output:
+        m_explicit_output_ports[id] = {
+            m_pool.take(client, port_name+LEFT_SUFFIX,  false),
+            m_pool.take(client, port_name+RIGHT_SUFFIX, false),
+        };
+        track_use(m_explicit_output_ports[id]);
     }
+    m_layout++;
 }
 
 ///
 /// Unregister port and remove input/output from settings
 ///
 void Backend::unregister_port(const std::string name, const bool input) {
-    if (input) {
-        jack_port_unregister(m_client, m_input_ports[name][0]);
-        jack_port_unregister(m_client, m_input_ports[name][1]);
-        jack_port_unregister(m_client, m_implicit_output_ports[name][0]);
-        jack_port_unregister(m_client, m_implicit_output_ports[name][1]);
-
-        m_input_ports.erase(name);
-        m_implicit_output_ports.erase(name);
-        settings.remove_input(name);
-    } else {
-        jack_port_unregister(m_client, m_explicit_output_ports[name][0]);
-        jack_port_unregister(m_client, m_explicit_output_ports[name][1]);
+    unregister_ports({{name, input}});
+}
+
+///
+/// Unregister several ports with a single engine update
+///
+void Backend::unregister_ports(const std::vector<std::pair<std::string, bool>>& names) {
+    TRACE_SCOPE("unregister ports", "ports", names.size());
+    std::vector<std::pair<jack_client_t*, jack_port_t*>> ports;
+    auto drop = [&ports](jack_client_t* client, const std::vector<jack_port_t*>& channel) {
+        for (jack_port_t* port : channel)
+            ports.push_back({client, port});
+    };
+    for (const auto& n : names) {
+        const std::string& name = n.first;
+        if (n.second) {
+            const channel_id_t id = settings.find_input(name);
+            if (id == NO_CHANNEL)
+                throw Settings::InputNotFound(name);
+
+            drop(m_client, m_input_ports[id]);
+            drop(m_client, m_implicit_output_ports[id]);
+            forget_use(m_implicit_output_ports[id]);
+            for (size_t k=1; k<m_engines.size(); k++) {
+                drop(m_engines[k]->client, m_engines[k]->taps[id]);
+                m_engines[k]->taps.erase(id);
+            }
 
-        m_explicit_output_ports.erase(name);
-        settings.remove_output(name);
+            m_input_ports.erase(id);
+            m_implicit_output_ports.erase(id);
+            settings.remove_input(name);
+        } else {
+            const channel_id_t id = settings.find_output(name);
+            if (id == NO_CHANNEL)
+                throw Settings::OutputNotFound(name);
+
+            drop(bus_client(id), m_explicit_output_ports[id]);
+            forget_use(m_explicit_output_ports[id]);
+
+            m_explicit_output_ports.erase(id);
+            m_bus_shard.erase(id);
+            settings.remove_output(name);
+        }
     }
+    m_layout++;
+
+    // the callbacks must be done with the ports before they go away
+    commit();
+    sync();
+
+    for (const auto& p : ports)
+        m_pool.give(p.first, p.second);
 }
 
 ///
 /// Rename port in jack backend and in settings
+/// (ports are keyed by channel id so the mix stays valid)
 ///
 void Backend::rename_port(const std::string old_name, const std::string new_name, const bool input) {
     if (input) {
-        float old_vol = settings.get_input_volume(old_name);
-        settings.remove_input(old_name);
-
-        m_input_ports[new_name] = m_input_ports[old_name];
-        m_input_ports.erase(old_name);
-
-        m_implicit_output_ports[new_name] = m_implicit_output_ports[old_name];
-        m_implicit_output_ports.erase(old_name);
-
-        jack_port_set_name(m_input_ports[new_name][0], (new_name+LEFT_SUFFIX ).c_str());
-        jack_port_set_name(m_input_ports[new_name][1], (new_name+RIGHT_SUFFIX).c_str());
+        const channel_id_t id = settings.find_input(old_name);
+        settings.rename_input(old_name, new_name);
 
-        jack_port_set_name(m_implicit_output_ports[new_name][0], (new_name+OUT_SUFFIX+LEFT_SUFFIX ).c_str());
-        jack_port_set_name(m_implicit_output_ports[new_name][1], (new_name+OUT_SUFFIX+RIGHT_SUFFIX).c_str());
+        if (m_input_ports.count(id)) {
+            jack_port_set_name(m_input_ports[id][0], (new_name+LEFT_SUFFIX ).c_str());
+            jack_port_set_name(m_input_ports[id][1], (new_name+RIGHT_SUFFIX).c_str());
 
-        settings.add_input(new_name, old_vol);
+            jack_port_set_name(m_implicit_output_ports[id][0], (new_name+OUT_SUFFIX+LEFT_SUFFIX ).c_str());
+            jack_port_set_name(m_implicit_output_ports[id][1], (new_name+OUT_SUFFIX+RIGHT_SUFFIX).c_str());
+        }
+        for (size_t k=1; k<m_engines.size(); k++) {
+            const auto tap = m_engines[k]->taps.find(id);
+            if (tap == m_engines[k]->taps.end())
+                continue;
+            jack_port_set_name(tap->second[0], (new_name+LEFT_SUFFIX ).c_str());
+            jack_port_set_name(tap->second[1], (new_name+RIGHT_SUFFIX).c_str());
+        }
     } else {
-        float old_vol = settings.get_output_volume(old_name);
-        settings.remove_output(old_name);
-
-        m_explicit_output_ports[new_name] = m_explicit_output_ports[old_name];
-        m_explicit_output_ports.erase(old_name);
-
-        jack_port_set_name(m_explicit_output_ports[new_name][0], (new_name+LEFT_SUFFIX ).c_str());
-        jack_port_set_name(m_explicit_output_ports[new_name][1], (new_name+RIGHT_SUFFIX).c_str());
+        const channel_id_t id = settings.find_output(old_name);
+        settings.rename_output(old_name, new_name);
 
-        settings.add_output(new_name, old_vol);
+        if (m_explicit_output_ports.count(id)) {
+            jack_port_set_name(m_explicit_output_ports[id][0], (new_name+LEFT_SUFFIX ).c_str());
+            jack_port_set_name(m_explicit_output_ports[id][1], (new_name+RIGHT_SUFFIX).c_str());
+        }
     }
 }
 
 ///
-/// Callback function. Does the actual backend audio connection handling.
+/// Apply the config file on top of the running state. Only channels that
+/// were added or removed touch jack ports; volumes, routing, monitor and
+/// scenes are patched in place and published in one commit. The file has
+/// no ids, so a channel renamed in it is removed and added again (its
+/// external jack connections are not carried over: use `rename` for that).
 ///
-int Backend::callback(jack_nframes_t nframes) {
-# define SAMPLE_TYPE jack_default_audio_sample_t
+void Backend::reload_config() {
+    // our own saves keep the binary snapshot in step with the file
+    std::lock_guard<std::mutex> command(command_lock);
+    if (!settings.changed_on_disk())
+        return;
 
-    // Mirror inputs to output versions (with volume controls)
-    for (const auto& in : m_input_ports) {
-        std::vector<jack_port_t*> out = m_implicit_output_ports[in.first];
-        SAMPLE_TYPE* mleft  = nullptr;
-        SAMPLE_TYPE* mright = nullptr;
+    SETTINGS_BACKEND cfg(settings.filename());
+    try {
+        cfg.load();
+    } catch (std::exception& e) {
+        LOG_ERROR("Could not reload config: %s", e.what());
+        return;
+    }
+    const Scene live = settings.snapshot();
 
-        if (settings.monitoring_input() && settings.get_monitor() == in.first) {
-             mleft  = (SAMPLE_TYPE*) jack_port_get_buffer(m_monitor_port[0], nframes);
-             mright = (SAMPLE_TYPE*) jack_port_get_buffer(m_monitor_port[1], nframes);
+    // connection signature of a channel (what it is connected to)
+    auto signature = [](const std::map<std::string, std::vector<std::string>>& connections,
+                        const std::string& name, const bool input) {
+        std::vector<std::string> sig;
+        for (const auto& p : connections) {
+            if (!input && p.first == name)
+                sig = p.second;
+            else if (input && std::find(p.second.begin(), p.second.end(), name) != p.second.end())
+                sig.push_back(p.first);
         }
+        std::sort(sig.begin(), sig.end());
+        return sig;
+    };
 
-        SAMPLE_TYPE* oleft  = (SAMPLE_TYPE*) jack_port_get_buffer(out[0], nframes);
-        SAMPLE_TYPE* oright = (SAMPLE_TYPE*) jack_port_get_buffer(out[1], nframes);
-
-        SAMPLE_TYPE* ileft  = (SAMPLE_TYPE*) jack_port_get_buffer(in.second[0], nframes);
-        SAMPLE_TYPE* iright = (SAMPLE_TYPE*) jack_port_get_buffer(in.second[1], nframes);
+    auto diff = [&](const std::map<std::string, float>& before, const std::map<std::string, float>& after,
+                    const bool input) {
+        std::vector<std::string> gone, added;
+        for (const auto& p : before)
+            if (!after.count(p.first)) gone.push_back(p.first);
+        for (const auto& p : after)
+            if (!before.count(p.first)) added.push_back(p.first);
 
-        float volume_mod = settings.get_input_volume(in.first);
-        for (jack_nframes_t i=0; i<nframes; i++) {
-            oleft[i]  = ileft[i]  * volume_mod;
-            oright[i] = iright[i] * volume_mod;
+        std::vector<std::pair<std::string, bool>> removals;
+        for (const std::string& g : gone) {
+            LOG_INFO("config: remove %s", g.c_str());
+            removals.push_back({g, input});
         }
-        if (mleft && mright) {
-            std::memcpy(mleft , oleft , sizeof(SAMPLE_TYPE) * nframes);
-            std::memcpy(mright, oright, sizeof(SAMPLE_TYPE) * nframes);
+
+        if (!removals.empty())
+            unregister_ports(removals);
+        for (const std::string& a : added) {
+            LOG_INFO("config: add %s", a.c_str());
+            if (m_client)
+                register_port(a, input);
+            else if (input)
+                settings.add_input(a, after.at(a));
+            else
+                settings.add_output(a, after.at(a));
         }
-    }
+    };
 
-    // Add inputs to the outputs theyre connected to with volume mod for each
-    for (const auto& out : m_explicit_output_ports) {
-        SAMPLE_TYPE* mleft  = nullptr;
-        SAMPLE_TYPE* mright = nullptr;
+    diff(live.input_volumes, cfg.m_input_volumes, true);
+    diff(live.output_volumes, cfg.m_output_volumes, false);
 
-        if (settings.monitoring_output() && settings.get_monitor() == out.first) {
-             mleft  = (SAMPLE_TYPE*) jack_port_get_buffer(m_monitor_port[0], nframes);
-             mright = (SAMPLE_TYPE*) jack_port_get_buffer(m_monitor_port[1], nframes);
-        }
+    // volumes
+    for (const auto& p : cfg.m_input_volumes)
+        if (settings.get_input_volume(p.first) != p.second)
+            settings.set_input_volume(p.first, p.second);
+    for (const auto& p : cfg.m_output_volumes)
+        if (settings.get_output_volume(p.first) != p.second)
+            settings.set_output_volume(p.first, p.second);
 
-        SAMPLE_TYPE* oleft  = (SAMPLE_TYPE*) jack_port_get_buffer(out.second[0], nframes);
-        SAMPLE_TYPE* oright = (SAMPLE_TYPE*) jack_port_get_buffer(out.second[1], nframes);
+    // routing
+    for (const auto& p : cfg.m_output_volumes) {
+        std::vector<std::string> wanted = signature(cfg.m_connections, p.first, false);
+        std::vector<std::string> current = settings.get_connections(p.first);
+        std::sort(current.begin(), current.end());
+        if (wanted != current)
+            settings.set_connections(p.first, wanted);
+    }
 
-        // Set output to 0
-        for (jack_nframes_t i=0; i<nframes; i++) {
-            oleft[i]  = 0;
-            oright[i] = 0;
+    // inserts
+    auto inserts = [this](const std::vector<std::string>& names,
+                          const std::map<std::string, InsertChain>& chains, const bool input) {
+        for (const std::string& name : names) {
+            const auto chain = chains.find(name);
+            const InsertChain wanted = chain == chains.end() ? InsertChain() : chain->second;
+            if (SETTINGS_BACKEND::save_inserts(settings.get_inserts(name, input)) != SETTINGS_BACKEND::save_inserts(wanted))
+                settings.set_inserts(name, input, wanted);
         }
+    };
+    inserts(settings.get_inputs(), cfg.m_input_inserts, true);
+    inserts(settings.get_outputs(), cfg.m_output_inserts, false);
 
-        // Add connected inpus with their volume mods
-        for ( std::string iname : settings.get_connections(out.first)) {
-            /* cout << o.first << iname << endl; */
-            std::vector<jack_port_t*> in = m_input_ports[iname];
+    // ducking
+    const std::map<std::string, DuckRule> ducks = settings.get_ducks();
+    for (const auto& p : ducks)
+        if (!cfg.m_ducks.count(p.first))
+            settings.remove_duck(p.first);
+    for (const auto& p : cfg.m_ducks)
+        if (!ducks.count(p.first) || SETTINGS_BACKEND::save_duck(ducks.at(p.first)) != SETTINGS_BACKEND::save_duck(p.second))
+            settings.set_duck(p.first, p.second);
 
-            SAMPLE_TYPE* ileft  = (SAMPLE_TYPE*) jack_port_get_buffer(in[0], nframes);
-            SAMPLE_TYPE* iright = (SAMPLE_TYPE*) jack_port_get_buffer(in[1], nframes);
+    // mix-minus
+    const std::map<std::string, MixMinusGroup> groups = settings.get_mix_minus();
+    for (const auto& p : groups)
+        if (!cfg.m_mix_minus.count(p.first))
+            settings.remove_mix_minus(p.first);
+    for (const auto& p : cfg.m_mix_minus)
+        if (!groups.count(p.first) ||
+                SETTINGS_BACKEND::save_mix_minus(groups.at(p.first)) != SETTINGS_BACKEND::save_mix_minus(p.second))
+            settings.set_mix_minus(p.first, p.second);
 
-            float ivolume_mod = settings.get_input_volume(iname);
-            for (jack_nframes_t i=0; i<nframes; i++) {
-                oleft[i]  += ileft[i]  * ivolume_mod;
-                oright[i] += iright[i] * ivolume_mod;
-            }
+    // MIDI mappings
+    const std::map<std::string, MidiMapping> midi = settings.get_midi();
+    for (const auto& p : midi)
+        if (!cfg.m_midi.count(p.first))
+            settings.remove_midi(p.first);
+    for (const auto& p : cfg.m_midi)
+        if (!midi.count(p.first) || SETTINGS_BACKEND::save_midi(midi.at(p.first)) != SETTINGS_BACKEND::save_midi(p.second))
+            settings.set_midi(p.first, p.second);
+
+    // tags
+    auto tags = [this](const std::vector<std::string>& names,
+                       const std::map<std::string, std::vector<std::string>>& stored, const bool input) {
+        for (const std::string& name : names) {
+            const auto t = stored.find(name);
+            std::set<std::string> wanted;
+            if (t != stored.end())
+                wanted.insert(t->second.begin(), t->second.end());
+            if (settings.get_tags(name, input) != wanted)
+                settings.set_tags(name, input, wanted);
         }
+    };
+    tags(settings.get_inputs(), cfg.m_input_tags, true);
+    tags(settings.get_outputs(), cfg.m_output_tags, false);
+
+    // monitor
+    if (cfg.m_monitor_channel != settings.get_monitor() || cfg.m_monitoring_input != settings.monitoring_input()) {
+        if (cfg.m_monitoring_input && settings.is_input(cfg.m_monitor_channel))
+            settings.monitor_input(cfg.m_monitor_channel);
+        else if (!cfg.m_monitoring_input && settings.is_output(cfg.m_monitor_channel))
+            settings.monitor_output(cfg.m_monitor_channel);
+    }
 
-        // Apply output volume_mod
-        float ovolume_mod = settings.get_output_volume(out.first);
-        for (jack_nframes_t i=0; i<nframes; i++) {
-            oleft[i]  *= ovolume_mod;
-            oright[i] *= ovolume_mod;
+    // scenes
+    bool scenes_changed = false;
+    for (const std::string& name : settings.get_scenes()) {
+        if (!cfg.m_scenes.count(name)) {
+            remove_scene(name);
+            scenes_changed = true;
         }
-        if (mleft && mright) {
-            std::memcpy(mleft , oleft , sizeof(SAMPLE_TYPE) * nframes);
-            std::memcpy(mright, oright, sizeof(SAMPLE_TYPE) * nframes);
+    }
+    for (const auto& p : cfg.m_scenes) {
+        if (!settings.is_scene(p.first) ||
+                SETTINGS_BACKEND::save_scene(settings.get_scene(p.first)) != SETTINGS_BACKEND::save_scene(p.second)) {
+            settings.store_scene(p.first, p.second);
+            scenes_changed = true;
         }
     }
 
-    return 0;
-#undef SAMPLE_TYPE
+    commit();
+    if (scenes_changed && m_client)
+        prepare_scenes();
+}
+
+///
+/// How much output rendering was skipped for lack of connections
+///
+Backend::RenderStats Backend::render_stats() {
+    RenderStats stats = {0, 0, 0, 0};
+    {
+        std::lock_guard<std::mutex> lock(m_use_lock);
+        std::set<const PortUse*> pairs;
+        for (const auto& p : m_port_use) {
+            if (!pairs.insert(p.second.get()).second)
+                continue;
+            stats.outputs++;
+            stats.connected += p.second->connected.load();
+        }
+    }
+    for (const auto& engine : m_engines) {
+        stats.rendered += engine->rendered.load(std::memory_order_relaxed);
+        stats.skipped  += engine->skipped.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+///
+/// Overload watchdog state of every engine
+///
+const std::vector<Backend::WatchdogStats> Backend::watchdog_stats() {
+    static const Shed::Stage order[] = WATCHDOG_SHED_ORDER;
+    std::vector<WatchdogStats> stats;
+    for (const auto& engine : m_engines) {
+        WatchdogStats s = {engine->shard, engine->load.load(std::memory_order_relaxed), {},
+                           engine->sheds.load(std::memory_order_relaxed),
+                           engine->restores.load(std::memory_order_relaxed)};
+        const unsigned int shed = engine->shed.load(std::memory_order_relaxed);
+        for (const Shed::Stage stage : order)
+            if (shed & (1u << stage))
+                s.shed.push_back(Shed::name(stage));
+        stats.push_back(s);
+    }
+    return stats;
+}
+
+///
+/// Loudness meter of `output` (nullptr if it isn't measured)
+///
+std::shared_ptr<LoudnessMeter> Backend::loudness(const std::string& output) {
+    std::lock_guard<std::mutex> lock(m_control_lock);
+    const auto meter = m_loudness.find(settings.find_output(output));
+    return meter == m_loudness.end() ? nullptr : meter->second;
+}
+
+///
+/// Buses with a loudness meter
+///
+const std::vector<std::string> Backend::measured() {
+    std::lock_guard<std::mutex> lock(m_control_lock);
+    std::vector<std::string> outputs;
+    for (const auto& p : m_loudness)
+        outputs.push_back(settings.channel(p.first).name);
+    std::sort(outputs.begin(), outputs.end());
+    return outputs;
+}
+
+///
+/// Map the next MIDI control moved on the surface like `mapping`
+/// (call with `command_lock` held)
+///
+void Backend::learn(const MidiMapping& mapping) {
+    m_learning = mapping;
+    m_learn = true;
+}
+
+///
+/// Whether a channel is muted from the MIDI surface
+///
+const bool Backend::muted(const std::string& name, const bool input) {
+    std::lock_guard<std::mutex> lock(m_control_lock);
+    const auto fader = m_faders.find(input ? settings.find_input(name) : settings.find_output(name));
+    return fader != m_faders.end() && fader->second->muted.load(std::memory_order_relaxed);
+}
+
+///
+/// Engine metrics: callback durations, xruns, DSP load, rendered frames,
+/// work shed by the watchdog and the gain, peak level and loudness of
+/// every bus, labelled with the mixer instance. Reads what the callbacks
+/// keep up to date and the buses as of the last commit, never waits on
+/// the callbacks or on commands.
+///
+void Backend::metrics(MetricsWriter& writer) {
+    std::lock_guard<std::mutex> lock(m_metrics_lock);
+
+    for (const auto& engine : m_engines) {
+        const std::string shard = std::to_string(engine->shard);
+        unsigned long long count = 0;
+        for (size_t b=0; b<=CALLBACK_BUCKETS; b++) {
+            count += engine->durations[b].load(std::memory_order_relaxed);
+            const std::string le = b < CALLBACK_BUCKETS ? std::to_string(CALLBACK_BUCKETS_US[b] / 1e6) : "+Inf";
+            writer.sample("jamyxer_callback_duration_seconds", "histogram", "_bucket",
+                          MetricsWriter::labels({{"mixer", m_client_name}, {"shard", shard}, {"le", le}}), count);
+        }
+        const std::string labels = MetricsWriter::labels({{"mixer", m_client_name}, {"shard", shard}});
+        writer.sample("jamyxer_callback_duration_seconds", "histogram", "_count", labels, count);
+        writer.sample("jamyxer_callback_duration_seconds", "histogram", "_sum", labels,
+                      engine->duration_sum.load(std::memory_order_relaxed) / 1e6);
+        writer.counter("jamyxer_xruns", labels, engine->xruns.load(std::memory_order_relaxed));
+        writer.counter("jamyxer_rendered_frames", labels, engine->rendered.load(std::memory_order_relaxed));
+        writer.counter("jamyxer_skipped_frames", labels, engine->skipped.load(std::memory_order_relaxed));
+        writer.gauge("jamyxer_shed_stages", labels, engine->shed_count.load(std::memory_order_relaxed));
+        writer.counter("jamyxer_sheds", labels, engine->sheds.load(std::memory_order_relaxed));
+        writer.counter("jamyxer_restores", labels, engine->restores.load(std::memory_order_relaxed));
+    }
+
+    // (the engines of a dead server are only closed under the same lock)
+    const std::string mixer = MetricsWriter::labels({{"mixer", m_client_name}});
+    const bool up = m_client != 0 && !m_engines.empty();
+    writer.gauge("jamyxer_jack_up", mixer, up);
+    if (up)
+        writer.gauge("jamyxer_dsp_load_ratio", mixer, jack_cpu_load(m_engines[0]->client) / 100);
+
+    for (const MeteredBus& bus : m_metered) {
+        const std::string labels = MetricsWriter::labels({{"mixer", m_client_name}, {"bus", bus.name}});
+        writer.gauge("jamyxer_bus_gain", labels, bus.gain);
+
+        if (bus.loudness) {
+            const LoudnessMeter::Reading r = bus.loudness->reading();
+            const std::pair<const char*, float> values[] = {
+                {"jamyxer_loudness_momentary_lufs", r.momentary}, {"jamyxer_loudness_short_term_lufs", r.short_term},
+                {"jamyxer_loudness_integrated_lufs", r.integrated}, {"jamyxer_true_peak_dbtp", r.true_peak}};
+            for (const auto& v : values)
+                if (std::isfinite(v.second))
+                    writer.gauge(v.first, labels, v.second);
+        }
+        if (bus.use)
+            writer.gauge("jamyxer_bus_peak", labels, bus.use->peak.load(std::memory_order_relaxed));
+    }
+}
+
+///
+/// Refresh what scrapes read of the buses (after a commit, with
+/// `m_control_lock` held)
+///
+void Backend::update_metered() {
+    std::vector<MeteredBus> metered;
+    for (channel_id_t id=0; id<settings.channel_count(); id++) {
+        const Channel& c = settings.channel(id);
+        if (!c.active || c.input)
+            continue;
+        MeteredBus bus = {c.name, c.volume, nullptr, nullptr};
+
+        const auto meter = m_loudness.find(id);
+        if (meter != m_loudness.end())
+            bus.loudness = meter->second;
+
+        auto ports = m_explicit_output_ports.find(id);
+        if (ports != m_explicit_output_ports.end() && !ports->second.empty()) {
+            std::lock_guard<std::mutex> lock(m_use_lock);
+            auto use = m_port_use.find(ports->second[0]);
+            if (use != m_port_use.end())
+                bus.use = use->second;
+        }
+        metered.push_back(bus);
+    }
+
+    std::lock_guard<std::mutex> lock(m_metrics_lock);
+    m_metered.swap(metered);
+}
+
+///
+/// Spare ports and time spent registering ports
+///
+PortPool::Stats Backend::port_stats() {
+    return m_pool.stats();
+}
+
+///
+/// Compile `state` into an engine-ready mix against the current ports.
+/// Channels missing from `state` take their values from `settings`
+/// (`complete` is set to false if that happened).
+///
+std::shared_ptr<Mix> Backend::compile(const Scene& state, bool* complete) {
+    std::shared_ptr<Mix> mix = std::make_shared<Mix>();
+    std::map<channel_id_t, size_t> input_index;
+    std::map<channel_id_t, size_t> output_index;
+    bool all_set = true;
+
+    mix->layout = m_layout;
+    mix->block  = m_block;
+
+    auto port_use = [&](jack_port_t* port) {
+        std::lock_guard<std::mutex> lock(m_use_lock);
+        const std::shared_ptr<PortUse>& use = m_port_use.at(port);
+        mix->port_uses.push_back(use);
+        return use.get();
+    };
+
+    for (const auto& p : m_input_ports) {
+        const auto out = m_implicit_output_ports.find(p.first);
+        if (out == m_implicit_output_ports.end())
+            continue;
+
+        const std::string& name = settings.channel(p.first).name;
+
+        Mix::Strip strip;
+        strip.in[0]  = p.second[0];
+        strip.in[1]  = p.second[1];
+        strip.out[0] = out->second[0];
+        strip.out[1] = out->second[1];
+        strip.use    = port_use(out->second[0]);
+
+        const auto vol = state.input_volumes.find(name);
+        if (vol != state.input_volumes.end()) {
+            strip.gain = vol->second;
+        } else {
+            strip.gain = settings.channel(p.first).volume;
+            all_set = false;
+        }
+
+        const auto fader = m_faders.find(p.first);
+        if (fader != m_faders.end())
+            strip.fader = fader->second.get();
+
+        if (state.monitoring_input && state.monitor_channel == name)
+            mix->monitor_input = mix->inputs.size();
+
+        for (const auto& processor : m_inserts[p.first]) {
+            if (!processor)
+                continue;
+            strip.inserts.push_back(processor.get());
+            mix->processors.push_back(processor);
+        }
+        input_index[p.first] = mix->inputs.size();
+        mix->inputs.push_back(strip);
+    }
+
+    for (const auto& p : m_explicit_output_ports) {
+        const Channel& channel = settings.channel(p.first);
+
+        Mix::Bus bus;
+        bus.out[0] = p.second[0];
+        bus.out[1] = p.second[1];
+        bus.use    = port_use(p.second[0]);
+
+        std::vector<channel_id_t> connected;
+        const auto vol = state.output_volumes.find(channel.name);
+        if (vol != state.output_volumes.end()) {
+            bus.gain = vol->second;
+            const auto c = state.connections.find(channel.name);
+            if (c != state.connections.end()) {
+                for (const std::string& i : c->second)
+                    if (settings.is_input(i))
+                        connected.push_back(settings.find_input(i));
+            }
+        } else {
+            bus.gain = channel.volume;
+            connected = settings.get_sources(p.first);
+            all_set = false;
+        }
+
+        for (channel_id_t i : connected) {
+            const auto idx = input_index.find(i);
+            if (idx != input_index.end())
+                bus.sources.push_back(idx->second);
+        }
+
+        const auto shard = m_bus_shard.find(p.first);
+        if (shard != m_bus_shard.end())
+            bus.shard = shard->second;
+        bus.low_priority = channel.tags.count(WATCHDOG_LOW_PRIORITY_TAG) > 0;
+        const auto fader = m_faders.find(p.first);
+        if (fader != m_faders.end())
+            bus.fader = fader->second.get();
+        const auto meter = m_loudness.find(p.first);
+        if (meter != m_loudness.end()) {
+            bus.loudness = meter->second.get();
+            mix->meters.push_back(meter->second);
+        }
+
+        for (const auto& processor : m_inserts[p.first]) {
+            if (!processor)
+                continue;
+            bus.inserts.push_back(processor.get());
+            mix->processors.push_back(processor);
+        }
+
+        if (!state.monitoring_input && state.monitor_channel == channel.name)
+            mix->monitor_output = mix->outputs.size();
+
+        output_index[p.first] = mix->outputs.size();
+        mix->outputs.push_back(bus);
+    }
+
+    if (mix->monitor_input < 0 && mix->monitor_output < 0)
+        all_set = false;
+
+    // === Ducking ===
+    // (envelopes and gains outlive the mix: they carry the smoothing)
+    mix->envelope_release = DUCK_ENVELOPE_MS * m_sample_rate / 1000.f;
+    mix->peak_release = PEAK_DECAY_MS * m_sample_rate / 1000.f;
+    std::map<size_t, Envelope*> keys;
+    for (const auto& p : settings.get_ducks()) {
+        const DuckRule& rule = p.second;
+        const auto key = input_index.find(settings.find_input(rule.key));
+        if (key == input_index.end())
+            continue;
+
+        std::shared_ptr<Envelope>& envelope = m_envelopes[settings.find_input(rule.key)];
+        if (!envelope)
+            envelope = std::make_shared<Envelope>();
+        if (!keys.count(key->second)) {
+            keys[key->second] = envelope.get();
+            mix->keys.push_back({key->second, envelope.get()});
+            mix->envelopes.push_back(envelope);
+        }
+        std::shared_ptr<DuckGain>& gain = m_duck_gains[p.first];
+        if (!gain)
+            gain = std::make_shared<DuckGain>();
+        mix->duck_gains.push_back(gain);
+
+        Mix::Duck duck;
+        duck.envelope  = envelope.get();
+        duck.gain      = gain.get();
+        duck.threshold = std::pow(10.f, rule.threshold / 20);
+        duck.depth     = std::pow(10.f, rule.depth / 20);
+        duck.attack    = rule.attack  * m_sample_rate / 1000.f;
+        duck.release   = rule.release * m_sample_rate / 1000.f;
+        mix->ducks.push_back(duck);
+
+        for (const std::string& i : rule.inputs) {
+            const auto idx = input_index.find(settings.find_input(i));
+            if (idx != input_index.end())
+                mix->inputs[idx->second].ducks.push_back(gain.get());
+        }
+        for (const std::string& o : rule.outputs) {
+            const auto idx = output_index.find(settings.find_output(o));
+            if (idx != output_index.end())
+                mix->outputs[idx->second].ducks.push_back(gain.get());
+        }
+    }
+
+    // === Mix-minus ===
+    // (participants in the order of the strips, groups without any skipped)
+    for (const auto& p : settings.get_mix_minus()) {
+        std::map<size_t, const std::vector<jack_port_t*>*> members;
+        for (const std::string& name : p.second.participants) {
+            const channel_id_t id = settings.find_input(name);
+            const auto idx = input_index.find(id);
+            const auto ret = m_returns.find({p.first, id});
+            if (idx != input_index.end() && ret != m_returns.end())
+                members[idx->second] = &ret->second;
+        }
+        if (members.empty())
+            continue;
+
+        Mix::MixMinus group;
+        group.gain = p.second.volume;
+        for (const auto& m : members) {
+            group.sources.push_back(m.first);
+            group.returns.push_back({{(*m.second)[0], (*m.second)[1]}, port_use((*m.second)[0])});
+        }
+        mix->mix_minus.push_back(group);
+    }
+
+    // === MIDI mappings ===
+    // (faders outlive the mix: they carry the mutes and the moves not stored yet)
+    for (const auto& p : settings.get_midi()) {
+        const MidiMapping& mapping = p.second;
+        Mix::Control control;
+        if (!MidiControl::parse(p.first, control.control))
+            continue;
+        const channel_id_t id = mapping.input ? settings.find_input(mapping.target)
+                                              : settings.find_output(mapping.target);
+        const auto fader = m_faders.find(id);
+        if (mapping.input) {
+            const auto idx = input_index.find(id);
+            if (idx == input_index.end() || fader == m_faders.end())
+                continue;
+            control.input = idx->second;
+        } else {
+            const auto idx = output_index.find(id);
+            if (idx == output_index.end() || fader == m_faders.end())
+                continue;
+            control.output = idx->second;
+        }
+        control.fader = fader->second.get();
+        control.mute  = mapping.mute;
+        control.min   = std::min(1.f, std::max(0.f, mapping.min));
+        control.max   = std::min(1.f, std::max(0.f, mapping.max));
+        mix->controls.push_back(control);
+        mix->faders.push_back(fader->second);
+    }
+
+    for (Mix::Strip& strip : mix->inputs) {
+        if (strip.inserts.empty() && strip.ducks.empty())
+            continue;
+        strip.insert_buf[0].resize(m_block);
+        strip.insert_buf[1].resize(m_block);
+    }
+
+    // === Shards ===
+    // (a shard reads its taps in the order of the strips)
+    mix->shards.resize(std::max<size_t>(1, m_engines.size()));
+    for (size_t b=0; b<mix->outputs.size(); b++)
+        mix->shards[mix->outputs[b].shard].buses.push_back(b);
+    for (size_t k=0; k<mix->shards.size(); k++) {
+        Mix::Shard& shard = mix->shards[k];
+        shard.in_bufs.resize(mix->inputs.size() * 2);
+        if (!k)
+            continue;
+        for (const auto& p : input_index) {
+            const auto tap = m_engines[k]->taps.find(p.first);
+            if (tap != m_engines[k]->taps.end()) {
+                shard.taps.resize(mix->inputs.size() * 2);
+                shard.taps[p.second*2]   = tap->second[0];
+                shard.taps[p.second*2+1] = tap->second[1];
+                mix->inputs[p.second].tapped = true;
+            }
+        }
+    }
+    for (size_t k=0; k<mix->shards.size(); k++)
+        plan_partials(*mix, k);
+
+    if (complete)
+        *complete = all_set;
+    return mix;
+}
+
+///
+/// Plan the sums of the buses of shard `k` (see Mix::Partial). Buses with
+/// the same sources share a sum; then, as long as two sums have two or
+/// more terms in common, the largest common subset becomes a partial of
+/// its own and replaces those terms in every sum containing it. Each
+/// replacement strictly shrinks the total number of terms, so planning
+/// always ends. The plan of the last compile is reused as long as the
+/// routing of the shard is the same.
+/// (call with `m_control_lock` held)
+///
+void Backend::plan_partials(Mix& mix, const unsigned int k) {
+    Mix::Shard& shard = mix.shards[k];
+    const size_t n_inputs = mix.inputs.size();
+
+    // Same routing as last time: same plan
+    std::vector<std::vector<size_t>> routing;
+    for (size_t b : shard.buses)
+        routing.push_back(mix.outputs[b].sources);
+    if (m_plans.size() <= k)
+        m_plans.resize(k + 1);
+    PartialPlan& plan = m_plans[k];
+    if (plan.layout == mix.layout && plan.inputs == n_inputs && plan.buses == shard.buses && plan.sources == routing) {
+        shard.partials = plan.partials;
+        for (size_t b=0; b<shard.buses.size(); b++)
+            mix.outputs[shard.buses[b]].sum = plan.sums[b];
+        shard.partial_buf.resize(shard.partials.size() * 2 * mix.block);
+        shard.partial_ready.resize(shard.partials.size());
+        return;
+    }
+
+    // terms of each distinct sum: inputs, or partials (n_inputs + index)
+    std::vector<std::set<size_t>> sums;
+    std::vector<int> bus_sum(shard.buses.size(), -1);
+    for (size_t b=0; b<shard.buses.size(); b++) {
+        const std::vector<size_t>& sources = mix.outputs[shard.buses[b]].sources;
+        if (sources.empty())
+            continue;
+        const std::set<size_t> terms(sources.begin(), sources.end());
+        const auto same = std::find(sums.begin(), sums.end(), terms);
+        bus_sum[b] = same - sums.begin();
+        if (same == sums.end())
+            sums.push_back(terms);
+    }
+
+    auto add_partial = [&](const std::set<size_t>& terms) {
+        Mix::Partial partial;
+        for (size_t t : terms) {
+            if (t < n_inputs)
+                partial.sources.push_back(t);
+            else
+                partial.partials.push_back(t - n_inputs);
+        }
+        shard.partials.push_back(partial);
+        return shard.partials.size() - 1;
+    };
+
+    while (true) {
+        std::vector<size_t> best;
+        for (size_t i=0; i<sums.size(); i++) {
+            for (size_t j=i+1; j<sums.size(); j++) {
+                std::vector<size_t> common;
+                std::set_intersection(sums[i].begin(), sums[i].end(), sums[j].begin(), sums[j].end(),
+                                      std::back_inserter(common));
+                if (common.size() > best.size())
+                    best = common;
+            }
+        }
+        if (best.size() < 2)
+            break;
+
+        const size_t shared = n_inputs + add_partial(std::set<size_t>(best.begin(), best.end()));
+        for (std::set<size_t>& terms : sums) {
+            if (!std::includes(terms.begin(), terms.end(), best.begin(), best.end()))
+                continue;
+            for (size_t t : best)
+                terms.erase(t);
+            terms.insert(shared);
+        }
+    }
+
+    // the sum of each bus (a lone shared partial is used as-is)
+    std::vector<size_t> partial_of(sums.size());
+    for (size_t s=0; s<sums.size(); s++) {
+        if (sums[s].size() == 1 && *sums[s].begin() >= n_inputs)
+            partial_of[s] = *sums[s].begin() - n_inputs;
+        else
+            partial_of[s] = add_partial(sums[s]);
+    }
+    for (size_t b=0; b<shard.buses.size(); b++)
+        if (bus_sum[b] >= 0)
+            mix.outputs[shard.buses[b]].sum = partial_of[bus_sum[b]];
+
+    plan.layout  = mix.layout;
+    plan.inputs  = n_inputs;
+    plan.buses   = shard.buses;
+    plan.sources = routing;
+    plan.partials = shard.partials;
+    plan.sums.clear();
+    for (size_t b : shard.buses)
+        plan.sums.push_back(mix.outputs[b].sum);
+
+    shard.partial_buf.resize(shard.partials.size() * 2 * mix.block);
+    shard.partial_ready.resize(shard.partials.size());
+}
+
+///
+/// Hand a new mix over to the callback, fading from the current one
+/// over `fade` frames
+///
+void Backend::publish(std::shared_ptr<Mix> mix, jack_nframes_t fade) {
+    // one timed mix in flight at a time, in order
+    wait_timed();
+    collect();
+
+    if (m_timing) {
+        m_timed_applied.store(0, std::memory_order_relaxed);
+        m_timed_engines = m_engines.size();
+        for (const auto& engine : m_engines)
+            engine->timed_queue.push({m_timed_frame, mix.get(), fade});
+        m_timed_pending = mix;
+        m_committed_revision = settings.revision();
+        m_committed_layout   = mix->layout;
+        return;
+    }
+
+    if (m_published)
+        m_retired.push_back({m_published, periods()});
+    m_published = mix;
+
+    m_fade.store(fade, std::memory_order_release);
+    m_mix.store(mix.get(), std::memory_order_release);
+
+    m_committed_revision = settings.revision();
+    m_committed_layout   = mix->layout;
+}
+
+///
+/// Wait until the scheduler saw the timed mix in flight applied and made
+/// it the published mix (call with `m_control_lock` held)
+///
+void Backend::wait_timed() {
+    if (!m_timed_pending)
+        return;
+
+    // (the caller holds m_control_lock, it is released while waiting)
+    std::unique_lock<std::mutex> lock(m_control_lock, std::adopt_lock);
+    m_timed_wake.wait(lock, [this](){ return !m_timed_pending; });
+    lock.release();
+}
+
+///
+/// Drop the timed mix in flight before the engines go away
+///
+void Backend::forget_timed() {
+    std::lock_guard<std::mutex> lock(m_control_lock);
+    m_timed_pending.reset();
+    m_timed_wake.notify_all();
+}
+
+///
+/// Once the callbacks switched to the timed mix queued by the last timed
+/// command, make it the published one and wake `wait_timed` up (scheduler
+/// thread, no lock held while the callbacks get there)
+///
+void Backend::settle_timed() {
+    std::shared_ptr<Mix> pending;
+    unsigned int engines;
+    {
+        std::lock_guard<std::mutex> lock(m_control_lock);
+        pending = m_timed_pending;
+        engines = m_timed_engines;
+    }
+    if (!pending)
+        return;
+
+    while (m_client && m_timed_applied.load(std::memory_order_acquire) < engines)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    std::lock_guard<std::mutex> lock(m_control_lock);
+    if (m_timed_pending != pending)
+        return;
+    if (m_client) {
+        if (m_published)
+            m_retired.push_back({m_published, periods()});
+        m_published = m_timed_pending;
+
+        // the callback already runs it: no fade
+        m_fade.store(0, std::memory_order_release);
+        m_mix.store(m_published.get(), std::memory_order_release);
+    }
+    m_timed_pending.reset();
+    m_timed_wake.notify_all();
+}
+
+///
+/// Release retired mixes the callback can no longer be reading
+///
+void Backend::collect() {
+    const std::vector<unsigned long> period = periods();
+
+    auto done = [&](const std::pair<std::shared_ptr<Mix>, std::vector<unsigned long>>& r){
+        if (!m_client)
+            return true;
+        // (stamped before a shard was opened: it never saw the mix)
+        for (size_t k=0; k<period.size() && k<r.second.size(); k++) {
+            if (period[k] < r.second[k] + 2 ||
+                    m_engines[k]->fade_from.load(std::memory_order_acquire) == r.first.get())
+                return false;
+        }
+        return true;
+    };
+    m_retired.erase(std::remove_if(m_retired.begin(), m_retired.end(), done), m_retired.end());
+}
+
+///
+/// Wait until the callbacks run the published mix (no fade in progress)
+///
+void Backend::sync() {
+    if (!m_client)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_control_lock);
+        wait_timed();
+    }
+
+    const std::vector<unsigned long> period = periods();
+    auto settled = [&](){
+        for (size_t k=0; k<period.size(); k++) {
+            if (m_engines[k]->period.load(std::memory_order_acquire) < period[k] + 2 ||
+                    m_engines[k]->fade_from.load(std::memory_order_acquire))
+                return false;
+        }
+        return true;
+    };
+    for (int i=0; i<1000; i++) {
+        if (settled())
+            return;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+///
+/// Periods run by the callback of each client so far
+///
+const std::vector<unsigned long> Backend::periods() {
+    std::vector<unsigned long> period;
+    for (const auto& engine : m_engines)
+        period.push_back(engine->period.load(std::memory_order_acquire));
+    return period;
+}
+
+///
+/// Compile the settings and publish them if they changed since last commit
+///
+void Backend::commit() {
+    std::vector<jack_port_t*> released;
+    {
+        std::lock_guard<std::mutex> lock(m_control_lock);
+
+        if (!m_client)
+            return;
+        if (m_published && m_committed_revision == settings.revision() && m_committed_layout == m_layout)
+            return;
+        TRACE_SCOPE("commit");
+        update_inserts();
+        update_loudness();
+        forget_ducks();
+        update_faders();
+        update_returns(released);
+
+        const bool relayout = m_committed_layout != m_layout;
+        publish(compile(settings.snapshot()));
+        settle_faders();
+        update_metered();
+
+        // keep scenes ready for the new ports
+        if (relayout) {
+            for (auto& p : m_scenes) {
+                if (settings.is_scene(p.first))
+                    p.second.mix = compile(settings.get_scene(p.first), &p.second.complete);
+            }
+        }
+    }
+    if (released.empty())
+        return;
+
+    // the callbacks must be done with the returns before they go away
+    sync();
+    for (jack_port_t* port : released)
+        m_pool.give(m_client, port);
+}
+
+///
+/// Bring the insert processors in line with the chains in `settings`.
+/// Processors keep their state as long as their type and position in the
+/// chain stay the same; other changes rebuild the chain and bump the
+/// layout so the prepared scenes pick up the new processors.
+/// (call with `m_control_lock` held)
+///
+void Backend::update_inserts() {
+    bool changed = false;
+
+    auto update = [&](const channel_id_t id) {
+        const InsertChain& chain = settings.channel(id).inserts;
+        std::vector<std::shared_ptr<Processor>>& processors = m_inserts[id];
+
+        bool same = processors.size() == chain.size();
+        for (size_t i=0; same && i<chain.size(); i++)
+            same = processors[i] ? processors[i]->type() == chain[i].type : false;
+
+        if (!same) {
+            processors.clear();
+            for (const Insert& insert : chain) {
+                std::shared_ptr<Processor> processor;
+                try {
+                    processor.reset(Processor::create(insert.type));
+                } catch (Processor::ProcessorException& e) {
+                    LOG_ERROR("%s: %s", settings.channel(id).name.c_str(), e.what());
+                }
+                processors.push_back(processor);
+            }
+            changed = true;
+        }
+
+        // parameters go straight to the processors
+        for (size_t i=0; i<chain.size(); i++) {
+            if (!processors[i])
+                continue;
+            for (const auto& p : chain[i].params) {
+                try {
+                    processors[i]->set(p.first, p.second);
+                } catch (Processor::ProcessorException& e) {
+                    LOG_ERROR("%s: %s", settings.channel(id).name.c_str(), e.what());
+                }
+            }
+            if (!same)
+                processors[i]->prepare(m_sample_rate);
+        }
+        if (processors.empty())
+            m_inserts.erase(id);
+    };
+
+    for (const auto& p : m_input_ports)
+        update(p.first);
+    for (const auto& p : m_explicit_output_ports)
+        update(p.first);
+    for (auto it = m_inserts.begin(); it != m_inserts.end(); ) {
+        if (!m_input_ports.count(it->first) && !m_explicit_output_ports.count(it->first)) {
+            it = m_inserts.erase(it);
+            changed = true;
+        } else {
+            ++it;
+        }
+    }
+
+    if (changed)
+        m_layout++;
+}
+
+///
+/// Give a loudness meter to every bus tagged LOUDNESS_TAG and drop the
+/// others. A meter keeps measuring as long as its bus is tagged and the
+/// sample rate stays the same; changes bump the layout so the prepared
+/// scenes pick them up.
+/// (call with `m_control_lock` held)
+///
+void Backend::update_loudness() {
+    bool changed = false;
+    for (const auto& p : m_explicit_output_ports) {
+        const bool tagged = settings.channel(p.first).tags.count(LOUDNESS_TAG) > 0;
+        const auto meter = m_loudness.find(p.first);
+        if (meter != m_loudness.end() && (!tagged || meter->second->sample_rate() != m_sample_rate)) {
+            m_loudness.erase(meter);
+            changed = true;
+        }
+        if (tagged && !m_loudness.count(p.first)) {
+            m_loudness[p.first] = std::make_shared<LoudnessMeter>(m_sample_rate);
+            changed = true;
+        }
+    }
+    for (auto it = m_loudness.begin(); it != m_loudness.end(); ) {
+        if (!m_explicit_output_ports.count(it->first)) {
+            it = m_loudness.erase(it);
+            changed = true;
+        } else {
+            ++it;
+        }
+    }
+
+    if (changed)
+        m_layout++;
+}
+
+///
+/// Drop the ducking state of rules and key inputs that are gone
+/// (call with `m_control_lock` held)
+///
+void Backend::forget_ducks() {
+    const std::map<std::string, DuckRule>& ducks = settings.get_ducks();
+    std::set<channel_id_t> keys;
+    for (const auto& p : ducks)
+        keys.insert(settings.find_input(p.second.key));
+
+    for (auto it = m_duck_gains.begin(); it != m_duck_gains.end(); )
+        it = ducks.count(it->first) ? std::next(it) : m_duck_gains.erase(it);
+    for (auto it = m_envelopes.begin(); it != m_envelopes.end(); )
+        it = keys.count(it->first) ? std::next(it) : m_envelopes.erase(it);
+}
+
+///
+/// Give a fader to every channel mapped to a MIDI control and drop the
+/// others. Faders keep their mute and pending moves as long as the
+/// channel stays mapped; changes bump the layout so the prepared scenes
+/// pick them up.
+/// (call with `m_control_lock` held)
+///
+void Backend::update_faders() {
+    std::set<channel_id_t> mapped;
+    for (const auto& p : settings.get_midi()) {
+        const channel_id_t id = p.second.input ? settings.find_input(p.second.target)
+                                               : settings.find_output(p.second.target);
+        if (id != NO_CHANNEL)
+            mapped.insert(id);
+    }
+
+    bool changed = false;
+    for (channel_id_t id : mapped) {
+        if (m_faders.count(id))
+            continue;
+        std::shared_ptr<Fader> fader = std::make_shared<Fader>();
+        fader->stored = settings.channel(id).volume;
+        m_faders[id] = fader;
+        changed = true;
+    }
+    for (auto it = m_faders.begin(); it != m_faders.end(); ) {
+        if (!mapped.count(it->first)) {
+            it = m_faders.erase(it);
+            changed = true;
+        } else {
+            ++it;
+        }
+    }
+
+    if (changed)
+        m_layout++;
+}
+
+///
+/// Hand the faders whose volume was set by something other than MIDI (a
+/// command, scene or reload) back to the mix just published
+/// (call with `m_control_lock` held)
+///
+void Backend::settle_faders() {
+    for (const auto& p : m_faders) {
+        const float volume = settings.channel(p.first).volume;
+        if (volume == p.second->stored)
+            continue;
+        p.second->stored = volume;
+        p.second->settled.store(p.second->moves.load(std::memory_order_acquire), std::memory_order_relaxed);
+    }
+}
+
+///
+/// Bring the return ports of the mix-minus groups in line with `settings`:
+/// participants that joined get a pair, renamed ones get theirs renamed
+/// and the pairs of those that left go to `released`, to be given back
+/// once the callbacks stopped using them.
+/// (call with `m_control_lock` held)
+///
+void Backend::update_returns(std::vector<jack_port_t*>& released) {
+    std::map<std::pair<std::string, channel_id_t>, std::string> wanted;
+    for (const auto& p : settings.get_mix_minus()) {
+        for (const std::string& name : p.second.participants) {
+            const channel_id_t id = settings.find_input(name);
+            if (m_input_ports.count(id))
+                wanted[{p.first, id}] = Settings::return_name(p.first, settings.channel(id).name);
+        }
+    }
+
+    bool changed = false;
+    for (auto it = m_returns.begin(); it != m_returns.end(); ) {
+        if (wanted.count(it->first)) {
+            ++it;
+            continue;
+        }
+        forget_use(it->second);
+        released.insert(released.end(), it->second.begin(), it->second.end());
+        it = m_returns.erase(it);
+        changed = true;
+    }
+
+    for (const auto& w : wanted) {
+        const auto ret = m_returns.find(w.first);
+        if (ret == m_returns.end()) {
+            std::vector<jack_port_t*>& ports = m_returns[w.first];
+            ports = {
+                m_pool.take(m_client, w.second+LEFT_SUFFIX,  false),
+                m_pool.take(m_client, w.second+RIGHT_SUFFIX, false),
+            };
+            track_use(ports);
+            changed = true;
+        } else if (w.second+LEFT_SUFFIX != jack_port_short_name(ret->second[0])) {
+            // the participant was renamed
+            jack_port_set_name(ret->second[0], (w.second+LEFT_SUFFIX ).c_str());
+            jack_port_set_name(ret->second[1], (w.second+RIGHT_SUFFIX).c_str());
+        }
+    }
+
+    if (changed)
+        m_layout++;
+}
+
+///
+/// Compile every stored scene
+///
+void Backend::prepare_scenes() {
+    std::lock_guard<std::mutex> lock(m_control_lock);
+
+    m_scenes.clear();
+    for (const std::string& name : settings.get_scenes()) {
+        PreparedScene& prepared = m_scenes[name];
+        prepared.mix = compile(settings.get_scene(name), &prepared.complete);
+    }
+}
+
+///
+/// Store the current state as a scene and prepare it
+///
+void Backend::store_scene(const std::string& name) {
+    std::lock_guard<std::mutex> lock(m_control_lock);
+
+    settings.store_scene(name);
+    PreparedScene& prepared = m_scenes[name];
+    prepared.mix = compile(settings.get_scene(name), &prepared.complete);
+}
+
+///
+/// Remove a scene and its prepared mix
+///
+void Backend::remove_scene(const std::string& name) {
+    std::lock_guard<std::mutex> lock(m_control_lock);
+
+    settings.remove_scene(name);
+    m_scenes.erase(name);
+}
+
+///
+/// Switch to a scene without touching the jack client.
+/// Every gain and route is crossfaded over `fade_ms` milliseconds.
+///
+void Backend::recall_scene(const std::string& name, const float fade_ms) {
+    std::lock_guard<std::mutex> lock(m_control_lock);
+
+    settings.apply_scene(name);
+
+    if (!m_client)
+        return;
+
+    jack_nframes_t fade = fade_ms > 0 ? (jack_nframes_t)(fade_ms * m_sample_rate / 1000) : 0;
+
+    // scenes that don't set every channel depend on the current state
+    const auto prepared = m_scenes.find(name);
+    if (prepared != m_scenes.end() && prepared->second.complete && prepared->second.mix->layout == m_layout)
+        publish(prepared->second.mix, fade);
+    else
+        publish(compile(settings.snapshot()), fade);
+}
+
+///
+/// Sum the sources of `bus` into `n` frames from frame time `frame` at
+/// `left` and `right`. `in_bufs` holds the input buffers of the block; a
+/// shard reads them already scaled by the input volume (from the implicit
+/// outputs of the main client).
+///
+void Backend::render_bus(const Mix& mix, const Mix::Bus& bus, const std::vector<sample_t*>& in_bufs,
+                         const bool prescaled, sample_t* left, sample_t* right,
+                         const jack_nframes_t frame, jack_nframes_t n) {
+    // Set output to 0
+    std::memset(left , 0, sizeof(sample_t) * n);
+    std::memset(right, 0, sizeof(sample_t) * n);
+
+    // Add connected inpus with their volume mods (frame by frame while a fader moves)
+    for (size_t s : bus.sources) {
+        const sample_t* ileft  = in_bufs[s*2];
+        const sample_t* iright = in_bufs[s*2+1];
+
+        const Mix::Level level = mix.inputs[s].level(frame);
+        if (prescaled || level.steady) {
+            const float ivolume_mod = prescaled ? 1.f : level.gain;
+            for (jack_nframes_t i=0; i<n; i++) {
+                left[i]  += ileft[i]  * ivolume_mod;
+                right[i] += iright[i] * ivolume_mod;
+            }
+        } else {
+            for (jack_nframes_t i=0; i<n; i++) {
+                const float ivolume_mod = level.at(frame + i);
+                left[i]  += ileft[i]  * ivolume_mod;
+                right[i] += iright[i] * ivolume_mod;
+            }
+        }
+    }
+
+    // Apply output volume_mod
+    const Mix::Level level = bus.level(frame);
+    for (jack_nframes_t i=0; i<n; i++) {
+        const float volume_mod = level.at(frame + i);
+        left[i]  *= volume_mod;
+        right[i] *= volume_mod;
+    }
+}
+
+///
+/// Render frames [offset, offset+n) of the mix-minus returns (main
+/// client, after the strips). Each group is summed once into the scratch
+/// buffers and every return is that sum minus its own participant: O(N)
+/// per group instead of summing N-1 inputs for each of the N returns.
+///
+void Backend::render_mix_minus(Engine& engine, jack_nframes_t nframes, jack_nframes_t offset, jack_nframes_t n) {
+    const Mix* mix = engine.current;
+    if (mix->mix_minus.empty())
+        return;
+    TRACE_SCOPE("render mix-minus");
+    const Mix* from = engine.from;
+    const std::vector<sample_t*>& in_bufs = mix->shards[0].in_bufs;
+    sample_t* sleft  = engine.scratch[0].data();
+    sample_t* sright = engine.scratch[1].data();
+
+    auto fade_at = [&](jack_nframes_t i) {
+        const jack_nframes_t pos = engine.fade_pos + i + 1;
+        return pos >= engine.fade_len ? 1.f : (float)pos / engine.fade_len;
+    };
+    // gain of an input at frame `i` from its level in the previous and the
+    // current mix, following the strip crossfade
+    const jack_nframes_t frame = engine.frame_time + offset;
+    auto gain = [&](const Mix::Level& before, const Mix::Level& level, jack_nframes_t i) {
+        const float b = level.at(frame + i);
+        if (!from)
+            return b;
+        const float a = before.at(frame + i);
+        return a + (b - a) * fade_at(i);
+    };
+
+    for (size_t g=0; g<mix->mix_minus.size(); g++) {
+        const Mix::MixMinus& group = mix->mix_minus[g];
+
+        // Nothing reads any return (or the block outgrew the scratch buffers):
+        // silent, so a reader connecting before we notice hears no stale block
+        bool connected = false;
+        for (const Mix::MixMinus::Return& ret : group.returns)
+            connected = connected || ret.use->connected.load(std::memory_order_acquire);
+        if (!connected || n > engine.scratch[0].size()) {
+            for (const Mix::MixMinus::Return& ret : group.returns) {
+                std::memset((sample_t*) jack_port_get_buffer(ret.out[0], nframes) + offset, 0, sizeof(sample_t) * n);
+                std::memset((sample_t*) jack_port_get_buffer(ret.out[1], nframes) + offset, 0, sizeof(sample_t) * n);
+                ret.use->peak.store(0, std::memory_order_relaxed);
+            }
+            engine.skipped.fetch_add(n * group.returns.size(), std::memory_order_relaxed);
+            continue;
+        }
+
+        // group volume of the previous mix (same layout: same groups)
+        const Mix::MixMinus* before = from && g < from->mix_minus.size() &&
+            from->mix_minus[g].sources == group.sources ? &from->mix_minus[g] : nullptr;
+        auto group_gain = [&](jack_nframes_t i) {
+            return before ? before->gain + (group.gain - before->gain) * fade_at(i) : group.gain;
+        };
+
+        // Sum of the whole group
+        std::memset(sleft , 0, sizeof(sample_t) * n);
+        std::memset(sright, 0, sizeof(sample_t) * n);
+        for (size_t s : group.sources) {
+            const sample_t* ileft  = in_bufs[s*2];
+            const sample_t* iright = in_bufs[s*2+1];
+            const Mix::Level level = mix->inputs[s].level(frame);
+            const Mix::Level before = from ? from->inputs[s].level(frame) : level;
+            for (jack_nframes_t i=0; i<n; i++) {
+                const float volume_mod = gain(before, level, i);
+                sleft[i]  += ileft[i]  * volume_mod;
+                sright[i] += iright[i] * volume_mod;
+            }
+        }
+
+        // Each return: the sum without its participant
+        for (size_t r=0; r<group.returns.size(); r++) {
+            const Mix::MixMinus::Return& ret = group.returns[r];
+            if (!ret.use->connected.load(std::memory_order_acquire)) {
+                engine.skipped.fetch_add(n, std::memory_order_relaxed);
+                ret.use->peak.store(0, std::memory_order_relaxed);
+                std::memset((sample_t*) jack_port_get_buffer(ret.out[0], nframes) + offset, 0, sizeof(sample_t) * n);
+                std::memset((sample_t*) jack_port_get_buffer(ret.out[1], nframes) + offset, 0, sizeof(sample_t) * n);
+                continue;
+            }
+            engine.rendered.fetch_add(n, std::memory_order_relaxed);
+
+            const size_t s = group.sources[r];
+            const sample_t* ileft  = in_bufs[s*2];
+            const sample_t* iright = in_bufs[s*2+1];
+            sample_t* oleft  = (sample_t*) jack_port_get_buffer(ret.out[0], nframes) + offset;
+            sample_t* oright = (sample_t*) jack_port_get_buffer(ret.out[1], nframes) + offset;
+            const Mix::Level level = mix->inputs[s].level(frame);
+            const Mix::Level before = from ? from->inputs[s].level(frame) : level;
+            for (jack_nframes_t i=0; i<n; i++) {
+                const float volume_mod = gain(before, level, i);
+                const float group_mod  = group_gain(i);
+                oleft[i]  = (sleft[i]  - ileft[i]  * volume_mod) * group_mod;
+                oright[i] = (sright[i] - iright[i] * volume_mod) * group_mod;
+            }
+            meter(*mix, *ret.use, oleft, oright, n, engine.shed.load(std::memory_order_relaxed));
+        }
+    }
+}
+
+///
+/// Switch the callback of `engine` to `mix`, crossfading over `fade`
+/// frames if the port layout allows it. During a crossfade, a mix without
+/// a fade of its own becomes the new target of the fade in progress and a
+/// faded one is faded to once it is over (callback only).
+///
+void Backend::switch_mix(Engine& engine, const Mix* mix, const jack_nframes_t fade) {
+    if (mix == engine.current) {
+        engine.next = nullptr;
+        return;
+    }
+    TRACE_SCOPE("switch mix", "fade", fade);
+    if (engine.from && mix && engine.from->layout == mix->layout) {
+        if (fade) {
+            engine.next      = mix;
+            engine.next_fade = fade;
+        } else {
+            engine.next    = nullptr;
+            engine.current = mix;
+        }
+        return;
+    }
+    engine.next = nullptr;
+    if (fade && engine.current && mix && engine.current->layout == mix->layout) {
+        engine.from     = engine.current;
+        engine.fade_pos = 0;
+        engine.fade_len = fade;
+    } else {
+        engine.from = nullptr;
+    }
+    engine.current = mix;
+    engine.fade_from.store(engine.from, std::memory_order_release);
+}
+
+///
+/// Callback function. Does the actual backend audio connection handling.
+/// (one per client: the main client and each shard)
+///
+int Backend::callback(Engine& engine, jack_nframes_t nframes) {
+    TRACE_SCOPE("callback", "shard", engine.shard);
+    const jack_time_t began = jack_get_time();
+    const Mix* mix = m_mix.load(std::memory_order_acquire);
+
+    // Pick up newly published mix
+    if (mix != engine.seen) {
+        engine.seen = mix;
+        switch_mix(engine, mix, m_fade.load(std::memory_order_acquire));
+    }
+
+    // Ducking gains of this period (the shards read them)
+    if (!engine.shard && engine.current)
+        update_ducks(*engine.current, nframes);
+
+    // Split the period at timed events and MIDI events (main client)
+    const jack_nframes_t start = jack_last_frame_time(engine.client);
+    engine.frame_time = start;
+    void* midi = !engine.shard && m_midi_in ? jack_port_get_buffer(m_midi_in, nframes) : nullptr;
+    const uint32_t midi_events = midi ? jack_midi_get_event_count(midi) : 0;
+    uint32_t next_midi = 0;
+    jack_nframes_t pos = 0;
+    while (pos < nframes) {
+        jack_nframes_t end = nframes;
+
+        const TimedMix* event = engine.timed_queue.front();
+        if (event) {
+            const int32_t offset = (int32_t)(event->frame - start);
+            if (offset <= (int32_t) pos) {
+                switch_mix(engine, event->mix, event->fade);
+                engine.timed_queue.pop();
+                m_timed_applied.fetch_add(1, std::memory_order_release);
+                continue;
+            }
+            if (offset < (int32_t) nframes)
+                end = offset;
+        }
+
+        if (next_midi < midi_events) {
+            jack_midi_event_t control;
+            if (jack_midi_event_get(&control, midi, next_midi) != 0) {
+                next_midi++;
+                continue;
+            }
+            if (control.time <= pos) {
+                midi_event(engine, control.buffer, control.size, start + pos);
+                next_midi++;
+                continue;
+            }
+            end = std::min(end, control.time);
+        }
+
+        // (in blocks the mix has its buffers sized for)
+        if (engine.current && engine.current->block)
+            end = std::min(end, pos + engine.current->block);
+
+        if (engine.current && engine.shard < engine.current->shards.size())
+            render(engine, nframes, pos, end - pos);
+        pos = end;
+    }
+    if (!engine.shard && m_midi_out)
+        feedback(engine, nframes);
+
+    // Callback duration histogram (single writer: no read-modify-write needed)
+    const jack_time_t took = jack_get_time() - began;
+    size_t bucket = 0;
+    while (bucket < CALLBACK_BUCKETS && took > CALLBACK_BUCKETS_US[bucket])
+        bucket++;
+    engine.durations[bucket].store(engine.durations[bucket].load(std::memory_order_relaxed) + 1,
+                                   std::memory_order_relaxed);
+    engine.duration_sum.store(engine.duration_sum.load(std::memory_order_relaxed) + took,
+                              std::memory_order_relaxed);
+    watchdog(engine, took, nframes);
+
+    engine.period.fetch_add(1, std::memory_order_release);
+    return 0;
+}
+
+///
+/// Overload watchdog (end of each callback): shed the next stage of
+/// WATCHDOG_SHED_ORDER after an xrun or WATCHDOG_SHED_PERIODS periods over
+/// budget in a row, restore the last one shed after WATCHDOG_RESTORE_MS
+/// with headroom. Between the two thresholds nothing changes.
+///
+void Backend::watchdog(Engine& engine, const jack_time_t took, jack_nframes_t nframes) {
+    static const Shed::Stage order[] = WATCHDOG_SHED_ORDER;
+    static const unsigned int stages = sizeof order / sizeof order[0];
+
+    if (!m_sample_rate || !nframes)
+        return;
+    const float load = (float) took * m_sample_rate / (1e6f * nframes);
+    engine.load.store(engine.load.load(std::memory_order_relaxed) * 0.9f + load * 0.1f,
+                      std::memory_order_relaxed);
+
+    const unsigned long xruns = engine.xruns.load(std::memory_order_relaxed);
+    const bool xrun = xruns != engine.xruns_seen;
+    engine.xruns_seen = xruns;
+
+    engine.over = load > WATCHDOG_SHED_LOAD ? engine.over + 1 : 0;
+    engine.calm = load < WATCHDOG_RESTORE_LOAD ? engine.calm + nframes : 0;
+
+    unsigned int count = engine.shed_count.load(std::memory_order_relaxed);
+    if ((xrun || engine.over >= WATCHDOG_SHED_PERIODS) && count < stages) {
+        const Shed::Stage stage = order[count++];
+        LOG_WARN("%s shard %u: %s at %.0f%% of the period, shedding %s", m_client_name.c_str(), engine.shard,
+                 xrun ? "xrun" : "callback", 100 * load, Shed::name(stage));
+        engine.shed.store(engine.shed.load(std::memory_order_relaxed) | (1u << stage), std::memory_order_relaxed);
+        engine.sheds.fetch_add(1, std::memory_order_relaxed);
+    } else if (engine.calm >= (unsigned long) m_sample_rate * WATCHDOG_RESTORE_MS / 1000 && count > 0) {
+        const Shed::Stage stage = order[--count];
+        LOG_INFO("%s shard %u: headroom is back, restoring %s", m_client_name.c_str(), engine.shard,
+                 Shed::name(stage));
+        engine.shed.store(engine.shed.load(std::memory_order_relaxed) & ~(1u << stage), std::memory_order_relaxed);
+        engine.restores.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        return;
+    }
+    engine.shed_count.store(count, std::memory_order_relaxed);
+    engine.over = 0;
+    engine.calm = 0;
+}
+
+///
+/// Follow the key inputs and move the gain of every ducking rule for this
+/// period (main client's callback, before rendering). Each key envelope
+/// is computed once, whatever the number of rules using it.
+///
+void Backend::update_ducks(const Mix& mix, jack_nframes_t nframes) {
+    if (mix.ducks.empty())
+        return;
+    TRACE_SCOPE("update ducks");
+
+    const float decay = mix.envelope_release > 0 ? std::exp(-(float) nframes / mix.envelope_release) : 0.f;
+    for (const auto& key : mix.keys) {
+        const sample_t* left  = (sample_t*) jack_port_get_buffer(mix.inputs[key.first].in[0], nframes);
+        const sample_t* right = (sample_t*) jack_port_get_buffer(mix.inputs[key.first].in[1], nframes);
+        float peak = 0;
+        for (jack_nframes_t i=0; i<nframes; i++)
+            peak = std::max(peak, std::max(std::fabs(left[i]), std::fabs(right[i])));
+        key.second->level = std::max(peak, key.second->level * decay);
+    }
+
+    for (const Mix::Duck& duck : mix.ducks) {
+        const float target = duck.envelope->level > duck.threshold ? duck.depth : 1.f;
+        const float time = target < duck.gain->gain ? duck.attack : duck.release;
+        const float from = duck.gain->gain;
+        duck.gain->gain = target + (from - target) * (time > 0 ? std::exp(-(float) nframes / time) : 0.f);
+        if (std::fabs(duck.gain->gain - target) < 1e-4f)
+            duck.gain->gain = target;
+
+        duck.gain->from.store(from, std::memory_order_relaxed);
+        duck.gain->to.store(duck.gain->gain, std::memory_order_release);
+    }
+}
+
+///
+/// Apply a MIDI event to the faders mapped to its control (main client's
+/// callback, at frame time `frame` of the event: what is heard ramps from
+/// there). Controllers 99/98 select an NRPN parameter and 6/38 set its
+/// value; a note on toggles. While learning, the control is handed to the
+/// MIDI thread.
+///
+void Backend::midi_event(Engine& engine, const unsigned char* data, const size_t size, const jack_nframes_t frame) {
+    if (size < 3 || !engine.current)
+        return;
+    const Mix& mix = *engine.current;
+    const unsigned char status = data[0] & 0xF0;
+    const unsigned int channel = (data[0] & 0x0F) + 1;
+    const unsigned int number = data[1] & 0x7F;
+    const unsigned int value = data[2] & 0x7F;
+    const jack_nframes_t length = MIDI_SMOOTH_MS * m_sample_rate / 1000;
+
+    auto apply = [&](const MidiControl::Type type, const unsigned int control, const unsigned int position,
+                     const unsigned int top) {
+        if (m_learn.load(std::memory_order_relaxed)) {
+            MidiControl learned;
+            learned.type = type;
+            learned.channel = channel;
+            learned.number = control;
+            if (m_learned.push(learned))
+                m_learn.store(false, std::memory_order_relaxed);
+        }
+
+        for (const Mix::Control& c : mix.controls) {
+            if (c.control.type != type || c.control.number != control ||
+                    (c.control.channel && c.control.channel != channel))
+                continue;
+            Fader* fader = c.fader;
+            Fader::Ramps ramps = fader->ramp();
+            if (c.mute) {
+                // (no echo suppression: buttons light up from the feedback)
+                const bool muted = type == MidiControl::NOTE ? !fader->muted.load(std::memory_order_relaxed)
+                                                             : 2 * position > top;
+                fader->muted.store(muted, std::memory_order_relaxed);
+                ramps.mute = FaderRamp(ramps.mute.at(frame), muted ? 0.f : 1.f, frame, length);
+            } else {
+                // (the surface is where the volume comes from: no feedback)
+                const float gain = c.min + (c.max - c.min) * position / top;
+                const float compiled = c.input >= 0 ? mix.inputs[c.input].gain : mix.outputs[c.output].gain;
+                ramps.volume = FaderRamp(fader->moved() ? ramps.volume.at(frame) : compiled, gain, frame, length);
+                fader->gain.store(gain, std::memory_order_relaxed);
+                fader->moves.store(fader->moves.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+                fader->received = gain;
+            }
+            fader->hear(ramps);
+        }
+    };
+
+    if (status == 0x90 && value) {
+        apply(MidiControl::NOTE, number, value, 127);
+    } else if (status == 0xB0) {
+        unsigned int& param = engine.nrpn[channel - 1];
+        unsigned int& entry = engine.nrpn_data[channel - 1];
+        switch (number) {
+            case 99:    // NRPN parameter MSB...
+                param = (value << 7) | (param == NO_NRPN ? 0 : param & 0x7F);
+                return;
+            case 98:    // ...and LSB
+                param = (param == NO_NRPN ? 0 : param & ~0x7Fu) | value;
+                return;
+            case 101:   // an RPN deselects it
+            case 100:
+                param = NO_NRPN;
+                return;
+            case 6:     // data entry MSB...
+                if (param == NO_NRPN)
+                    break;
+                entry = value << 7;
+                apply(MidiControl::NRPN, param, entry, 16383);
+                return;
+            case 38:    // ...and LSB
+                if (param == NO_NRPN)
+                    break;
+                entry = (entry & ~0x7Fu) | value;
+                apply(MidiControl::NRPN, param, entry, 16383);
+                return;
+        }
+        apply(MidiControl::CC, number, value, 127);
+    }
+}
+
+///
+/// Send the state of the mapped channels back to the surface (main
+/// client's callback, every MIDI_FEEDBACK_MS): the position of the motor
+/// faders and the mute lights, only for what changed since last time
+///
+void Backend::feedback(Engine& engine, jack_nframes_t nframes) {
+    void* out = jack_port_get_buffer(m_midi_out, nframes);
+    jack_midi_clear_buffer(out);
+    const Mix* mix = engine.current;
+    if (!mix || mix->controls.empty())
+        return;
+    if (m_resend.exchange(false, std::memory_order_relaxed)) {
+        for (const Mix::Control& c : mix->controls) {
+            c.fader->sent_gain = -1;
+            c.fader->sent_mute = -1;
+            c.fader->received = -1;
+        }
+    }
+    // (the surface is already where it sent a volume from)
+    for (const Mix::Control& c : mix->controls) {
+        if (c.fader->received < 0)
+            continue;
+        c.fader->sent_gain = c.fader->received;
+        c.fader->received = -1;
+    }
+    if (engine.feedback_in > nframes) {
+        engine.feedback_in -= nframes;
+        return;
+    }
+    engine.feedback_in = MIDI_FEEDBACK_MS * m_sample_rate / 1000;
+
+    auto send = [&](const MidiControl& control, const unsigned int value) {
+        const unsigned char channel = control.channel ? control.channel - 1 : 0;
+        if (control.type == MidiControl::NRPN) {
+            const unsigned char messages[4][3] = {
+                {(unsigned char)(0xB0 | channel), 99, (unsigned char)(control.number >> 7)},
+                {(unsigned char)(0xB0 | channel), 98, (unsigned char)(control.number & 0x7F)},
+                {(unsigned char)(0xB0 | channel), 6,  (unsigned char)(value >> 7)},
+                {(unsigned char)(0xB0 | channel), 38, (unsigned char)(value & 0x7F)},
+            };
+            for (const auto& message : messages)
+                jack_midi_event_write(out, nframes - 1, message, 3);
+        } else {
+            const unsigned char status = control.type == MidiControl::NOTE ? 0x90 : 0xB0;
+            const unsigned char message[3] = {(unsigned char)(status | channel), (unsigned char) control.number,
+                                              (unsigned char) value};
+            jack_midi_event_write(out, nframes - 1, message, 3);
+        }
+    };
+    auto volume = [&](const Mix::Control& c) {
+        return c.fader->volume(c.input >= 0 ? mix->inputs[c.input].gain : mix->outputs[c.output].gain);
+    };
+
+    // (every control of a fader that changed, then mark them all sent)
+    for (const Mix::Control& c : mix->controls) {
+        const unsigned int top = c.control.type == MidiControl::NRPN ? 16383 : 127;
+        if (c.mute) {
+            const bool muted = c.fader->muted.load(std::memory_order_relaxed);
+            if ((int) muted != c.fader->sent_mute)
+                send(c.control, muted ? top : 0);
+        } else {
+            const float gain = volume(c);
+            if (gain == c.fader->sent_gain)
+                continue;
+            const float span = c.max - c.min;
+            const float position = span > 0 ? std::min(1.f, std::max(0.f, (gain - c.min) / span)) : 0.f;
+            send(c.control, (unsigned int) std::lround(position * top));
+        }
+    }
+    for (const Mix::Control& c : mix->controls) {
+        if (c.mute)
+            c.fader->sent_mute = c.fader->muted.load(std::memory_order_relaxed);
+        else
+            c.fader->sent_gain = volume(c);
+    }
+}
+
+///
+/// True if a ducking rule in `ducks` is not at unity gain this period
+///
+const bool Backend::ducking(const std::vector<DuckGain*>& ducks) {
+    for (DuckGain* duck : ducks)
+        if (duck->to.load(std::memory_order_acquire) != 1 || duck->from.load(std::memory_order_relaxed) != 1)
+            return true;
+    return false;
+}
+
+///
+/// Apply the ducking gains to frames [offset, offset+n) of the period
+/// (ramped linearly over the whole period)
+///
+void Backend::apply_ducks(const std::vector<DuckGain*>& ducks, sample_t* left, sample_t* right,
+                          jack_nframes_t nframes, jack_nframes_t offset, jack_nframes_t n) {
+    for (DuckGain* duck : ducks) {
+        const float to   = duck->to.load(std::memory_order_acquire);
+        const float from = duck->from.load(std::memory_order_relaxed);
+        if (from == 1 && to == 1)
+            continue;
+        const float step = (to - from) / nframes;
+        for (jack_nframes_t i=0; i<n; i++) {
+            const float gain = from + step * (offset + i + 1);
+            left[i]  *= gain;
+            right[i] *= gain;
+        }
+    }
+}
+
+///
+/// Render bus `output` of the current mix of `engine` into `left` and
+/// `right`, crossfading from the previous mix
+///
+void Backend::render_output(Engine& engine, const size_t output, sample_t* left, sample_t* right,
+                            jack_nframes_t nframes, jack_nframes_t offset, jack_nframes_t n) {
+    const Mix* mix = engine.current;
+    const Mix* from = engine.from;
+    const Mix::Shard& shard = mix->shards[engine.shard];
+    const Mix::Bus& bus = mix->outputs[output];
+    const std::vector<sample_t*>& in_bufs = shard.in_bufs;
+    const bool prescaled = engine.shard != 0;
+    const jack_nframes_t frame = engine.frame_time + offset;
+
+    // From its shared sum if this block has it (the monitor may render a
+    // bus of another shard, or the bus got connected since)
+    if (bus.sum >= 0 && bus.shard == engine.shard && shard.partial_ready[bus.sum]) {
+        const sample_t* pleft  = shard.partial_buf.data() + bus.sum * 2 * mix->block;
+        const sample_t* pright = pleft + mix->block;
+        const Mix::Level level = bus.level(frame);
+        for (jack_nframes_t i=0; i<n; i++) {
+            const float volume_mod = level.at(frame + i);
+            left[i]  = pleft[i]  * volume_mod;
+            right[i] = pright[i] * volume_mod;
+        }
+    } else {
+        render_bus(*mix, bus, in_bufs, prescaled, left, right, frame, n);
+    }
+
+    // Crossfade from the previous mix of this bus
+    if (from && n <= engine.scratch[0].size()) {
+        sample_t* fleft  = engine.scratch[0].data();
+        sample_t* fright = engine.scratch[1].data();
+
+        render_bus(*from, from->outputs[output], in_bufs, prescaled, fleft, fright, frame, n);
+        for (jack_nframes_t i=0; i<n; i++) {
+            const jack_nframes_t pos = engine.fade_pos + i + 1;
+            const float t = pos >= engine.fade_len ? 1.f : (float)pos / engine.fade_len;
+            left[i]  = fleft[i]  + (left[i]  - fleft[i])  * t;
+            right[i] = fright[i] + (right[i] - fright[i]) * t;
+        }
+    }
+
+    apply_ducks(mix->outputs[output].ducks, left, right, nframes, offset, n);
+}
+
+///
+/// Compute the partial sums of the shard that the buses rendered in this
+/// block need: those of connected (or monitored) buses and the partials
+/// they build on
+///
+void Backend::render_partials(Engine& engine, jack_nframes_t offset, jack_nframes_t n) {
+    const Mix* mix = engine.current;
+    const Mix::Shard& shard = mix->shards[engine.shard];
+    std::vector<char>& ready = shard.partial_ready;
+    std::fill(ready.begin(), ready.end(), 0);
+    if (shard.partials.empty() || n > mix->block)
+        return;
+    TRACE_SCOPE("render partials", "partials", shard.partials.size());
+
+    // (marked as needed first, they are all computed below)
+    const bool shed = engine.shed.load(std::memory_order_relaxed) & (1u << Shed::LOW_PRIORITY_BUSES);
+    for (size_t o : shard.buses) {
+        const Mix::Bus& bus = mix->outputs[o];
+        const bool monitored = !engine.shard && (int)o == mix->monitor_output;
+        if (bus.sum < 0 || (bus.low_priority && shed && !monitored))
+            continue;
+        if (monitored || bus.loudness || bus.use->connected.load(std::memory_order_acquire))
+            ready[bus.sum] = 1;
+    }
+    for (size_t p=shard.partials.size(); p-- > 0; )
+        if (ready[p])
+            for (size_t q : shard.partials[p].partials)
+                ready[q] = 1;
+
+    const bool prescaled = engine.shard != 0;
+    const jack_nframes_t frame = engine.frame_time + offset;
+    for (size_t p=0; p<shard.partials.size(); p++) {
+        if (!ready[p])
+            continue;
+        const Mix::Partial& partial = shard.partials[p];
+        sample_t* left  = shard.partial_buf.data() + p * 2 * mix->block;
+        sample_t* right = left + mix->block;
+        std::memset(left , 0, sizeof(sample_t) * n);
+        std::memset(right, 0, sizeof(sample_t) * n);
+
+        for (size_t s : partial.sources) {
+            const sample_t* ileft  = shard.in_bufs[s*2];
+            const sample_t* iright = shard.in_bufs[s*2+1];
+            const Mix::Level level = mix->inputs[s].level(frame);
+            if (prescaled || level.steady) {
+                const float volume_mod = prescaled ? 1.f : level.gain;
+                for (jack_nframes_t i=0; i<n; i++) {
+                    left[i]  += ileft[i]  * volume_mod;
+                    right[i] += iright[i] * volume_mod;
+                }
+            } else {
+                for (jack_nframes_t i=0; i<n; i++) {
+                    const float volume_mod = level.at(frame + i);
+                    left[i]  += ileft[i]  * volume_mod;
+                    right[i] += iright[i] * volume_mod;
+                }
+            }
+        }
+        for (size_t q : partial.partials) {
+            const sample_t* qleft  = shard.partial_buf.data() + q * 2 * mix->block;
+            const sample_t* qright = qleft + mix->block;
+            for (jack_nframes_t i=0; i<n; i++) {
+                left[i]  += qleft[i];
+                right[i] += qright[i];
+            }
+        }
+    }
+}
+
+///
+/// Update the peak meter of an output pair with `n` rendered frames
+/// (every WATCHDOG_METER_STRIDE frames while `shed` has metering)
+///
+void Backend::meter(const Mix& mix, const PortUse& use, const sample_t* left, const sample_t* right,
+                    jack_nframes_t n, const unsigned int shed) {
+    const jack_nframes_t stride = (shed & (1u << Shed::METERING)) ? WATCHDOG_METER_STRIDE : 1;
+    float peak = 0;
+    for (jack_nframes_t i=0; i<n; i += stride)
+        peak = std::max(peak, std::max(std::fabs(left[i]), std::fabs(right[i])));
+    const float decay = mix.peak_release > 0 ? std::exp(-(float) n / mix.peak_release) : 0.f;
+    use.peak.store(std::max(peak, use.peak.load(std::memory_order_relaxed) * decay), std::memory_order_relaxed);
+}
+
+///
+/// Render frames [offset, offset+n) of the period with the current mix:
+/// the strips and monitor on the main client, the buses of the shard on
+/// every client
+///
+void Backend::render(Engine& engine, jack_nframes_t nframes, jack_nframes_t offset, jack_nframes_t n) {
+    TRACE_SCOPE("render", "frames", n);
+    const Mix* mix = engine.current;
+    const Mix* from = engine.from;
+    if (n > engine.scratch[0].size())
+        from = nullptr;
+    const Mix::Shard& shard = mix->shards[engine.shard];
+    const unsigned int shed = engine.shed.load(std::memory_order_relaxed);
+
+    // crossfade position of frame `i` in this block
+    auto fade_at = [&](jack_nframes_t i) {
+        const jack_nframes_t pos = engine.fade_pos + i + 1;
+        return pos >= engine.fade_len ? 1.f : (float)pos / engine.fade_len;
+    };
+
+    if (!engine.shard) {
+        TRACE_SCOPE("render inputs");
+        for (size_t s=0; s<mix->inputs.size(); s++) {
+            const Mix::Strip& in = mix->inputs[s];
+            shard.in_bufs[s*2]   = (sample_t*) jack_port_get_buffer(in.in[0], nframes) + offset;
+            shard.in_bufs[s*2+1] = (sample_t*) jack_port_get_buffer(in.in[1], nframes) + offset;
+
+            // Run the inserts and ducking on a copy (the port buffers belong to jack)
+            if ((in.inserts.empty() && !ducking(in.ducks)) || n > mix->block)
+                continue;
+            sample_t* ileft  = in.insert_buf[0].data();
+            sample_t* iright = in.insert_buf[1].data();
+            std::memcpy(ileft , shard.in_bufs[s*2]  , sizeof(sample_t) * n);
+            std::memcpy(iright, shard.in_bufs[s*2+1], sizeof(sample_t) * n);
+            for (Processor* processor : in.inserts)
+                processor->process(ileft, iright, n);
+            apply_ducks(in.ducks, ileft, iright, nframes, offset, n);
+            shard.in_bufs[s*2]   = ileft;
+            shard.in_bufs[s*2+1] = iright;
+        }
+    } else {
+        for (size_t s=0; s<shard.taps.size(); s++)
+            shard.in_bufs[s] = (sample_t*) jack_port_get_buffer(shard.taps[s], nframes) + offset;
+    }
+    if (from)
+        std::copy(shard.in_bufs.begin(), shard.in_bufs.end(), from->shards[engine.shard].in_bufs.begin());
+
+    // Sums shared by the buses
+    render_partials(engine, offset, n);
+
+    // Add inputs to the outputs theyre connected to with volume mod for each
+    for (size_t o : shard.buses) {
+        const Mix::Bus& out = mix->outputs[o];
+
+        sample_t* oleft  = (sample_t*) jack_port_get_buffer(out.out[0], nframes) + offset;
+        sample_t* oright = (sample_t*) jack_port_get_buffer(out.out[1], nframes) + offset;
+
+        // Nothing reads it (the monitor is filled from its ports on shard 0,
+        // a loudness meter counts), or shed by the watchdog: silent, so a
+        // reader connecting before we notice hears no stale block
+        const bool monitored = !engine.shard && (int)o == mix->monitor_output;
+        const bool unread = !out.use->connected.load(std::memory_order_acquire) && !monitored && !out.loudness;
+        if (unread || (out.low_priority && !monitored && (shed & (1u << Shed::LOW_PRIORITY_BUSES)))) {
+            engine.skipped.fetch_add(n, std::memory_order_relaxed);
+            out.use->peak.store(0, std::memory_order_relaxed);
+            std::memset(oleft , 0, sizeof(sample_t) * n);
+            std::memset(oright, 0, sizeof(sample_t) * n);
+            continue;
+        }
+        engine.rendered.fetch_add(n, std::memory_order_relaxed);
+        TRACE_SCOPE("render bus", "output", o);
+
+        render_output(engine, o, oleft, oright, nframes, offset, n);
+        for (Processor* processor : out.inserts)
+            processor->process(oleft, oright, n);
+        meter(*mix, *out.use, oleft, oright, n, shed);
+        if (out.loudness && !(shed & (1u << Shed::ANALYSIS)))
+            out.loudness->push(oleft, oright, n);
+
+        if (monitored) {
+            sample_t* mleft  = (sample_t*) jack_port_get_buffer(m_monitor_port[0], nframes) + offset;
+            sample_t* mright = (sample_t*) jack_port_get_buffer(m_monitor_port[1], nframes) + offset;
+            std::memcpy(mleft , oleft , sizeof(sample_t) * n);
+            std::memcpy(mright, oright, sizeof(sample_t) * n);
+        }
+    }
+
+    if (!engine.shard) {
+        TRACE_SCOPE("render strips");
+        sample_t* mleft  = (sample_t*) jack_port_get_buffer(m_monitor_port[0], nframes) + offset;
+        sample_t* mright = (sample_t*) jack_port_get_buffer(m_monitor_port[1], nframes) + offset;
+
+        // Mirror inputs to output versions (with volume controls)
+        for (size_t s=0; s<mix->inputs.size(); s++) {
+            const Mix::Strip& in = mix->inputs[s];
+
+            sample_t* oleft  = (sample_t*) jack_port_get_buffer(in.out[0], nframes) + offset;
+            sample_t* oright = (sample_t*) jack_port_get_buffer(in.out[1], nframes) + offset;
+
+            // Nothing reads it (shard taps count as readers), or shed by the
+            // watchdog: silent for the other clients
+            const bool unread = !in.use->connected.load(std::memory_order_acquire) && (int)s != mix->monitor_input;
+            if (unread || (!in.tapped && (int)s != mix->monitor_input && (shed & (1u << Shed::IMPLICIT_OUTPUTS)))) {
+                engine.skipped.fetch_add(n, std::memory_order_relaxed);
+                std::memset(oleft , 0, sizeof(sample_t) * n);
+                std::memset(oright, 0, sizeof(sample_t) * n);
+                continue;
+            }
+            engine.rendered.fetch_add(n, std::memory_order_relaxed);
+
+            const sample_t* ileft  = shard.in_bufs[s*2];
+            const sample_t* iright = shard.in_bufs[s*2+1];
+
+            // (frame by frame while a fader moves)
+            const jack_nframes_t frame = engine.frame_time + offset;
+            const Mix::Level level = in.level(frame);
+            if (from) {
+                const Mix::Level before = from->inputs[s].level(frame);
+                for (jack_nframes_t i=0; i<n; i++) {
+                    const float a = before.at(frame + i);
+                    const float b = level.at(frame + i);
+                    const float volume_mod = a + (b - a) * fade_at(i);
+                    oleft[i]  = ileft[i]  * volume_mod;
+                    oright[i] = iright[i] * volume_mod;
+                }
+            } else if (level.steady) {
+                for (jack_nframes_t i=0; i<n; i++) {
+                    oleft[i]  = ileft[i]  * level.gain;
+                    oright[i] = iright[i] * level.gain;
+                }
+            } else {
+                for (jack_nframes_t i=0; i<n; i++) {
+                    const float volume_mod = level.at(frame + i);
+                    oleft[i]  = ileft[i]  * volume_mod;
+                    oright[i] = iright[i] * volume_mod;
+                }
+            }
+
+            if ((int)s == mix->monitor_input) {
+                std::memcpy(mleft , oleft , sizeof(sample_t) * n);
+                std::memcpy(mright, oright, sizeof(sample_t) * n);
+            }
+        }
+
+        render_mix_minus(engine, nframes, offset, n);
+
+        // A bus of another shard is monitored: mix it again here
+        // (its own ports belong to another client, its inserts run there)
+        if (mix->monitor_output >= 0 && mix->outputs[mix->monitor_output].shard != 0)
+            render_output(engine, mix->monitor_output, mleft, mright, nframes, offset, n);
+
+        if (mix->monitor_input < 0 && mix->monitor_output < 0) {
+            std::memset(mleft , 0, sizeof(sample_t) * n);
+            std::memset(mright, 0, sizeof(sample_t) * n);
+        }
+    }
+
+    // Advance crossfade
+    if (engine.from) {
+        engine.fade_pos += n;
+        if (!from || engine.fade_pos >= engine.fade_len) {
+            engine.from = nullptr;
+            engine.fade_from.store(nullptr, std::memory_order_release);
+            if (engine.next)
+                switch_mix(engine, engine.next, engine.next_fade);
+        }
+    }
 }
 
 ///
@@ -280,9 +2917,20 @@ int Backend::callback(jack_nframes_t nframes) {
 ///
 void Backend::shutdown() {
     if (m_client) {
-        std::cout << "Shutting down client..." << std::endl;
-        jack_deactivate(m_client);
-        jack_client_close(m_client);
+        LOG_INFO("Shutting down client...");
+        forget_timed();
+        // deactivating disconnects everything, that's not the user's doing
+        m_closing = true;
+        m_active = false;
+        m_pool.stop();
+        m_pool.detach();
+        // shards first, they read from the main client
+        std::lock_guard<std::mutex> lock(m_metrics_lock);
+        for (size_t k=m_engines.size(); k-- > 0; )
+            jack_deactivate(m_engines[k]->client);
+        for (size_t k=m_engines.size(); k-- > 0; )
+            jack_client_close(m_engines[k]->client);
+        m_engines.clear();
         m_client = 0;
     }
 }
@@ -4,43 +4,349 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+#include <memory>
 #include <exception>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
 
 #include <jack/jack.h>
 #include "settings.h"
+#include "mix.h"
+#include "port_pool.h"
+#include "spsc_queue.h"
+#include "metrics.h"
+#include "watchdog.h"
+
+// reconnection delay after a failed attempt (doubles up to the max)
+#define RECON_BACKOFF_MIN_MS 50
+#define RECON_BACKOFF_MAX_MS 2000
+
+// timed commands run (and get compiled) this long before they are due
+#define TIMED_LOOKAHEAD_MS 50
+
+// no NRPN parameter selected on a MIDI channel
+#define NO_NRPN ((unsigned int) -1)
 
 class Backend {
     private:
         const std::string m_client_name;
 
-        jack_client_t* m_client = 0;
+        std::atomic<jack_client_t*> m_client;
+        jack_nframes_t m_sample_rate = 0;
+        jack_nframes_t m_block = 0;
 
-        std::map<std::string, std::vector<jack_port_t*>> m_input_ports;
-        std::map<std::string, std::vector<jack_port_t*>> m_implicit_output_ports;
-        std::map<std::string, std::vector<jack_port_t*>> m_explicit_output_ports;
+        std::map<channel_id_t, std::vector<jack_port_t*>> m_input_ports;
+        std::map<channel_id_t, std::vector<jack_port_t*>> m_implicit_output_ports;
+        std::map<channel_id_t, std::vector<jack_port_t*>> m_explicit_output_ports;
         std::vector<jack_port_t*>m_monitor_port;
+        PortPool m_pool;
+
+        // insert processors of each channel (aligned with its chain in
+        // settings, nullptr for unknown types)
+        std::map<channel_id_t, std::vector<std::shared_ptr<Processor>>> m_inserts;
+
+        // loudness meters of the buses tagged LOUDNESS_TAG
+        std::map<channel_id_t, std::shared_ptr<LoudnessMeter>> m_loudness;
+
+        // connection state of each output port pair (both ports map to it)
+        std::mutex m_use_lock;
+        std::map<jack_port_t*, std::shared_ptr<PortUse>> m_port_use;
+
+        // ducking state, by key input and by rule name
+        std::map<channel_id_t, std::shared_ptr<Envelope>> m_envelopes;
+        std::map<std::string, std::shared_ptr<DuckGain>> m_duck_gains;
+
+        // return ports of the mix-minus groups, by group and participant
+        std::map<std::pair<std::string, channel_id_t>, std::vector<jack_port_t*>> m_returns;
+
+        // live volume and mute of the channels mapped to MIDI controls
+        std::map<channel_id_t, std::shared_ptr<Fader>> m_faders;
+
+        // incremented every time the port maps above change
+        unsigned long m_layout = 0;
+
+        // === engine state (see mix.h) ===
+        struct PreparedScene {
+            std::shared_ptr<Mix> mix;
+            bool complete; // scene sets every channel: mix can be published as-is
+        };
+
+        std::mutex m_control_lock;
+        std::shared_ptr<Mix> m_published;
+        std::vector<std::pair<std::shared_ptr<Mix>, std::vector<unsigned long>>> m_retired;
+        std::map<std::string, PreparedScene> m_scenes;
+        unsigned long m_committed_revision = 0;
+        unsigned long m_committed_layout = 0;
+
+        // partial sums last planned per shard, reused while the layout and
+        // the sources of its buses stay the same (volume, mute and insert
+        // changes don't plan again)
+        struct PartialPlan {
+            unsigned long layout = 0;
+            size_t inputs = 0;
+            std::vector<size_t> buses;
+            std::vector<std::vector<size_t>> sources;  // of the buses of the shard
+            std::vector<Mix::Partial> partials;
+            std::vector<int> sums;                     // of the buses of the shard
+        };
+        std::vector<PartialPlan> m_plans;
+
+        std::atomic<const Mix*> m_mix;
+        std::atomic<jack_nframes_t> m_fade;
+
+        // === timed commands ===
+        struct TimedMix {
+            jack_nframes_t frame;
+            const Mix* mix;
+            jack_nframes_t fade;
+        };
+
+        std::shared_ptr<Mix> m_timed_pending;   // in the queues, not applied yet
+        bool m_timing = false;                  // publish() queues for m_timed_frame
+        jack_nframes_t m_timed_frame = 0;
+        std::atomic<unsigned int> m_timed_applied;  // callbacks that switched to it...
+        unsigned int m_timed_engines = 0;           // ...out of these
+        std::condition_variable m_timed_wake;       // (with m_control_lock) it was applied
+
+        std::multimap<jack_time_t, std::pair<jack_nframes_t, std::function<void()>>> m_schedule;
+        std::mutex m_schedule_lock;
+        std::condition_variable m_schedule_wake;
+        bool m_run_scheduler = false;
+        std::thread m_scheduler;
+
+        // === MIDI control surface ===
+        jack_port_t* m_midi_in = nullptr;
+        jack_port_t* m_midi_out = nullptr;
+        std::atomic<bool> m_resend;            // surface (re)connected: send it everything
+
+        std::atomic<bool> m_learn;             // map the next control moved...
+        MidiMapping m_learning;                // ...like this (under `command_lock`)
+        SpscQueue<MidiControl, 16> m_learned;  // (callback to MIDI thread)
+
+        bool m_run_midi = false;
+        std::mutex m_midi_lock;
+        std::condition_variable m_midi_wake;
+        std::thread m_midi_thread;
+
+        ///
+        /// A jack client and the state of its callback: the main client
+        /// (shard 0) or a client rendering a share of the buses
+        ///
+        struct Engine {
+            Backend* backend;
+            jack_client_t* client;
+            unsigned int shard;
+
+            // tap ports reading the implicit outputs (shards other than 0)
+            std::map<channel_id_t, std::vector<jack_port_t*>> taps;
+
+            SpscQueue<TimedMix, 16> timed_queue;
+            std::atomic<const Mix*> fade_from;
+            std::atomic<unsigned long> period;
+
+            // output frames rendered and skipped (nothing connected)
+            std::atomic<unsigned long long> rendered;
+            std::atomic<unsigned long long> skipped;
+
+            // callback durations (count per CALLBACK_BUCKETS_US bucket, the
+            // last one for longer callbacks, and their total in us) and xruns
+            std::atomic<unsigned long long> durations[CALLBACK_BUCKETS + 1];
+            std::atomic<unsigned long long> duration_sum;
+            std::atomic<unsigned long> xruns;
+
+            // overload watchdog: stages of WATCHDOG_SHED_ORDER shed (bit per
+            // Shed::Stage), callback time over the period (smoothed) and
+            // how many times work was shed and restored
+            std::atomic<unsigned int> shed;
+            std::atomic<unsigned int> shed_count;
+            std::atomic<float> load;
+            std::atomic<unsigned long> sheds;
+            std::atomic<unsigned long> restores;
+
+            // only touched by the callback
+            const Mix* seen = nullptr;        // last value of m_mix picked up
+            const Mix* current = nullptr;
+            const Mix* from = nullptr;
+            jack_nframes_t fade_pos = 0;
+            jack_nframes_t fade_len = 0;
+            const Mix* next = nullptr;        // faded to once the fade in progress is over
+            jack_nframes_t next_fade = 0;
+            std::vector<sample_t> scratch[2];
+            unsigned int over = 0;            // periods over budget in a row
+            unsigned long calm = 0;           // ...and with headroom
+            unsigned long xruns_seen = 0;
+            unsigned int nrpn[16];            // NRPN parameter selected per MIDI channel...
+            unsigned int nrpn_data[16];       // ...and its data entry so far
+            jack_nframes_t feedback_in = 0;   // frames until MIDI feedback is due
+            jack_nframes_t frame_time = 0;    // of the period being rendered
+
+            Engine(Backend* b, jack_client_t* c, const unsigned int s)
+                : backend(b), client(c), shard(s), fade_from(nullptr), period(0),
+                  rendered(0), skipped(0), duration_sum(0), xruns(0),
+                  shed(0), shed_count(0), load(0), sheds(0), restores(0) {
+                for (auto& count : durations)
+                    count = 0;
+                for (unsigned int c=0; c<16; c++) {
+                    nrpn[c] = NO_NRPN;
+                    nrpn_data[c] = 0;
+                }
+            }
+        };
+
+        std::vector<std::unique_ptr<Engine>> m_engines;  // [0]: main client (changed under m_metrics_lock too)
+        std::map<channel_id_t, unsigned int> m_bus_shard;
+        bool m_active = false;  // clients activated: taps can be connected
+
+        // === jack event thread (reconnection and external connections) ===
+        struct PortEvent {
+            std::string port;    // our port (short name), empty: `other` was registered
+            std::string other;   // full name of the other client's port
+            bool connected;
+        };
+
+        // === metrics ===
+        // (all a scrape reads, so it never waits behind a command)
+        struct MeteredBus {
+            std::string name;
+            float gain;
+            std::shared_ptr<PortUse> use;
+            std::shared_ptr<LoudnessMeter> loudness;
+        };
+        std::mutex m_metrics_lock;
+        std::vector<MeteredBus> m_metered;
+
+        void update_metered();
 
         bool m_try_recon;
         std::thread m_recon_loop;
+        std::mutex m_event_lock;
+        std::condition_variable m_event_wake;
+        std::vector<PortEvent> m_port_events;
+        std::vector<jack_client_t*> m_dead_clients;   // closed by the event thread
+        jack_nframes_t m_new_block = 0;                // buffer size to recompile for
+        std::set<std::string> m_client_names;          // of the main client and shards
+        std::atomic<bool> m_closing;
+
+        void on_shutdown();
+        void on_buffer_size(jack_nframes_t nframes);
+        void track_use(const std::vector<jack_port_t*>& ports);
+        void update_use(jack_port_t* port);
+        void forget_use(const std::vector<jack_port_t*>& ports);
+        const bool is_ours(const std::string& port_name);
+        void on_port_connect(jack_port_id_t a, jack_port_id_t b, const bool connected);
+        void on_port_registration(jack_port_id_t port, const bool registered);
+        void handle_port_events(const std::vector<PortEvent>& events);
+        void restore_connections(const std::string& other="");
+
+        Engine* open_engine(const std::string& name, const unsigned int shard);
+        void assign_shards();
+        const unsigned int assign_shard(const channel_id_t output);
+        void connect_taps(const channel_id_t input);
+        jack_client_t* bus_client(const channel_id_t output);
+        const std::vector<unsigned long> periods();
+
+        int callback(Engine& engine, jack_nframes_t nframes);
+        void watchdog(Engine& engine, const jack_time_t took, jack_nframes_t nframes);
+        void switch_mix(Engine& engine, const Mix* mix, const jack_nframes_t fade);
+        void render(Engine& engine, jack_nframes_t nframes, jack_nframes_t offset, jack_nframes_t n);
+        void render_output(Engine& engine, const size_t output, sample_t* left, sample_t* right,
+                           jack_nframes_t nframes, jack_nframes_t offset, jack_nframes_t n);
+        void update_ducks(const Mix& mix, jack_nframes_t nframes);
+        const bool ducking(const std::vector<DuckGain*>& ducks);
+        void apply_ducks(const std::vector<DuckGain*>& ducks, sample_t* left, sample_t* right,
+                         jack_nframes_t nframes, jack_nframes_t offset, jack_nframes_t n);
+        void meter(const Mix& mix, const PortUse& use, const sample_t* left, const sample_t* right,
+                   jack_nframes_t n, const unsigned int shed);
+        void render_bus(const Mix& mix, const Mix::Bus& bus, const std::vector<sample_t*>& in_bufs,
+                        const bool prescaled, sample_t* left, sample_t* right,
+                        const jack_nframes_t frame, jack_nframes_t n);
+        void render_mix_minus(Engine& engine, jack_nframes_t nframes, jack_nframes_t offset, jack_nframes_t n);
+
+        void render_partials(Engine& engine, jack_nframes_t offset, jack_nframes_t n);
+        void midi_event(Engine& engine, const unsigned char* data, const size_t size, const jack_nframes_t frame);
+        void feedback(Engine& engine, jack_nframes_t nframes);
 
-        int callback(jack_nframes_t nframes);
+        std::shared_ptr<Mix> compile(const Scene& state, bool* complete=nullptr);
+        void plan_partials(Mix& mix, const unsigned int k);
+        void publish(std::shared_ptr<Mix> mix, jack_nframes_t fade=0);
+        void prepare_scenes();
+        void update_inserts();
+        void update_loudness();
+        void forget_ducks();
+        void update_faders();
+        void settle_faders();
+        void update_returns(std::vector<jack_port_t*>& released);
+        void wait_timed();
+        void settle_timed();
+        void forget_timed();
+        void collect();
+        void sync();
+        void scheduler_loop();
+        void midi_loop();
+        void sync_midi();
 
     public:
         class BackendException : public std::exception {};
         class JackServerIsDown : public BackendException {};
 
+        // held while a command or a config reload edits settings
+        std::mutex command_lock;
         Settings settings;
-        explicit Backend(const std::string client_name);
+        explicit Backend(const std::string client_name, const std::string config_path=CONFIG_PATH);
         ~Backend();
+        const std::string& name() const;
         void setup();
         void start_recon_loop();
         void stop_recon_loop();
+        void start_scheduler();
+        void stop_scheduler();
+        void start_midi();
+        void stop_midi();
         void shutdown();
+        void restart();
 
         void register_port(const std::string name, const bool input);
         void unregister_port(const std::string name, const bool input);
+        void unregister_ports(const std::vector<std::pair<std::string, bool>>& names);
         void rename_port(const std::string old_name, const std::string new_name, const bool input);
+
+        void commit();
+        void reload_config();
+
+        const jack_nframes_t frame_in(const float ms);
+        void schedule(const jack_nframes_t frame, std::function<void()> action);
+        PortPool::Stats port_stats();
+
+        struct RenderStats {
+            size_t outputs;             // output port pairs (implicit and explicit)
+            size_t connected;           // ...with something reading them
+            unsigned long long rendered;  // output frames rendered
+            unsigned long long skipped;   // ...and skipped
+        };
+        RenderStats render_stats();
+        struct WatchdogStats {
+            unsigned int shard;
+            float load;                   // callback time over the period
+            std::vector<std::string> shed;  // stages shed, in shedding order
+            unsigned long sheds;
+            unsigned long restores;
+        };
+        const std::vector<WatchdogStats> watchdog_stats();
+        std::shared_ptr<LoudnessMeter> loudness(const std::string& output);
+        const std::vector<std::string> measured();
+        void metrics(MetricsWriter& writer);
+        const std::map<std::string, unsigned int> shards();
+
+        void learn(const MidiMapping& mapping);
+        const bool muted(const std::string& name, const bool input);
+
+        void store_scene(const std::string& name);
+        void remove_scene(const std::string& name);
+        void recall_scene(const std::string& name, const float fade_ms=0);
 };
 
 #endif
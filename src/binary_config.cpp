@@ -0,0 +1,163 @@
+#include "binary_config.h"
+#include "log.h"
+
+#include <cstring>
+#include <cstdio>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+///
+/// Constructor:
+///     @param filename the path to the binary snapshot
+///
+BinaryConfig::BinaryConfig(const std::string filename) : m_filename(filename) { }
+
+const BinaryConfigHeader* BinaryConfig::header_ptr() const {
+    return (const BinaryConfigHeader*) m_map;
+}
+
+///
+/// Map the snapshot. Return false (and map nothing) if it is missing,
+/// malformed, of another version or out of date with the `source` file.
+///
+const bool BinaryConfig::open(const std::string& source) {
+    close();
+
+    struct ::stat src;
+    if (::stat(source.c_str(), &src) != 0)
+        return false;
+
+    int fd = ::open(m_filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct ::stat st;
+    if (::fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(BinaryConfigHeader)) {
+        ::close(fd);
+        return false;
+    }
+
+    m_size = st.st_size;
+    m_map = ::mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (m_map == MAP_FAILED) {
+        m_map = nullptr;
+        return false;
+    }
+
+    const BinaryConfigHeader& h = header();
+    // a section of the string table (no overflow on corrupt offsets)
+    auto in_strings = [&h](const uint64_t off, const uint64_t len) {
+        return len <= h.strings_size && off <= h.strings_size - len;
+    };
+    const uint64_t channels_end = h.channels_off + (uint64_t) h.n_channels * sizeof(BinaryChannelRecord);
+    const uint64_t routing_end  = h.routing_off + (uint64_t) h.n_rows * h.row_words * sizeof(uint64_t);
+
+    bool ok = std::memcmp(h.magic, BINARY_CONFIG_MAGIC, sizeof h.magic) == 0
+        && h.version == BINARY_CONFIG_VERSION
+        && h.header_size == sizeof(BinaryConfigHeader)
+        && h.file_size == m_size
+        && channels_end <= m_size && routing_end <= m_size
+        && h.strings_off + h.strings_size <= m_size
+        && in_strings(h.scenes_off, h.scenes_len)
+        && in_strings(h.external_off, h.external_len)
+        && in_strings(h.inserts_off, h.inserts_len)
+        && in_strings(h.ducks_off, h.ducks_len)
+        && in_strings(h.mix_minus_off, h.mix_minus_len)
+        && in_strings(h.tags_off, h.tags_len)
+        && in_strings(h.midi_off, h.midi_len)
+        && (uint64_t) h.row_words * 64 >= h.n_channels
+        && h.n_rows <= h.n_channels
+        && h.channels_off % 8 == 0 && h.routing_off % 8 == 0;
+
+    for (uint32_t i=0; ok && i<h.n_channels; i++) {
+        const BinaryChannelRecord& c = channels()[i];
+        ok = in_strings(c.name_off, c.name_len) && in_strings(c.alias_off, c.alias_len);
+    }
+
+    // stale if the JSON was edited since
+    ok = ok && h.source_size == (uint64_t) src.st_size
+            && h.source_mtime_ns == (uint64_t) src.st_mtim.tv_sec * 1000000000 + src.st_mtim.tv_nsec
+            && h.source_inode == (uint64_t) src.st_ino;
+
+    if (!ok)
+        close();
+    return ok;
+}
+
+///
+/// Unmap the snapshot
+///
+void BinaryConfig::close() {
+    if (m_map)
+        ::munmap(m_map, m_size);
+    m_map = nullptr;
+    m_size = 0;
+}
+
+///
+/// Get header (snapshot must be open)
+///
+const BinaryConfigHeader& BinaryConfig::header() const {
+    return *header_ptr();
+}
+
+///
+/// Get channel records (`header().n_channels` long, indexed by channel id)
+///
+const BinaryChannelRecord* BinaryConfig::channels() const {
+    return (const BinaryChannelRecord*) ((const char*) m_map + header().channels_off);
+}
+
+///
+/// Get routing row `row` (`header().row_words` long)
+///
+const uint64_t* BinaryConfig::routing_row(const size_t row) const {
+    return (const uint64_t*) ((const char*) m_map + header().routing_off) + row * header().row_words;
+}
+
+///
+/// Get string from the string table
+///
+const std::string BinaryConfig::string(const uint64_t off, const uint64_t len) const {
+    return std::string((const char*) m_map + header().strings_off + off, len);
+}
+
+///
+/// Stamp `data` with the stat of `source` and atomically replace `filename`
+///
+const bool BinaryConfig::write(const std::string& filename, std::string data, const std::string& source) {
+    struct ::stat src;
+    if (data.size() < sizeof(BinaryConfigHeader) || ::stat(source.c_str(), &src) != 0)
+        return false;
+
+    BinaryConfigHeader* h = (BinaryConfigHeader*) &data[0];
+    h->source_size     = src.st_size;
+    h->source_mtime_ns = (uint64_t) src.st_mtim.tv_sec * 1000000000 + src.st_mtim.tv_nsec;
+    h->source_inode    = src.st_ino;
+
+    const std::string tmp_filename = filename + ".tmp";
+    int fd = ::open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    bool ok = ::write(fd, data.data(), data.size()) == (ssize_t) data.size();
+    ok = ok && ::fsync(fd) == 0;
+    ::close(fd);
+
+    if (!ok || std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+        LOG_ERROR("Could not write `%s`", filename.c_str());
+        std::remove(tmp_filename.c_str());
+        return false;
+    }
+    return true;
+}
+
+///
+/// Destructor
+///
+BinaryConfig::~BinaryConfig() {
+    close();
+}
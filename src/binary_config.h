@@ -0,0 +1,96 @@
+#ifndef BINARY_CONFIG_H
+#define BINARY_CONFIG_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#define BINARY_CONFIG_MAGIC "JMXSNAP"
+#define BINARY_CONFIG_VERSION 8
+
+///
+/// On-disk layout of the binary snapshot. Every section is 8 byte aligned
+/// and read in place from the mapping.
+///
+///     header | channel records | routing rows | string table
+///
+struct BinaryConfigHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+
+    // stat of the JSON config this snapshot was compiled with
+    uint64_t source_size;
+    uint64_t source_mtime_ns;
+    uint64_t source_inode;
+
+    uint64_t journal_seq;
+
+    uint32_t n_channels;
+    uint32_t n_rows;          // routing rows: one per output, in id order
+    uint32_t row_words;       // routing words per row
+    uint32_t monitor;         // channel id or UINT32_MAX
+    uint32_t shard_count;
+    uint32_t reserved;
+    uint32_t scenes_len;      // JSON text of the scenes (in string table)
+    uint32_t external_len;    // JSON text of the external connections
+    uint64_t scenes_off;
+    uint64_t external_off;
+    uint64_t inserts_off;     // JSON text of the insert chains (by channel id)
+    uint64_t inserts_len;
+    uint64_t ducks_off;       // JSON text of the ducking rules
+    uint64_t ducks_len;
+    uint64_t mix_minus_off;   // JSON text of the mix-minus groups
+    uint64_t mix_minus_len;
+    uint64_t tags_off;        // JSON text of the channel tags (by channel id)
+    uint64_t tags_len;
+    uint64_t midi_off;        // JSON text of the MIDI mappings
+    uint64_t midi_len;
+
+    uint64_t channels_off;
+    uint64_t routing_off;
+    uint64_t strings_off;
+    uint64_t strings_size;
+    uint64_t file_size;
+};
+
+#define BINARY_CHANNEL_INPUT  0x1
+#define BINARY_CHANNEL_ACTIVE 0x2
+#define BINARY_CHANNEL_SHARD_SHIFT 8   // pinned shard + 1 (0: automatic)
+
+struct BinaryChannelRecord {
+    uint32_t name_off;   // into string table
+    uint32_t name_len;
+    uint32_t alias_off;
+    uint32_t alias_len;
+    uint32_t flags;
+    float volume;
+};
+
+///
+/// Read-only mapping of a binary snapshot
+///
+class BinaryConfig {
+    private:
+        const std::string m_filename;
+        void* m_map = nullptr;
+        size_t m_size = 0;
+
+        const BinaryConfigHeader* header_ptr() const;
+
+    public:
+        explicit BinaryConfig(const std::string filename);
+        ~BinaryConfig();
+
+        const bool open(const std::string& source);
+        void close();
+
+        const BinaryConfigHeader& header() const;
+        const BinaryChannelRecord* channels() const;
+        const uint64_t* routing_row(const size_t row) const;
+        const std::string string(const uint64_t off, const uint64_t len) const;
+
+        static const bool write(const std::string& filename, std::string data, const std::string& source);
+};
+
+#endif
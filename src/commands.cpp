@@ -1,6 +1,14 @@
 #include "commands.h"
+#include "metrics.h"
+#include "trace.h"
+#include "loudness.h"
 #include <utility>
 #include <regex>
+#include <chrono>
+#include <cmath>
+#include <cctype>
+#include <algorithm>
+#include <iostream>
 
 std::string vol(std::vector<std::string> args, Backend* backend, const int fd) {
     std::string target_type;
@@ -24,8 +32,9 @@ std::string vol(std::vector<std::string> args, Backend* backend, const int fd) {
     std::function<void(std::string, float)> set_function;
     std::function<float(std::string)> get_function;
     std::function<void(std::string, int)> listen_function;
+    const bool input = target_type == "input" || target_type == "in";
 
-    if (target_type == "input" || target_type == "in") {
+    if (input) {
         set_function = [&](std::string t, float v){ backend->settings.set_input_volume(t, v); };
         get_function = [&](std::string t){ return backend->settings.get_input_volume(t); };
         listen_function = [&](std::string t, int fd){ backend->settings.add_input_volume_listener(t, fd); };
@@ -36,6 +45,29 @@ std::string vol(std::vector<std::string> args, Backend* backend, const int fd) {
     } else
         throw CommandHandler::CommandException("Error: unrecognized target type: " + target_type);
 
+    // A pattern sets every channel it matches (published by one commit)
+    if (Settings::is_selector(target)) {
+        const std::vector<std::string> targets = backend->settings.select(target, input);
+        const std::string what = std::to_string(targets.size())+(input ? " inputs" : " outputs");
+        if (action == "get") {
+            std::string out = "";
+            for (const std::string& t : targets)
+                out += t+": "+std::to_string(get_function(t)*100)+"\n";
+            out.pop_back();
+            return out;
+        } else if (action == "set") {
+            for (const std::string& t : targets)
+                set_function(t, volume/100);
+            return "Set volume of "+what+" to "+std::to_string(volume);
+        } else if (action == "mod") {
+            for (const std::string& t : targets)
+                set_function(t, get_function(t) + (volume/100));
+            return "Changed volume of "+what+" by "+std::to_string(volume);
+        } else if (action == "listen") {
+            throw CommandHandler::CommandException("Error: listen takes a single channel");
+        } else
+            throw CommandHandler::CommandException("Error: unrecognized action: " + action);
+    }
 
     if (action == "set")
         set_function(target, volume/100);
@@ -55,6 +87,38 @@ std::string vol(std::vector<std::string> args, Backend* backend, const int fd) {
 
 }
 
+///
+/// Connect (+1), disconnect (-1) or toggle (0) every input matching the
+/// first selector with every output matching the second. Each output's
+/// row is rewritten whole (one journal record) and the whole change is
+/// published by the commit that follows the command.
+///
+std::string connect_selected(std::vector<std::string> args, Backend* backend, int action) {
+    const std::vector<std::string> inputs  = backend->settings.select(args[0], true);
+    const std::vector<std::string> outputs = backend->settings.select(args[1], false);
+
+    size_t changed = 0;
+    for (const std::string& output : outputs) {
+        const std::vector<std::string> current = backend->settings.get_connections(output);
+        std::set<std::string> row(current.begin(), current.end());
+        const size_t before = changed;
+        for (const std::string& input : inputs) {
+            const bool on = row.count(input);
+            if (action == -1 || (action == 0 && on))
+                row.erase(input);
+            else
+                row.insert(input);
+            changed += on != (bool) row.count(input);
+        }
+        if (changed != before)
+            backend->settings.set_connections(output, std::vector<std::string>(row.begin(), row.end()));
+    }
+
+    const std::string verb = action == +1 ? "Connected " : action == -1 ? "Disconnected " : "Toggled ";
+    return verb+std::to_string(inputs.size())+" inputs x "+std::to_string(outputs.size())+" outputs ("
+        +std::to_string(changed)+" routes changed)";
+}
+
 std::string connect_command(std::vector<std::string> args, Backend* backend, int action=+1) {
     if (args.size() != 2)
         throw CommandHandler::InvalidNArgs(2, args.size());
@@ -62,6 +126,9 @@ std::string connect_command(std::vector<std::string> args, Backend* backend, int
     std::string input  = args[0];
     std::string output = args[1];
 
+    if (Settings::is_selector(input) || Settings::is_selector(output))
+        return connect_selected(args, backend, action);
+
     if (action == 0)
         action = backend->settings.is_connected(input, output) ? -1 : +1;
 
@@ -109,6 +176,7 @@ std::string get(std::vector<std::string> args, Backend* backend, const int fd) {
         }
         if (!backend->settings.is_output(args[1], true))
             throw CommandHandler::CommandException("Unknown output: `"+args[1]+"`");
+        get_func = [&](){ return backend->settings.get_connections(args[1]); };
     } else if (target_type == "aliases" || target_type == "als") {
         get_func = [&](){
             std::vector<std::string> o;
@@ -119,11 +187,24 @@ std::string get(std::vector<std::string> args, Backend* backend, const int fd) {
                 o.push_back(a + " : " + backend->settings.get_output_name(a));
             return o;
         };
+    } else if (target_type == "pool") {
+        const PortPool::Stats stats = backend->port_stats();
+        return "spare inputs: " + std::to_string(stats.spare_inputs) +
+               "\nspare outputs: " + std::to_string(stats.spare_outputs) +
+               "\nregistered: " + std::to_string(stats.registered) +
+               " ports in " + std::to_string(stats.register_ms) + " ms";
     } else if (target_type == "monitor" || target_type == "mon"){
         if (args.size() == 2 && (args[1] == "input" || args[1] == "in")) {
             return std::to_string(backend->settings.monitoring_input());
         }
         return backend->settings.get_monitor();
+    } else if (target_type == "loudness" || target_type == "lufs") {
+        if (args.size() < 2)
+            throw CommandHandler::InvalidNArgs(2, args.size());
+        std::shared_ptr<LoudnessMeter> meter = backend->loudness(args[1]);
+        if (!meter)
+            throw CommandHandler::CommandException("Not measuring the loudness of `"+args[1]+"`");
+        return LoudnessMeter::format(meter->reading());
     } else
         throw CommandHandler::CommandException("Unknown target_type: `"+target_type+"`");
 
@@ -131,7 +212,8 @@ std::string get(std::vector<std::string> args, Backend* backend, const int fd) {
     for (std::string e : get_func()) {
         out += e+"\n";
     }
-    out.pop_back();
+    if (out != "")
+        out.pop_back();
 
     return out;
 }
@@ -215,10 +297,656 @@ std::string mon(std::vector<std::string> args, Backend* backend, const int fd) {
     else
         throw CommandHandler::CommandException("Invalid target_type: `"+target_type+"`");
 
+    if (Settings::is_selector(target)) {
+        const bool input = target_type == "input" || target_type == "in";
+        const std::vector<std::string> targets = backend->settings.select(target, input);
+        if (targets.size() != 1)
+            throw CommandHandler::CommandException("Error: `"+target+"` matches "+std::to_string(targets.size())
+                +" channels, only one can be monitored");
+        target = targets[0];
+    }
+
     set_mon_func(target);
     return "Monitoring "+target+" now...";
 }
 
+std::string matrix(std::vector<std::string> args, Backend* backend, const int fd) {
+    std::string action = args.empty() ? "get" : args[0];
+
+    if (action == "get" || action == "g") {
+        return backend->settings.get_matrix();
+    } else if (action == "set" || action == "s") {
+        // matrix set <output>=<hex> [<output>=<hex> ...]
+        std::vector<std::pair<std::string, std::string>> rows;
+        for (size_t i=1; i<args.size(); i++) {
+            size_t eq = args[i].rfind('=');
+            if (eq == std::string::npos)
+                throw CommandHandler::CommandException("Error: expected <output>=<hex>: `"+args[i]+"`");
+            rows.push_back({args[i].substr(0, eq), args[i].substr(eq+1)});
+        }
+        backend->settings.set_matrix(rows);
+        return "Updated "+std::to_string(rows.size())+" outputs";
+    }
+
+    if (args.size() < 2)
+        throw CommandHandler::InvalidNArgs(2, args.size());
+
+    if (action == "clear") {
+        backend->settings.clear_connections(args[1]);
+        return "Disconnected all inputs from `"+args[1]+"`";
+    } else if (action == "all") {
+        backend->settings.connect_all(args[1]);
+        return "Connected `"+args[1]+"` to all outputs";
+    } else if (action == "none") {
+        backend->settings.disconnect_all(args[1]);
+        return "Disconnected `"+args[1]+"` from all outputs";
+    } else if (action == "copy") {
+        if (args.size() < 3)
+            throw CommandHandler::InvalidNArgs(3, args.size());
+        backend->settings.copy_connections(args[1], args[2]);
+        return "Copied connections of `"+args[1]+"` to `"+args[2]+"`";
+    } else
+        throw CommandHandler::CommandException("Error: unrecognized action: " + action);
+}
+
+std::string scene(std::vector<std::string> args, Backend* backend, const int fd) {
+    if (args.size() < 1)
+        throw CommandHandler::InvalidNArgs(1, args.size());
+    std::string action = args[0];
+
+    if (action == "list" || action == "ls") {
+        std::string out = "";
+        for (std::string s : backend->settings.get_scenes())
+            out += s+"\n";
+        if (out == "")
+            return "No scenes stored";
+        out.pop_back();
+        return out;
+    }
+
+    if (args.size() < 2)
+        throw CommandHandler::InvalidNArgs(2, args.size());
+    std::string name = args[1];
+
+    if (action == "store" || action == "st") {
+        backend->store_scene(name);
+        return "Stored scene `"+name+"`";
+    } else if (action == "recall" || action == "rc") {
+        float fade_ms = (args.size() > 2) ? std::stof(args[2]) : 0;
+        backend->recall_scene(name, fade_ms);
+        return "Recalled scene `"+name+"` (fade: "+std::to_string((int)fade_ms)+" ms)";
+    } else if (action == "remove" || action == "rem" || action == "rm") {
+        backend->remove_scene(name);
+        return "Removed scene `"+name+"`";
+    } else
+        throw CommandHandler::CommandException("Error: unrecognized action: " + action);
+}
+
+std::string shard(std::vector<std::string> args, Backend* backend, const int fd) {
+    if (args.size() < 1)
+        throw CommandHandler::InvalidNArgs(1, args.size());
+    std::string action = args[0];
+
+    if (action == "list" || action == "ls") {
+        std::string out = "count: "+std::to_string(backend->settings.shard_count())+"\n";
+        for (const auto& p : backend->shards()) {
+            const int pinned = backend->settings.get_output_shard(p.first);
+            out += p.first+": "+std::to_string(p.second);
+            if (pinned >= 0)
+                out += " (pinned to "+std::to_string(pinned)+")";
+            out += "\n";
+        }
+        out.pop_back();
+        return out;
+    } else if (action == "apply") {
+        backend->restart();
+        return "Restarting with "+std::to_string(backend->settings.shard_count())+" shards";
+    }
+
+    if (action == "count" || action == "cnt") {
+        if (args.size() < 2)
+            throw CommandHandler::InvalidNArgs(2, args.size());
+        backend->settings.set_shard_count(std::stoul(args[1]));
+        return "Shard count set to "+args[1]+" (`shard apply` to use it)";
+    } else if (action == "pin") {
+        if (args.size() < 3)
+            throw CommandHandler::InvalidNArgs(3, args.size());
+        // -1 or auto, else one of the shards (1..count, whole numbers only)
+        int k = -1;
+        if (args[2] != "auto" && args[2] != "-1") {
+            const size_t digits = args[2].find_first_not_of("0123456789");
+            const unsigned long shard = digits == std::string::npos && !args[2].empty() && args[2].size() < 10 ? std::stoul(args[2]) : 0;
+            if (shard < 1 || shard > backend->settings.shard_count())
+                throw CommandHandler::CommandException("Error: no such shard: " + args[2]
+                        + " (1-" + std::to_string(backend->settings.shard_count()) + " or auto)");
+            k = shard;
+        }
+        backend->settings.set_output_shard(args[1], k);
+        return "Pinned `"+args[1]+"` to shard "+args[2]+" (`shard apply` to use it)";
+    } else
+        throw CommandHandler::CommandException("Error: unrecognized action: " + action);
+}
+
+std::string insert(std::vector<std::string> args, Backend* backend, const int fd) {
+    if (args.size() < 2)
+        throw CommandHandler::InvalidNArgs(2, args.size());
+    std::string target_type = args[0];
+    std::string name = args[1];
+    std::string action = (args.size() > 2) ? args[2] : "list";
+
+    bool input;
+    if (target_type == "input" || target_type == "in")
+        input = true;
+    else if (target_type == "output" || target_type == "out")
+        input = false;
+    else
+        throw CommandHandler::CommandException("Error: unrecognized target type: " + target_type);
+
+    InsertChain chain = backend->settings.get_inserts(name, input);
+
+    if (action == "list" || action == "ls") {
+        std::string out = "";
+        for (size_t i=0; i<chain.size(); i++) {
+            out += std::to_string(i)+": "+chain[i].type;
+            for (const auto& p : chain[i].params)
+                out += " "+p.first+"="+std::to_string(p.second);
+            out += "\n";
+        }
+        if (out == "")
+            return "No inserts";
+        out.pop_back();
+        return out;
+    }
+
+    // type and parameters are checked on a throwaway processor
+    auto check = [](const Insert& insert) {
+        try {
+            std::unique_ptr<Processor> processor(Processor::create(insert.type));
+            for (const auto& p : insert.params)
+                processor->set(p.first, p.second);
+        } catch (Processor::ProcessorException& e) {
+            throw CommandHandler::CommandException(std::string("Error: ") + e.what());
+        }
+    };
+
+    if (action == "add") {
+        // insert add <type> [param=value ...]
+        if (args.size() < 4)
+            throw CommandHandler::InvalidNArgs(4, args.size());
+        Insert added;
+        added.type = args[3];
+        for (size_t i=4; i<args.size(); i++) {
+            const size_t eq = args[i].find('=');
+            if (eq == std::string::npos)
+                throw CommandHandler::CommandException("Error: expected param=value: " + args[i]);
+            added.params[args[i].substr(0, eq)] = std::stof(args[i].substr(eq + 1));
+        }
+        check(added);
+        chain.push_back(added);
+        backend->settings.set_inserts(name, input, chain);
+        return "Added "+added.type+" at "+std::to_string(chain.size() - 1);
+    } else if (action == "set") {
+        // insert set <index> <param> <value>
+        if (args.size() < 6)
+            throw CommandHandler::InvalidNArgs(6, args.size());
+        const size_t index = std::stoul(args[3]);
+        if (index >= chain.size())
+            throw CommandHandler::CommandException("Error: no insert at "+args[3]);
+        chain[index].params[args[4]] = std::stof(args[5]);
+        check(chain[index]);
+        backend->settings.set_inserts(name, input, chain);
+        return "Set "+args[4]+" of "+chain[index].type+" to "+args[5];
+    } else if (action == "remove" || action == "rem" || action == "rm") {
+        if (args.size() < 4)
+            throw CommandHandler::InvalidNArgs(4, args.size());
+        const size_t index = std::stoul(args[3]);
+        if (index >= chain.size())
+            throw CommandHandler::CommandException("Error: no insert at "+args[3]);
+        chain.erase(chain.begin() + index);
+        backend->settings.set_inserts(name, input, chain);
+        return "Removed insert "+args[3];
+    } else if (action == "clear") {
+        backend->settings.set_inserts(name, input, {});
+        return "Cleared inserts";
+    } else
+        throw CommandHandler::CommandException("Error: unrecognized action: " + action);
+}
+
+std::string duck(std::vector<std::string> args, Backend* backend, const int fd) {
+    if (args.size() < 1)
+        throw CommandHandler::InvalidNArgs(1, args.size());
+    std::string action = args[0];
+
+    auto join = [](const std::vector<std::string>& names) {
+        std::string out = "";
+        for (const std::string& n : names)
+            out += (out == "" ? "" : ",") + n;
+        return out;
+    };
+
+    if (action == "list" || action == "ls") {
+        std::string out = "";
+        for (const auto& p : backend->settings.get_ducks()) {
+            const DuckRule& rule = p.second;
+            out += p.first+": "+rule.key+" -> in="+join(rule.inputs)+" out="+join(rule.outputs)
+                +" threshold="+std::to_string(rule.threshold)+" depth="+std::to_string(rule.depth)
+                +" attack="+std::to_string(rule.attack)+" release="+std::to_string(rule.release)+"\n";
+        }
+        if (out == "")
+            return "No ducking rules";
+        out.pop_back();
+        return out;
+    }
+
+    if (args.size() < 2)
+        throw CommandHandler::InvalidNArgs(2, args.size());
+    std::string name = args[1];
+
+    if (action == "set") {
+        // duck set <name> <key> [in=a,b] [out=c] [threshold=dB] [depth=dB] [attack=ms] [release=ms]
+        if (args.size() < 3)
+            throw CommandHandler::InvalidNArgs(3, args.size());
+        const std::map<std::string, DuckRule>& ducks = backend->settings.get_ducks();
+        DuckRule rule = ducks.count(name) ? ducks.at(name) : DuckRule();
+
+        if (!backend->settings.is_input(args[2], true))
+            throw Settings::InputNotFound(args[2]);
+        rule.key = backend->settings.get_input_name(args[2]);
+
+        for (size_t i=3; i<args.size(); i++) {
+            const size_t eq = args[i].find('=');
+            if (eq == std::string::npos)
+                throw CommandHandler::CommandException("Error: expected param=value: " + args[i]);
+            const std::string param = args[i].substr(0, eq);
+            const std::string value = args[i].substr(eq + 1);
+
+            if (param == "in" || param == "out") {
+                const bool input = param == "in";
+                std::vector<std::string> targets;
+                std::stringstream list(value);
+                std::string target;
+                while (std::getline(list, target, ',')) {
+                    if (input && !backend->settings.is_input(target, true))
+                        throw Settings::InputNotFound(target);
+                    if (!input && !backend->settings.is_output(target, true))
+                        throw Settings::OutputNotFound(target);
+                    targets.push_back(input ? backend->settings.get_input_name(target)
+                                            : backend->settings.get_output_name(target));
+                }
+                (input ? rule.inputs : rule.outputs) = targets;
+            } else if (param == "threshold") {
+                rule.threshold = std::stof(value);
+            } else if (param == "depth") {
+                rule.depth = std::stof(value);
+            } else if (param == "attack") {
+                rule.attack = std::stof(value);
+            } else if (param == "release") {
+                rule.release = std::stof(value);
+            } else
+                throw CommandHandler::CommandException("Error: unrecognized parameter: " + param);
+        }
+
+        backend->settings.set_duck(name, rule);
+        return "Set ducking rule `"+name+"`";
+    } else if (action == "remove" || action == "rem" || action == "rm") {
+        backend->settings.remove_duck(name);
+        return "Removed ducking rule `"+name+"`";
+    } else
+        throw CommandHandler::CommandException("Error: unrecognized action: " + action);
+}
+
+std::string tag(std::vector<std::string> args, Backend* backend, const int fd) {
+    if (args.size() < 1)
+        throw CommandHandler::InvalidNArgs(1, args.size());
+
+    auto join = [](const std::vector<std::string>& names) {
+        std::string out = "";
+        for (const std::string& n : names)
+            out += (out == "" ? "" : ",") + n;
+        return out;
+    };
+
+    if (args[0] == "list" || args[0] == "ls") {
+        std::map<std::string, std::pair<std::vector<std::string>, std::vector<std::string>>> tagged;
+        for (const std::string& i : backend->settings.get_inputs())
+            for (const std::string& t : backend->settings.get_tags(i, true))
+                tagged[t].first.push_back(i);
+        for (const std::string& o : backend->settings.get_outputs())
+            for (const std::string& t : backend->settings.get_tags(o, false))
+                tagged[t].second.push_back(o);
+
+        std::string out = "";
+        for (const auto& p : tagged)
+            out += "@"+p.first+": in="+join(p.second.first)+" out="+join(p.second.second)+"\n";
+        if (out == "")
+            return "No tags";
+        out.pop_back();
+        return out;
+    }
+
+    // tag <in|out> <selector> [add|rm|set <tag>...]
+    if (args.size() < 2)
+        throw CommandHandler::InvalidNArgs(2, args.size());
+    const std::string target_type = args[0];
+    bool input;
+    if (target_type == "input" || target_type == "in")
+        input = true;
+    else if (target_type == "output" || target_type == "out")
+        input = false;
+    else
+        throw CommandHandler::CommandException("Invalid target_type: `"+target_type+"`");
+    const std::vector<std::string> targets = backend->settings.select(args[1], input);
+
+    if (args.size() == 2) {
+        std::string out = "";
+        for (const std::string& t : targets) {
+            const std::set<std::string>& tags = backend->settings.get_tags(t, input);
+            out += t+": "+join(std::vector<std::string>(tags.begin(), tags.end()))+"\n";
+        }
+        out.pop_back();
+        return out;
+    }
+
+    const std::string action = args[2];
+    std::set<std::string> given;
+    for (size_t i=3; i<args.size(); i++)
+        given.insert(args[i][0] == '@' ? args[i].substr(1) : args[i]);
+    if (given.count(""))
+        throw CommandHandler::CommandException("Error: empty tag");
+
+    size_t changed = 0;
+    for (const std::string& t : targets) {
+        std::set<std::string> tags = backend->settings.get_tags(t, input);
+        const std::set<std::string> before = tags;
+        if (action == "add") {
+            tags.insert(given.begin(), given.end());
+        } else if (action == "remove" || action == "rem" || action == "rm") {
+            for (const std::string& g : given)
+                tags.erase(g);
+        } else if (action == "set") {
+            tags = given;
+        } else
+            throw CommandHandler::CommandException("Error: unrecognized action: " + action);
+        if (tags != before) {
+            backend->settings.set_tags(t, input, tags);
+            changed++;
+        }
+    }
+    return "Retagged "+std::to_string(changed)+" of "+std::to_string(targets.size())
+        +(input ? " inputs" : " outputs");
+}
+
+std::string mixminus(std::vector<std::string> args, Backend* backend, const int fd) {
+    if (args.size() < 1)
+        throw CommandHandler::InvalidNArgs(1, args.size());
+    std::string action = args[0];
+
+    if (action == "list" || action == "ls") {
+        std::string out = "";
+        for (const auto& p : backend->settings.get_mix_minus()) {
+            std::string participants = "";
+            for (const std::string& n : p.second.participants)
+                participants += (participants == "" ? "" : ",") + n;
+            out += p.first+": "+participants+" vol="+std::to_string((int) std::round(p.second.volume * 100))+"\n";
+        }
+        if (out == "")
+            return "No mix-minus groups";
+        out.pop_back();
+        return out;
+    }
+
+    if (args.size() < 2)
+        throw CommandHandler::InvalidNArgs(2, args.size());
+    std::string name = args[1];
+    const std::map<std::string, MixMinusGroup>& groups = backend->settings.get_mix_minus();
+    MixMinusGroup group = groups.count(name) ? groups.at(name) : MixMinusGroup();
+
+    auto participant = [&](const std::string& input) {
+        if (!backend->settings.is_input(input, true))
+            throw Settings::InputNotFound(input);
+        return backend->settings.get_input_name(input);
+    };
+
+    if (action == "set") {
+        // mixminus set <group> <in>...
+        group.participants.clear();
+        for (size_t i=2; i<args.size(); i++) {
+            const std::string in = participant(args[i]);
+            if (std::find(group.participants.begin(), group.participants.end(), in) == group.participants.end())
+                group.participants.push_back(in);
+        }
+        backend->settings.set_mix_minus(name, group);
+        return "Set mix-minus group `"+name+"`";
+    } else if (action == "join" || action == "add") {
+        if (args.size() < 3)
+            throw CommandHandler::InvalidNArgs(3, args.size());
+        const std::string in = participant(args[2]);
+        if (std::find(group.participants.begin(), group.participants.end(), in) == group.participants.end())
+            group.participants.push_back(in);
+        backend->settings.set_mix_minus(name, group);
+        return in+" joined `"+name+"`";
+    } else if (action == "leave") {
+        if (args.size() < 3)
+            throw CommandHandler::InvalidNArgs(3, args.size());
+        if (!groups.count(name))
+            throw Settings::MixMinusNotFound(name);
+        const std::string in = participant(args[2]);
+        const auto it = std::find(group.participants.begin(), group.participants.end(), in);
+        if (it == group.participants.end())
+            throw CommandHandler::CommandException("Error: "+in+" is not in `"+name+"`");
+        group.participants.erase(it);
+        backend->settings.set_mix_minus(name, group);
+        return in+" left `"+name+"`";
+    } else if (action == "volume" || action == "vol") {
+        // mixminus vol <group> <0-100>
+        if (args.size() < 3)
+            throw CommandHandler::InvalidNArgs(3, args.size());
+        if (!groups.count(name))
+            throw Settings::MixMinusNotFound(name);
+        group.volume = std::stof(args[2]) / 100;
+        backend->settings.set_mix_minus(name, group);
+        return "Set volume of `"+name+"` to "+args[2];
+    } else if (action == "remove" || action == "rem" || action == "rm") {
+        backend->settings.remove_mix_minus(name);
+        return "Removed mix-minus group `"+name+"`";
+    } else
+        throw CommandHandler::CommandException("Error: unrecognized action: " + action);
+}
+
+///
+/// Loudness meters: list the measured buses with their readings, turn
+/// metering on or off for the outputs matching a selector (through
+/// LOUDNESS_TAG), reset a meter's integrated loudness and true peak, or
+/// listen for the next reading of a bus.
+///
+std::string loudness(std::vector<std::string> args, Backend* backend, const int fd) {
+    if (args.size() < 1)
+        throw CommandHandler::InvalidNArgs(1, args.size());
+    const std::string action = args[0];
+
+    if (action == "list" || action == "ls") {
+        std::string out = "";
+        for (const std::string& o : backend->measured()) {
+            std::shared_ptr<LoudnessMeter> meter = backend->loudness(o);
+            if (meter)
+                out += o+": "+LoudnessMeter::format(meter->reading())+"\n";
+        }
+        if (out == "")
+            return "No loudness meters";
+        out.pop_back();
+        return out;
+    }
+
+    if (args.size() < 2)
+        throw CommandHandler::InvalidNArgs(2, args.size());
+
+    if (action == "on" || action == "off") {
+        size_t changed = 0;
+        const std::vector<std::string> targets = backend->settings.select(args[1], false);
+        for (const std::string& t : targets) {
+            std::set<std::string> tags = backend->settings.get_tags(t, false);
+            const bool had = tags.count(LOUDNESS_TAG);
+            if (action == "on")
+                tags.insert(LOUDNESS_TAG);
+            else
+                tags.erase(LOUDNESS_TAG);
+            if (had != (bool) tags.count(LOUDNESS_TAG)) {
+                backend->settings.set_tags(t, false, tags);
+                changed++;
+            }
+        }
+        return "Turned loudness metering "+action+" for "+std::to_string(changed)+" of "
+            +std::to_string(targets.size())+" outputs";
+    }
+
+    std::shared_ptr<LoudnessMeter> meter = backend->loudness(args[1]);
+    if (!meter)
+        throw CommandHandler::CommandException("Not measuring the loudness of `"+args[1]+"`");
+
+    if (action == "reset") {
+        meter->reset();
+        return "Reset the loudness meter of `"+args[1]+"`";
+    } else if (action == "listen") {
+        meter->listen(fd, args[1]);
+        // signal server not to send response
+        return "IS LISTENER";
+    } else
+        throw CommandHandler::CommandException("Error: unrecognized action: " + action);
+}
+
+///
+/// MIDI mappings: list them, map a control ("cc:1:7", "nrpn:1:1024",
+/// "note:1:60") to the volume or mute of a channel, map the next control
+/// moved on the surface (learn) or unmap one.
+///
+///     midi map <control> <in|out> <channel> vol [min max]
+///     midi map <control> <in|out> <channel> mute
+///     midi learn <in|out> <channel> vol|mute [min max]
+///     midi rm <control>
+///
+std::string midi(std::vector<std::string> args, Backend* backend, const int fd) {
+    if (args.size() < 1)
+        throw CommandHandler::InvalidNArgs(1, args.size());
+    const std::string action = args[0];
+
+    if (action == "list" || action == "ls") {
+        std::string out = "";
+        for (const auto& p : backend->settings.get_midi()) {
+            const MidiMapping& m = p.second;
+            out += p.first+": "+(m.input ? "in " : "out ")+m.target;
+            if (m.mute)
+                out += std::string(" mute")+(backend->muted(m.target, m.input) ? " (muted)" : "");
+            else
+                out += " vol "+std::to_string((int) std::lround(m.min*100))+"-"+std::to_string((int) std::lround(m.max*100));
+            out += "\n";
+        }
+        if (out == "")
+            return "No MIDI mappings";
+        out.pop_back();
+        return out;
+    }
+
+    if (action == "remove" || action == "rem" || action == "rm") {
+        if (args.size() < 2)
+            throw CommandHandler::InvalidNArgs(2, args.size());
+        backend->settings.remove_midi(args[1]);
+        return "Unmapped "+args[1];
+    }
+
+    // <in|out> <channel> vol|mute [min max], from `first`
+    auto mapping = [&](const size_t first) {
+        if (args.size() < first + 3)
+            throw CommandHandler::InvalidNArgs(first + 3, args.size());
+        MidiMapping m;
+        const std::string target_type = args[first];
+        if (target_type == "input" || target_type == "in")
+            m.input = true;
+        else if (target_type == "output" || target_type == "out")
+            m.input = false;
+        else
+            throw CommandHandler::CommandException("Invalid target_type: `"+target_type+"`");
+        if (m.input ? !backend->settings.is_input(args[first+1], true) : !backend->settings.is_output(args[first+1], true))
+            throw CommandHandler::CommandException(std::string("Unknown ")+(m.input ? "input" : "output")+": `"+args[first+1]+"`");
+        m.target = m.input ? backend->settings.get_input_name(args[first+1])
+                           : backend->settings.get_output_name(args[first+1]);
+
+        const std::string param = args[first+2];
+        if (param == "mute") {
+            m.mute = true;
+        } else if (param == "volume" || param == "vol") {
+            if (args.size() == first + 5) {
+                m.min = std::stof(args[first+3]) / 100;
+                m.max = std::stof(args[first+4]) / 100;
+            } else if (args.size() != first + 3) {
+                throw CommandHandler::InvalidNArgs(first + 5, args.size());
+            }
+            if (m.min < 0 || m.min > 1 || m.max < 0 || m.max > 1)
+                throw CommandHandler::CommandException("Error: volume range out of 0-100");
+        } else
+            throw CommandHandler::CommandException("Error: unrecognized parameter: " + param);
+        return m;
+    };
+
+    if (action == "map") {
+        if (args.size() < 2)
+            throw CommandHandler::InvalidNArgs(2, args.size());
+        MidiControl control;
+        if (!MidiControl::parse(args[1], control))
+            throw CommandHandler::CommandException("Invalid MIDI control: `"+args[1]+"` (try cc:1:7)");
+        const MidiMapping m = mapping(2);
+        if (control.type == MidiControl::NOTE && !m.mute)
+            throw CommandHandler::CommandException("Error: a note can only mute");
+        backend->settings.set_midi(control.name(), m);
+        return "Mapped "+control.name()+" to "+m.target;
+    } else if (action == "learn") {
+        const MidiMapping m = mapping(1);
+        backend->learn(m);
+        return "Move a control to map it to "+m.target;
+    } else
+        throw CommandHandler::CommandException("Error: unrecognized action: " + action);
+}
+
+std::string stats(std::vector<std::string> args, Backend* backend, const int fd) {
+    const Backend::RenderStats render = backend->render_stats();
+    const unsigned long long total = render.rendered + render.skipped;
+    const int skipped = total ? (int) (100 * render.skipped / total) : 0;
+
+    std::string out = "outputs: " + std::to_string(render.connected) + "/" + std::to_string(render.outputs) +
+           " connected, " + std::to_string(skipped) + "% of output frames skipped (" +
+           std::to_string(render.skipped) + " of " + std::to_string(total) + ")";
+
+    for (const Backend::WatchdogStats& w : backend->watchdog_stats()) {
+        std::string shed;
+        for (const std::string& stage : w.shed)
+            shed += (shed.empty() ? "" : ", ") + stage;
+        out += "\nshard " + std::to_string(w.shard) + ": load " + std::to_string((int) (100 * w.load)) +
+               "% of the period, shed: " + (shed.empty() ? "nothing" : shed) + " (" +
+               std::to_string(w.sheds) + " sheds, " + std::to_string(w.restores) + " restores)";
+    }
+    return out;
+}
+
+std::string trace(std::vector<std::string> args, Backend* backend, const int fd) {
+    if (args.size() < 1)
+        throw CommandHandler::InvalidNArgs(1, args.size());
+    std::string action = args[0];
+
+    if (action == "start") {
+        Trace::start();
+        return "Tracing...";
+    } else if (action == "stop") {
+        if (args.size() < 2)
+            throw CommandHandler::InvalidNArgs(2, args.size());
+        Trace::stop();
+        try {
+            return "Trace written to `"+Trace::write(args[1])+"`";
+        } catch (Trace::TraceException& e) {
+            throw CommandHandler::CommandException(e.what());
+        }
+    } else
+        throw CommandHandler::CommandException("Error: unrecognized action: " + action);
+}
+
 #define CMD_ALIAS(o, e) \
 std::string o##_##e(std::vector<std::string> args, Backend* backend, const int fd){ \
     args.insert(args.begin(), std::string( #e )); \
@@ -259,9 +987,20 @@ CMD_ALIAS(vol_out, mod);
 CMD_ALIAS(vol_out, get);
 CMD_ALIAS(vol_out, listen);
 
+CMD_ALIAS(scene, list);
+CMD_ALIAS(scene, store);
+CMD_ALIAS(scene, recall);
+CMD_ALIAS(scene, remove);
+
 #undef CMD_ALIAS
 
-commands_map_t gen_abrevs(abrevs_list_t abrevs, std::string ww="") {
+///
+/// Every alias of the commands in `abrevs` (words of a level joined to
+/// the aliases of the level above, `ww`), with in `names` the full
+/// command each stands for (words of `path` and the first of each level)
+///
+commands_map_t gen_abrevs(abrevs_list_t abrevs, std::map<std::string, std::string>& names,
+                          std::string ww="", std::string path="") {
     commands_map_t commands;
     for (size_t i=0; i<abrevs.size(); i++) {
         auto g = abrevs[i];
@@ -269,11 +1008,13 @@ commands_map_t gen_abrevs(abrevs_list_t abrevs, std::string ww="") {
         auto func = std::get<2>(g);
 
         if (std::get<0>(g) == 0) {
+            const std::string name = path.empty() ? shorts[0] : path+" "+shorts[0];
             for (std::string w : shorts) {
 #ifdef DEBUG
                 std::cout << "alias: " << ww+w << std::endl;
 #endif
                 commands[ww+w] = {0, func};
+                names[ww+w] = name;
 
                 abrevs_list_t sub_abrevs;
                 for (size_t ii=1; i+ii<abrevs.size(); ii++){
@@ -286,7 +1027,7 @@ commands_map_t gen_abrevs(abrevs_list_t abrevs, std::string ww="") {
                     } else break;
                 }
                 if (!sub_abrevs.empty()) {
-                    auto gg = gen_abrevs(sub_abrevs, ww+w);
+                    auto gg = gen_abrevs(sub_abrevs, names, ww+w, name);
                     commands.insert(gg.begin(), gg.end());
                 }
             }
@@ -297,9 +1038,9 @@ commands_map_t gen_abrevs(abrevs_list_t abrevs, std::string ww="") {
 }
 
 ///
-/// Constructor: Initialize m_commands map and m_backend
+/// Constructor: Initialize m_commands map and m_instances
 ///
-CommandHandler::CommandHandler(Backend* backend) : m_backend(backend) {
+CommandHandler::CommandHandler(Instances* instances) : m_instances(instances) {
     typedef std::vector<std::string> shorts;
     shorts input_shorts  = { "input", "in", "i" };
     shorts output_shorts = {"output", "out", "o"};
@@ -340,7 +1081,8 @@ CommandHandler::CommandHandler(Backend* backend) : m_backend(backend) {
 
         {0, {"load", "l"},
             [](std::vector<std::string> a, Backend* b, const int fd){
-                b->shutdown();
+                // the event thread reconnects once we release command_lock
+                b->restart();
                 b->settings.load();
                 return std::string("Loaded!");
             }},
@@ -365,9 +1107,35 @@ CommandHandler::CommandHandler(Backend* backend) : m_backend(backend) {
         {0, monitor_shorts, mon},
         {1, input_shorts,  mon_in},
         {1, output_shorts, mon_out},
+
+        {0, {"matrix", "mtx", "mx"}, matrix},
+
+        {0, {"scene", "scn", "sc"}, scene},
+        {1, {"list", "ls"}, scene_list},
+        {1, {"store", "st"}, scene_store},
+        {1, {"recall", "rc"}, scene_recall},
+        {1, {"remove", "rem", "rm"}, scene_remove},
+
+        {0, {"shard", "shd", "sh"}, shard},
+
+        {0, {"insert", "ins", "is"}, insert},
+
+        {0, {"duck", "dk"}, duck},
+
+        {0, {"mixminus", "mm"}, mixminus},
+
+        {0, {"tag", "tg"}, tag},
+
+        {0, {"loudness", "lufs", "ld"}, loudness},
+
+        {0, {"midi", "md"}, midi},
+
+        {0, {"stats", "st"}, stats},
+
+        {0, {"trace", "tr"}, trace},
     };
 
-    m_commands = gen_abrevs(abrevs);
+    m_commands = gen_abrevs(abrevs, m_names);
 
 }
 
@@ -416,6 +1184,49 @@ std::pair<std::string, std::vector<std::string>> CommandHandler::parse_line(std:
 
 }
 
+///
+/// Instance the commands of `fd` go to
+///
+Backend* CommandHandler::selected(const int fd) {
+    auto it = m_selected.find(fd);
+    return it == m_selected.end() ? m_instances->first() : it->second;
+}
+
+///
+/// Drop what was kept for `fd` (once it hung up)
+///
+void CommandHandler::forget(const int fd) {
+    m_selected.erase(fd);
+}
+
+///
+/// `instances`: list the mixer instances (`*` marks the one in use)
+/// `use [<instance>]`: show or pick the instance of later commands
+///
+std::string CommandHandler::instance_command(const std::string& cmd, const std::vector<std::string>& args, const int fd) {
+    if (cmd == "use") {
+        if (args.size() > 1)
+            throw InvalidNArgs(1, args.size());
+        if (args.empty())
+            return "Using `" + selected(fd)->name() + "`";
+        Backend* backend = m_instances->get(args[0]);
+        if (!backend)
+            throw CommandException("Unknown instance: `" + args[0] + "`");
+        m_selected[fd] = backend;
+        return "Using `" + backend->name() + "`";
+    }
+
+    if (!args.empty())
+        throw InvalidNArgs(0, args.size());
+    std::string out = "";
+    Backend* current = selected(fd);
+    for (Backend* backend : m_instances->all())
+        out += backend->name() + " (" + backend->settings.filename() + ")"
+            + (backend == current ? " *" : "") + "\n";
+    out.pop_back();
+    return out;
+}
+
 ///
 /// Parse and run `cmd` line and return output of command
 ///
@@ -424,10 +1235,104 @@ std::string CommandHandler::run(std::string cmd_line, const int fd) {
     std::string cmd = cmd_and_args.first;
     std::vector<std::string> args = cmd_and_args.second;
 
+    // `<instance>: cmd...`: run cmd on another instance than the selected one
+    Backend* backend = selected(fd);
+    if (cmd.size() > 1 && cmd.back() == ':') {
+        backend = m_instances->get(cmd.substr(0, cmd.size()-1));
+        if (!backend)
+            throw CommandException("Unknown instance: `" + cmd.substr(0, cmd.size()-1) + "`");
+        if (args.empty())
+            throw EmptyCommand();
+        cmd = args[0];
+        args.erase(args.begin());
+    }
+
+    if (cmd == "use" || cmd == "instances" || cmd == "inst")
+        return instance_command(cmd, args, fd);
+
+    // `@<frames> cmd...` or `@+<ms> cmd...`: run cmd at a jack frame time
+    jack_nframes_t frame = 0;
+    const bool timed = cmd[0] == '@';
+    if (timed) {
+        if (args.empty())
+            throw EmptyCommand();
+        try {
+            // (no sign: stoul would wrap a negative frame around)
+            const bool relative = cmd.size() > 1 && cmd[1] == '+';
+            const size_t first = relative ? 2 : 1;
+            if (first >= cmd.size() || !(std::isdigit((unsigned char) cmd[first]) || (relative && cmd[first] == '.')))
+                throw std::invalid_argument(cmd);
+            size_t end;
+            if (relative) {
+                const float ms = std::stof(cmd.substr(2), &end);
+                end += 2;
+                frame = backend->frame_in(ms);
+            } else {
+                frame = std::stoul(cmd.substr(1), &end);
+                end += 1;
+                if ((int32_t)(frame - backend->frame_in(0)) < 0)
+                    throw CommandException("Time stamp is in the past: `"+cmd+"`");
+            }
+            if (end != cmd.size())
+                throw std::invalid_argument(cmd);
+        } catch (std::logic_error& e) {
+            throw CommandException("Invalid time stamp: `"+cmd+"`");
+        } catch (Backend::JackServerIsDown& e) {
+            throw CommandException("Jack server is down");
+        }
+        cmd = args[0];
+        args.erase(args.begin());
+    }
+
     if (m_commands.find(cmd) != m_commands.end()) {
-        if (m_commands[cmd].first == args.size() || m_commands[cmd].first == 0)
-            return m_commands[cmd].second(args, m_backend, fd);
-        else
+        if (m_commands[cmd].first == args.size() || m_commands[cmd].first == 0) {
+            if (timed) {
+                const commandref_t command = m_commands[cmd].second;
+                try {
+                    backend->schedule(frame, [command, args, backend](){
+                        try {
+                            command(args, backend, -1);
+                        } catch (...) {
+                            backend->commit();
+                            throw;
+                        }
+                        backend->commit();
+                    });
+                } catch (Backend::JackServerIsDown& e) {
+                    throw CommandException("Jack server is down");
+                }
+                return "Scheduled at frame " + std::to_string(frame);
+            }
+
+#ifdef WITH_METRICS
+            const auto name = m_names.find(cmd);
+            const std::string labels = MetricsWriter::labels({{"command", name != m_names.end() ? name->second : cmd}});
+            Metrics::count("jamyxer_commands", labels);
+            const auto began = std::chrono::steady_clock::now();
+#endif
+
+            std::lock_guard<std::mutex> lock(backend->command_lock);
+            std::string out;
+            try {
+                out = m_commands[cmd].second(args, backend, fd);
+            } catch (...) {
+#ifdef WITH_METRICS
+                Metrics::count("jamyxer_command_errors", labels);
+#endif
+                // (whatever it changed before failing goes out now, not
+                // with some later command)
+                backend->commit();
+                throw;
+            }
+            // hand any settings change over to the audio engine
+            backend->commit();
+
+#ifdef WITH_METRICS
+            Metrics::observe("jamyxer_command_duration_seconds", labels,
+                    std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count());
+#endif
+            return out;
+        } else
             throw InvalidNArgs(m_commands[cmd].first, args.size());
     } else {
         throw CommandNotFound(cmd);
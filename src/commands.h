@@ -2,6 +2,7 @@
 #define COMMANDS_H
 
 #include "backend.h"
+#include "instances.h"
 
 #include <string>
 #include <vector>
@@ -18,8 +19,12 @@ typedef std::vector<std::tuple<unsigned int, std::vector<std::string>, commandre
 class CommandHandler {
     private:
         std::map<std::string, command_t> m_commands;
-        Backend* m_backend;
+        std::map<std::string, std::string> m_names;  // alias -> full command name (metrics)
+        Instances* m_instances;
+        std::map<int, Backend*> m_selected;         // fd -> instance picked with `use`
         std::pair<std::string, std::vector<std::string>> parse_line(std::string);
+        Backend* selected(const int fd);
+        std::string instance_command(const std::string& cmd, const std::vector<std::string>& args, const int fd);
 
     public:
         class CommandHandlerException : public std::exception {
@@ -63,8 +68,9 @@ class CommandHandler {
                 }
         };
 
-        CommandHandler(Backend* backend);
+        CommandHandler(Instances* instances);
         std::string run(std::string cmd, const int fd=-1);
+        void forget(const int fd);
 
 };
 
@@ -0,0 +1,133 @@
+#include "config_watcher.h"
+#include "log.h"
+#include "shutdown.h"
+
+#include <cstring>
+#include <cerrno>
+
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+
+///
+/// Constructor: watch nothing yet (see `add`)
+///
+ConfigWatcher::ConfigWatcher() : m_watch(false) { }
+
+///
+/// Watch one more file (before `start`):
+///     @param filename the file to watch
+///     @param on_change called after the file changed
+///
+void ConfigWatcher::add(const std::string filename, std::function<void()> on_change) {
+    const size_t slash = filename.rfind('/');
+    const std::string name = slash == std::string::npos ? filename : filename.substr(slash+1);
+    m_watches.push_back({filename, on_change, -1, name, false});
+}
+
+///
+/// Start watching
+///
+void ConfigWatcher::start() {
+    m_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd < 0) {
+        LOG_WARN("Could not watch config files: %s", std::strerror(errno));
+        return;
+    }
+
+    bool any = false;
+    for (Watch& w : m_watches) {
+        const size_t slash = w.filename.rfind('/');
+        const std::string dir = slash == std::string::npos ? "." : w.filename.substr(0, slash);
+
+        // (the same directory gives the same descriptor back)
+        w.wd = ::inotify_add_watch(m_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        if (w.wd < 0)
+            LOG_WARN("Could not watch `%s`: %s", w.filename.c_str(), std::strerror(errno));
+        else
+            any = true;
+    }
+    if (!any) {
+        ::close(m_fd);
+        m_fd = -1;
+        return;
+    }
+
+    m_watch = true;
+    m_thread = std::thread([this](){ watch_loop(); });
+}
+
+///
+/// Stop watching
+///
+void ConfigWatcher::stop() {
+    if (!m_watch)
+        return;
+
+    m_watch = false;
+    m_thread.join();
+    ::close(m_fd);
+    m_fd = -1;
+}
+
+///
+/// Drain pending events and mark the files they are about. Return true
+/// if there was any.
+///
+const bool ConfigWatcher::read_events() {
+    bool hit = false;
+    alignas(struct inotify_event) char buf[4096];
+
+    for (;;) {
+        ssize_t len = ::read(m_fd, buf, sizeof buf);
+        if (len <= 0)
+            break;
+
+        for (char* p = buf; p < buf + len; ) {
+            const struct inotify_event* e = (const struct inotify_event*) p;
+            for (Watch& w : m_watches) {
+                if (e->len && e->wd == w.wd && w.name == e->name) {
+                    w.pending = true;
+                    hit = true;
+                }
+            }
+            p += sizeof(struct inotify_event) + e->len;
+        }
+    }
+    return hit;
+}
+
+///
+/// Watcher thread: wait for a change then for CONFIG_WATCH_DEBOUNCE_MS
+/// without changes before calling back
+///
+void ConfigWatcher::watch_loop() {
+    Log::register_thread("config watcher");
+
+    bool pending = false;
+    while (m_watch) {
+        struct ::pollfd pfds[2] = {{m_fd, POLLIN, 0}, {Shutdown::fd(), POLLIN, 0}};
+        int s = ::poll(pfds, 2, pending ? CONFIG_WATCH_DEBOUNCE_MS : 500);
+
+        if (pfds[1].revents) {
+            break;
+        } else if (s > 0) {
+            pending = read_events() || pending;
+        } else if (s == 0 && pending) {
+            pending = false;
+            for (Watch& w : m_watches) {
+                if (!w.pending)
+                    continue;
+                w.pending = false;
+                w.on_change();
+            }
+        }
+    }
+}
+
+///
+/// Destructor
+///
+ConfigWatcher::~ConfigWatcher() {
+    stop();
+}
@@ -0,0 +1,47 @@
+#ifndef CONFIG_WATCHER_H
+#define CONFIG_WATCHER_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <atomic>
+
+// quiet time after the last change before reloading
+#define CONFIG_WATCH_DEBOUNCE_MS 150
+
+///
+/// Watch files with inotify (all of them from one thread) and call their
+/// `on_change` (from the watcher thread) once edits have settled. The
+/// parent directories are watched so editors that save through a rename
+/// are seen too.
+///
+class ConfigWatcher {
+    private:
+        struct Watch {
+            std::string filename;
+            std::function<void()> on_change;
+            int wd;             // of the parent directory
+            std::string name;   // in the parent directory
+            bool pending;
+        };
+
+        std::vector<Watch> m_watches;
+
+        int m_fd = -1;
+        std::atomic<bool> m_watch;
+        std::thread m_thread;
+
+        void watch_loop();
+        const bool read_events();
+
+    public:
+        ConfigWatcher();
+        ~ConfigWatcher();
+
+        void add(const std::string filename, std::function<void()> on_change);
+        void start();
+        void stop();
+};
+
+#endif
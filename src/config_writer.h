@@ -4,6 +4,13 @@
 #include <string>
 #include <map>
 #include <vector>
+#include <functional>
+
+#include "scene.h"
+#include "insert.h"
+#include "ducking.h"
+#include "mix_minus.h"
+#include "midi.h"
 
 class ConfigWriter{
     public:
@@ -15,8 +22,22 @@ class ConfigWriter{
         std::map<std::string, std::vector<std::string>> m_connections;
         std::string m_monitor_channel;
         bool m_monitoring_input;
+        std::map<std::string, Scene> m_scenes;
+        std::map<std::string, std::vector<std::string>> m_external; // our port -> other clients' ports
+        unsigned int m_shard_count = 0;              // bus clients (0: single client)
+        std::map<std::string, int> m_output_shards;  // outputs pinned to a shard
+        std::map<std::string, InsertChain> m_input_inserts;
+        std::map<std::string, InsertChain> m_output_inserts;
+        std::map<std::string, DuckRule> m_ducks;
+        std::map<std::string, MixMinusGroup> m_mix_minus;
+        std::map<std::string, std::vector<std::string>> m_input_tags;
+        std::map<std::string, std::vector<std::string>> m_output_tags;
+        std::map<std::string, MidiMapping> m_midi;   // by control ("cc:1:7")
+        unsigned long m_journal_seq = 0; // last journal record included
         virtual void load() = 0;
-        virtual void save() = 0;
+        // `before_rename` gets the written temporary file before it replaces
+        // the config (to stamp the binary snapshot with it first)
+        virtual void save(std::function<void(const std::string&)> before_rename = nullptr) = 0;
 };
 
 #endif
@@ -0,0 +1,25 @@
+#ifndef DUCKING_H
+#define DUCKING_H
+
+#include <string>
+#include <vector>
+
+// release time of the key input envelope (peak hold, then exponential decay)
+#define DUCK_ENVELOPE_MS 50
+
+///
+/// Stored form of a ducking rule: while the level of the `key` input is
+/// above `threshold`, the target inputs and outputs are turned down by
+/// `depth`, reaching it over `attack` and recovering over `release`.
+///
+struct DuckRule {
+    std::string key;
+    std::vector<std::string> inputs;
+    std::vector<std::string> outputs;
+    float threshold = -40;  // dBFS
+    float depth     = -12;  // dB
+    float attack    = 10;   // ms
+    float release   = 300;  // ms
+};
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef INSERT_H
+#define INSERT_H
+
+#include <string>
+#include <map>
+#include <vector>
+
+///
+/// Stored form of one insert processor of a channel: its type (see
+/// `Processor::create`) and the parameters to set on it
+///
+struct Insert {
+    std::string type;
+    std::map<std::string, float> params;
+};
+
+typedef std::vector<Insert> InsertChain;
+
+#endif
@@ -0,0 +1,48 @@
+#include "instances.h"
+
+#include <algorithm>
+
+///
+/// Create an instance (loads its config):
+///     @param name the jack client name, also used to address it in commands
+///     @param config_path its config file (not shared with another instance)
+///
+Backend* Instances::add(const std::string name, const std::string config_path) {
+    if (name.empty() || name.find_first_of(": \t") != std::string::npos)
+        throw InvalidInstance("`" + name + "` (no spaces or colons)");
+    for (const auto& b : m_backends) {
+        if (b->name() == name)
+            throw InvalidInstance("`" + name + "` is defined twice");
+        if (b->settings.filename() == config_path)
+            throw InvalidInstance("`" + name + "` and `" + b->name() + "` share `" + config_path + "`");
+    }
+
+    m_backends.push_back(std::unique_ptr<Backend>(new Backend(name, config_path)));
+    return m_backends.back().get();
+}
+
+///
+/// The instance named `name` (nullptr if there's none)
+///
+Backend* Instances::get(const std::string& name) const {
+    auto it = std::find_if(m_backends.begin(), m_backends.end(),
+            [&](const std::unique_ptr<Backend>& b){ return b->name() == name; });
+    return it == m_backends.end() ? nullptr : it->get();
+}
+
+///
+/// The default instance (nullptr if there's none)
+///
+Backend* Instances::first() const {
+    return m_backends.empty() ? nullptr : m_backends[0].get();
+}
+
+///
+/// All instances, in the order they were added
+///
+const std::vector<Backend*> Instances::all() const {
+    std::vector<Backend*> backends;
+    for (const auto& b : m_backends)
+        backends.push_back(b.get());
+    return backends;
+}
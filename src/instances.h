@@ -0,0 +1,43 @@
+#ifndef INSTANCES_H
+#define INSTANCES_H
+
+#include "backend.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <exception>
+
+///
+/// The mixer instances hosted by the process. Each has its own jack
+/// client (named after the instance), config and engine; they share the
+/// control socket, logging, journal and config watcher threads. The first
+/// one added is the default target of commands.
+///
+class Instances {
+    private:
+        std::vector<std::unique_ptr<Backend>> m_backends;
+
+    public:
+        class InstanceException : public std::exception {
+            public:
+                std::string os;
+            const char* what() const throw() {
+                return os.c_str();
+            }
+        };
+
+        class InvalidInstance : public InstanceException {
+            public:
+                InvalidInstance(const std::string& why) {
+                    os = "Invalid instance: " + why;
+                }
+        };
+
+        Backend* add(const std::string name, const std::string config_path);
+        Backend* get(const std::string& name) const;
+        Backend* first() const;
+        const std::vector<Backend*> all() const;
+};
+
+#endif
@@ -0,0 +1,233 @@
+#include "journal.h"
+#include "metrics.h"
+#include "trace.h"
+#include "log.h"
+
+#include <fstream>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+    // shared by all journals: their queues and the I/O thread
+    std::mutex g_lock;
+    std::condition_variable g_wakeup;
+    std::condition_variable g_done;
+    std::vector<Journal*> g_journals;   // started ones
+
+    // held while a journal starts or stops (and the thread with it)
+    std::mutex g_thread_lock;
+    std::thread g_thread;
+}
+
+///
+/// Constructor:
+///     @param filename the path to the journal file
+///
+Journal::Journal(const std::string filename) : m_filename(filename) { }
+
+///
+/// Open the journal for appending and hand it to the I/O thread (started
+/// with the first journal)
+///
+void Journal::start() {
+    std::lock_guard<std::mutex> thread_lock(g_thread_lock);
+    if (m_running)
+        return;
+
+    m_fd = ::open(m_filename.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0644);
+    if (m_fd < 0)
+        LOG_ERROR("Could not open journal `%s`: %s", m_filename.c_str(), std::strerror(errno));
+
+    std::lock_guard<std::mutex> lock(g_lock);
+    m_running = true;
+    g_journals.push_back(this);
+    if (g_journals.size() == 1)
+        g_thread = std::thread(io_loop);
+}
+
+///
+/// Write everything queued and take the journal back from the I/O thread
+/// (stopped with the last journal)
+///
+void Journal::stop() {
+    std::lock_guard<std::mutex> thread_lock(g_thread_lock);
+    if (!m_running)
+        return;
+
+    bool last;
+    {
+        std::unique_lock<std::mutex> lock(g_lock);
+        g_done.wait(lock, [&](){ return m_written >= m_queued; });
+        m_running = false;
+        g_journals.erase(std::find(g_journals.begin(), g_journals.end(), this));
+        last = g_journals.empty();
+    }
+    if (last) {
+        g_wakeup.notify_all();
+        g_thread.join();
+    }
+
+    if (m_fd >= 0)
+        ::close(m_fd);
+    m_fd = -1;
+}
+
+///
+/// Queue a record (one line, newline included)
+///
+void Journal::append(const std::string& record) {
+    {
+        std::lock_guard<std::mutex> lock(g_lock);
+        m_queue.push_back({record, nullptr});
+        m_queued++;
+    }
+    g_wakeup.notify_all();
+}
+
+///
+/// Queue a compaction: once every record queued before it is written,
+/// `write_snapshot` runs on the I/O thread and the journal is emptied
+///
+void Journal::compact(std::function<void()> write_snapshot) {
+    {
+        std::lock_guard<std::mutex> lock(g_lock);
+        m_queue.push_back({"", write_snapshot});
+        m_queued++;
+    }
+    g_wakeup.notify_all();
+}
+
+///
+/// Block until everything queued so far is on disk
+///
+void Journal::flush() {
+    std::unique_lock<std::mutex> lock(g_lock);
+    const unsigned long target = m_queued;
+    if (!m_running)
+        return;
+    g_done.wait(lock, [&](){ return m_written >= target || !m_running; });
+}
+
+///
+/// Append records to the file and sync them
+///
+void Journal::write_records(const std::string& data) {
+    if (m_fd < 0 || data.empty())
+        return;
+    TRACE_SCOPE("journal write", "bytes", data.size());
+    const auto began = std::chrono::steady_clock::now();
+
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = ::write(m_fd, data.data() + off, data.size() - off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR("Journal write failed: %s", std::strerror(errno));
+            return;
+        }
+        off += n;
+    }
+    ::fdatasync(m_fd);
+
+    Metrics::observe("jamyxer_journal_write_seconds", "",
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count());
+    Metrics::count("jamyxer_journal_bytes", "", data.size());
+}
+
+///
+/// Write a batch taken from the queue: records are grouped up to each
+/// snapshot
+///
+void Journal::write_batch(const std::vector<Entry>& batch) {
+    std::string data;
+    for (const Entry& e : batch) {
+        if (!e.snapshot) {
+            data += e.record;
+            continue;
+        }
+
+        // records before the snapshot are part of it
+        write_records(data);
+        data.clear();
+
+        TRACE_SCOPE("snapshot");
+        const auto began = std::chrono::steady_clock::now();
+        e.snapshot();
+        if (m_fd >= 0 && ::ftruncate(m_fd, 0) == 0)
+            ::fdatasync(m_fd);
+        Metrics::observe("jamyxer_save_seconds", "",
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count());
+    }
+    write_records(data);
+}
+
+///
+/// I/O thread: drain the queues of all started journals in batches, until
+/// none is left
+///
+void Journal::io_loop() {
+    Trace::register_thread("journal");
+    Log::register_thread("journal");
+    std::unique_lock<std::mutex> lock(g_lock);
+
+    auto pending = [](){
+        for (const Journal* j : g_journals)
+            if (!j->m_queue.empty())
+                return true;
+        return false;
+    };
+
+    for (;;) {
+        g_wakeup.wait(lock, [&](){ return g_journals.empty() || pending(); });
+        if (g_journals.empty())
+            break;
+
+        // (a journal with records queued can't stop before they're written)
+        for (size_t i=0; i<g_journals.size(); i++) {
+            Journal* j = g_journals[i];
+            if (j->m_queue.empty())
+                continue;
+
+            std::vector<Entry> batch;
+            batch.swap(j->m_queue);
+            lock.unlock();
+            j->write_batch(batch);
+            lock.lock();
+
+            j->m_written += batch.size();
+            g_done.notify_all();
+        }
+    }
+}
+
+///
+/// Read all records (stops at the first incomplete line)
+///
+const std::vector<std::string> Journal::read() {
+    std::vector<std::string> records;
+    std::ifstream file(m_filename);
+    std::string line;
+
+    while (std::getline(file, line)) {
+        if (file.eof())
+            break; // torn write: no trailing newline
+        records.push_back(line);
+    }
+    return records;
+}
+
+///
+/// Destructor
+///
+Journal::~Journal() {
+    stop();
+}
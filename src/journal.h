@@ -0,0 +1,63 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <string>
+#include <vector>
+#include <functional>
+
+// compact after this many records...
+#define JOURNAL_COMPACT_RECORDS 1000
+// ...or after this many seconds with pending records
+#define JOURNAL_COMPACT_SECONDS 60
+
+///
+/// Append-only change journal. The journals of every mixer instance are
+/// written by one shared background I/O thread (running while any of them
+/// is started). Records queued while the thread is busy are written with
+/// a single write() and fdatasync() (group commit). A compaction writes a
+/// snapshot (through a callback, in queue order) and then empties the
+/// journal.
+///
+class Journal {
+    private:
+        struct Entry {
+            std::string record;
+            std::function<void()> snapshot; // set for compactions
+        };
+
+        const std::string m_filename;
+        int m_fd = -1;
+
+        // under the lock shared by all journals (see journal.cpp)
+        std::vector<Entry> m_queue;
+        unsigned long m_queued = 0;
+        unsigned long m_written = 0;
+        bool m_running = false;
+
+        static void io_loop();
+        void write_batch(const std::vector<Entry>& batch);
+        void write_records(const std::string& data);
+
+    public:
+        class JournalException : public std::exception {
+            public:
+                std::string os;
+            const char* what() const throw() {
+                return os.c_str();
+            }
+        };
+
+        explicit Journal(const std::string filename);
+        ~Journal();
+
+        void start();
+        void stop();
+
+        void append(const std::string& record);
+        void compact(std::function<void()> write_snapshot);
+        void flush();
+
+        const std::vector<std::string> read();
+};
+
+#endif
@@ -4,14 +4,27 @@
 #define JSON_INPUTS_HEADER "INPUTS"
 #define JSON_OUTPUTS_HEADER "OUTPUTS"
 #define JSON_CONNECTIONS_HEADER "CONNECTIONS"
+#define JSON_SCENES_HEADER "SCENES"
+#define JSON_JOURNAL_SEQ_HEADER "JOURNAL_SEQ"
+#define JSON_EXTERNAL_HEADER "EXTERNAL"
+#define JSON_SHARDS_HEADER "SHARDS"
+#define JSON_INSERTS_HEADER "INSERTS"
+#define JSON_DUCKING_HEADER "DUCKING"
+#define JSON_MIX_MINUS_HEADER "MIX_MINUS"
+#define JSON_TAGS_HEADER "TAGS"
+#define JSON_MIDI_HEADER "MIDI"
 
 #include <string>
 #include <map>
 #include <vector>
-#include <iostream>
 #include <fstream>
+#include <sstream>
+#include <cstdio>
 #include <json/json.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "config_writer.h"
+#include "log.h"
 
 class JSONWriter : public ConfigWriter {
     public:
@@ -37,9 +50,7 @@ class JSONWriter : public ConfigWriter {
             m_input_volumes = {};
 
             for (std::string input : root["INPUTS"].getMemberNames()) {
-#ifdef DEBUG
-                std::cout << input+": " << root["INPUTS"][input].asFloat() << std::endl;
-#endif
+                LOG_DEBUG("%s: %f", input.c_str(), root["INPUTS"][input].asFloat());
                 m_input_volumes[input] = root["INPUTS"][input].asFloat() / 100;
             }
 
@@ -50,9 +61,7 @@ class JSONWriter : public ConfigWriter {
             m_output_volumes = {};
 
             for (std::string output : root["OUTPUTS"].getMemberNames()) {
-#ifdef DEBUG
-                std::cout << output+": " << root["OUTPUTS"][output].asFloat() << std::endl;
-#endif
+                LOG_DEBUG("%s: %f", output.c_str(), root["OUTPUTS"][output].asFloat());
                 m_output_volumes[output] = root["OUTPUTS"][output].asFloat() / 100;
             }
 
@@ -67,17 +76,103 @@ class JSONWriter : public ConfigWriter {
                 std::vector<std::string> connected;
                 for (Json::Value input : connection) {
                     connected.push_back(input.asString());
-#ifdef DEBUG
-                    std::cout << output+"->"+input.asString() << std::endl;
-#endif
+                    LOG_DEBUG("%s->%s", output.c_str(), input.asString().c_str());
                 }
                 m_connections[output] = connected;
             }
 
+            //
+            // === LOAD EXTERNAL CONNECTIONS ===
+            //
+
+            m_external = {};
+
+            for (std::string port : root[JSON_EXTERNAL_HEADER].getMemberNames()) {
+                for (Json::Value other : root[JSON_EXTERNAL_HEADER][port])
+                    m_external[port].push_back(other.asString());
+            }
+
+            //
+            // === LOAD SHARDS ===
+            //
+
+            m_shard_count = root[JSON_SHARDS_HEADER]["COUNT"].asUInt();
+            m_output_shards = {};
+
+            for (std::string output : root[JSON_SHARDS_HEADER][JSON_OUTPUTS_HEADER].getMemberNames())
+                m_output_shards[output] = root[JSON_SHARDS_HEADER][JSON_OUTPUTS_HEADER][output].asInt();
+
+            //
+            // === LOAD INSERTS ===
+            //
+
+            m_input_inserts = {};
+            m_output_inserts = {};
+
+            const Json::Value& inserts = root[JSON_INSERTS_HEADER];
+            for (std::string input : inserts[JSON_INPUTS_HEADER].getMemberNames())
+                m_input_inserts[input] = load_inserts(inserts[JSON_INPUTS_HEADER][input]);
+            for (std::string output : inserts[JSON_OUTPUTS_HEADER].getMemberNames())
+                m_output_inserts[output] = load_inserts(inserts[JSON_OUTPUTS_HEADER][output]);
+
+            //
+            // === LOAD DUCKING RULES ===
+            //
+
+            m_ducks = {};
+
+            for (std::string name : root[JSON_DUCKING_HEADER].getMemberNames())
+                m_ducks[name] = load_duck(root[JSON_DUCKING_HEADER][name]);
+
+            //
+            // === LOAD MIX-MINUS GROUPS ===
+            //
+
+            m_mix_minus = {};
+
+            for (std::string name : root[JSON_MIX_MINUS_HEADER].getMemberNames())
+                m_mix_minus[name] = load_mix_minus(root[JSON_MIX_MINUS_HEADER][name]);
+
+            //
+            // === LOAD TAGS ===
+            //
+
+            m_input_tags = {};
+            m_output_tags = {};
+
+            const Json::Value& tags = root[JSON_TAGS_HEADER];
+            for (std::string input : tags[JSON_INPUTS_HEADER].getMemberNames())
+                for (const Json::Value& tag : tags[JSON_INPUTS_HEADER][input])
+                    m_input_tags[input].push_back(tag.asString());
+            for (std::string output : tags[JSON_OUTPUTS_HEADER].getMemberNames())
+                for (const Json::Value& tag : tags[JSON_OUTPUTS_HEADER][output])
+                    m_output_tags[output].push_back(tag.asString());
+
+            //
+            // === LOAD MIDI MAPPINGS ===
+            //
+
+            m_midi = {};
+
+            for (std::string control : root[JSON_MIDI_HEADER].getMemberNames())
+                m_midi[control] = load_midi(root[JSON_MIDI_HEADER][control]);
+
+            m_journal_seq = root[JSON_JOURNAL_SEQ_HEADER].asUInt64();
+
+            //
+            // === LOAD SCENES ===
+            //
+
+            m_scenes = {};
+
+            for (std::string name : root[JSON_SCENES_HEADER].getMemberNames()) {
+                m_scenes[name] = load_scene(root[JSON_SCENES_HEADER][name]);
+                LOG_DEBUG("scene: %s", name.c_str());
+            }
 
         }
 
-        void save() {
+        void save(std::function<void(const std::string&)> before_rename = nullptr) {
             Json::Value root;
 
             root["MONITOR"]["isinput"] = m_monitoring_input;
@@ -94,11 +189,234 @@ class JSONWriter : public ConfigWriter {
                     root["CONNECTIONS"][p.first][(int)i] = p.second[i];
             }
 
-            std::ofstream cfg_file(m_filename);
-            cfg_file << root << '\n';
-            /* std::cout << root << std::endl; */
-            cfg_file.close();
+            for (const auto& p : m_scenes)
+                root[JSON_SCENES_HEADER][p.first] = save_scene(p.second);
+
+            for (const auto& p : m_external) {
+                for (size_t i=0; i<p.second.size(); i++)
+                    root[JSON_EXTERNAL_HEADER][p.first][(int)i] = p.second[i];
+            }
+
+            if (m_shard_count || !m_output_shards.empty()) {
+                root[JSON_SHARDS_HEADER]["COUNT"] = m_shard_count;
+                for (const auto& p : m_output_shards)
+                    root[JSON_SHARDS_HEADER][JSON_OUTPUTS_HEADER][p.first] = p.second;
+            }
 
+            for (const auto& p : m_input_inserts)
+                root[JSON_INSERTS_HEADER][JSON_INPUTS_HEADER][p.first] = save_inserts(p.second);
+            for (const auto& p : m_output_inserts)
+                root[JSON_INSERTS_HEADER][JSON_OUTPUTS_HEADER][p.first] = save_inserts(p.second);
+
+            for (const auto& p : m_ducks)
+                root[JSON_DUCKING_HEADER][p.first] = save_duck(p.second);
+
+            for (const auto& p : m_mix_minus)
+                root[JSON_MIX_MINUS_HEADER][p.first] = save_mix_minus(p.second);
+
+            for (const auto& p : m_input_tags)
+                for (size_t i=0; i<p.second.size(); i++)
+                    root[JSON_TAGS_HEADER][JSON_INPUTS_HEADER][p.first][(int)i] = p.second[i];
+            for (const auto& p : m_output_tags)
+                for (size_t i=0; i<p.second.size(); i++)
+                    root[JSON_TAGS_HEADER][JSON_OUTPUTS_HEADER][p.first][(int)i] = p.second[i];
+
+            for (const auto& p : m_midi)
+                root[JSON_MIDI_HEADER][p.first] = save_midi(p.second);
+
+            root[JSON_JOURNAL_SEQ_HEADER] = (Json::UInt64) m_journal_seq;
+
+            std::ostringstream cfg;
+            cfg << root << '\n';
+            const std::string data = cfg.str();
+
+            // write to a temporary file and rename it over the config so a
+            // crash never leaves a half written config behind
+            const std::string tmp_filename = m_filename + ".tmp";
+            int fd = ::open(tmp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                LOG_ERROR("Could not write `%s`", tmp_filename.c_str());
+                return;
+            }
+            bool ok = ::write(fd, data.data(), data.size()) == (ssize_t) data.size();
+            ok = ok && ::fsync(fd) == 0;
+            ::close(fd);
+            if (ok && before_rename)
+                before_rename(tmp_filename);
+
+            if (!ok || std::rename(tmp_filename.c_str(), m_filename.c_str()) != 0) {
+                LOG_ERROR("Could not save `%s`", m_filename.c_str());
+                std::remove(tmp_filename.c_str());
+            }
+        }
+
+        ///
+        /// Read a scene object (same layout as the top level sections)
+        ///
+        static Scene load_scene(const Json::Value& node) {
+            Scene scene;
+
+            scene.monitoring_input = node["MONITOR"]["isinput"].asBool();
+            scene.monitor_channel  = node["MONITOR"]["channel"].asString();
+
+            for (std::string input : node[JSON_INPUTS_HEADER].getMemberNames())
+                scene.input_volumes[input] = node[JSON_INPUTS_HEADER][input].asFloat() / 100;
+
+            for (std::string output : node[JSON_OUTPUTS_HEADER].getMemberNames())
+                scene.output_volumes[output] = node[JSON_OUTPUTS_HEADER][output].asFloat() / 100;
+
+            for (std::string output : node[JSON_CONNECTIONS_HEADER].getMemberNames()) {
+                std::vector<std::string> connected;
+                for (Json::Value input : node[JSON_CONNECTIONS_HEADER][output])
+                    connected.push_back(input.asString());
+                scene.connections[output] = connected;
+            }
+
+            return scene;
+        }
+
+        ///
+        /// Build a scene object (same layout as the top level sections)
+        ///
+        static Json::Value save_scene(const Scene& scene) {
+            Json::Value node;
+
+            node["MONITOR"]["isinput"] = scene.monitoring_input;
+            node["MONITOR"]["channel"] = scene.monitor_channel;
+
+            for (const auto& p : scene.input_volumes)
+                node[JSON_INPUTS_HEADER][p.first] = p.second * 100;
+
+            for (const auto& p : scene.output_volumes)
+                node[JSON_OUTPUTS_HEADER][p.first] = p.second * 100;
+
+            for (const auto& p : scene.connections) {
+                node[JSON_CONNECTIONS_HEADER][p.first] = Json::Value(Json::arrayValue);
+                for (size_t i=0; i<p.second.size(); i++)
+                    node[JSON_CONNECTIONS_HEADER][p.first][(int)i] = p.second[i];
+            }
+
+            return node;
+        }
+
+        ///
+        /// Read an insert chain: [{"type": "delay", "ms": 10}, ...]
+        ///
+        static InsertChain load_inserts(const Json::Value& node) {
+            InsertChain chain;
+            for (const Json::Value& i : node) {
+                Insert insert;
+                insert.type = i["type"].asString();
+                for (std::string param : i.getMemberNames())
+                    if (param != "type")
+                        insert.params[param] = i[param].asFloat();
+                chain.push_back(insert);
+            }
+            return chain;
+        }
+
+        ///
+        /// Build an insert chain array
+        ///
+        static Json::Value save_inserts(const InsertChain& chain) {
+            Json::Value node(Json::arrayValue);
+            for (const Insert& insert : chain) {
+                Json::Value i;
+                i["type"] = insert.type;
+                for (const auto& p : insert.params)
+                    i[p.first] = p.second;
+                node.append(i);
+            }
+            return node;
+        }
+
+        ///
+        /// Read a ducking rule: {"KEY": "Mic", "INPUTS": [...], "OUTPUTS": [...],
+        /// "THRESHOLD": dBFS, "DEPTH": dB, "ATTACK": ms, "RELEASE": ms}
+        ///
+        static DuckRule load_duck(const Json::Value& node) {
+            DuckRule rule;
+            rule.key = node["KEY"].asString();
+            for (const Json::Value& i : node[JSON_INPUTS_HEADER])
+                rule.inputs.push_back(i.asString());
+            for (const Json::Value& o : node[JSON_OUTPUTS_HEADER])
+                rule.outputs.push_back(o.asString());
+            rule.threshold = node.get("THRESHOLD", rule.threshold).asFloat();
+            rule.depth     = node.get("DEPTH", rule.depth).asFloat();
+            rule.attack    = node.get("ATTACK", rule.attack).asFloat();
+            rule.release   = node.get("RELEASE", rule.release).asFloat();
+            return rule;
+        }
+
+        ///
+        /// Build a ducking rule object
+        ///
+        static Json::Value save_duck(const DuckRule& rule) {
+            Json::Value node;
+            node["KEY"] = rule.key;
+            node[JSON_INPUTS_HEADER]  = Json::Value(Json::arrayValue);
+            node[JSON_OUTPUTS_HEADER] = Json::Value(Json::arrayValue);
+            for (const std::string& i : rule.inputs)
+                node[JSON_INPUTS_HEADER].append(i);
+            for (const std::string& o : rule.outputs)
+                node[JSON_OUTPUTS_HEADER].append(o);
+            node["THRESHOLD"] = rule.threshold;
+            node["DEPTH"]     = rule.depth;
+            node["ATTACK"]    = rule.attack;
+            node["RELEASE"]   = rule.release;
+            return node;
+        }
+
+        ///
+        /// Read a mix-minus group: {"PARTICIPANTS": [...], "VOLUME": 0-100}
+        ///
+        static MixMinusGroup load_mix_minus(const Json::Value& node) {
+            MixMinusGroup group;
+            for (const Json::Value& p : node["PARTICIPANTS"])
+                group.participants.push_back(p.asString());
+            group.volume = node.get("VOLUME", 100).asFloat() / 100;
+            return group;
+        }
+
+        ///
+        /// Build a mix-minus group object
+        ///
+        static Json::Value save_mix_minus(const MixMinusGroup& group) {
+            Json::Value node;
+            node["PARTICIPANTS"] = Json::Value(Json::arrayValue);
+            for (const std::string& p : group.participants)
+                node["PARTICIPANTS"].append(p);
+            node["VOLUME"] = group.volume * 100;
+            return node;
+        }
+
+        ///
+        /// Read a MIDI mapping: {"INPUT": "Mic"} or {"OUTPUT": "Main"}, with
+        /// "MUTE": true or the "MIN" and "MAX" volume (0-100)
+        ///
+        static MidiMapping load_midi(const Json::Value& node) {
+            MidiMapping mapping;
+            mapping.input  = node.isMember("INPUT");
+            mapping.target = node[mapping.input ? "INPUT" : "OUTPUT"].asString();
+            mapping.mute   = node.get("MUTE", false).asBool();
+            mapping.min    = node.get("MIN", 0).asFloat() / 100;
+            mapping.max    = node.get("MAX", 100).asFloat() / 100;
+            return mapping;
+        }
+
+        ///
+        /// Build a MIDI mapping object
+        ///
+        static Json::Value save_midi(const MidiMapping& mapping) {
+            Json::Value node;
+            node[mapping.input ? "INPUT" : "OUTPUT"] = mapping.target;
+            if (mapping.mute) {
+                node["MUTE"] = true;
+            } else {
+                node["MIN"] = mapping.min * 100;
+                node["MAX"] = mapping.max * 100;
+            }
+            return node;
         }
 };
 
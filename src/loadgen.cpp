@@ -0,0 +1,451 @@
+//
+// jamyxer-loadgen: control socket load generator and latency benchmark
+//
+// Opens connections to a running jamyxer and replays a weighted mix of
+// commands, then prints throughput and latency percentiles as JSON. Each
+// connection keeps one command in flight (the protocol has no reply
+// framing). With a rate, commands are sent on a fixed schedule; with
+// --open-loop their latency is measured from the time they were due, so
+// a server falling behind shows up in the percentiles instead of slowing
+// the load down.
+//
+// The commands change the settings (and the journal) of the instance:
+// run it against a scratch config, e.g. with jackd on the dummy driver:
+//
+//     jackd -d dummy -r 48000 -p 256 &
+//     jamyxer &
+//     jamyxer-loadgen -c 8 -r 2000 -d 10 --mix vol=70,con=10,get=20 -l 4
+//
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include <json/json.h>
+
+#define DEFAULT_HOST "127.0.0.1"
+#define DEFAULT_PORT "2909"
+
+// a reply not received within this time counts as a timeout
+#define REPLY_TIMEOUT_MS 2000
+
+typedef std::chrono::steady_clock clock_type;
+
+struct Options {
+    std::string host = DEFAULT_HOST;
+    std::string port = DEFAULT_PORT;
+    unsigned int connections = 4;
+    unsigned int listeners = 0;
+    double rate = 0;            // commands per second over all connections (0: as fast as possible)
+    bool open_loop = false;
+    double duration = 10;       // seconds
+    double warmup = 1;          // seconds (not measured)
+    unsigned int seed = 1;
+    std::map<std::string, unsigned int> mix = {{"vol", 70}, {"con", 10}, {"get", 20}};
+    std::vector<std::string> inputs;
+    std::vector<std::string> outputs;
+};
+
+///
+/// Measurements of one kind of command
+///
+struct OpStats {
+    std::vector<double> latencies;  // microseconds
+    unsigned long errors = 0;
+    unsigned long timeouts = 0;
+
+    void merge(const OpStats& o) {
+        latencies.insert(latencies.end(), o.latencies.begin(), o.latencies.end());
+        errors += o.errors;
+        timeouts += o.timeouts;
+    }
+};
+
+///
+/// Connect to the control socket (-1 on failure)
+///
+int open_connection(const Options& opt) {
+    struct ::addrinfo hints, *ai;
+    std::memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (::getaddrinfo(opt.host.c_str(), opt.port.c_str(), &hints, &ai) != 0)
+        return -1;
+
+    int fd = -1;
+    for (struct ::addrinfo* p = ai; p != NULL; p = p->ai_next) {
+        fd = ::socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if (fd < 0)
+            continue;
+        if (::connect(fd, p->ai_addr, p->ai_addrlen) == 0)
+            break;
+        ::close(fd);
+        fd = -1;
+    }
+    ::freeaddrinfo(ai);
+    return fd;
+}
+
+///
+/// Wait up to `timeout_ms` for data and read it. Return false on timeout
+/// or a closed connection.
+///
+const bool receive(const int fd, std::string& out, const int timeout_ms) {
+    struct ::pollfd pfd { .fd = fd, .events = POLLIN, .revents = 0 };
+    if (::poll(&pfd, 1, timeout_ms) <= 0)
+        return false;
+
+    char buf[4096];
+    ssize_t n = ::recv(fd, buf, sizeof buf, 0);
+    if (n <= 0)
+        return false;
+    out.assign(buf, n);
+    return true;
+}
+
+///
+/// Send a command line and wait for its reply
+///
+const bool request(const int fd, const std::string& line, std::string& reply) {
+    const std::string data = line + "\n";
+    if (::send(fd, data.data(), data.size(), MSG_NOSIGNAL) != (ssize_t) data.size())
+        return false;
+    return receive(fd, reply, REPLY_TIMEOUT_MS);
+}
+
+///
+/// Replies jamyxer gives to commands it could not run
+///
+const bool is_error(const std::string& reply) {
+    for (const char* prefix : {"Error", "Unknown", "Invalid", "Empty command"})
+        if (reply.compare(0, std::strlen(prefix), prefix) == 0)
+            return true;
+    return reply.find(" not found: `") != std::string::npos;
+}
+
+const std::string quote(const std::string& name) {
+    return "\"" + name + "\"";
+}
+
+///
+/// Names listed by a `get ins`/`get outs` reply
+///
+const std::vector<std::string> list(const int fd, const std::string& command) {
+    std::vector<std::string> names;
+    std::string reply;
+    if (!request(fd, command, reply))
+        return names;
+    std::istringstream lines(reply);
+    std::string line;
+    while (std::getline(lines, line))
+        if (!line.empty())
+            names.push_back(line);
+    return names;
+}
+
+///
+/// Command of kind `op` on random channels
+///
+const std::string make_command(const std::string& op, const Options& opt, std::mt19937& rng) {
+    auto pick = [&](const std::vector<std::string>& v) {
+        return quote(v[std::uniform_int_distribution<size_t>(0, v.size() - 1)(rng)]);
+    };
+    const std::string in  = pick(opt.inputs);
+    const std::string out = pick(opt.outputs);
+
+    if (op == "vol") {
+        const int volume = std::uniform_int_distribution<int>(0, 100)(rng);
+        return std::uniform_int_distribution<int>(0, 1)(rng)
+            ? "vol out set " + out + " " + std::to_string(volume)
+            : "vol in set "  + in  + " " + std::to_string(volume);
+    } else if (op == "con") {
+        return "tcon " + in + " " + out;
+    } else {
+        switch (std::uniform_int_distribution<int>(0, 3)(rng)) {
+            case 0:  return "get ins";
+            case 1:  return "get outs";
+            case 2:  return "vol out get " + out;
+            // (the list of connections may be empty, which gets no reply)
+            default: return "get con " + out + " " + in;
+        }
+    }
+}
+
+///
+/// Connection thread: send commands until `end`
+///
+void run_connection(const Options& opt, const unsigned int index, const clock_type::time_point start,
+                    const clock_type::time_point end, std::map<std::string, OpStats>& stats,
+                    std::atomic<bool>& failed) {
+    const int fd = open_connection(opt);
+    if (fd < 0) {
+        failed = true;
+        return;
+    }
+
+    std::mt19937 rng(opt.seed + index);
+    std::vector<std::string> ops;
+    std::vector<unsigned int> weights;
+    for (const auto& p : opt.mix) {
+        ops.push_back(p.first);
+        weights.push_back(p.second);
+    }
+    std::discrete_distribution<size_t> choose(weights.begin(), weights.end());
+
+    // this connection's share of the rate, staggered against the others
+    const double period = opt.rate > 0 ? opt.connections / opt.rate : 0;
+    const auto interval = std::chrono::duration_cast<clock_type::duration>(std::chrono::duration<double>(period));
+    clock_type::time_point due = start + interval * index / opt.connections;
+
+    const auto measured_from = start + std::chrono::duration_cast<clock_type::duration>(
+            std::chrono::duration<double>(opt.warmup));
+
+    while (true) {
+        if (period > 0)
+            std::this_thread::sleep_until(due);
+        const clock_type::time_point sent = clock_type::now();
+        if (sent >= end)
+            break;
+
+        const std::string op = ops[choose(rng)];
+        std::string reply;
+        const bool ok = request(fd, make_command(op, opt, rng), reply);
+        const clock_type::time_point received = clock_type::now();
+
+        const clock_type::time_point from = opt.open_loop && period > 0 ? due : sent;
+        if (from >= measured_from) {
+            OpStats& s = stats[op];
+            if (!ok)
+                s.timeouts++;
+            else if (is_error(reply))
+                s.errors++;
+            else
+                s.latencies.push_back(std::chrono::duration<double, std::micro>(received - from).count());
+        }
+        if (!ok)
+            break;  // the reply may still come: this connection is out of step
+        due += interval;
+    }
+    ::close(fd);
+}
+
+///
+/// Listener thread: subscribe to volume changes of an output and count
+/// the notifications until `end`
+///
+void run_listener(const Options& opt, const std::string& output, const clock_type::time_point end,
+                  std::atomic<unsigned long>& notifications) {
+    const int fd = open_connection(opt);
+    if (fd < 0)
+        return;
+
+    const std::string line = "vol out listen " + quote(output) + "\n";
+    while (clock_type::now() < end) {
+        if (::send(fd, line.data(), line.size(), MSG_NOSIGNAL) != (ssize_t) line.size())
+            break;
+        std::string notification;
+        while (clock_type::now() < end && !receive(fd, notification, 100)) { }
+        if (!notification.empty())
+            notifications++;
+    }
+    ::close(fd);
+}
+
+Json::Value percentiles(std::vector<double> v) {
+    Json::Value out(Json::objectValue);
+    if (v.empty())
+        return out;
+    std::sort(v.begin(), v.end());
+    auto at = [&](const double q) { return v[std::min(v.size() - 1, (size_t) (q * v.size()))]; };
+    double sum = 0;
+    for (double x : v)
+        sum += x;
+    out["mean"] = sum / v.size();
+    out["p50"]  = at(0.50);
+    out["p90"]  = at(0.90);
+    out["p99"]  = at(0.99);
+    out["p999"] = at(0.999);
+    out["max"]  = v.back();
+    return out;
+}
+
+void usage(const char* name) {
+    std::cerr <<
+        "usage: " << name << " [options]\n"
+        "  -H, --host HOST          jamyxer host (" DEFAULT_HOST ")\n"
+        "  -p, --port PORT          control port (" DEFAULT_PORT ")\n"
+        "  -c, --connections N      concurrent connections (4)\n"
+        "  -r, --rate R             commands per second over all connections (0: unpaced)\n"
+        "  -o, --open-loop          measure latency from when commands were due (needs --rate)\n"
+        "  -d, --duration S         measured seconds (10)\n"
+        "  -w, --warmup S           seconds before measuring (1)\n"
+        "  -m, --mix OP=W,...       weights of vol, con and get commands (vol=70,con=10,get=20)\n"
+        "  -l, --listeners N        connections listening to output volumes (0)\n"
+        "  -i, --input NAME         input to use (repeatable, default: all)\n"
+        "  -O, --output NAME        output to use (repeatable, default: all)\n"
+        "  -s, --seed N             random seed (1)\n";
+}
+
+const bool parse_mix(const std::string& text, std::map<std::string, unsigned int>& mix) {
+    mix.clear();
+    std::istringstream items(text);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        const size_t eq = item.find('=');
+        const std::string op = item.substr(0, eq);
+        if (eq == std::string::npos || (op != "vol" && op != "con" && op != "get"))
+            return false;
+        mix[op] = std::stoul(item.substr(eq + 1));
+    }
+    return !mix.empty();
+}
+
+int main(int argc, char* argv[]) {
+    Options opt;
+
+    const struct ::option long_options[] = {
+        {"host",        required_argument, 0, 'H'},
+        {"port",        required_argument, 0, 'p'},
+        {"connections", required_argument, 0, 'c'},
+        {"rate",        required_argument, 0, 'r'},
+        {"open-loop",   no_argument,       0, 'o'},
+        {"duration",    required_argument, 0, 'd'},
+        {"warmup",      required_argument, 0, 'w'},
+        {"mix",         required_argument, 0, 'm'},
+        {"listeners",   required_argument, 0, 'l'},
+        {"input",       required_argument, 0, 'i'},
+        {"output",      required_argument, 0, 'O'},
+        {"seed",        required_argument, 0, 's'},
+        {"help",        no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    try {
+        int c;
+        while ((c = ::getopt_long(argc, argv, "H:p:c:r:od:w:m:l:i:O:s:h", long_options, NULL)) != -1) {
+            switch (c) {
+                case 'H': opt.host = optarg; break;
+                case 'p': opt.port = optarg; break;
+                case 'c': opt.connections = std::max(1ul, std::stoul(optarg)); break;
+                case 'r': opt.rate = std::stod(optarg); break;
+                case 'o': opt.open_loop = true; break;
+                case 'd': opt.duration = std::stod(optarg); break;
+                case 'w': opt.warmup = std::stod(optarg); break;
+                case 'l': opt.listeners = std::stoul(optarg); break;
+                case 'i': opt.inputs.push_back(optarg); break;
+                case 'O': opt.outputs.push_back(optarg); break;
+                case 's': opt.seed = std::stoul(optarg); break;
+                case 'm':
+                    if (!parse_mix(optarg, opt.mix)) {
+                        std::cerr << "Invalid mix: `" << optarg << "`" << std::endl;
+                        return 2;
+                    }
+                    break;
+                default:
+                    usage(argv[0]);
+                    return c == 'h' ? 0 : 2;
+            }
+        }
+    } catch (std::logic_error& e) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // === Discover the channels ===
+    const int fd = open_connection(opt);
+    if (fd < 0) {
+        std::cerr << "Could not connect to " << opt.host << ":" << opt.port << std::endl;
+        return 1;
+    }
+    if (opt.inputs.empty())
+        opt.inputs = list(fd, "get ins");
+    if (opt.outputs.empty())
+        opt.outputs = list(fd, "get outs");
+    ::close(fd);
+    if (opt.inputs.empty() || opt.outputs.empty()) {
+        std::cerr << "Need at least one input and one output" << std::endl;
+        return 1;
+    }
+
+    // === Run ===
+    const clock_type::time_point start = clock_type::now();
+    const clock_type::time_point end = start + std::chrono::duration_cast<clock_type::duration>(
+            std::chrono::duration<double>(opt.warmup + opt.duration));
+
+    std::atomic<bool> failed(false);
+    std::atomic<unsigned long> notifications(0);
+    std::vector<std::map<std::string, OpStats>> stats(opt.connections);
+    std::vector<std::thread> threads;
+    for (unsigned int l=0; l<opt.listeners; l++)
+        threads.push_back(std::thread(run_listener, std::cref(opt), opt.outputs[l % opt.outputs.size()],
+                                      end, std::ref(notifications)));
+    for (unsigned int k=0; k<opt.connections; k++)
+        threads.push_back(std::thread(run_connection, std::cref(opt), k, start, end,
+                                      std::ref(stats[k]), std::ref(failed)));
+    for (std::thread& t : threads)
+        t.join();
+
+    if (failed)
+        std::cerr << "Some connections could not be opened" << std::endl;
+
+    // === Report ===
+    std::map<std::string, OpStats> by_op;
+    OpStats all;
+    for (const auto& s : stats) {
+        for (const auto& p : s) {
+            by_op[p.first].merge(p.second);
+            all.merge(p.second);
+        }
+    }
+    const unsigned long requests = all.latencies.size() + all.errors + all.timeouts;
+
+    Json::Value report;
+    report["config"]["host"] = opt.host;
+    report["config"]["port"] = opt.port;
+    report["config"]["connections"] = opt.connections;
+    report["config"]["rate"] = opt.rate;
+    report["config"]["open_loop"] = opt.open_loop;
+    report["config"]["duration_s"] = opt.duration;
+    report["config"]["warmup_s"] = opt.warmup;
+    report["config"]["seed"] = opt.seed;
+    for (const auto& p : opt.mix)
+        report["config"]["mix"][p.first] = p.second;
+
+    report["requests"] = (Json::UInt64) requests;
+    report["errors"] = (Json::UInt64) all.errors;
+    report["timeouts"] = (Json::UInt64) all.timeouts;
+    report["throughput_rps"] = requests / opt.duration;
+    report["latency_us"] = percentiles(all.latencies);
+    for (const auto& p : by_op) {
+        Json::Value& op = report["ops"][p.first];
+        op["requests"] = (Json::UInt64) (p.second.latencies.size() + p.second.errors + p.second.timeouts);
+        op["errors"] = (Json::UInt64) p.second.errors;
+        op["timeouts"] = (Json::UInt64) p.second.timeouts;
+        op["latency_us"] = percentiles(p.second.latencies);
+    }
+    report["listeners"]["connections"] = opt.listeners;
+    report["listeners"]["notifications"] = (Json::UInt64) notifications.load();
+
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "  ";
+    builder["precision"] = 6;
+    std::cout << Json::writeString(builder, report) << std::endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,256 @@
+#include "log.h"
+#include "spsc_queue.h"
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
+#include <cstdio>
+#include <cstdarg>
+#include <ctime>
+
+#ifdef DEBUG
+std::atomic<int> Log::level(Log::LEVEL_DEBUG);
+#else
+std::atomic<int> Log::level(Log::LEVEL_INFO);
+#endif
+
+namespace {
+    struct Record {
+        int64_t time;   // CLOCK_REALTIME, ns
+        Log::Level level;
+        char text[LOG_MESSAGE_SIZE];
+    };
+
+    ///
+    /// Messages of one thread on their way to the flusher
+    ///
+    struct Buffer {
+        std::string thread;
+        SpscQueue<Record, LOG_RING_RECORDS> queue;
+        std::atomic<unsigned long> dropped;
+        std::atomic<bool> owned;
+
+        Buffer() : dropped(0), owned(true) { }
+    };
+
+    ///
+    /// Gives the buffer of a thread back when the thread exits
+    ///
+    struct BufferHolder {
+        Buffer* buffer = nullptr;
+        ~BufferHolder() {
+            if (buffer)
+                buffer->owned.store(false, std::memory_order_release);
+        }
+    };
+
+    std::mutex g_buffers_lock;
+    std::vector<std::unique_ptr<Buffer>> g_buffers;
+
+    thread_local Buffer* t_buffer = nullptr;
+
+    std::mutex g_flusher_lock;
+    std::condition_variable g_flusher_wake;
+    bool g_flushing = false;
+    std::thread g_flusher;
+
+    ///
+    /// Buffer of the calling thread (reuses the buffer of an exited thread)
+    ///
+    Buffer* acquire(const std::string& name) {
+        thread_local BufferHolder holder;
+        std::lock_guard<std::mutex> lock(g_buffers_lock);
+        if (holder.buffer) {
+            holder.buffer->thread = name;
+            return holder.buffer;
+        }
+
+        size_t t = 0;
+        for (; t<g_buffers.size(); t++) {
+            bool owned = false;
+            // (only once the flusher has written out what it left)
+            if (g_buffers[t]->queue.empty() && g_buffers[t]->owned.compare_exchange_strong(owned, true))
+                break;
+        }
+        if (t == g_buffers.size())
+            g_buffers.push_back(std::unique_ptr<Buffer>(new Buffer()));
+        Buffer* buffer = g_buffers[t].get();
+        buffer->thread = name.empty() ? "thread " + std::to_string(t) : name;
+        holder.buffer = buffer;
+        t_buffer = buffer;
+        return buffer;
+    }
+
+    const char* level_name(const Log::Level level) {
+        switch (level) {
+            case Log::LEVEL_DEBUG: return "debug";
+            case Log::LEVEL_INFO:  return "info";
+            case Log::LEVEL_WARN:  return "warn";
+            case Log::LEVEL_ERROR: return "error";
+        }
+        return "";
+    }
+
+    struct Pending {
+        Record record;
+        std::string thread;
+    };
+
+    // messages written recently: time written and repeats counted since
+    struct Repeat {
+        int64_t since;
+        unsigned long count;
+        Log::Level level;
+        std::string thread;
+    };
+    std::map<std::string, Repeat> g_repeats;
+
+    void line(std::string& out, const int64_t time, const Log::Level level, const std::string& thread,
+              const std::string& text) {
+        const time_t seconds = time / 1000000000;
+        struct tm tm;
+        ::localtime_r(&seconds, &tm);
+        char stamp[32];
+        std::strftime(stamp, sizeof stamp, "%Y-%m-%dT%H:%M:%S", &tm);
+        char ms[8];
+        std::snprintf(ms, sizeof ms, ".%03d", (int) (time / 1000000 % 1000));
+        out += std::string(stamp) + ms + " " + level_name(level) + " [" + thread + "] " + text + "\n";
+    }
+
+    ///
+    /// Write out everything waiting (flusher thread)
+    ///
+    void flush(const int64_t now) {
+        std::vector<Pending> pending;
+        std::vector<std::pair<std::string, unsigned long>> dropped;
+        {
+            std::lock_guard<std::mutex> lock(g_buffers_lock);
+            for (const auto& buffer : g_buffers) {
+                while (const Record* record = buffer->queue.front()) {
+                    pending.push_back({*record, buffer->thread});
+                    buffer->queue.pop();
+                }
+                const unsigned long n = buffer->dropped.exchange(0);
+                if (n)
+                    dropped.push_back({buffer->thread, n});
+            }
+        }
+        std::stable_sort(pending.begin(), pending.end(), [](const Pending& a, const Pending& b){
+            return a.record.time < b.record.time;
+        });
+
+        std::string out, err;
+        for (const Pending& p : pending) {
+            const std::string text(p.record.text);
+            const std::string key = p.thread + '\0' + text;
+            auto it = g_repeats.find(key);
+            if (it != g_repeats.end() && p.record.time - it->second.since < LOG_REPEAT_WINDOW_MS * 1000000LL) {
+                it->second.count++;
+                continue;
+            }
+            g_repeats[key] = {p.record.time, 0, p.record.level, p.thread};
+            line(p.record.level >= Log::LEVEL_WARN ? err : out, p.record.time, p.record.level, p.thread, text);
+        }
+
+        // close the windows that ran out
+        for (auto it = g_repeats.begin(); it != g_repeats.end(); ) {
+            if (now - it->second.since < LOG_REPEAT_WINDOW_MS * 1000000LL) {
+                it++;
+                continue;
+            }
+            const Repeat& r = it->second;
+            if (r.count)
+                line(r.level >= Log::LEVEL_WARN ? err : out, now, r.level, r.thread,
+                     it->first.substr(it->first.find('\0') + 1) +
+                     " (repeated " + std::to_string(r.count) + " times)");
+            it = g_repeats.erase(it);
+        }
+
+        for (const auto& d : dropped)
+            line(err, now, Log::LEVEL_WARN, d.first, std::to_string(d.second) + " log messages dropped");
+
+        if (!out.empty()) {
+            std::fwrite(out.data(), 1, out.size(), stdout);
+            std::fflush(stdout);
+        }
+        if (!err.empty()) {
+            std::fwrite(err.data(), 1, err.size(), stderr);
+            std::fflush(stderr);
+        }
+    }
+
+    int64_t realtime() {
+        struct timespec ts;
+        ::clock_gettime(CLOCK_REALTIME, &ts);
+        return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+}
+
+///
+/// Name the calling thread in the log and give it its queue now, so that
+/// logging from it never allocates
+///
+void Log::register_thread(const std::string& name) {
+    acquire(name);
+}
+
+///
+/// Queue a printf-style message (call through the LOG_* macros). Dropped
+/// (and counted) if the thread's queue is full.
+///
+void Log::write(const Level level, const char* format, ...) {
+    Buffer* buffer = t_buffer;
+    if (!buffer)
+        buffer = acquire("");
+
+    Record record;
+    record.time = realtime();
+    record.level = level;
+    va_list args;
+    va_start(args, format);
+    std::vsnprintf(record.text, sizeof record.text, format, args);
+    va_end(args);
+
+    if (!buffer->queue.push(record))
+        buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+///
+/// Start the flusher thread
+///
+void Log::start() {
+    std::lock_guard<std::mutex> lock(g_flusher_lock);
+    if (g_flushing)
+        return;
+    g_flushing = true;
+    g_flusher = std::thread([](){
+        std::unique_lock<std::mutex> lock(g_flusher_lock);
+        while (g_flushing) {
+            g_flusher_wake.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_MS));
+            lock.unlock();
+            flush(realtime());
+            lock.lock();
+        }
+    });
+}
+
+///
+/// Write out what is left and stop the flusher thread
+///
+void Log::stop() {
+    {
+        std::lock_guard<std::mutex> lock(g_flusher_lock);
+        if (!g_flushing)
+            return;
+        g_flushing = false;
+    }
+    g_flusher_wake.notify_one();
+    g_flusher.join();
+
+    // repeats still counting are written too
+    flush(realtime() + LOG_REPEAT_WINDOW_MS * 1000000LL);
+}
@@ -0,0 +1,49 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+// longest message kept (longer ones are truncated)
+#define LOG_MESSAGE_SIZE 240
+// messages a thread can have waiting for the flusher (more are dropped)
+#define LOG_RING_RECORDS 256
+// how often the flusher writes waiting messages out
+#define LOG_FLUSH_MS 20
+// identical messages within this time after one is written are only counted
+#define LOG_REPEAT_WINDOW_MS 1000
+
+///
+/// Asynchronous logger. Every thread formats its messages into fixed-size
+/// records on its own lock-free queue; a flusher thread writes them out
+/// in time order (warnings and errors to stderr, the rest to stdout) and
+/// folds repeats. Logging never locks, blocks or (once the thread has its
+/// queue) allocates, so it is safe from the jack threads: they get their
+/// queue from the thread init callback. Use the LOG_* macros.
+///
+class Log {
+    public:
+        enum Level { LEVEL_DEBUG, LEVEL_INFO, LEVEL_WARN, LEVEL_ERROR };
+
+        static std::atomic<int> level;  // messages below it are skipped
+
+        static void register_thread(const std::string& name);
+        static void write(const Level level, const char* format, ...)
+            __attribute__((format(printf, 2, 3)));
+
+        static void start();
+        static void stop();
+};
+
+#define LOG_AT(lvl, ...) do { \
+        if ((lvl) >= Log::level.load(std::memory_order_relaxed)) \
+            Log::write((lvl), __VA_ARGS__); \
+    } while (0)
+
+#define LOG_DEBUG(...) LOG_AT(Log::LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)  LOG_AT(Log::LEVEL_INFO,  __VA_ARGS__)
+#define LOG_WARN(...)  LOG_AT(Log::LEVEL_WARN,  __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(Log::LEVEL_ERROR, __VA_ARGS__)
+
+#endif
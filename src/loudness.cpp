@@ -0,0 +1,353 @@
+#include "loudness.h"
+#include "trace.h"
+#include "log.h"
+
+#include <algorithm>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <limits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/socket.h>
+
+namespace {
+    // shared by all meters: the registry and the analysis thread
+    std::mutex g_lock;
+    std::condition_variable g_wakeup;
+    std::vector<LoudnessMeter*> g_meters;
+
+    // held while a meter comes or goes (and the thread with it)
+    std::mutex g_thread_lock;
+    std::thread g_thread;
+
+    // ITU-R BS.1770-4 annex 2: 4x oversampling interpolation filter, by phase
+    const float TRUE_PEAK_TAPS[4][12] = {
+        { 0.0017089843750f,  0.0109863281250f, -0.0196533203125f,  0.0332031250000f,
+         -0.0594482421875f,  0.1373291015625f,  0.9721679687500f, -0.1022949218750f,
+          0.0476074218750f, -0.0266113281250f,  0.0148925781250f, -0.0083007812500f},
+        {-0.0291748046875f,  0.0292968750000f, -0.0517578125000f,  0.0891113281250f,
+         -0.1665039062500f,  0.4650878906250f,  0.7797851562500f, -0.2003173828125f,
+          0.1015625000000f, -0.0582275390625f,  0.0330810546875f, -0.0189208984375f},
+        {-0.0189208984375f,  0.0330810546875f, -0.0582275390625f,  0.1015625000000f,
+         -0.2003173828125f,  0.7797851562500f,  0.4650878906250f, -0.1665039062500f,
+          0.0891113281250f, -0.0517578125000f,  0.0292968750000f, -0.0291748046875f},
+        {-0.0083007812500f,  0.0148925781250f, -0.0266113281250f,  0.0476074218750f,
+         -0.1022949218750f,  0.9721679687500f,  0.1373291015625f, -0.0594482421875f,
+          0.0332031250000f, -0.0196533203125f,  0.0109863281250f,  0.0017089843750f},
+    };
+
+    const float SILENCE = -std::numeric_limits<float>::infinity();
+
+    // loudness of a mean square sum of the sides (channel weights are 1)
+    float lufs(const double energy) {
+        return energy > 0 ? -0.691 + 10 * std::log10(energy) : SILENCE;
+    }
+}
+
+///
+/// Constructor:
+///     @param sample_rate of the frames pushed
+///
+LoudnessMeter::LoudnessMeter(const jack_nframes_t sample_rate)
+    : m_sample_rate(sample_rate), m_dropped(0), m_reset(false),
+      m_weighted(LOUDNESS_CHUNK), m_interp(LOUDNESS_CHUNK), m_step(std::max<jack_nframes_t>(1, sample_rate / 10)) {
+    // K-weighting filters for this sample rate (BS.1770 prototypes)
+    double f0 = 1681.974450955533;
+    double q  = 0.7071752369554196;
+    double k  = std::tan(M_PI * f0 / sample_rate);
+    const double vh = std::pow(10.0, 3.999843853973347 / 20);
+    const double vb = std::pow(vh, 0.4996667741545416);
+    double a0 = 1 + k / q + k * k;
+    m_shelf.b[0] = (vh + vb * k / q + k * k) / a0;
+    m_shelf.b[1] = 2 * (k * k - vh) / a0;
+    m_shelf.b[2] = (vh - vb * k / q + k * k) / a0;
+    m_shelf.a[0] = 1;
+    m_shelf.a[1] = 2 * (k * k - 1) / a0;
+    m_shelf.a[2] = (1 - k / q + k * k) / a0;
+
+    f0 = 38.13547087602444;
+    q  = 0.5003270373238773;
+    k  = std::tan(M_PI * f0 / sample_rate);
+    a0 = 1 + k / q + k * k;
+    m_highpass.b[0] = 1;
+    m_highpass.b[1] = -2;
+    m_highpass.b[2] = 1;
+    m_highpass.a[0] = 1;
+    m_highpass.a[1] = 2 * (k * k - 1) / a0;
+    m_highpass.a[2] = (1 - k / q + k * k) / a0;
+
+    clear();
+    m_reading = {SILENCE, SILENCE, SILENCE, SILENCE, 0};
+
+    std::lock_guard<std::mutex> thread_lock(g_thread_lock);
+    std::lock_guard<std::mutex> lock(g_lock);
+    g_meters.push_back(this);
+    if (g_meters.size() == 1)
+        g_thread = std::thread(analysis_loop);
+}
+
+///
+/// Sample rate the meter was made for
+///
+const jack_nframes_t LoudnessMeter::sample_rate() const {
+    return m_sample_rate;
+}
+
+///
+/// Callback: queue `n` frames of the bus (dropped if the analysis fell
+/// behind)
+///
+void LoudnessMeter::push(const sample_t* left, const sample_t* right, jack_nframes_t n) {
+    Chunk chunk;
+    for (jack_nframes_t done=0; done<n; done+=chunk.n) {
+        chunk.n = std::min<jack_nframes_t>(n - done, LOUDNESS_CHUNK);
+        std::memcpy(chunk.frames[0], left  + done, sizeof(sample_t) * chunk.n);
+        std::memcpy(chunk.frames[1], right + done, sizeof(sample_t) * chunk.n);
+        if (!m_queue.push(chunk))
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+///
+/// Latest reading
+///
+const LoudnessMeter::Reading LoudnessMeter::reading() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    Reading reading = m_reading;
+    reading.dropped = m_dropped.load(std::memory_order_relaxed);
+    return reading;
+}
+
+///
+/// Start the integrated loudness and true peak over (from the next drain)
+///
+void LoudnessMeter::reset() {
+    m_reset = true;
+}
+
+///
+/// Send the next reading to `fd` (once, as `<bus>: <reading>`)
+///
+void LoudnessMeter::listen(const int fd, const std::string& bus) {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_listeners.push_back({fd, bus});
+}
+
+///
+/// Reading as `M <lufs> S <lufs> I <lufs> LUFS TP <dbtp> dBTP`
+///
+const std::string LoudnessMeter::format(const Reading& reading) {
+    auto value = [](const float v) {
+        if (std::isinf(v))
+            return std::string("-inf");
+        char buf[16];
+        std::snprintf(buf, sizeof buf, "%.1f", v);
+        return std::string(buf);
+    };
+    std::string out = "M " + value(reading.momentary) + " S " + value(reading.short_term) +
+                      " I " + value(reading.integrated) + " LUFS TP " + value(reading.true_peak) + " dBTP";
+    if (reading.dropped)
+        out += " (" + std::to_string(reading.dropped) + " blocks dropped)";
+    return out;
+}
+
+///
+/// Forget everything measured (analysis thread or constructor)
+///
+void LoudnessMeter::clear() {
+    for (auto& z : m_shelf.z)
+        z[0] = z[1] = 0;
+    for (auto& z : m_highpass.z)
+        z[0] = z[1] = 0;
+    m_step_pos = 0;
+    m_step_sum = 0;
+    m_step_count = 0;
+    std::fill(std::begin(m_steps), std::end(m_steps), 0);
+    std::fill(std::begin(m_bin_sum), std::end(m_bin_sum), 0);
+    std::fill(std::begin(m_bin_count), std::end(m_bin_count), 0);
+    for (auto& h : m_history)
+        std::fill(std::begin(h), std::end(h), 0);
+    m_peak = 0;
+}
+
+///
+/// Analysis thread: run frames [from, to) of one side through a filter
+///
+void LoudnessMeter::run(Biquad& f, const int side, const float* in, float* out,
+                        const jack_nframes_t from, const jack_nframes_t to) {
+    double* z = f.z[side];
+    for (jack_nframes_t i=from; i<to; i++) {
+        const double x = in[i];
+        const double y = f.b[0] * x + z[0];
+        z[0] = f.b[1] * x - f.a[1] * y + z[1];
+        z[1] = f.b[2] * x - f.a[2] * y;
+        out[i] = y;
+    }
+}
+
+///
+/// Analysis thread: K-weight a chunk into the current step and take its
+/// true peak. The filters are recursive and run frame by frame; the
+/// interpolation runs tap by tap over the whole chunk, in loops the
+/// compiler can vectorize.
+///
+void LoudnessMeter::analyze(const Chunk& chunk) {
+    const jack_nframes_t n = chunk.n;
+    float* weighted = m_weighted.data();
+
+    // (split at the step boundaries)
+    for (jack_nframes_t from=0; from<n; ) {
+        const jack_nframes_t to = std::min<jack_nframes_t>(n, from + m_step - m_step_pos);
+        for (int side=0; side<2; side++) {
+            run(m_shelf, side, chunk.frames[side], weighted, from, to);
+            run(m_highpass, side, weighted, weighted, from, to);
+            for (jack_nframes_t i=from; i<to; i++)
+                m_step_sum += weighted[i] * weighted[i];
+        }
+        m_step_pos += to - from;
+        from = to;
+        if (m_step_pos == m_step)
+            end_step();
+    }
+
+    // true peak: 4 phases of the interpolated signal (and the samples)
+    float* y = m_interp.data();
+    float peak = m_peak;
+    for (int side=0; side<2; side++) {
+        float* h = m_history[side];
+        std::memcpy(h + 11, chunk.frames[side], sizeof(float) * n);
+        for (int p=0; p<4; p++) {
+            std::fill(y, y + n, 0.f);
+            for (int t=0; t<12; t++) {
+                const float tap = TRUE_PEAK_TAPS[p][t];
+                for (jack_nframes_t i=0; i<n; i++)
+                    y[i] += tap * h[i + t];
+            }
+            for (jack_nframes_t i=0; i<n; i++)
+                peak = std::max(peak, std::fabs(y[i]));
+        }
+        for (jack_nframes_t i=0; i<n; i++)
+            peak = std::max(peak, std::fabs(h[i + 11]));
+        std::memmove(h, h + n, sizeof(float) * 11);
+    }
+    m_peak = peak;
+}
+
+///
+/// Analysis thread: close a 100 ms step, gate the 400 ms block ending
+/// with it and publish a reading
+///
+void LoudnessMeter::end_step() {
+    const size_t window = sizeof m_steps / sizeof m_steps[0];
+    m_steps[m_step_count % window] = m_step_sum / m_step;
+    m_step_count++;
+    m_step_pos = 0;
+    m_step_sum = 0;
+
+    auto mean = [&](const size_t steps) {
+        const size_t count = std::min<size_t>(steps, m_step_count);
+        double energy = 0;
+        for (size_t s=0; s<count; s++)
+            energy += m_steps[(m_step_count - 1 - s) % window];
+        return energy / steps;
+    };
+    const double block = mean(4);
+
+    // gating blocks overlap by 75%: one per step once 400 ms are in
+    const float loudness = lufs(block);
+    if (m_step_count >= 4 && loudness >= -70) {
+        const size_t bin = std::min<size_t>(LOUDNESS_HISTOGRAM_BINS - 1, (loudness + 70) * 10);
+        m_bin_sum[bin] += block;
+        m_bin_count[bin]++;
+    }
+
+    Reading reading = {loudness, lufs(mean(window)), integrated(),
+                       m_peak > 0 ? 20 * std::log10(m_peak) : SILENCE,
+                       m_dropped.load(std::memory_order_relaxed)};
+    std::vector<std::pair<int, std::string>> listeners;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_reading = reading;
+        listeners.swap(m_listeners);
+    }
+    for (const auto& l : listeners) {
+        const std::string noti = l.second + ": " + format(reading);
+        ::send(l.first, noti.c_str(), noti.length(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+}
+
+///
+/// Integrated loudness: mean of the blocks above the absolute gate, then
+/// of those within 10 LU of it (relative gate)
+///
+const float LoudnessMeter::integrated() const {
+    double energy = 0;
+    unsigned long count = 0;
+    for (size_t b=0; b<LOUDNESS_HISTOGRAM_BINS; b++) {
+        energy += m_bin_sum[b];
+        count  += m_bin_count[b];
+    }
+    if (!count)
+        return SILENCE;
+
+    const float gate = lufs(energy / count) - 10;
+    const size_t first = gate <= -70 ? 0 : std::min<size_t>(LOUDNESS_HISTOGRAM_BINS, (gate + 70) * 10);
+    energy = 0;
+    count = 0;
+    for (size_t b=first; b<LOUDNESS_HISTOGRAM_BINS; b++) {
+        energy += m_bin_sum[b];
+        count  += m_bin_count[b];
+    }
+    return count ? lufs(energy / count) : SILENCE;
+}
+
+///
+/// Analysis thread: analyze everything queued
+///
+void LoudnessMeter::drain() {
+    if (m_reset.exchange(false))
+        clear();
+    for (const Chunk* chunk = m_queue.front(); chunk; chunk = m_queue.front()) {
+        analyze(*chunk);
+        m_queue.pop();
+    }
+}
+
+///
+/// Analysis thread: drain every meter each LOUDNESS_POLL_MS (the callbacks
+/// never wake it) until none is left
+///
+void LoudnessMeter::analysis_loop() {
+    Trace::register_thread("loudness");
+    Log::register_thread("loudness");
+    std::unique_lock<std::mutex> lock(g_lock);
+    while (!g_meters.empty()) {
+        {
+            TRACE_SCOPE("analyze loudness", "meters", g_meters.size());
+            for (LoudnessMeter* meter : g_meters)
+                meter->drain();
+        }
+        g_wakeup.wait_for(lock, std::chrono::milliseconds(LOUDNESS_POLL_MS),
+                          [](){ return g_meters.empty(); });
+    }
+}
+
+///
+/// Destructor: leave the analysis thread (stopped with the last meter)
+///
+LoudnessMeter::~LoudnessMeter() {
+    std::lock_guard<std::mutex> thread_lock(g_thread_lock);
+    bool last;
+    {
+        std::lock_guard<std::mutex> lock(g_lock);
+        g_meters.erase(std::find(g_meters.begin(), g_meters.end(), this));
+        last = g_meters.empty();
+    }
+    if (last) {
+        g_wakeup.notify_all();
+        g_thread.join();
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+
+#include <jack/jack.h>
+#include "processor.h"
+#include "spsc_queue.h"
+
+// buses with this tag get a loudness meter
+#define LOUDNESS_TAG "loudness"
+// frames per block handed from the callback to the analysis thread...
+#define LOUDNESS_CHUNK 256
+// ...and blocks a meter can have waiting (dropped past that)
+#define LOUDNESS_QUEUE_CHUNKS 512
+// how often the analysis thread drains the meters
+#define LOUDNESS_POLL_MS 20
+
+// integrated loudness histogram: gating blocks by loudness, 0.1 LU wide
+// from the absolute gate (-70 LUFS) up
+#define LOUDNESS_HISTOGRAM_BINS 1000
+
+///
+/// EBU R128 / ITU-R BS.1770-4 loudness meter of a stereo bus. The jack
+/// callback only copies the bus into a lock-free queue (`push`); one
+/// background analysis thread, shared by all meters, runs the K-weighting,
+/// the gating and the 4x oversampled true peak, and publishes a reading
+/// every 100 ms (the momentary and short-term window step).
+///
+class LoudnessMeter {
+    public:
+        struct Reading {
+            float momentary;        // LUFS, last 400 ms
+            float short_term;       // LUFS, last 3 s
+            float integrated;       // LUFS, gated, since the last reset
+            float true_peak;        // dBTP, since the last reset
+            unsigned long dropped;  // blocks the analysis fell behind on
+        };
+
+    private:
+        struct Chunk {
+            jack_nframes_t n;
+            sample_t frames[2][LOUDNESS_CHUNK];
+        };
+
+        ///
+        /// Second order section (transposed direct form II)
+        ///
+        struct Biquad {
+            double b[3];
+            double a[3];
+            double z[2][2] = {{0, 0}, {0, 0}};  // per side
+        };
+
+        const jack_nframes_t m_sample_rate;
+
+        SpscQueue<Chunk, LOUDNESS_QUEUE_CHUNKS> m_queue;
+        std::atomic<unsigned long> m_dropped;
+        std::atomic<bool> m_reset;
+
+        // === analysis thread only ===
+        Biquad m_shelf;             // K-weighting: high shelf...
+        Biquad m_highpass;          // ...then high pass
+        std::vector<float> m_weighted;  // scratch (one side of a chunk)
+        std::vector<float> m_interp;    // ...and one phase of its true peak
+
+        jack_nframes_t m_step;      // frames per 100 ms
+        jack_nframes_t m_step_pos = 0;
+        double m_step_sum = 0;      // weighted squares of both sides so far
+        double m_steps[30];         // mean square of the last steps (3 s)
+        unsigned long m_step_count = 0;
+
+        double m_bin_sum[LOUDNESS_HISTOGRAM_BINS];
+        unsigned long m_bin_count[LOUDNESS_HISTOGRAM_BINS];
+
+        float m_history[2][11 + LOUDNESS_CHUNK];  // true peak filter input
+        float m_peak = 0;
+
+        // === readers ===
+        std::mutex m_lock;
+        Reading m_reading;
+        std::vector<std::pair<int, std::string>> m_listeners;  // fd, bus
+
+        void clear();
+        static void run(Biquad& f, const int side, const float* in, float* out,
+                        const jack_nframes_t from, const jack_nframes_t to);
+        void analyze(const Chunk& chunk);
+        void end_step();
+        const float integrated() const;
+        void drain();
+        static void analysis_loop();
+
+    public:
+        explicit LoudnessMeter(const jack_nframes_t sample_rate);
+        ~LoudnessMeter();
+
+        const jack_nframes_t sample_rate() const;
+
+        void push(const sample_t* left, const sample_t* right, jack_nframes_t n);
+
+        const Reading reading();
+        void reset();
+        void listen(const int fd, const std::string& bus);
+
+        static const std::string format(const Reading& reading);
+};
+
+#endif
@@ -2,6 +2,11 @@
 #include "package_config.h"
 #include "commands.h"
 #include "server.h"
+#include "config_watcher.h"
+#include "metrics_server.h"
+#include "trace.h"
+#include "log.h"
+#include "shutdown.h"
 
 #include <iostream>
 #include <vector>
@@ -10,7 +15,10 @@
 #include <thread>
 #include <chrono>
 
-#include <csignal>
+#include <cerrno>
+
+#include <poll.h>
+#include <unistd.h>
 
 #ifdef WITH_READLINE
 #include <readline/readline.h>
@@ -19,50 +27,120 @@
 #include <sys/select.h>
 #include <sys/time.h>
 #include <sys/types.h>
-#include <unistd.h>
 #endif
 
-bool g_interrupt = false;
-Server* g_server;
+///
+/// Print the command line options
+///
+static void usage(const char* argv0) {
+    std::cerr << "Usage: " << argv0 << " [-i <name>=<config>]... [-p <port>]\n"
+                 "  -i  host a mixer instance: its jack client name and config file\n"
+                 "      (repeatable, the first one takes commands by default;\n"
+                 "      default: " JACK_CLIENT_NAME "=" CONFIG_PATH ")\n"
+                 "  -p  command port (default: " PORT ")" << std::endl;
+}
 
 ///
 /// Main function
 ///
 int main(int argc, char* argv[]) {
-    Backend backend(JACK_CLIENT_NAME);
+    std::vector<std::pair<std::string, std::string>> definitions;
+    std::string port = PORT;
+    for (int opt; (opt = ::getopt(argc, argv, "i:p:h")) != -1; ) {
+        const std::string arg = optarg ? optarg : "";
+        const size_t eq = arg.find('=');
+        if (opt == 'i' && eq != std::string::npos && eq > 0 && eq+1 < arg.size()) {
+            definitions.push_back({arg.substr(0, eq), arg.substr(eq+1)});
+        } else if (opt == 'p' && !arg.empty()) {
+            port = arg;
+        } else {
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind < argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (definitions.empty())
+        definitions.push_back({JACK_CLIENT_NAME, CONFIG_PATH});
+
+    // SIGINT and SIGTERM are taken by Shutdown::wait (blocked in every thread)
+    Shutdown::block_signals();
+
+    // Messages are written out by the log thread from here on
+    Log::start();
+    Log::register_thread("main");
+
+    Instances instances;
+    try {
+        for (const auto& d : definitions)
+            instances.add(d.first, d.second);
+    } catch (Instances::InstanceException& e) {
+        LOG_ERROR("%s", e.what());
+        Log::stop();
+        return 1;
+    }
+    const std::vector<Backend*> backends = instances.all();
 
-    // Handle interrupt signal
-    /* auto int_handler = [&](){ */
-    /*     while (!g_interrupt) { */
-    /*         std::this_thread::sleep_for(std::chrono::seconds(1)); */
-    /*     } */
-    /*     std::cout << "Stopping..." << std::endl; */
-    /*     backend.stop_recon_loop(); */
-    /*     backend.shutdown(); */
-    /*     exit(0); */
-    /* }; */
+    ConfigWatcher watcher;
+    for (Backend* backend : backends) {
+        // Start jack reconnection loop
+        backend->start_recon_loop();
 
-    /* std::signal(SIGINT, [](int s){ g_interrupt = true; }); */
-    /* std::thread int_handler_thread(int_handler); */
+        // Start timed commands thread
+        backend->start_scheduler();
 
-    // Start jack reconnection loop
-    backend.start_recon_loop();
+        // Store what the MIDI surface changes
+        backend->start_midi();
+
+        // Pick up edits made to the config file while running
+        watcher.add(backend->settings.filename(), [backend](){ backend->reload_config(); });
+    }
+    watcher.start();
+
+#ifdef WITH_METRICS
+    // Serve engine and control plane metrics
+    MetricsServer metrics([&](MetricsWriter& writer){
+            for (Backend* backend : backends)
+                backend->metrics(writer);
+            Metrics::collect(writer);
+        });
+    metrics.start();
+#endif
 
     // Start socket listener
-    Server server(&backend);
+    Server server(&instances, port);
     server.start();
-    g_server = &server;
 
     // Start cmd loop (runs until `stop` command)
-    std::thread cmd_thread(cmd_loop, &backend, &server);
+    std::thread cmd_thread(cmd_loop, &instances);
 
-    server.m_listener_thread.join();
+    // Run until a `stop` command or a signal
+    LOG_INFO("Stopping (%s)...", Shutdown::wait().c_str());
 
-    std::cout << "Stopping..." << std::endl;
-    /* server.stop(); */
+    // No more changes: commands, timed commands, MIDI and reloads
+    server.stop();
     cmd_thread.join();
-    backend.stop_recon_loop();
-    backend.shutdown();
+    for (Backend* backend : backends) {
+        backend->stop_scheduler();
+        backend->stop_midi();
+    }
+    watcher.stop();
+
+    // Make them durable before telling the clients we're gone
+    for (Backend* backend : backends)
+        backend->settings.flush();
+    server.disconnect_all("stopping...");
+
+#ifdef WITH_METRICS
+    metrics.stop();
+#endif
+    for (Backend* backend : backends) {
+        backend->stop_recon_loop();
+        backend->shutdown();
+    }
+    Log::stop();
 
     return 0;
 }
@@ -71,16 +149,22 @@ int main(int argc, char* argv[]) {
 ///
 /// Command loop
 ///
-void cmd_loop(Backend* backend, Server* server) {
-    CommandHandler command_handler(backend);
+void cmd_loop(Instances* instances) {
+    Trace::register_thread("cmd loop");
+    Log::register_thread("cmd loop");
+    CommandHandler command_handler(instances);
 
 
 
 #ifdef WITH_READLINE
     char * c_cmd_line = (char *)NULL;
-    rl_event_hook = []()->int{
-        if (g_server->stopped) rl_done = true;
-        return 0;
+    // wait for input or a shutdown request (read as end of input)
+    rl_getc_function = [](FILE* in)->int{
+        struct ::pollfd pfds[2] = {{::fileno(in), POLLIN, 0}, {Shutdown::fd(), POLLIN, 0}};
+        while (::poll(pfds, 2, -1) < 0 && errno == EINTR) { }
+        if (pfds[1].revents)
+            return EOF;
+        return rl_getc(in);
     };
 #endif
 
@@ -89,31 +173,41 @@ void cmd_loop(Backend* backend, Server* server) {
 #ifndef WITH_READLINE
         ::fd_set rfds;
         int fd = 0;
+        const int shutdown_fd = Shutdown::fd();
 
         std::cout << "[" PACKAGE_STRING "] >>> " << std::flush;
         int retval;
         do {
             FD_ZERO(&rfds);
             FD_SET(fd, &rfds);
-            struct ::timeval timeout { .tv_sec=1, .tv_usec=0 };
-            retval = ::select(fd + 1, &rfds, NULL, NULL, &timeout);
-
-            if (server->stopped) break;
-        } while (retval == 0);
+            FD_SET(shutdown_fd, &rfds);
+            retval = ::select(shutdown_fd + 1, &rfds, NULL, NULL, NULL);
+        } while (retval == -1 && errno == EINTR);
         if (retval == -1) std::perror("select()");
 
-        if (!server->stopped) {
-            std::getline(std::cin, cmd_line);
+        if (Shutdown::requested())
+            break;
+        if (!std::getline(std::cin, cmd_line)) {
+            // no terminal: keep serving the socket
+            LOG_INFO("stdin closed, command line disabled");
+            return;
         }
 #endif
         if (cmd_line == "stop" || cmd_line == "quit")
             break;
 
-        if (server->stopped)
+        if (Shutdown::requested())
             break;
         if (cmd_line != "") {
+            TRACE_EVENT("receive");
             try {
-                std::cout << command_handler.run(cmd_line) << std::endl;
+                std::string response;
+                {
+                    TRACE_SCOPE("dispatch");
+                    response = command_handler.run(cmd_line);
+                }
+                TRACE_SCOPE("reply");
+                std::cout << response << std::endl;
             } catch (CommandHandler::CommandHandlerException& e) {
                 std::cout << e.what() << std::endl;
             } catch (Settings::SettingsException& e) {
@@ -147,9 +241,7 @@ void cmd_loop(Backend* backend, Server* server) {
     clear_history();
 #endif
 
-    if (!server->stopped) {
-        server->stop();
-    }
+    Shutdown::request("stop command");
 #undef GET_NEXT_COMMAND_LINE
 }
 
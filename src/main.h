@@ -1,13 +1,13 @@
 #ifndef MAIN_H
 #define MAIN_H
 
-#include "backend.h"
+#include "instances.h"
 #include "server.h"
 #include <string>
 #include <map>
 
 int main(int argc, char** argv);
 
-void cmd_loop(Backend* backend, Server* server);
+void cmd_loop(Instances* instances);
 
 #endif
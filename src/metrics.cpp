@@ -0,0 +1,209 @@
+#include "metrics.h"
+
+#include <sstream>
+#include <iomanip>
+#include <mutex>
+#include <set>
+
+namespace {
+    ///
+    /// Samples of one thread, registered for as long as the thread lives
+    ///
+    struct ThreadMetrics {
+        std::mutex lock;    // owner thread and scrapes
+        Metrics::Samples samples;
+
+        ThreadMetrics();
+        ~ThreadMetrics();
+    };
+
+    std::mutex g_registry_lock;
+    std::set<ThreadMetrics*> g_threads;
+    Metrics::Samples g_retired;     // of the threads that exited
+
+    void merge(Metrics::Samples& into, const Metrics::Samples& samples, const bool gauges) {
+        for (const auto& p : samples) {
+            if (p.second.type == Metrics::GAUGE && !gauges)
+                continue;
+            auto it = into.find(p.first);
+            if (it == into.end()) {
+                into.insert(p);
+                continue;
+            }
+            it->second.value += p.second.value;
+            it->second.sum   += p.second.sum;
+        }
+    }
+
+#ifdef WITH_METRICS
+    // (nothing counts without --enable-metrics)
+    ThreadMetrics::ThreadMetrics() {
+        std::lock_guard<std::mutex> lock(g_registry_lock);
+        g_threads.insert(this);
+    }
+
+    ThreadMetrics::~ThreadMetrics() {
+        std::lock_guard<std::mutex> lock(g_registry_lock);
+        merge(g_retired, samples, false);
+        g_threads.erase(this);
+    }
+
+    ThreadMetrics& local() {
+        thread_local ThreadMetrics metrics;
+        return metrics;
+    }
+#endif
+
+    const std::string number(const double value) {
+        std::ostringstream os;
+        os << std::setprecision(12) << value;
+        return os.str();
+    }
+}
+
+
+//
+// === Writer ===
+//
+
+///
+/// Label set text (`{name="value",...}`, empty without labels)
+///
+const std::string MetricsWriter::labels(const std::vector<std::pair<std::string, std::string>>& labels) {
+    if (labels.empty())
+        return "";
+
+    std::string os = "{";
+    for (size_t i=0; i<labels.size(); i++) {
+        if (i)
+            os += ',';
+        os += labels[i].first + "=\"";
+        for (char c : labels[i].second) {
+            if (c == '\\' || c == '"')
+                os += '\\';
+            if (c == '\n')
+                os += "\\n";
+            else
+                os += c;
+        }
+        os += '"';
+    }
+    return os + "}";
+}
+
+///
+/// Add a sample of `family` (`suffix` is appended to the family name:
+/// `_total`, `_bucket`, ...)
+///
+void MetricsWriter::sample(const std::string& family, const std::string& type, const std::string& suffix,
+                           const std::string& labels, const double value) {
+    auto it = m_families.find(family);
+    if (it == m_families.end()) {
+        m_order.push_back(family);
+        it = m_families.insert({family, {type, {}}}).first;
+    }
+    it->second.samples.push_back(family + suffix + labels + " " + number(value));
+}
+
+void MetricsWriter::counter(const std::string& family, const std::string& labels, const double value) {
+    sample(family, "counter", "_total", labels, value);
+}
+
+void MetricsWriter::gauge(const std::string& family, const std::string& labels, const double value) {
+    sample(family, "gauge", "", labels, value);
+}
+
+///
+/// Exposition text, `# EOF` included
+///
+const std::string MetricsWriter::str() const {
+    std::string os;
+    for (const std::string& name : m_order) {
+        const Family& family = m_families.at(name);
+        os += "# TYPE " + name + " " + family.type + "\n";
+        for (const std::string& sample : family.samples)
+            os += sample + "\n";
+    }
+    return os + "# EOF\n";
+}
+
+
+//
+// === Per thread samples ===
+//
+
+///
+/// Add `value` to a counter of the calling thread
+///
+void Metrics::count(const std::string& family, const std::string& labels, const double value) {
+#ifdef WITH_METRICS
+    ThreadMetrics& metrics = local();
+    std::lock_guard<std::mutex> lock(metrics.lock);
+    Sample& sample = metrics.samples.insert({{family, labels}, {COUNTER, 0, 0}}).first->second;
+    sample.value += value;
+#else
+    (void) family; (void) labels; (void) value;
+#endif
+}
+
+///
+/// Set a gauge of the calling thread (gauges of several threads add up)
+///
+void Metrics::set(const std::string& family, const std::string& labels, const double value) {
+#ifdef WITH_METRICS
+    ThreadMetrics& metrics = local();
+    std::lock_guard<std::mutex> lock(metrics.lock);
+    Sample& sample = metrics.samples.insert({{family, labels}, {GAUGE, 0, 0}}).first->second;
+    sample.value = value;
+#else
+    (void) family; (void) labels; (void) value;
+#endif
+}
+
+///
+/// Add an observation (a duration in seconds, a size...) to a summary of
+/// the calling thread
+///
+void Metrics::observe(const std::string& family, const std::string& labels, const double value) {
+#ifdef WITH_METRICS
+    ThreadMetrics& metrics = local();
+    std::lock_guard<std::mutex> lock(metrics.lock);
+    Sample& sample = metrics.samples.insert({{family, labels}, {SUMMARY, 0, 0}}).first->second;
+    sample.value += 1;
+    sample.sum   += value;
+#else
+    (void) family; (void) labels; (void) value;
+#endif
+}
+
+///
+/// Merge the samples of every thread into `writer`
+///
+void Metrics::collect(MetricsWriter& writer) {
+    Samples samples;
+    {
+        std::lock_guard<std::mutex> lock(g_registry_lock);
+        samples = g_retired;
+        for (ThreadMetrics* metrics : g_threads) {
+            std::lock_guard<std::mutex> thread_lock(metrics->lock);
+            merge(samples, metrics->samples, true);
+        }
+    }
+
+    for (const auto& p : samples) {
+        const std::string& family = p.first.first;
+        const std::string& labels = p.first.second;
+        switch (p.second.type) {
+            case COUNTER:
+                writer.counter(family, labels, p.second.value);
+                break;
+            case GAUGE:
+                writer.gauge(family, labels, p.second.value);
+                break;
+            case SUMMARY:
+                writer.sample(family, "summary", "_count", labels, p.second.value);
+                writer.sample(family, "summary", "_sum", labels, p.second.sum);
+                break;
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <utility>
+
+// upper bounds of the callback duration histogram buckets (+Inf is implied)
+#define CALLBACK_BUCKETS 9
+static const unsigned int CALLBACK_BUCKETS_US[CALLBACK_BUCKETS] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000
+};
+
+// release time of the output peak meters
+#define PEAK_DECAY_MS 300
+
+///
+/// OpenMetrics text exposition: samples are grouped by family (in the
+/// order families are first seen) and written out by `str`
+///
+class MetricsWriter {
+    private:
+        struct Family {
+            std::string type;
+            std::vector<std::string> samples;
+        };
+
+        std::vector<std::string> m_order;
+        std::map<std::string, Family> m_families;
+
+    public:
+        static const std::string labels(const std::vector<std::pair<std::string, std::string>>& labels);
+
+        void sample(const std::string& family, const std::string& type, const std::string& suffix,
+                    const std::string& labels, const double value);
+        void counter(const std::string& family, const std::string& labels, const double value);
+        void gauge(const std::string& family, const std::string& labels, const double value);
+
+        const std::string str() const;
+};
+
+///
+/// Control plane metrics. Every thread counts into its own set of
+/// samples (under a lock only a scrape can contend for); the sets are
+/// merged when scraped. Counters and summaries of threads that exited
+/// are kept, their gauges are dropped. Not for the jack callbacks: the
+/// engine keeps its own atomics (see `Backend::metrics`). Without
+/// --enable-metrics, counting does nothing.
+///
+class Metrics {
+    public:
+        enum Type { COUNTER, GAUGE, SUMMARY };
+
+        struct Sample {
+            Type type;
+            double value;   // summaries: count
+            double sum;
+        };
+
+        // by family and labels
+        typedef std::map<std::pair<std::string, std::string>, Sample> Samples;
+
+        static void count(const std::string& family, const std::string& labels="", const double value=1);
+        static void set(const std::string& family, const std::string& labels, const double value);
+        static void observe(const std::string& family, const std::string& labels, const double value);
+
+        static void collect(MetricsWriter& writer);
+};
+
+#endif
@@ -0,0 +1,171 @@
+#include "metrics_server.h"
+#include "log.h"
+#include "shutdown.h"
+
+#include <cstring>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+
+///
+/// Constructor:
+///     @param collect fills the writer on every scrape (from the server thread)
+///
+MetricsServer::MetricsServer(std::function<void(MetricsWriter&)> collect)
+    : m_collect(collect), m_serve(false) { }
+
+///
+/// Bind the endpoints and start serving
+///
+void MetricsServer::start() {
+    if (std::strlen(METRICS_PORT)) {
+        struct ::addrinfo hints, *ai;
+        std::memset(&hints, 0, sizeof hints);
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        int s = ::getaddrinfo("127.0.0.1", METRICS_PORT, &hints, &ai);
+        if (s != 0) {
+            LOG_ERROR("Metrics endpoint: %s", gai_strerror(s));
+        } else {
+            int fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            int yes = 1;
+            if (fd >= 0)
+                ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
+            if (fd >= 0 && ::bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && ::listen(fd, 4) == 0) {
+                m_fds.push_back(fd);
+            } else {
+                LOG_ERROR("Could not serve metrics on port " METRICS_PORT ": %s", std::strerror(errno));
+                if (fd >= 0)
+                    ::close(fd);
+            }
+            ::freeaddrinfo(ai);
+        }
+    }
+
+    if (std::strlen(METRICS_SOCKET)) {
+        struct ::sockaddr_un addr;
+        std::memset(&addr, 0, sizeof addr);
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, METRICS_SOCKET, sizeof addr.sun_path - 1);
+        ::unlink(METRICS_SOCKET);
+
+        int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && ::bind(fd, (struct sockaddr*) &addr, sizeof addr) == 0 && ::listen(fd, 4) == 0) {
+            m_fds.push_back(fd);
+        } else {
+            LOG_ERROR("Could not serve metrics on `" METRICS_SOCKET "`: %s", std::strerror(errno));
+            if (fd >= 0)
+                ::close(fd);
+        }
+    }
+
+    if (m_fds.empty())
+        return;
+    m_serve = true;
+    m_thread = std::thread([this](){ serve_loop(); });
+}
+
+///
+/// Stop serving and close the endpoints
+///
+void MetricsServer::stop() {
+    if (m_serve) {
+        m_serve = false;
+        m_thread.join();
+    }
+    for (int fd : m_fds)
+        ::close(fd);
+    if (!m_fds.empty() && std::strlen(METRICS_SOCKET))
+        ::unlink(METRICS_SOCKET);
+    m_fds.clear();
+}
+
+///
+/// Server thread: accept connections until stopped
+///
+void MetricsServer::serve_loop() {
+    std::vector<struct ::pollfd> pfds;
+    for (int fd : m_fds)
+        pfds.push_back({fd, POLLIN, 0});
+    pfds.push_back({Shutdown::fd(), POLLIN, 0});
+
+    while (m_serve) {
+        int s = ::poll(pfds.data(), pfds.size(), 500);
+        if (s <= 0)
+            continue;
+        if (pfds.back().revents)
+            break;
+
+        for (const struct ::pollfd& pfd : pfds) {
+            if (!(pfd.revents & POLLIN))
+                continue;
+            int fd = ::accept(pfd.fd, NULL, NULL);
+            if (fd < 0)
+                continue;
+            serve(fd);
+            ::close(fd);
+        }
+    }
+}
+
+///
+/// Read one request from `fd` and answer it
+///
+void MetricsServer::serve(const int fd) {
+    // don't let a silent client hold the thread
+    struct timeval timeout { .tv_sec = 1, .tv_usec = 0 };
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+    std::string request;
+    char buf[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+        ssize_t n = ::recv(fd, buf, sizeof buf, 0);
+        if (n <= 0)
+            break;
+        request.append(buf, n);
+    }
+
+    const std::string line = request.substr(0, request.find("\r\n"));
+    std::string status = "200 OK";
+    std::string type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+    std::string body;
+    if (line.compare(0, 13, "GET /metrics ") == 0 || line == "GET /metrics") {
+        MetricsWriter writer;
+        m_collect(writer);
+        body = writer.str();
+    } else if (line.compare(0, 4, "GET ") == 0) {
+        status = "404 Not Found";
+        type = "text/plain";
+        body = "Not found (try /metrics)\n";
+    } else {
+        status = "405 Method Not Allowed";
+        type = "text/plain";
+        body = "Only GET is supported\n";
+    }
+
+    const std::string response = "HTTP/1.0 " + status + "\r\n"
+        "Content-Type: " + type + "\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "Connection: close\r\n\r\n" + body;
+
+    size_t off = 0;
+    while (off < response.size()) {
+        ssize_t n = ::send(fd, response.data() + off, response.size() - off, MSG_NOSIGNAL);
+        if (n <= 0)
+            break;
+        off += n;
+    }
+}
+
+///
+/// Destructor
+///
+MetricsServer::~MetricsServer() {
+    stop();
+}
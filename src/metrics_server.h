@@ -0,0 +1,41 @@
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <atomic>
+
+#include "metrics.h"
+
+// loopback TCP port of the metrics endpoint ("" for none)
+#define METRICS_PORT "9909"
+// unix socket path of the metrics endpoint ("" for none)
+#define METRICS_SOCKET ""
+
+///
+/// Minimal HTTP endpoint answering `GET /metrics` with the OpenMetrics
+/// text built by `collect`. Only listens on the loopback interface
+/// and/or a unix socket; requests are served one at a time.
+///
+class MetricsServer {
+    private:
+        std::function<void(MetricsWriter&)> m_collect;
+
+        std::vector<int> m_fds;
+        std::atomic<bool> m_serve;
+        std::thread m_thread;
+
+        void serve_loop();
+        void serve(const int fd);
+
+    public:
+        explicit MetricsServer(std::function<void(MetricsWriter&)> collect);
+        ~MetricsServer();
+
+        void start();
+        void stop();
+};
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef MIDI_H
+#define MIDI_H
+
+#include <string>
+#include <cstdlib>
+
+// jack MIDI ports of the main client
+#define MIDI_IN_PORT  "MIDI in"
+#define MIDI_OUT_PORT "MIDI out"
+
+// how often the volumes moved from MIDI are stored in the settings
+#define MIDI_SYNC_MS 100
+// feedback to the control surface goes out at most this often
+#define MIDI_FEEDBACK_MS 20
+// volume moves and mutes from the surface ramp over this long (no zipper noise)
+#define MIDI_SMOOTH_MS 5
+
+///
+/// A control of a MIDI surface: a controller, an NRPN parameter or a
+/// note, on one MIDI channel (1-16, 0: any). Written "cc:1:7",
+/// "nrpn:1:1024" or "note:0:60".
+///
+struct MidiControl {
+    enum Type { CC, NRPN, NOTE };
+
+    Type type = CC;
+    unsigned int channel = 0;
+    unsigned int number = 0;
+
+    ///
+    /// Read a control from its written form (false if malformed)
+    ///
+    static const bool parse(const std::string& spec, MidiControl& control) {
+        const size_t a = spec.find(':');
+        const size_t b = a == std::string::npos ? a : spec.find(':', a + 1);
+        if (b == std::string::npos)
+            return false;
+        const std::string type = spec.substr(0, a);
+        if (type == "cc")
+            control.type = CC;
+        else if (type == "nrpn")
+            control.type = NRPN;
+        else if (type == "note")
+            control.type = NOTE;
+        else
+            return false;
+
+        char* end;
+        const std::string channel = spec.substr(a + 1, b - a - 1);
+        const std::string number = spec.substr(b + 1);
+        control.channel = std::strtoul(channel.c_str(), &end, 10);
+        if (channel.empty() || *end || control.channel > 16)
+            return false;
+        control.number = std::strtoul(number.c_str(), &end, 10);
+        if (number.empty() || *end || control.number > (control.type == NRPN ? 16383u : 127u))
+            return false;
+        return true;
+    }
+
+    const std::string name() const {
+        static const char* types[] = {"cc", "nrpn", "note"};
+        return std::string(types[type]) + ":" + std::to_string(channel) + ":" + std::to_string(number);
+    }
+};
+
+///
+/// Stored form of a MIDI mapping (keyed by the written control): the
+/// control sets the volume of the `target` input or output between `min`
+/// and `max`, or mutes it (a note toggles, a controller mutes from half
+/// way up). Mutes are live state of the engine, they are not stored.
+///
+struct MidiMapping {
+    std::string target;
+    bool input = true;
+    bool mute  = false;
+    float min  = 0;
+    float max  = 1;
+};
+
+#endif
@@ -0,0 +1,310 @@
+#ifndef MIX_H
+#define MIX_H
+
+#include <vector>
+#include <memory>
+#include <atomic>
+
+#include <jack/jack.h>
+#include "processor.h"
+#include "loudness.h"
+#include "midi.h"
+
+///
+/// Level of a ducking key input (main client's callback only, once per
+/// period)
+///
+struct Envelope {
+    float level = 0;
+};
+
+///
+/// Gain of a ducking rule over the current period, ramping from `from`
+/// to `to`. Written by the main client's callback, read by every shard.
+///
+struct DuckGain {
+    std::atomic<float> from;
+    std::atomic<float> to;
+    float gain = 1;     // smoothed gain (main client's callback only)
+
+    DuckGain() : from(1), to(1) { }
+};
+
+///
+/// A move of a fader as heard: from `from` to `to` over `length` frames,
+/// starting at frame time `start`
+///
+struct FaderRamp {
+    float from;
+    float to;
+    jack_nframes_t start;
+    jack_nframes_t length;
+
+    FaderRamp() : from(1), to(1), start(0), length(0) { }
+    FaderRamp(const float from, const float to, const jack_nframes_t start, const jack_nframes_t length)
+        : from(from), to(to), start(start), length(length) { }
+
+    float at(const jack_nframes_t frame) const {
+        const int32_t pos = (int32_t)(frame - start);
+        if (pos >= (int32_t) length)
+            return to;
+        return pos <= 0 ? from : from + (to - from) * pos / length;
+    }
+
+    bool done(const jack_nframes_t frame) const { return (int32_t)(frame - start) >= (int32_t) length; }
+};
+
+///
+/// Live volume and mute of a channel mapped to MIDI controls. The main
+/// client's callback moves them at the frame of each MIDI event and every
+/// shard reads them. A volume move overrides the gain compiled into the
+/// mix until the settings caught up with it (`settled`). What the
+/// callbacks hear ramps to each move over MIDI_SMOOTH_MS from that frame
+/// on, mutes included.
+///
+struct Fader {
+    struct Ramps {
+        FaderRamp volume;
+        FaderRamp mute;     // 1 -> 0 to mute
+    };
+
+    std::atomic<float> gain;
+    std::atomic<unsigned long> moves;     // volume moves from MIDI so far
+    std::atomic<unsigned long> settled;   // ...that the published mix includes
+    std::atomic<bool> muted;
+
+    // the ramps heard: the main client's callback fills the other slot, then flips
+    Ramps ramps[2];
+    std::atomic<unsigned int> heard;
+
+    float stored = 0;       // volume in the settings (control threads only)
+
+    // (main client's callback only)
+    float received = -1;    // volume the surface sent since the last feedback
+    float sent_gain = -1;   // feedback last sent to the surface (`feedback` only)
+    int sent_mute = -1;
+
+    Fader() : gain(1), moves(0), settled(0), muted(false), heard(0) { }
+
+    ///
+    /// True while a volume move overrides the gain of the published mix
+    ///
+    bool moved() const {
+        return moves.load(std::memory_order_acquire) != settled.load(std::memory_order_relaxed);
+    }
+
+    ///
+    /// Volume of a channel whose mix compiled `compiled` (ignoring the mute)
+    ///
+    float volume(const float compiled) const {
+        return moved() ? gain.load(std::memory_order_relaxed) : compiled;
+    }
+
+    const Ramps ramp() const { return ramps[heard.load(std::memory_order_acquire)]; }
+
+    ///
+    /// Make `next` the ramps heard (main client's callback)
+    ///
+    void hear(const Ramps& next) {
+        const unsigned int slot = !heard.load(std::memory_order_relaxed);
+        ramps[slot] = next;
+        heard.store(slot, std::memory_order_release);
+    }
+};
+
+///
+/// Whether anything in the jack graph reads an output port pair. Kept up
+/// to date from the port connect callback; outputs nobody reads are not
+/// rendered. `peak` is the level last rendered to the pair (written by
+/// the callback rendering it, decaying over PEAK_DECAY_MS).
+///
+struct PortUse {
+    jack_port_t* ports[2];
+    std::atomic<bool> connected;
+    mutable std::atomic<float> peak;
+
+    PortUse(jack_port_t* left, jack_port_t* right) : ports{left, right}, connected(false), peak(0) { }
+};
+
+///
+/// Engine-ready form of the mixer state, compiled from `Settings` (or a
+/// `Scene`) by the control threads and read as-is by `Backend::callback`.
+/// A published mix is never modified by the control threads, so swapping
+/// the whole mix pointer switches every gain and route atomically.
+///
+struct Mix {
+    ///
+    /// Level of a strip or bus from frame time `frame` on: its gain, or
+    /// what its fader has it at while a move is heard (`steady` when it
+    /// holds still, as long as no MIDI event comes)
+    ///
+    struct Level {
+        float gain;
+        bool steady = true;
+        bool moved = false;
+        Fader::Ramps ramps;
+
+        Level(const float compiled, const Fader* fader, const jack_nframes_t frame) : gain(compiled) {
+            if (!fader)
+                return;
+            ramps = fader->ramp();
+            moved = fader->moved();
+            steady = ramps.mute.done(frame) && (!moved || ramps.volume.done(frame));
+            if (steady)
+                gain = (moved ? ramps.volume.to : compiled) * ramps.mute.to;
+        }
+
+        float at(const jack_nframes_t frame) const {
+            if (steady)
+                return gain;
+            return (moved ? ramps.volume.at(frame) : gain) * ramps.mute.at(frame);
+        }
+    };
+
+    struct Strip {
+        jack_port_t* in[2];
+        jack_port_t* out[2];
+        const PortUse* use;     // of the implicit output
+        float gain;
+        const Fader* fader = nullptr;   // when mapped to MIDI controls
+        bool tapped = false;    // read by another shard
+
+        Level level(const jack_nframes_t frame) const { return Level(gain, fader, frame); }
+
+        // insert chain and ducking, run before the gain on a copy of the input
+        std::vector<Processor*> inserts;
+        std::vector<DuckGain*> ducks;
+        mutable std::vector<sample_t> insert_buf[2];
+    };
+
+    struct Bus {
+        jack_port_t* out[2];
+        const PortUse* use;
+        float gain;
+        const Fader* fader = nullptr;   // when mapped to MIDI controls
+        std::vector<size_t> sources; // indexes into `inputs`
+        unsigned int shard = 0;
+        int sum = -1;                // partial of its shard summing `sources`
+        bool low_priority = false;   // silenced when the watchdog sheds it
+        LoudnessMeter* loudness = nullptr;
+
+        // ducking and insert chain, run in place on the output after the gain
+        std::vector<DuckGain*> ducks;
+        std::vector<Processor*> inserts;
+
+        Level level(const jack_nframes_t frame) const { return Level(gain, fader, frame); }
+    };
+
+    ///
+    /// Sum shared by buses of a shard: inputs (at their gain) plus earlier
+    /// partials. Buses with the same sources share one; inputs common to
+    /// several buses are factored into partials of their own.
+    ///
+    struct Partial {
+        std::vector<size_t> sources;   // indexes into `inputs`
+        std::vector<size_t> partials;  // earlier partials of the shard
+    };
+
+    ///
+    /// Work of one jack client. Shard 0 is the main client: it owns the
+    /// inputs, their implicit outputs and the monitor. Other shards read
+    /// the implicit outputs (gain already applied) through tap ports.
+    ///
+    struct Shard {
+        std::vector<size_t> buses;        // indexes into `outputs`
+        std::vector<jack_port_t*> taps;   // 2 per input (shards other than 0)
+
+        // shared sums of the buses, in dependency order
+        std::vector<Partial> partials;
+
+        // per period input buffer cache (only touched by this shard's callback)
+        mutable std::vector<sample_t*> in_bufs;
+        // partial sums of the block (2 * `block` frames each) and whether
+        // they were computed for it
+        mutable std::vector<sample_t> partial_buf;
+        mutable std::vector<char> partial_ready;
+    };
+
+    ///
+    /// Ducking rule: targets follow `gain`, which moves to `depth` while
+    /// the envelope of the key input is above `threshold` (linear values,
+    /// times in frames)
+    ///
+    struct Duck {
+        Envelope* envelope;
+        DuckGain* gain;
+        float threshold;
+        float depth;
+        float attack;
+        float release;
+    };
+
+    ///
+    /// Mix-minus group: every participant gets the sum of the group without
+    /// itself. The sum is taken once and each return subtracts its own
+    /// participant from it (main client's callback).
+    ///
+    struct MixMinus {
+        struct Return {
+            jack_port_t* out[2];
+            const PortUse* use;
+        };
+
+        std::vector<size_t> sources;   // indexes into `inputs`, sorted
+        std::vector<Return> returns;   // aligned with `sources`
+        float gain;
+    };
+
+    ///
+    /// MIDI mapping: the control sets the volume of a strip or bus between
+    /// `min` and `max`, or mutes it (main client's callback)
+    ///
+    struct Control {
+        MidiControl control;
+        Fader* fader;
+        bool mute;
+        float min;
+        float max;
+        int input  = -1;    // index into `inputs`...
+        int output = -1;    // ...or `outputs` of the target
+    };
+
+    std::vector<Strip> inputs;
+    std::vector<Bus> outputs;
+    std::vector<Shard> shards;
+
+    // ducking: key inputs (index into `inputs`, each once) and rules
+    std::vector<std::pair<size_t, Envelope*>> keys;
+    std::vector<Duck> ducks;
+    std::vector<MixMinus> mix_minus;
+    float envelope_release = 0;     // frames
+    float peak_release = 0;         // frames (output peak meters)
+
+    // owners of the insert processors (shared with the other mixes)
+    std::vector<std::shared_ptr<Processor>> processors;
+    // owners of the loudness meters (shared with the other mixes)
+    std::vector<std::shared_ptr<LoudnessMeter>> meters;
+    // owners of the port connection states (shared with the other mixes)
+    std::vector<std::shared_ptr<PortUse>> port_uses;
+    // owners of the ducking state (shared with the other mixes)
+    std::vector<std::shared_ptr<Envelope>> envelopes;
+    std::vector<std::shared_ptr<DuckGain>> duck_gains;
+    // MIDI mappings and the owners of their faders (shared with the other mixes)
+    std::vector<Control> controls;
+    std::vector<std::shared_ptr<Fader>> faders;
+    // longest block the strip insert buffers can take (inserts are
+    // bypassed on longer ones until the next compile)
+    jack_nframes_t block = 0;
+
+    // index into inputs/outputs of the monitored channel (-1: none)
+    int monitor_input  = -1;
+    int monitor_output = -1;
+
+    // port layout this mix was compiled against (see Backend::m_layout)
+    unsigned long layout = 0;
+
+    // settings revision this mix was compiled from
+    unsigned long revision = 0;
+};
+
+#endif
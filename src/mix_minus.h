@@ -0,0 +1,20 @@
+#ifndef MIX_MINUS_H
+#define MIX_MINUS_H
+
+#include <string>
+#include <vector>
+
+// between the group and participant names in the name of a return
+#define MIX_MINUS_SEPARATOR " - "
+
+///
+/// Stored form of a mix-minus group: each participant (an input) gets a
+/// return, "<group> - <participant>", carrying every other participant
+/// at their input volume, scaled by `volume`.
+///
+struct MixMinusGroup {
+    std::vector<std::string> participants;
+    float volume = 1;
+};
+
+#endif
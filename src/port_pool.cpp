@@ -0,0 +1,167 @@
+#include "port_pool.h"
+#include "log.h"
+
+///
+/// Constructor:
+///     @param channels how many spare channels to keep around
+///
+PortPool::PortPool(const size_t channels) : m_register_time(0) {
+    m_target[true]  = 2 * channels;
+    m_target[false] = 4 * channels;
+}
+
+///
+/// Start the refill thread
+///
+void PortPool::start() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_run)
+        return;
+    m_run = true;
+    m_thread = std::thread([this](){ refill_loop(); });
+}
+
+///
+/// Stop the refill thread
+///
+void PortPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_run)
+            return;
+        m_run = false;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+}
+
+///
+/// Refill from `client` (call once it's active)
+///
+void PortPool::attach(jack_client_t* client) {
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_client = client;
+    }
+    m_wake.notify_all();
+}
+
+///
+/// Forget the spare ports: the client they belong to is gone
+///
+void PortPool::detach() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_client = 0;
+    m_spare[true].clear();
+    m_spare[false].clear();
+}
+
+///
+/// Register a port, keeping track of the time spent in jackd
+///
+jack_port_t* PortPool::register_port(jack_client_t* client, const std::string& name, const bool input) {
+    const auto start = std::chrono::steady_clock::now();
+    jack_port_t* port = jack_port_register(client, name.c_str(), JACK_DEFAULT_AUDIO_TYPE,
+                                           input ? JackPortIsInput : JackPortIsOutput, 0);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_registered++;
+    m_register_time += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+    return port;
+}
+
+///
+/// Get a port named `name`: a spare one if there is any, a freshly
+/// registered one otherwise
+///
+jack_port_t* PortPool::take(jack_client_t* client, const std::string& name, const bool input) {
+    jack_port_t* port = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (client == m_client && !m_spare[input].empty()) {
+            port = m_spare[input].back();
+            m_spare[input].pop_back();
+        }
+    }
+    m_wake.notify_all();
+
+    if (port) {
+        if (jack_port_rename(client, port, name.c_str()) == 0)
+            return port;
+        jack_port_unregister(client, port);
+    }
+    return register_port(client, name, input);
+}
+
+///
+/// Hand back a port that is no longer used. It is disconnected and kept
+/// as a spare, or unregistered if the pool is full.
+///
+void PortPool::give(jack_client_t* client, jack_port_t* port) {
+    const bool input = jack_port_flags(port) & JackPortIsInput;
+    std::string name;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (client == m_client && m_spare[input].size() < m_target[input])
+            name = PORT_POOL_PREFIX + std::to_string(++m_serial);
+    }
+
+    if (!name.empty() && jack_port_disconnect(client, port) == 0 &&
+            jack_port_rename(client, port, name.c_str()) == 0) {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (client == m_client) {
+            m_spare[input].push_back(port);
+            return;
+        }
+    }
+    jack_port_unregister(client, port);
+}
+
+///
+/// Pool and registration numbers
+///
+PortPool::Stats PortPool::stats() {
+    std::lock_guard<std::mutex> lock(m_lock);
+    return {
+        m_spare[true].size(),
+        m_spare[false].size(),
+        m_registered,
+        m_register_time.count() / 1e6,
+    };
+}
+
+///
+/// Refill thread: register spare ports whenever the pool is below target
+///
+void PortPool::refill_loop() {
+    std::unique_lock<std::mutex> lock(m_lock);
+    while (m_run) {
+        jack_client_t* client = m_client;
+        const bool input = m_spare[true].size() < m_target[true];
+        if (!client || (!input && m_spare[false].size() >= m_target[false])) {
+            m_wake.wait(lock);
+            continue;
+        }
+        const std::string name = PORT_POOL_PREFIX + std::to_string(++m_serial);
+
+        // jackd round trip without holding the pool
+        lock.unlock();
+        jack_port_t* port = register_port(client, name, input);
+        lock.lock();
+
+        if (!port) {
+            LOG_WARN("Could not register spare port");
+            m_wake.wait_for(lock, std::chrono::seconds(2));
+        } else if (client == m_client) {
+            m_spare[input].push_back(port);
+        }
+    }
+}
+
+///
+/// Destructor
+///
+PortPool::~PortPool() {
+    stop();
+}
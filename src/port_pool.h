@@ -0,0 +1,74 @@
+#ifndef PORT_POOL_H
+#define PORT_POOL_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include <jack/jack.h>
+
+// spare channels kept registered for each direction
+// (override with -DPORT_POOL_SIZE=n, 0 disables the pool)
+#ifndef PORT_POOL_SIZE
+#define PORT_POOL_SIZE 8
+#endif
+
+// name prefix of the spare ports as seen by other jack clients
+#define PORT_POOL_PREFIX "~spare "
+
+///
+/// Spare jack ports that are already registered. Adding a channel takes
+/// ports from the pool and only renames them, removing one gives them
+/// back. A background thread tops the pool up so the jackd round trips
+/// of jack_port_register happen off the command path.
+///
+/// An input channel needs two input and four output ports (its implicit
+/// output plus, on average, an output channel), an output channel two
+/// output ports.
+///
+class PortPool {
+    private:
+        std::mutex m_lock;
+        std::condition_variable m_wake;
+        std::thread m_thread;
+        bool m_run = false;
+
+        jack_client_t* m_client = 0;
+        size_t m_target[2];               // [is_input]
+        std::vector<jack_port_t*> m_spare[2];
+        unsigned long m_serial = 0;
+
+        // registration stats
+        unsigned long m_registered = 0;
+        std::chrono::nanoseconds m_register_time;
+
+        jack_port_t* register_port(jack_client_t* client, const std::string& name, const bool input);
+        void refill_loop();
+
+    public:
+        struct Stats {
+            size_t spare_inputs;
+            size_t spare_outputs;
+            unsigned long registered;
+            double register_ms;
+        };
+
+        explicit PortPool(const size_t channels);
+        ~PortPool();
+
+        void start();
+        void stop();
+
+        void attach(jack_client_t* client);
+        void detach();
+
+        jack_port_t* take(jack_client_t* client, const std::string& name, const bool input);
+        void give(jack_client_t* client, jack_port_t* port);
+
+        Stats stats();
+};
+
+#endif
@@ -0,0 +1,125 @@
+#include "processor.h"
+
+#include <cmath>
+#include <algorithm>
+
+///
+/// New processor of the given type
+///
+Processor* Processor::create(const std::string& type) {
+    if (type == "gain")
+        return new GainProcessor();
+    if (type == "polarity")
+        return new PolarityProcessor();
+    if (type == "delay")
+        return new DelayProcessor();
+    throw UnknownProcessor(type);
+}
+
+///
+/// Types `create` knows about
+///
+const std::vector<std::string> Processor::types() {
+    return {"gain", "polarity", "delay"};
+}
+
+
+//
+// === Gain ===
+//
+
+void GainProcessor::prepare(const jack_nframes_t) {
+    m_gain = std::pow(10.f, m_db.load() / 20);
+}
+
+void GainProcessor::process(sample_t* left, sample_t* right, const jack_nframes_t nframes) {
+    const float target = std::pow(10.f, m_db.load(std::memory_order_relaxed) / 20);
+    const float step = (target - m_gain) / nframes;
+    for (jack_nframes_t i=0; i<nframes; i++) {
+        const float gain = m_gain + step * (i + 1);
+        left[i]  *= gain;
+        right[i] *= gain;
+    }
+    m_gain = target;
+}
+
+void GainProcessor::set(const std::string& param, const float value) {
+    if (param != "db")
+        throw UnknownParameter(type(), param);
+    m_db.store(value, std::memory_order_relaxed);
+}
+
+const std::map<std::string, float> GainProcessor::params() const {
+    return {{"db", m_db.load()}};
+}
+
+
+//
+// === Polarity ===
+//
+
+void PolarityProcessor::process(sample_t* left, sample_t* right, const jack_nframes_t nframes) {
+    sample_t* buf[2] = {left, right};
+    for (int c=0; c<2; c++) {
+        if (!m_invert[c].load(std::memory_order_relaxed))
+            continue;
+        for (jack_nframes_t i=0; i<nframes; i++)
+            buf[c][i] = -buf[c][i];
+    }
+}
+
+void PolarityProcessor::set(const std::string& param, const float value) {
+    if (param == "left")
+        m_invert[0].store(value != 0, std::memory_order_relaxed);
+    else if (param == "right")
+        m_invert[1].store(value != 0, std::memory_order_relaxed);
+    else
+        throw UnknownParameter(type(), param);
+}
+
+const std::map<std::string, float> PolarityProcessor::params() const {
+    return {{"left", (float) m_invert[0].load()}, {"right", (float) m_invert[1].load()}};
+}
+
+
+//
+// === Delay ===
+//
+
+void DelayProcessor::prepare(const jack_nframes_t sample_rate) {
+    m_sample_rate = sample_rate;
+    const size_t size = (size_t) sample_rate * PROCESSOR_MAX_DELAY_MS / 1000 + 1;
+    m_ring[0].assign(size, 0);
+    m_ring[1].assign(size, 0);
+    m_pos = 0;
+}
+
+void DelayProcessor::process(sample_t* left, sample_t* right, const jack_nframes_t nframes) {
+    const size_t size = m_ring[0].size();
+    if (!size)
+        return;
+    const size_t delay = std::min(size - 1,
+            (size_t) (m_ms.load(std::memory_order_relaxed) * m_sample_rate / 1000));
+
+    sample_t* buf[2] = {left, right};
+    size_t pos = m_pos;
+    for (jack_nframes_t i=0; i<nframes; i++) {
+        const size_t read = (pos + size - delay) % size;
+        for (int c=0; c<2; c++) {
+            m_ring[c][pos] = buf[c][i];
+            buf[c][i] = m_ring[c][read];
+        }
+        pos = (pos + 1) % size;
+    }
+    m_pos = pos;
+}
+
+void DelayProcessor::set(const std::string& param, const float value) {
+    if (param != "ms")
+        throw UnknownParameter(type(), param);
+    m_ms.store(std::max(0.f, std::min(value, (float) PROCESSOR_MAX_DELAY_MS)), std::memory_order_relaxed);
+}
+
+const std::map<std::string, float> DelayProcessor::params() const {
+    return {{"ms", m_ms.load()}};
+}
@@ -0,0 +1,124 @@
+#ifndef PROCESSOR_H
+#define PROCESSOR_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <exception>
+
+#include <jack/jack.h>
+
+typedef jack_default_audio_sample_t sample_t;
+
+// longest delay a delay insert can be set to
+#define PROCESSOR_MAX_DELAY_MS 2000
+
+///
+/// Insert processor run by the jack callback on the signal of a channel
+/// (inputs before their volume, outputs after theirs).
+///
+/// `prepare` is called by a control thread before the processor is first
+/// handed to the callback and allocates everything it needs. `process`
+/// works in place on the left and right buffers of a block and must not
+/// allocate, lock or block. `set` can be called from any thread while the
+/// callback runs: parameters are atomics read once per block.
+///
+class Processor {
+    public:
+        class ProcessorException : public std::exception {
+            public:
+                std::string os;
+            const char* what() const throw() {
+                return os.c_str();
+            }
+        };
+
+        class UnknownProcessor : public ProcessorException {
+            public:
+                UnknownProcessor(const std::string& type) {
+                    os = "Unknown processor: `"+type+"`";
+                }
+        };
+
+        class UnknownParameter : public ProcessorException {
+            public:
+                UnknownParameter(const std::string& type, const std::string& param) {
+                    os = "Unknown parameter of "+type+": `"+param+"`";
+                }
+        };
+
+        virtual ~Processor() { }
+
+        virtual const std::string type() const = 0;
+        virtual void prepare(const jack_nframes_t sample_rate) = 0;
+        virtual void process(sample_t* left, sample_t* right, const jack_nframes_t nframes) = 0;
+
+        virtual void set(const std::string& param, const float value) = 0;
+        virtual const std::map<std::string, float> params() const = 0;
+
+        static Processor* create(const std::string& type);
+        static const std::vector<std::string> types();
+};
+
+///
+/// Gain in dB, ramped over a block on changes
+///
+class GainProcessor : public Processor {
+    private:
+        std::atomic<float> m_db;
+        float m_gain = 1;   // callback only
+
+    public:
+        GainProcessor() : m_db(0) { }
+
+        const std::string type() const { return "gain"; }
+        void prepare(const jack_nframes_t sample_rate);
+        void process(sample_t* left, sample_t* right, const jack_nframes_t nframes);
+
+        void set(const std::string& param, const float value);
+        const std::map<std::string, float> params() const;
+};
+
+///
+/// Polarity inversion of either side
+///
+class PolarityProcessor : public Processor {
+    private:
+        std::atomic<bool> m_invert[2];
+
+    public:
+        PolarityProcessor() { m_invert[0] = false; m_invert[1] = false; }
+
+        const std::string type() const { return "polarity"; }
+        void prepare(const jack_nframes_t) { }
+        void process(sample_t* left, sample_t* right, const jack_nframes_t nframes);
+
+        void set(const std::string& param, const float value);
+        const std::map<std::string, float> params() const;
+};
+
+///
+/// Delay in milliseconds (up to PROCESSOR_MAX_DELAY_MS) through a ring
+/// buffer allocated by `prepare`
+///
+class DelayProcessor : public Processor {
+    private:
+        std::atomic<float> m_ms;
+        jack_nframes_t m_sample_rate = 0;
+
+        std::vector<sample_t> m_ring[2];
+        size_t m_pos = 0;   // callback only
+
+    public:
+        DelayProcessor() : m_ms(0) { }
+
+        const std::string type() const { return "delay"; }
+        void prepare(const jack_nframes_t sample_rate);
+        void process(sample_t* left, sample_t* right, const jack_nframes_t nframes);
+
+        void set(const std::string& param, const float value);
+        const std::map<std::string, float> params() const;
+};
+
+#endif
@@ -0,0 +1,177 @@
+#include "routing_matrix.h"
+
+#include <algorithm>
+
+///
+/// Make room for `size` ids (existing routes are kept)
+///
+void RoutingMatrix::resize(const size_t size) {
+    if (size <= m_size)
+        return;
+    if (size <= m_capacity) {
+        m_size = size;
+        return;
+    }
+
+    // grow geometrically so adding channels one by one stays amortized O(1)
+    const size_t capacity = std::max(size, m_capacity * 2);
+    const size_t stride = (capacity + WORD_BITS - 1) / WORD_BITS;
+
+    std::vector<word_t> bits(capacity * stride, 0);
+    for (size_t r=0; r<m_size; r++)
+        std::copy(m_bits.begin() + r*m_stride, m_bits.begin() + (r+1)*m_stride, bits.begin() + r*stride);
+
+    m_bits.swap(bits);
+    m_stride = stride;
+    m_capacity = capacity;
+    m_size = size;
+}
+
+///
+/// Get number of ids
+///
+const size_t RoutingMatrix::size() const {
+    return m_size;
+}
+
+///
+/// Get number of words per row
+///
+const size_t RoutingMatrix::words() const {
+    return m_stride;
+}
+
+///
+/// Route input to output
+///
+void RoutingMatrix::set(const size_t in, const size_t out) {
+    m_bits[out*m_stride + in/WORD_BITS] |= (word_t)1 << (in % WORD_BITS);
+}
+
+///
+/// Unroute input from output (no-op if not routed)
+///
+void RoutingMatrix::clear(const size_t in, const size_t out) {
+    m_bits[out*m_stride + in/WORD_BITS] &= ~((word_t)1 << (in % WORD_BITS));
+}
+
+///
+/// Return true if input is routed to output
+///
+const bool RoutingMatrix::get(const size_t in, const size_t out) const {
+    return (m_bits[out*m_stride + in/WORD_BITS] >> (in % WORD_BITS)) & 1;
+}
+
+///
+/// Unroute every input from output
+///
+void RoutingMatrix::clear_row(const size_t out) {
+    std::fill(m_bits.begin() + out*m_stride, m_bits.begin() + (out+1)*m_stride, 0);
+}
+
+///
+/// Give output `dst` the same inputs as output `src`
+///
+void RoutingMatrix::copy_row(const size_t src, const size_t dst) {
+    if (src == dst)
+        return;
+    std::copy(m_bits.begin() + src*m_stride, m_bits.begin() + (src+1)*m_stride, m_bits.begin() + dst*m_stride);
+}
+
+///
+/// Unroute input from every output
+///
+void RoutingMatrix::clear_column(const size_t in) {
+    const word_t mask = ~((word_t)1 << (in % WORD_BITS));
+    for (size_t r=0; r<m_size; r++)
+        m_bits[r*m_stride + in/WORD_BITS] &= mask;
+}
+
+///
+/// Return true if no input is routed to output
+///
+const bool RoutingMatrix::row_empty(const size_t out) const {
+    const word_t* r = row(out);
+    for (size_t w=0; w<m_stride; w++)
+        if (r[w])
+            return false;
+    return true;
+}
+
+///
+/// Get raw words of a row (`words()` long)
+///
+const RoutingMatrix::word_t* RoutingMatrix::row(const size_t out) const {
+    return m_bits.data() + out*m_stride;
+}
+
+///
+/// Replace a row (missing words are zero, bits past `size()` are dropped)
+///
+void RoutingMatrix::assign_row(const size_t out, const std::vector<word_t>& bits) {
+    assign_row(out, bits.data(), bits.size());
+}
+
+///
+/// Replace a row from `n` raw words
+///
+void RoutingMatrix::assign_row(const size_t out, const word_t* bits, const size_t n) {
+    for (size_t w=0; w<m_stride; w++) {
+        word_t word = w < n ? bits[w] : 0;
+        if ((w+1)*WORD_BITS > m_size)
+            word &= w*WORD_BITS >= m_size ? 0 : ((word_t)1 << (m_size - w*WORD_BITS)) - 1;
+        m_bits[out*m_stride + w] = word;
+    }
+}
+
+///
+/// Get ids of the inputs routed to output (ascending)
+///
+const std::vector<size_t> RoutingMatrix::row_bits(const size_t out) const {
+    std::vector<size_t> ids;
+    const word_t* r = row(out);
+    for (size_t w=0; w<m_stride; w++) {
+        for (word_t bits = r[w]; bits; bits &= bits - 1)
+            ids.push_back(w*WORD_BITS + __builtin_ctzll(bits));
+    }
+    return ids;
+}
+
+///
+/// Hex dump of a row (bit n = input id n, most significant digit first),
+/// always `hex_digits()` long
+///
+const std::string RoutingMatrix::row_hex(const size_t out) const {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    const word_t* r = row(out);
+
+    for (size_t n=hex_digits(); n-- > 0;)
+        hex += digits[(r[n*4 / WORD_BITS] >> (n*4 % WORD_BITS)) & 0xf];
+    return hex;
+}
+
+///
+/// Length of a row hex dump: one digit per 4 ids
+///
+const size_t RoutingMatrix::hex_digits() const {
+    return (m_size + 3) / 4;
+}
+
+///
+/// Parse a row hex dump (see `row_hex`). Return false on bad digits.
+///
+const bool RoutingMatrix::parse_hex(const std::string& hex, std::vector<word_t>& bits) {
+    bits.assign((hex.size() * 4 + WORD_BITS - 1) / WORD_BITS, 0);
+
+    for (size_t n=0; n<hex.size(); n++) {
+        const char c = hex[hex.size()-1-n];
+        word_t d;
+        if (c >= '0' && c <= '9')      d = c - '0';
+        else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') d = c - 'A' + 10;
+        else return false;
+        bits[n*4 / WORD_BITS] |= d << (n*4 % WORD_BITS);
+    }
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef ROUTING_MATRIX_H
+#define ROUTING_MATRIX_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+///
+/// Dense bitset routing matrix indexed by channel id.
+/// Row `out` holds one bit per input id (set when the input is routed to
+/// `out`), so single routes are O(1) and whole-bus operations work on
+/// 64 routes per word.
+///
+class RoutingMatrix {
+    public:
+        typedef uint64_t word_t;
+        static const size_t WORD_BITS = 64;
+
+    private:
+        std::vector<word_t> m_bits;
+        size_t m_size = 0;   // number of ids (rows and columns)
+        size_t m_capacity = 0;
+        size_t m_stride = 0; // words per row
+
+    public:
+        void resize(const size_t size);
+        const size_t size() const;
+        const size_t words() const;
+
+        void set(const size_t in, const size_t out);
+        void clear(const size_t in, const size_t out);
+        const bool get(const size_t in, const size_t out) const;
+
+        void clear_row(const size_t out);
+        void copy_row(const size_t src, const size_t dst);
+        void clear_column(const size_t in);
+        const bool row_empty(const size_t out) const;
+
+        const word_t* row(const size_t out) const;
+        void assign_row(const size_t out, const std::vector<word_t>& bits);
+        void assign_row(const size_t out, const word_t* bits, const size_t n);
+        const std::vector<size_t> row_bits(const size_t out) const;
+
+        const std::string row_hex(const size_t out) const;
+        const size_t hex_digits() const;
+        static const bool parse_hex(const std::string& hex, std::vector<word_t>& bits);
+};
+
+#endif
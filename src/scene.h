@@ -0,0 +1,19 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <string>
+#include <map>
+#include <vector>
+
+///
+/// Named snapshot of the mixer state (volumes, connections and monitor)
+///
+struct Scene {
+    std::map<std::string, float> input_volumes;
+    std::map<std::string, float> output_volumes;
+    std::map<std::string, std::vector<std::string>> connections;
+    std::string monitor_channel;
+    bool monitoring_input = false;
+};
+
+#endif
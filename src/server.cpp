@@ -1,10 +1,16 @@
 #include "server.h"
 #include "commands.h"
+#include "metrics.h"
+#include "trace.h"
+#include "log.h"
+#include "shutdown.h"
 
 #include <iostream>
 #include <string>
+#include <map>
 
 #include <cstring>
+#include <cerrno>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
@@ -14,7 +20,6 @@
 #include <netdb.h>
 
 #define ASSERT(cond, msg) if(!(cond)) { std::cerr << msg << std::endl; exit(1); };
-#define PORT "2909"
 
 // get sockaddr, IPv4 or IPv6:
 void *get_in_addr(struct sockaddr *sa)
@@ -26,23 +31,28 @@ void *get_in_addr(struct sockaddr *sa)
     return &(((struct sockaddr_in6*)sa)->sin6_addr);
 }
 
-Server::Server(Backend* backend) : m_backend(backend) {}
+Server::Server(Instances* instances, const std::string port) : m_instances(instances), m_port(port) {
+    FD_ZERO(&m_clients);
+}
 
 void Server::listener() {
-    CommandHandler cmd_handler(m_backend);
+    Trace::register_thread("server");
+    Log::register_thread("server");
+    CommandHandler cmd_handler(m_instances);
     int s; // success holder
 
     // === Setup ===
     ::fd_set master, read_fds;
     FD_ZERO(&master);
     FD_ZERO(&read_fds);
+    const int shutdown_fd = Shutdown::fd();
 
     struct ::addrinfo hints, *ai;
     std::memset(&hints, 0, sizeof hints);
     hints.ai_family = AF_UNSPEC;
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_flags = AI_PASSIVE;
-    s = ::getaddrinfo(NULL, PORT, &hints, &ai);
+    s = ::getaddrinfo(NULL, m_port.c_str(), &hints, &ai);
     ASSERT(s == 0, gai_strerror(s));
 
     int listener;
@@ -58,25 +68,32 @@ void Server::listener() {
         if (s < 0) { ::close(listener); continue; }
         break;
     }
-    ASSERT(p != NULL, "Failed to bind");
+    ASSERT(p != NULL, "Failed to bind port " + m_port);
 
     ::freeaddrinfo(ai);
 
     s = ::listen(listener, 20);
     ASSERT(s != -1, "Error in listen");
 
+    m_sockfd = listener;
     FD_SET(listener, &master);
-    int fdmax = listener;
+    FD_SET(shutdown_fd, &master);
+    int fdmax = listener > shutdown_fd ? listener : shutdown_fd;
+    int clients = 0;
+    Metrics::set("jamyxer_clients", "", clients);
+    std::map<int, std::string> pending;  // start of the next command, per client
 
     // === Main loop ===
-    while (m_listen) {
+    // (commands already received are answered before leaving)
+    while (!Shutdown::requested()) {
         read_fds = master;
-        struct timeval timeout { .tv_sec = 1, .tv_usec = 0 };
-        s = ::select(fdmax+1, &read_fds, NULL, NULL, &timeout);
+        s = ::select(fdmax+1, &read_fds, NULL, NULL, NULL);
+        if (s == -1 && errno == EINTR)
+            continue;
         ASSERT(s != -1, "Error in select");
 
         for (int i=0; i <= fdmax; i++) {
-            if (!FD_ISSET(i, &read_fds))
+            if (!FD_ISSET(i, &read_fds) || i == shutdown_fd)
                 continue;
 
             if (i == listener) {
@@ -88,82 +105,114 @@ void Server::listener() {
 
                 FD_SET(newfd, &master);
                 fdmax = newfd > fdmax ? newfd : fdmax;
+                Metrics::set("jamyxer_clients", "", ++clients);
 
                 char remoteIP[INET6_ADDRSTRLEN];
 
-                std::cout << "New connection from "
-                    << ::inet_ntop(remoteaddr.ss_family,
-                            get_in_addr((struct sockaddr*) &remoteaddr),
-                            remoteIP, INET6_ADDRSTRLEN)
-                    << " on socket " << newfd << std::endl;
+                LOG_INFO("New connection from %s on socket %d",
+                         ::inet_ntop(remoteaddr.ss_family,
+                             get_in_addr((struct sockaddr*) &remoteaddr),
+                             remoteIP, INET6_ADDRSTRLEN),
+                         newfd);
             } else {
                 // handle data from a client
-                char buf[256];
-                int nbytes = ::recv(i, buf, 256, 0);
+                char buf[4096];
+                int nbytes = ::recv(i, buf, sizeof buf, 0);
                 if (nbytes == 0)
-                    std::cerr << "socket " << i << " hung up" << std::endl;
+                    LOG_INFO("socket %d hung up", i);
                 else if (nbytes < 0)
-                    std::perror("recv");
+                    LOG_WARN("recv: %s", std::strerror(errno));
+                if (nbytes > 0 && pending[i].size() + nbytes > COMMAND_MAX_LINE) {
+                    LOG_WARN("socket %d: command longer than %d bytes, hanging up", i, COMMAND_MAX_LINE);
+                    nbytes = -1;
+                }
                 if (nbytes <= 0) {
                     ::close(i);
                     FD_CLR(i, &master);
+                    cmd_handler.forget(i);
+                    pending.erase(i);
+                    Metrics::set("jamyxer_clients", "", --clients);
                     continue;
                 }
 
-                // we got some data from a client
-                if (FD_ISSET(i, &master)){
-                    /* if (std::strlen(buf) == 1 && (buf[0] == '\n' || buf[0] == '\r')) */
-                    /*     std::memset(buf, 0, sizeof buf); */
-                    /*     continue; */
-
-                    while (buf[std::strlen(buf)-1] == '\n' || buf[std::strlen(buf)-1] == '\r')
-                        buf[std::strlen(buf)-1] = 0;
-
+                // we got some data from a client: run the complete lines
+                // (a command can arrive over several reads)
+                TRACE_EVENT("receive", "fd", i);
+                std::string& received = pending[i];
+                received.append(buf, nbytes);
+                size_t begin = 0;
+                for (size_t end; (end = received.find('\n', begin)) != std::string::npos; begin = end + 1) {
+                    std::string line = received.substr(begin, end - begin);
+                    while (!line.empty() && line.back() == '\r')
+                        line.pop_back();
+                    if (line.empty())
+                        continue;
 
-                    if (std::strcmp(buf, "stop") == 0 || std::strcmp(buf, "quit") == 0) {
-                        m_listen = false;
-                        stopped = true;
-                        ::send(i, "stopping...\n", 11, 0);
-                        std::cout << "stopping..." << std::endl;
-                        std::memset(buf, 0, sizeof buf);
+                    if (line == "stop" || line == "quit") {
+                        // (answered by `disconnect_all` once stopped)
+                        Shutdown::request("stop command");
                         continue;
                     }
 
-#define HNDL_EXCPT() std::cout << e.what() << std::endl; \
-                     response = std::string(e.what())+'\n';
+#define HNDL_EXCPT() response = std::string(e.what())+'\n';
 
                     std::string response;
-                    try {
-                        response = cmd_handler.run(std::string(buf), i)+'\n';
-                    } catch (CommandHandler::CommandHandlerException& e) {
-                        HNDL_EXCPT();
-                    } catch (Settings::SettingsException& e) {
-                        HNDL_EXCPT();
+                    {
+                        TRACE_SCOPE("dispatch", "fd", i);
+                        try {
+                            response = cmd_handler.run(line, i)+'\n';
+                        } catch (CommandHandler::CommandHandlerException& e) {
+                            HNDL_EXCPT();
+                        } catch (Settings::SettingsException& e) {
+                            HNDL_EXCPT();
+                        }
                     }
+                    TRACE_SCOPE("reply", "fd", i);
                     if (response != "IS LISTENER\n") {
                         s = ::send(i, response.c_str(), response.length()-1, 0);
-                        std::cout << response;
+                        LOG_DEBUG("fd %d: %.*s", i, (int) response.length()-1, response.c_str());
 
                         ASSERT(s != -1, "Error in send");
                     } else {
-                        std::cout << "listener has been set (fd: " << i << ")\n";
+                        LOG_DEBUG("listener has been set (fd: %d)", i);
                     }
                 }
-                std::memset(buf, 0, sizeof buf);
+                received.erase(0, begin);
             }
         }
     }
+
+    // stop accepting, the clients get their farewell from `disconnect_all`
+    ::close(listener);
+    m_sockfd = -1;
+    FD_CLR(listener, &master);
+    FD_CLR(shutdown_fd, &master);
+    m_clients = master;
+    m_fdmax = fdmax;
 }
 
 void Server::start() {
-    m_listen = true;
     m_listener_thread = std::thread([&](){ listener(); });
 }
 
+///
+/// Wait for the listener to finish answering (after a shutdown request)
+///
 void Server::stop() {
-    m_listen = false;
-    stopped = true;
-    /* ::close(m_newsockfd); */
-    /* ::close(m_sockfd); */
-    /* m_listener_thread.join(); */
+    if (m_listener_thread.joinable())
+        m_listener_thread.join();
+}
+
+///
+/// Send `farewell` to every connected client and hang up (after `stop`)
+///
+void Server::disconnect_all(const std::string& farewell) {
+    for (int i=0; i <= m_fdmax; i++) {
+        if (!FD_ISSET(i, &m_clients))
+            continue;
+        ::send(i, farewell.c_str(), farewell.length(), MSG_NOSIGNAL);
+        ::close(i);
+    }
+    FD_ZERO(&m_clients);
+    Metrics::set("jamyxer_clients", "", 0);
 }
@@ -1,25 +1,38 @@
 #ifndef SERVER_H
 #define SERVER_H
 
-#include "backend.h"
+#include "instances.h"
 #include <thread>
+#include <string>
+#include <sys/select.h>
 
+// default command port (see `-p`)
+#define PORT "2909"
+// longest command line a client can send (commands end with a newline)
+#define COMMAND_MAX_LINE (1 << 20)
+
+///
+/// Command socket server, for all mixer instances. Serves clients until a
+/// shutdown is requested (see shutdown.h); connected clients are kept
+/// until `disconnect_all`.
+///
 class Server {
     private:
-        Backend* m_backend;
-        int m_sockfd = 0;
-        int m_newsockfd = 0;
+        Instances* m_instances;
+        const std::string m_port;
+        int m_sockfd = -1;
 
-        bool m_listen;
+        ::fd_set m_clients;
+        int m_fdmax = 0;
 
         void listener();
     public:
-        bool stopped = false;
-        Server(Backend* backend);
+        Server(Instances* instances, const std::string port=PORT);
         std::thread m_listener_thread;
 
         void start();
         void stop();
+        void disconnect_all(const std::string& farewell);
 };
 
 #endif
@@ -1,42 +1,621 @@
 #include "settings.h"
+#include "metrics.h"
+#include "trace.h"
+#include "log.h"
+#include "watchdog.h"
+#include "loudness.h"
 
 #include <iostream>
-#include <yaml-cpp/yaml.h>
+#include <algorithm>
+#include <memory>
+#include <cstring>
+#include <cstdlib>
+#include <functional>
+#include <regex>
+#include <fnmatch.h>
 #include <sys/socket.h>
 
 ///
 /// Constructor:
 ///     @param filename the path to the config file
 ///
-Settings::Settings(const std::string filename): m_filename(filename) { }
+Settings::Settings(const std::string filename): m_filename(filename),
+                                                 m_journal(filename + ".journal") { }
 
 ///
-/// Load settings from file (filename set in constructor)
+/// Load settings from file (filename set in constructor) and replay
+/// the changes journaled since it was written
 ///
 void Settings::load() {
-    SETTINGS_BACKEND backend(m_filename);
-    backend.load();
-    m_input_volumes    = backend.m_input_volumes;
-    m_output_volumes   = backend.m_output_volumes;
-    m_connections      = backend.m_connections;
-    m_monitoring_input = backend.m_monitoring_input;
-    m_monitor_channel  = backend.m_monitor_channel;
+    m_journal.flush();
+    m_journal.stop();
+
+    // use the binary snapshot when it is up to date with the JSON
+    BinaryConfig snapshot(binary_filename());
+    if (snapshot.open(m_filename) && load_binary(snapshot)) {
+        m_journal_seq = snapshot.header().journal_seq;
+        snapshot.close();
+    } else {
+        SETTINGS_BACKEND backend(m_filename);
+        backend.load();
+        load_json(backend);
+        m_journal_seq = backend.m_journal_seq;
+
+        if (!BinaryConfig::write(binary_filename(), compile_binary(), m_filename))
+            LOG_ERROR("Could not compile binary snapshot");
+    }
+
+    // === replay journal ===
+    m_replaying = true;
+
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+    size_t replayed = 0;
+    for (const std::string& line : m_journal.read()) {
+        Json::Value record;
+        if (!reader->parse(line.data(), line.data() + line.size(), &record, nullptr))
+            break;
+        if (record["seq"].asUInt64() <= m_journal_seq)
+            continue;
+
+        try {
+            replay(record);
+        } catch (SettingsException& e) {
+            LOG_WARN("journal: %s", e.what());
+        }
+        m_journal_seq = record["seq"].asUInt64();
+        replayed++;
+    }
+    m_replaying = false;
+    LOG_DEBUG("Replayed %zu journal records", replayed);
+
+    m_compacted_seq = m_journal_seq;
+    m_compacted_at  = std::chrono::steady_clock::now();
+    m_journal.start();
+
+    // fold the replayed records into a fresh snapshot
+    if (replayed)
+        compact();
+    m_revision++;
+}
+
+///
+/// Get path of the config file
+///
+const std::string Settings::filename() {
+    return m_filename;
+}
+
+///
+/// Return true if the config file was modified by someone else since
+/// it was last loaded or written (the binary snapshot is stamped with
+/// the config file it was compiled with)
+///
+const bool Settings::changed_on_disk() {
+    BinaryConfig snapshot(binary_filename());
+    return !snapshot.open(m_filename);
+}
+
+///
+/// Build channels, routing and scenes from a parsed JSON config
+///
+void Settings::load_json(SETTINGS_BACKEND& backend) {
+    m_channels.clear();
+    m_input_ids.clear();
+    m_output_ids.clear();
+    m_channels.reserve(backend.m_input_volumes.size() + backend.m_output_volumes.size());
+
+    for (const auto& p : backend.m_input_volumes)
+        add_channel(p.first, true, p.second);
+    for (const auto& p : backend.m_output_volumes)
+        add_channel(p.first, false, p.second);
+
+    m_routing = RoutingMatrix();
+    m_routing.resize(m_channels.size());
+
+    for (const auto& p : backend.m_connections) {
+        const channel_id_t o = find_output(p.first);
+        if (o == NO_CHANNEL)
+            continue;
+        for (const std::string& input : p.second) {
+            const channel_id_t i = find_input(input);
+            if (i != NO_CHANNEL)
+                m_routing.set(i, o);
+        }
+    }
+
+    m_monitor = backend.m_monitoring_input ? find_input(backend.m_monitor_channel)
+                                           : find_output(backend.m_monitor_channel);
+    m_scenes  = backend.m_scenes;
+
+    m_shard_count = backend.m_shard_count;
+    for (const auto& p : backend.m_output_shards) {
+        const channel_id_t o = find_output(p.first);
+        if (o != NO_CHANNEL)
+            m_channels[o].shard = p.second;
+    }
+
+    for (const auto& p : backend.m_input_inserts) {
+        const channel_id_t i = find_input(p.first);
+        if (i != NO_CHANNEL)
+            m_channels[i].inserts = p.second;
+    }
+    for (const auto& p : backend.m_output_inserts) {
+        const channel_id_t o = find_output(p.first);
+        if (o != NO_CHANNEL)
+            m_channels[o].inserts = p.second;
+    }
+
+    m_ducks = backend.m_ducks;
+    m_mix_minus = backend.m_mix_minus;
+    m_midi = backend.m_midi;
+
+    for (const auto& p : backend.m_input_tags) {
+        const channel_id_t i = find_input(p.first);
+        if (i != NO_CHANNEL)
+            m_channels[i].tags.insert(p.second.begin(), p.second.end());
+    }
+    for (const auto& p : backend.m_output_tags) {
+        const channel_id_t o = find_output(p.first);
+        if (o != NO_CHANNEL)
+            m_channels[o].tags.insert(p.second.begin(), p.second.end());
+    }
+
+    m_external.clear();
+    for (const auto& p : backend.m_external)
+        m_external[p.first].insert(p.second.begin(), p.second.end());
 
     gen_aliases();
 }
 
+///
+/// Path of the binary snapshot compiled from the config file
+///
+const std::string Settings::binary_filename() {
+    return m_filename + ".bin";
+}
+
+///
+/// Serialize channels (including removed ones, so ids and aliases survive
+/// restarts), routing and scenes into the binary snapshot layout
+///
+const std::string Settings::compile_binary() {
+    const size_t n = m_channels.size();
+    const size_t row_words = (n + 63) / 64;
+
+    std::string strings;
+    std::vector<BinaryChannelRecord> records(n);
+    size_t n_rows = 0;
+    for (size_t i=0; i<n; i++) {
+        const Channel& c = m_channels[i];
+        records[i].name_off  = strings.size();
+        records[i].name_len  = c.name.size();
+        strings += c.name;
+        records[i].alias_off = strings.size();
+        records[i].alias_len = c.alias.size();
+        strings += c.alias;
+        records[i].flags  = (c.input ? BINARY_CHANNEL_INPUT : 0) | (c.active ? BINARY_CHANNEL_ACTIVE : 0)
+                          | (c.shard + 1) << BINARY_CHANNEL_SHARD_SHIFT;
+        records[i].volume = c.volume;
+        n_rows += !c.input;
+    }
+
+    Json::Value scenes(Json::objectValue);
+    for (const auto& p : m_scenes)
+        scenes[p.first] = SETTINGS_BACKEND::save_scene(p.second);
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    const std::string scenes_json = m_scenes.empty() ? "" : Json::writeString(builder, scenes);
+
+    Json::Value external(Json::objectValue);
+    for (const auto& p : m_external)
+        for (const std::string& other : p.second)
+            external[p.first].append(other);
+    const std::string external_json = m_external.empty() ? "" : Json::writeString(builder, external);
+
+    Json::Value inserts(Json::objectValue);
+    for (size_t i=0; i<n; i++)
+        if (!m_channels[i].inserts.empty())
+            inserts[std::to_string(i)] = SETTINGS_BACKEND::save_inserts(m_channels[i].inserts);
+    const std::string inserts_json = inserts.empty() ? "" : Json::writeString(builder, inserts);
+
+    Json::Value tags(Json::objectValue);
+    for (size_t i=0; i<n; i++)
+        for (const std::string& tag : m_channels[i].tags)
+            tags[std::to_string(i)].append(tag);
+    const std::string tags_json = tags.empty() ? "" : Json::writeString(builder, tags);
+
+    Json::Value ducks(Json::objectValue);
+    for (const auto& p : m_ducks)
+        ducks[p.first] = SETTINGS_BACKEND::save_duck(p.second);
+    const std::string ducks_json = m_ducks.empty() ? "" : Json::writeString(builder, ducks);
+
+    Json::Value mix_minus(Json::objectValue);
+    for (const auto& p : m_mix_minus)
+        mix_minus[p.first] = SETTINGS_BACKEND::save_mix_minus(p.second);
+    const std::string mix_minus_json = m_mix_minus.empty() ? "" : Json::writeString(builder, mix_minus);
+
+    Json::Value midi(Json::objectValue);
+    for (const auto& p : m_midi)
+        midi[p.first] = SETTINGS_BACKEND::save_midi(p.second);
+    const std::string midi_json = m_midi.empty() ? "" : Json::writeString(builder, midi);
+
+    BinaryConfigHeader h;
+    std::memset(&h, 0, sizeof h);
+    std::memcpy(h.magic, BINARY_CONFIG_MAGIC, sizeof h.magic);
+    h.version      = BINARY_CONFIG_VERSION;
+    h.header_size  = sizeof h;
+    h.journal_seq  = m_journal_seq;
+    h.n_channels   = n;
+    h.n_rows       = n_rows;
+    h.row_words    = row_words;
+    h.monitor      = m_monitor == NO_CHANNEL ? UINT32_MAX : m_monitor;
+    h.shard_count  = m_shard_count;
+    h.scenes_off   = strings.size();
+    h.scenes_len   = scenes_json.size();
+    strings += scenes_json;
+    h.external_off = strings.size();
+    h.external_len = external_json.size();
+    strings += external_json;
+    h.inserts_off  = strings.size();
+    h.inserts_len  = inserts_json.size();
+    strings += inserts_json;
+    h.ducks_off    = strings.size();
+    h.ducks_len    = ducks_json.size();
+    strings += ducks_json;
+    h.mix_minus_off = strings.size();
+    h.mix_minus_len = mix_minus_json.size();
+    strings += mix_minus_json;
+    h.tags_off     = strings.size();
+    h.tags_len     = tags_json.size();
+    strings += tags_json;
+    h.midi_off     = strings.size();
+    h.midi_len     = midi_json.size();
+    strings += midi_json;
+
+    auto align = [](size_t off){ return (off + 7) & ~(size_t) 7; };
+    h.channels_off = align(sizeof h);
+    h.routing_off  = align(h.channels_off + n * sizeof(BinaryChannelRecord));
+    h.strings_off  = h.routing_off + n_rows * row_words * sizeof(uint64_t);
+    h.strings_size = strings.size();
+    h.file_size    = h.strings_off + strings.size();
+
+    std::string data(h.file_size, '\0');
+    std::memcpy(&data[0], &h, sizeof h);
+    if (n)
+        std::memcpy(&data[h.channels_off], records.data(), n * sizeof(BinaryChannelRecord));
+    for (size_t i=0, row=0; i<n; i++)
+        if (!m_channels[i].input)
+            std::memcpy(&data[h.routing_off + row++ * row_words * sizeof(uint64_t)], m_routing.row(i),
+                        std::min(row_words, m_routing.words()) * sizeof(uint64_t));
+    std::memcpy(&data[h.strings_off], strings.data(), strings.size());
+
+    return data;
+}
+
+///
+/// Build channels, routing and scenes from a mapped binary snapshot
+///
+const bool Settings::load_binary(const BinaryConfig& snapshot) {
+    const BinaryConfigHeader& h = snapshot.header();
+    const BinaryChannelRecord* records = snapshot.channels();
+
+    Json::CharReaderBuilder builder;
+    std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+
+    // channel id keying a section (false unless one of the snapshot's)
+    auto channel_id = [&h](const std::string& key, channel_id_t& id) {
+        char* end;
+        const unsigned long value = std::strtoul(key.c_str(), &end, 10);
+        if (key.empty() || *end || value >= h.n_channels)
+            return false;
+        id = value;
+        return true;
+    };
+
+    std::map<std::string, Scene> scenes;
+    if (h.scenes_len) {
+        const std::string text = snapshot.string(h.scenes_off, h.scenes_len);
+        Json::Value root;
+        if (!reader->parse(text.data(), text.data() + text.size(), &root, nullptr))
+            return false;
+        for (const std::string& name : root.getMemberNames())
+            scenes[name] = SETTINGS_BACKEND::load_scene(root[name]);
+    }
+
+    std::map<std::string, std::set<std::string>> external;
+    if (h.external_len) {
+        const std::string text = snapshot.string(h.external_off, h.external_len);
+        Json::Value root;
+        if (!reader->parse(text.data(), text.data() + text.size(), &root, nullptr))
+            return false;
+        for (const std::string& port : root.getMemberNames())
+            for (const Json::Value& other : root[port])
+                external[port].insert(other.asString());
+    }
+
+    std::map<channel_id_t, InsertChain> inserts;
+    if (h.inserts_len) {
+        const std::string text = snapshot.string(h.inserts_off, h.inserts_len);
+        Json::Value root;
+        if (!reader->parse(text.data(), text.data() + text.size(), &root, nullptr))
+            return false;
+        for (const std::string& key : root.getMemberNames()) {
+            channel_id_t id;
+            if (!channel_id(key, id))
+                return false;
+            inserts[id] = SETTINGS_BACKEND::load_inserts(root[key]);
+        }
+    }
+
+    std::map<channel_id_t, std::set<std::string>> tags;
+    if (h.tags_len) {
+        const std::string text = snapshot.string(h.tags_off, h.tags_len);
+        Json::Value root;
+        if (!reader->parse(text.data(), text.data() + text.size(), &root, nullptr))
+            return false;
+        for (const std::string& key : root.getMemberNames()) {
+            channel_id_t id;
+            if (!channel_id(key, id))
+                return false;
+            for (const Json::Value& tag : root[key])
+                tags[id].insert(tag.asString());
+        }
+    }
+
+    std::map<std::string, DuckRule> ducks;
+    if (h.ducks_len) {
+        const std::string text = snapshot.string(h.ducks_off, h.ducks_len);
+        Json::Value root;
+        if (!reader->parse(text.data(), text.data() + text.size(), &root, nullptr))
+            return false;
+        for (const std::string& name : root.getMemberNames())
+            ducks[name] = SETTINGS_BACKEND::load_duck(root[name]);
+    }
+
+    std::map<std::string, MixMinusGroup> mix_minus;
+    if (h.mix_minus_len) {
+        const std::string text = snapshot.string(h.mix_minus_off, h.mix_minus_len);
+        Json::Value root;
+        if (!reader->parse(text.data(), text.data() + text.size(), &root, nullptr))
+            return false;
+        for (const std::string& name : root.getMemberNames())
+            mix_minus[name] = SETTINGS_BACKEND::load_mix_minus(root[name]);
+    }
+
+    std::map<std::string, MidiMapping> midi;
+    if (h.midi_len) {
+        const std::string text = snapshot.string(h.midi_off, h.midi_len);
+        Json::Value root;
+        if (!reader->parse(text.data(), text.data() + text.size(), &root, nullptr))
+            return false;
+        for (const std::string& control : root.getMemberNames())
+            midi[control] = SETTINGS_BACKEND::load_midi(root[control]);
+    }
+
+    m_channels.clear();
+    m_input_ids.clear();
+    m_output_ids.clear();
+    m_input_alias_ids.clear();
+    m_output_alias_ids.clear();
+    m_next_input_alias = 0;
+    m_next_output_alias = 0;
+    m_channels.resize(h.n_channels);
+
+    for (channel_id_t i=0; i<h.n_channels; i++) {
+        Channel& c = m_channels[i];
+        c.name   = snapshot.string(records[i].name_off, records[i].name_len);
+        c.alias  = snapshot.string(records[i].alias_off, records[i].alias_len);
+        c.input  = records[i].flags & BINARY_CHANNEL_INPUT;
+        c.active = records[i].flags & BINARY_CHANNEL_ACTIVE;
+        c.shard  = (int)(records[i].flags >> BINARY_CHANNEL_SHARD_SHIFT) - 1;
+        c.volume = records[i].volume;
+        if (inserts.count(i))
+            c.inserts = inserts[i];
+        if (tags.count(i))
+            c.tags = tags[i];
+
+        // aliases are never handed out twice
+        unsigned int& next = c.input ? m_next_input_alias : m_next_output_alias;
+        if (c.alias.size() > 1)
+            next = std::max(next, (unsigned int) std::strtoul(c.alias.c_str() + 1, NULL, 10) + 1);
+
+        if (!c.active)
+            continue;
+        (c.input ? m_input_ids : m_output_ids)[c.name] = i;
+        (c.input ? m_input_alias_ids : m_output_alias_ids)[c.alias] = i;
+    }
+
+    m_routing = RoutingMatrix();
+    m_routing.resize(h.n_channels);
+    uint32_t row = 0;
+    for (channel_id_t i=0; i<h.n_channels; i++) {
+        if (m_channels[i].input)
+            continue;
+        if (row >= h.n_rows)
+            return false;
+        if (m_channels[i].active)
+            m_routing.assign_row(i, snapshot.routing_row(row), h.row_words);
+        row++;
+    }
+
+    m_monitor = h.monitor < h.n_channels && m_channels[h.monitor].active ? h.monitor : NO_CHANNEL;
+    m_scenes  = scenes;
+    m_external = external;
+    m_ducks = ducks;
+    m_mix_minus = mix_minus;
+    m_midi = midi;
+    m_shard_count = h.shard_count;
+    return true;
+}
+
+///
+/// Queue a snapshot of the settings (written by the journal thread)
+///
 void Settings::save() {
-    SETTINGS_BACKEND backend(m_filename);
-    backend.m_input_volumes    = m_input_volumes;
-    backend.m_output_volumes   = m_output_volumes;
-    backend.m_connections      = m_connections;
-    backend.m_monitoring_input = m_monitoring_input;
-    backend.m_monitor_channel  = m_monitor_channel;
-    backend.save();
+    compact();
+}
+
+///
+/// Block until every change made so far is on disk
+///
+void Settings::flush() {
+    m_journal.flush();
+}
+
+///
+/// Snapshot the settings into the config file and empty the journal
+///
+void Settings::compact() {
+    TRACE_SCOPE("settings compact");
+    std::shared_ptr<SETTINGS_BACKEND> backend = std::make_shared<SETTINGS_BACKEND>(m_filename);
+    const Scene state = snapshot();
+    backend->m_input_volumes    = state.input_volumes;
+    backend->m_output_volumes   = state.output_volumes;
+    backend->m_connections      = state.connections;
+    backend->m_monitoring_input = state.monitoring_input;
+    backend->m_monitor_channel  = state.monitor_channel;
+    backend->m_scenes           = m_scenes;
+    for (const auto& p : m_external)
+        backend->m_external[p.first].assign(p.second.begin(), p.second.end());
+    backend->m_shard_count = m_shard_count;
+    for (const Channel& c : m_channels)
+        if (c.active && !c.input && c.shard >= 0)
+            backend->m_output_shards[c.name] = c.shard;
+    for (const Channel& c : m_channels)
+        if (c.active && !c.inserts.empty())
+            (c.input ? backend->m_input_inserts : backend->m_output_inserts)[c.name] = c.inserts;
+    for (const Channel& c : m_channels)
+        if (c.active && !c.tags.empty())
+            (c.input ? backend->m_input_tags : backend->m_output_tags)[c.name].assign(c.tags.begin(), c.tags.end());
+    backend->m_ducks = m_ducks;
+    backend->m_mix_minus = m_mix_minus;
+    backend->m_midi = m_midi;
+    backend->m_journal_seq      = m_journal_seq;
+
+    const std::string binary = compile_binary();
+    const std::string binary_path = binary_filename();
+    // (the snapshot is stamped and on disk before the config is renamed
+    // into place, so the config watcher never takes it for an outside edit)
+    m_journal.compact([backend, binary, binary_path](){
+        backend->save([&binary, &binary_path](const std::string& written){
+            BinaryConfig::write(binary_path, binary, written);
+        });
+    });
+
+    m_compacted_seq = m_journal_seq;
+    m_compacted_at  = std::chrono::steady_clock::now();
+}
+
+///
+/// Journal a change (compacts every JOURNAL_COMPACT_RECORDS records or
+/// JOURNAL_COMPACT_SECONDS seconds)
+///
+void Settings::journal(Json::Value record) {
+    if (m_replaying)
+        return;
+
+    record["seq"] = (Json::UInt64) ++m_journal_seq;
+
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "";
+    m_journal.append(Json::writeString(builder, record) + "\n");
+
+    if (m_journal_seq - m_compacted_seq >= JOURNAL_COMPACT_RECORDS ||
+            std::chrono::steady_clock::now() - m_compacted_at >= std::chrono::seconds(JOURNAL_COMPACT_SECONDS))
+        compact();
+}
+
+///
+/// Journal the whole row of an output
+///
+void Settings::journal_row(const channel_id_t output) {
+    if (m_replaying)
+        return;
+
+    Json::Value record;
+    record["op"]  = "row";
+    record["out"] = m_channels[output].name;
+    record["ins"] = Json::Value(Json::arrayValue);
+    for (size_t i : m_routing.row_bits(output))
+        record["ins"].append(m_channels[i].name);
+    journal(record);
+}
+
+///
+/// Apply a journaled change
+///
+void Settings::replay(const Json::Value& record) {
+    const std::string op = record["op"].asString();
+    const bool input = record["in"].asBool();
+    const std::string name = record["name"].asString();
+
+    if (op == "add") {
+        if (input) add_input(name, record["vol"].asFloat());
+        else       add_output(name, record["vol"].asFloat());
+    } else if (op == "rm") {
+        if (input) remove_input(name);
+        else       remove_output(name);
+    } else if (op == "ren") {
+        if (input) rename_input(name, record["to"].asString());
+        else       rename_output(name, record["to"].asString());
+    } else if (op == "vol") {
+        if (input) set_input_volume(name, record["vol"].asFloat());
+        else       set_output_volume(name, record["vol"].asFloat());
+    } else if (op == "mon") {
+        if (input) monitor_input(name);
+        else       monitor_output(name);
+    } else if (op == "con") {
+        connect(name, record["out"].asString());
+    } else if (op == "dcon") {
+        disconnect(name, record["out"].asString());
+    } else if (op == "con_all") {
+        connect_all(name);
+    } else if (op == "dcon_all") {
+        disconnect_all(name);
+    } else if (op == "row") {
+        const channel_id_t o = find_output(record["out"].asString());
+        if (o == NO_CHANNEL)
+            throw OutputNotFound(record["out"].asString());
+        m_routing.clear_row(o);
+        for (const Json::Value& i : record["ins"])
+            if (is_input(i.asString()))
+                m_routing.set(m_input_ids[i.asString()], o);
+        m_revision++;
+    } else if (op == "scene") {
+        m_scenes[name] = SETTINGS_BACKEND::load_scene(record["scene"]);
+    } else if (op == "scene_rm") {
+        m_scenes.erase(name);
+    } else if (op == "shards") {
+        set_shard_count(record["count"].asUInt());
+    } else if (op == "shard") {
+        set_output_shard(name, record["shard"].asInt());
+    } else if (op == "inserts") {
+        set_inserts(name, input, SETTINGS_BACKEND::load_inserts(record["chain"]));
+    } else if (op == "tags") {
+        std::set<std::string> tags;
+        for (const Json::Value& tag : record["tags"])
+            tags.insert(tag.asString());
+        set_tags(name, input, tags);
+    } else if (op == "duck") {
+        set_duck(name, SETTINGS_BACKEND::load_duck(record["rule"]));
+    } else if (op == "duck_rm") {
+        remove_duck(name);
+    } else if (op == "mm") {
+        set_mix_minus(name, SETTINGS_BACKEND::load_mix_minus(record["group"]));
+    } else if (op == "mm_rm") {
+        remove_mix_minus(name);
+    } else if (op == "midi") {
+        set_midi(name, SETTINGS_BACKEND::load_midi(record["mapping"]));
+    } else if (op == "midi_rm") {
+        remove_midi(name);
+    } else if (op == "ext") {
+        set_external(name, record["other"].asString(), record["on"].asBool());
+    }
 }
 
 Settings::~Settings(){
-    return;
+    m_journal.stop();
 }
 
 template<typename TK, typename TV>
@@ -47,20 +626,289 @@ std::vector<TK> get_map_keys(std::map<TK, TV> const& input_map) {
     return retval;
 }
 
+///
+/// Get sorted names of the channels in an id index
+///
+const std::vector<std::string> Settings::get_names(const std::unordered_map<std::string, channel_id_t>& ids) {
+    std::vector<std::string> names;
+    names.reserve(ids.size());
+    for (const auto& p : ids)
+        names.push_back(p.first);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+
+///
+/// Whether `selector` can match several channels: `@tag`, `/regex/` or a
+/// glob (`*`, `?`, `[...]`)
+///
+const bool Settings::is_selector(const std::string& selector) {
+    if (selector.empty())
+        return false;
+    if (selector[0] == '@')
+        return true;
+    if (selector.size() > 1 && selector.front() == '/' && selector.back() == '/')
+        return true;
+    return selector.find_first_of("*?[") != std::string::npos;
+}
+
+///
+/// Sorted names of the inputs (or outputs) `selector` matches. A name or
+/// alias is looked up as-is, even if it looks like a pattern; a pattern
+/// that matches nothing throws `NoMatch`.
+///
+const std::vector<std::string> Settings::select(const std::string& selector, const bool input) {
+    const channel_id_t id = input ? find_input(selector) : find_output(selector);
+    if (id != NO_CHANNEL)
+        return {m_channels[id].name};
+    if (!is_selector(selector)) {
+        if (input) throw InputNotFound(selector);
+        else       throw OutputNotFound(selector);
+    }
+
+    std::function<bool(const Channel&)> match;
+    if (selector[0] == '@') {
+        const std::string tag = selector.substr(1);
+        match = [tag](const Channel& c){ return c.tags.count(tag) > 0; };
+    } else if (selector[0] == '/') {
+        std::shared_ptr<std::regex> re;
+        try {
+            re = std::make_shared<std::regex>(selector.substr(1, selector.size() - 2));
+        } catch (std::regex_error& e) {
+            throw InvalidSelector(selector);
+        }
+        match = [re](const Channel& c){ return std::regex_match(c.name, *re); };
+    } else {
+        match = [&selector](const Channel& c){ return ::fnmatch(selector.c_str(), c.name.c_str(), 0) == 0; };
+    }
+
+    const std::unordered_map<std::string, channel_id_t>& ids = input ? m_input_ids : m_output_ids;
+    std::vector<std::string> names;
+    for (const std::string& name : get_names(ids))
+        if (match(m_channels[ids.at(name)]))
+            names.push_back(name);
+    if (names.empty())
+        throw NoMatch(selector, input);
+    return names;
+}
+
+///
+/// Jack port names (without client) of a channel
+///
+const std::vector<std::string> Settings::channel_ports(const std::string& name, const bool input) {
+    if (input)
+        return {name+LEFT_SUFFIX, name+RIGHT_SUFFIX, name+OUT_SUFFIX+LEFT_SUFFIX, name+OUT_SUFFIX+RIGHT_SUFFIX};
+    return {name+LEFT_SUFFIX, name+RIGHT_SUFFIX};
+}
+
+///
+/// Carry the external connections of a channel over to its new name
+///
+void Settings::move_external(const std::string& name, const std::string& new_name, const bool input) {
+    const std::vector<std::string> from = channel_ports(name, input);
+    const std::vector<std::string> to = channel_ports(new_name, input);
+    for (size_t i=0; i<from.size(); i++) {
+        auto it = m_external.find(from[i]);
+        if (it == m_external.end())
+            continue;
+        m_external[to[i]] = it->second;
+        m_external.erase(from[i]);
+    }
+}
+
+///
+/// Point the ducking rules at the new name of a channel (drop it from
+/// them if `new_name` is empty)
+///
+void Settings::move_ducks(const std::string& name, const std::string& new_name, const bool input) {
+    for (auto& p : m_ducks) {
+        DuckRule& rule = p.second;
+        std::vector<std::string>& targets = input ? rule.inputs : rule.outputs;
+        for (auto it = targets.begin(); it != targets.end(); ) {
+            if (*it != name) {
+                ++it;
+            } else if (new_name.empty()) {
+                it = targets.erase(it);
+            } else {
+                *it++ = new_name;
+            }
+        }
+        if (input && rule.key == name && !new_name.empty())
+            rule.key = new_name;
+    }
+}
+
+///
+/// Point the MIDI mappings at the new name of a channel (drop the ones
+/// of it if `new_name` is empty)
+///
+void Settings::move_midi(const std::string& name, const std::string& new_name, const bool input) {
+    for (auto it = m_midi.begin(); it != m_midi.end(); ) {
+        if (it->second.input != input || it->second.target != name) {
+            ++it;
+        } else if (new_name.empty()) {
+            it = m_midi.erase(it);
+        } else {
+            (it++)->second.target = new_name;
+        }
+    }
+}
+
+///
+/// Point the mix-minus groups at the new name of an input (drop it from
+/// them if `new_name` is empty), along with the external connections of
+/// its returns
+///
+void Settings::move_mix_minus(const std::string& name, const std::string& new_name) {
+    for (auto& p : m_mix_minus) {
+        std::vector<std::string>& participants = p.second.participants;
+        const auto it = std::find(participants.begin(), participants.end(), name);
+        if (it == participants.end())
+            continue;
+
+        if (new_name.empty()) {
+            participants.erase(it);
+            forget_return(p.first, name);
+            continue;
+        }
+        *it = new_name;
+        for (const char* suffix : {LEFT_SUFFIX, RIGHT_SUFFIX}) {
+            const auto ext = m_external.find(return_name(p.first, name) + suffix);
+            if (ext == m_external.end())
+                continue;
+            m_external[return_name(p.first, new_name) + suffix] = ext->second;
+            m_external.erase(ext);
+        }
+    }
+}
+
+///
+/// Forget the external connections of a mix-minus return that goes away
+///
+void Settings::forget_return(const std::string& group, const std::string& participant) {
+    m_external.erase(return_name(group, participant) + LEFT_SUFFIX);
+    m_external.erase(return_name(group, participant) + RIGHT_SUFFIX);
+}
+
+///
+/// Create channel with a new id and alias
+///
+const channel_id_t Settings::add_channel(const std::string& name, const bool input, float vol) {
+    TRACE_SCOPE("settings add channel");
+    const channel_id_t id = m_channels.size();
+
+    Channel c;
+    c.name   = name;
+    c.input  = input;
+    c.active = true;
+    c.volume = vol;
+    c.shard  = -1;
+    if (input) {
+        c.alias = "I" + std::to_string(m_next_input_alias++);
+        m_input_ids[name] = id;
+        m_input_alias_ids[c.alias] = id;
+    } else {
+        c.alias = "O" + std::to_string(m_next_output_alias++);
+        m_output_ids[name] = id;
+        m_output_alias_ids[c.alias] = id;
+    }
+    m_channels.push_back(c);
+    m_routing.resize(m_channels.size());
+
+    m_revision++;
+    return id;
+}
+
+///
+/// Deactivate channel and drop it from the indexes (its id stays reserved)
+///
+void Settings::remove_channel(const channel_id_t id) {
+    TRACE_SCOPE("settings remove channel");
+    Channel& c = m_channels[id];
+    if (c.input) {
+        m_input_ids.erase(c.name);
+        m_input_alias_ids.erase(c.alias);
+        m_routing.clear_column(id);
+    } else {
+        m_output_ids.erase(c.name);
+        m_output_alias_ids.erase(c.alias);
+        m_routing.clear_row(id);
+    }
+    c.active = false;
+    c.volume_listeners = {};
+    for (const std::string& port : channel_ports(c.name, c.input))
+        m_external.erase(port);
+    move_ducks(c.name, "", c.input);
+    move_midi(c.name, "", c.input);
+    if (c.input)
+        move_mix_minus(c.name, "");
+
+    if (m_monitor == id)
+        m_monitor = NO_CHANNEL;
+    m_revision++;
+}
+
+
+///
+/// Get id of input by name or alias (NO_CHANNEL if not found)
+///
+const channel_id_t Settings::find_input(const std::string& input) {
+    auto it = m_input_ids.find(input);
+    if (it != m_input_ids.end())
+        return it->second;
+    it = m_input_alias_ids.find(input);
+    if (it != m_input_alias_ids.end())
+        return it->second;
+    return NO_CHANNEL;
+}
+
+///
+/// Get id of output by name or alias (NO_CHANNEL if not found)
+///
+const channel_id_t Settings::find_output(const std::string& output) {
+    auto it = m_output_ids.find(output);
+    if (it != m_output_ids.end())
+        return it->second;
+    it = m_output_alias_ids.find(output);
+    if (it != m_output_alias_ids.end())
+        return it->second;
+    return NO_CHANNEL;
+}
+
+///
+/// Get channel by id
+///
+const Channel& Settings::channel(const channel_id_t id) {
+    return m_channels[id];
+}
 
 ///
-/// Generate io name aliases
+/// Get number of ids handed out so far (including removed channels)
+///
+const size_t Settings::channel_count() {
+    return m_channels.size();
+}
+
+
+///
+/// Renumber io name aliases (I0..In, O0..On in name order)
 ///
 void Settings::gen_aliases() {
-    m_input_aliases = {};
-    m_output_aliases = {};
-    int counter = 0;
-    for (auto p : m_input_volumes) {
-        m_input_aliases["I" + std::to_string(counter++)] = p.first;
+    m_input_alias_ids.clear();
+    m_output_alias_ids.clear();
+    m_next_input_alias = 0;
+    m_next_output_alias = 0;
+
+    for (const std::string& i : get_inputs()) {
+        Channel& c = m_channels[m_input_ids[i]];
+        c.alias = "I" + std::to_string(m_next_input_alias++);
+        m_input_alias_ids[c.alias] = m_input_ids[i];
     }
-    counter = 0;
-    for (auto p : m_output_volumes) {
-        m_output_aliases["O" + std::to_string(counter++)] = p.first;
+    for (const std::string& o : get_outputs()) {
+        Channel& c = m_channels[m_output_ids[o]];
+        c.alias = "O" + std::to_string(m_next_output_alias++);
+        m_output_alias_ids[c.alias] = m_output_ids[o];
     }
 }
 
@@ -69,16 +917,14 @@ void Settings::gen_aliases() {
 /// Return true if input is alias
 ///
 const bool Settings::is_input_alias(const std::string& input) {
-    return (m_input_aliases.find(input) != m_input_aliases.end());
+    return (m_input_alias_ids.find(input) != m_input_alias_ids.end());
 }
 
 ///
 /// Return true if output is alias
 ///
 const bool Settings::is_output_alias(const std::string& output) {
-    bool out = (m_output_aliases.find(output) != m_output_aliases.end());
-    /* std::cout << out << std::endl; */
-    return out;
+    return (m_output_alias_ids.find(output) != m_output_alias_ids.end());
 }
 
 
@@ -86,8 +932,9 @@ const bool Settings::is_output_alias(const std::string& output) {
 /// Get real name of input (return input if not found in aliases)
 ///
 const std::string Settings::get_input_name(const std::string& input) {
-    if (is_input_alias(input))
-        return m_input_aliases[input];
+    auto it = m_input_alias_ids.find(input);
+    if (it != m_input_alias_ids.end())
+        return m_channels[it->second].name;
     return input;
 }
 
@@ -95,9 +942,9 @@ const std::string Settings::get_input_name(const std::string& input) {
 /// Get real name of output (return output if not found in aliases)
 ///
 const std::string Settings::get_output_name(const std::string& output) {
-    if (is_output_alias(output)) {
-        return m_output_aliases[output];
-    }
+    auto it = m_output_alias_ids.find(output);
+    if (it != m_output_alias_ids.end())
+        return m_channels[it->second].name;
     return output;
 }
 
@@ -106,54 +953,60 @@ const std::string Settings::get_output_name(const std::string& output) {
 /// Get name of channel being monitored
 ///
 const std::string Settings::get_monitor() {
-    return m_monitor_channel;
+    if (m_monitor == NO_CHANNEL)
+        return "";
+    return m_channels[m_monitor].name;
 }
 
 ///
 /// Return true if channel being monitored is input
 ///
 const bool Settings::monitoring_input() {
-    return m_monitoring_input;
+    return m_monitor != NO_CHANNEL && m_channels[m_monitor].input;
 }
 
 ///
 /// Return true if channel being monitored is output
 ///
 const bool Settings::monitoring_output() {
-    return !m_monitoring_input;
+    return !monitoring_input();
 }
 
 ///
-/// Get vector containing all input aliases
+/// Get vector containing all input aliases (in id order)
 ///
 const std::vector<std::string> Settings::get_input_aliases() {
-    return get_map_keys(m_input_aliases);
+    std::vector<std::string> aliases;
+    for (const Channel& c : m_channels)
+        if (c.active && c.input)
+            aliases.push_back(c.alias);
+    return aliases;
 }
 
 ///
-/// Get vector containing all output aliases
+/// Get vector containing all output aliases (in id order)
 ///
 
 const std::vector<std::string> Settings::get_output_aliases() {
-    return get_map_keys(m_output_aliases);
+    std::vector<std::string> aliases;
+    for (const Channel& c : m_channels)
+        if (c.active && !c.input)
+            aliases.push_back(c.alias);
+    return aliases;
 }
 
 ///
 /// Get vector containing the names of all inputs
 ///
 const std::vector<std::string> Settings::get_inputs() {
-    std::vector<std::string> inputs = get_map_keys(m_input_volumes);
-
-    return inputs;
+    return get_names(m_input_ids);
 }
 
 ///
 /// Get vector containing the names of all outputs
 ///
 const std::vector<std::string> Settings::get_outputs() {
-    std::vector<std::string> outputs = get_map_keys(m_output_volumes);
-
-    return outputs;
+    return get_names(m_output_ids);
 }
 
 
@@ -161,7 +1014,40 @@ const std::vector<std::string> Settings::get_outputs() {
 /// Get vector containing the names of all inputs connected to output
 ///
 const std::vector<std::string> Settings::get_connections(const std::string& output) {
-    return m_connections[get_output_name(output)];
+    std::vector<std::string> connected;
+    const channel_id_t o = find_output(output);
+    if (o == NO_CHANNEL)
+        return connected;
+
+    for (size_t i : m_routing.row_bits(o))
+        connected.push_back(m_channels[i].name);
+    return connected;
+}
+
+///
+/// Get ids of all inputs connected to output id
+///
+const std::vector<channel_id_t> Settings::get_sources(const channel_id_t output) {
+    std::vector<channel_id_t> sources;
+    for (size_t i : m_routing.row_bits(output))
+        sources.push_back(i);
+    return sources;
+}
+
+///
+/// Dump the routing matrix: a header line with the input id of each
+/// input, then one `<output>=<hex>` line per output where bit n of hex
+/// is set when input id n is connected.
+///
+const std::string Settings::get_matrix() {
+    std::string out = "#";
+    for (const Channel& c : m_channels)
+        if (c.active && c.input)
+            out += " " + std::to_string(&c - &m_channels[0]) + ":" + c.name;
+
+    for (const std::string& o : get_outputs())
+        out += "\n" + o + "=" + m_routing.row_hex(m_output_ids[o]);
+    return out;
 }
 
 
@@ -169,26 +1055,18 @@ const std::vector<std::string> Settings::get_connections(const std::string& outp
 /// Check if input is in inputs
 ///
 const bool Settings::is_input(const std::string& input, const bool check_alias) {
-    std::string i;
     if (check_alias)
-         i = get_input_name(input);
-    else i = input;
-
-    std::vector<std::string> ins = get_inputs();
-    return (std::find(ins.begin(), ins.end(), i) != ins.end());
+        return find_input(input) != NO_CHANNEL;
+    return m_input_ids.find(input) != m_input_ids.end();
 }
 
 ///
 /// Check if output is in outputs
 ///
 const bool Settings::is_output(const std::string& output, const bool check_alias) {
-    std::string o;
     if (check_alias)
-         o = get_output_name(output);
-    else o = output;
-
-    std::vector<std::string> outs = get_outputs();
-    return (std::find(outs.begin(), outs.end(), o) != outs.end());
+        return find_output(output) != NO_CHANNEL;
+    return m_output_ids.find(output) != m_output_ids.end();
 }
 
 
@@ -196,18 +1074,34 @@ const bool Settings::is_output(const std::string& output, const bool check_alias
 /// Add input to inputs with volume vol (default=1)
 ///
 void Settings::add_input(const std::string& name, float vol) {
-    m_input_volumes[name] = vol;
-
-    gen_aliases();
+    Json::Value record;
+    record["op"] = "add"; record["in"] = true; record["name"] = name; record["vol"] = vol;
+    journal(record);
+
+    const channel_id_t i = find_input(name);
+    if (i != NO_CHANNEL && m_channels[i].name == name) {
+        m_channels[i].volume = vol;
+        m_revision++;
+        return;
+    }
+    add_channel(name, true, vol);
 }
 
 ///
 /// Add output to outputs with volume vol (default=1)
 ///
 void Settings::add_output(const std::string& name, float vol) {
-    m_output_volumes[name] = vol;
-
-    gen_aliases();
+    Json::Value record;
+    record["op"] = "add"; record["in"] = false; record["name"] = name; record["vol"] = vol;
+    journal(record);
+
+    const channel_id_t o = find_output(name);
+    if (o != NO_CHANNEL && m_channels[o].name == name) {
+        m_channels[o].volume = vol;
+        m_revision++;
+        return;
+    }
+    add_channel(name, false, vol);
 }
 
 
@@ -215,14 +1109,82 @@ void Settings::add_output(const std::string& name, float vol) {
 /// Remove input
 ///
 void Settings::remove_input(const std::string& input) {
-    m_input_volumes.erase(get_input_name(input));
+    const channel_id_t i = find_input(input);
+    if (i == NO_CHANNEL)
+        return;
+
+    Json::Value record;
+    record["op"] = "rm"; record["in"] = true; record["name"] = m_channels[i].name;
+    journal(record);
+    remove_channel(i);
 }
 
 ///
 /// Remove output
 ///
 void Settings::remove_output(const std::string& output) {
-    m_output_volumes.erase(get_output_name(output));
+    const channel_id_t o = find_output(output);
+    if (o == NO_CHANNEL)
+        return;
+
+    Json::Value record;
+    record["op"] = "rm"; record["in"] = false; record["name"] = m_channels[o].name;
+    journal(record);
+    remove_channel(o);
+}
+
+
+///
+/// Rename input (keeps its id, alias, volume and connections)
+///
+void Settings::rename_input(const std::string& input, const std::string& new_name) {
+    TRACE_SCOPE("settings rename input");
+    const channel_id_t i = find_input(input);
+    if (i == NO_CHANNEL)
+        throw InputNotFound(input);
+    // (another name or alias would lose its channel)
+    const channel_id_t taken = find_input(new_name);
+    if (taken != NO_CHANNEL && taken != i)
+        throw InputExists(new_name);
+
+    Json::Value record;
+    record["op"] = "ren"; record["in"] = true; record["name"] = m_channels[i].name; record["to"] = new_name;
+    journal(record);
+
+    move_external(m_channels[i].name, new_name, true);
+    move_ducks(m_channels[i].name, new_name, true);
+    move_midi(m_channels[i].name, new_name, true);
+    move_mix_minus(m_channels[i].name, new_name);
+    m_input_ids.erase(m_channels[i].name);
+    m_channels[i].name = new_name;
+    m_input_ids[new_name] = i;
+    m_revision++;
+}
+
+///
+/// Rename output (keeps its id, alias, volume and connections)
+///
+void Settings::rename_output(const std::string& output, const std::string& new_name) {
+    TRACE_SCOPE("settings rename output");
+    const channel_id_t o = find_output(output);
+    if (o == NO_CHANNEL)
+        throw OutputNotFound(output);
+    // (another name or alias would lose its channel)
+    const channel_id_t taken = find_output(new_name);
+    if (taken != NO_CHANNEL && taken != o)
+        throw OutputExists(new_name);
+
+    Json::Value record;
+    record["op"] = "ren"; record["in"] = false; record["name"] = m_channels[o].name; record["to"] = new_name;
+    journal(record);
+
+    move_external(m_channels[o].name, new_name, false);
+    move_ducks(m_channels[o].name, new_name, false);
+    move_midi(m_channels[o].name, new_name, false);
+    m_output_ids.erase(m_channels[o].name);
+    m_channels[o].name = new_name;
+    m_output_ids[new_name] = o;
+    m_revision++;
 }
 
 
@@ -230,117 +1192,269 @@ void Settings::remove_output(const std::string& output) {
 /// Get volume of input
 ///
 const float Settings::get_input_volume(const std::string& input){
-    const std::string i = get_input_name(input);
-    if (!is_input(i))
-        throw InputNotFound(i);
+    const channel_id_t i = find_input(input);
+    if (i == NO_CHANNEL)
+        throw InputNotFound(input);
 
-    return m_input_volumes[i];
+    return m_channels[i].volume;
 }
 
 ///
 /// Get volume of output
 ///
 const float Settings::get_output_volume(const std::string& output){
-    const std::string o = get_output_name(output);
-    if (!is_output(o))
-        throw OutputNotFound(o);
+    const channel_id_t o = find_output(output);
+    if (o == NO_CHANNEL)
+        throw OutputNotFound(output);
 
-    return m_output_volumes[o];
+    return m_channels[o].volume;
 }
 
 ///
 /// Set monitor to copy input channel
 ///
 void Settings::monitor_input(const std::string input) {
-    const std::string i = get_input_name(input);
-    if (!is_input(i))
-        throw InputNotFound(i);
-    m_monitoring_input = true;
-    m_monitor_channel = i;
+    TRACE_SCOPE("settings monitor input");
+    const channel_id_t i = find_input(input);
+    if (i == NO_CHANNEL)
+        throw InputNotFound(input);
+
+    Json::Value record;
+    record["op"] = "mon"; record["in"] = true; record["name"] = m_channels[i].name;
+    journal(record);
+
+    m_monitor = i;
+    m_revision++;
 }
 
 ///
 /// Set monitor to copy output channel
 ///
 void Settings::monitor_output(const std::string output) {
-    const std::string o = get_output_name(output);
-    if (!is_output(o))
-        throw OutputNotFound(o);
-    m_monitoring_input = false;
-    m_monitor_channel = o;
+    TRACE_SCOPE("settings monitor output");
+    const channel_id_t o = find_output(output);
+    if (o == NO_CHANNEL)
+        throw OutputNotFound(output);
+
+    Json::Value record;
+    record["op"] = "mon"; record["in"] = false; record["name"] = m_channels[o].name;
+    journal(record);
+
+    m_monitor = o;
+    m_revision++;
 }
 
 ///
-/// Set volume of input
+/// Set volume of channel and notify its listeners
 ///
-void Settings::set_input_volume(const std::string& input, float new_vol) {
-    const std::string i = get_input_name(input);
-    if (!is_input(i))
-        throw InputNotFound(i);
+void Settings::set_volume(const channel_id_t id, float new_vol) {
+    TRACE_SCOPE("settings set volume");
+    Channel& c = m_channels[id];
 
     new_vol = new_vol > 1 ? 1 : new_vol;
     new_vol = new_vol < 0 ? 0 : new_vol;
-    m_input_volumes[i] = new_vol;
+    c.volume = new_vol;
+    m_revision++;
+
+    Json::Value record;
+    record["op"] = "vol"; record["in"] = c.input; record["name"] = c.name; record["vol"] = new_vol;
+    journal(record);
 
     std::string noti = std::to_string(new_vol*100);
-    for (int fd : m_input_volume_listeners[i]) {
+    Metrics::count("jamyxer_volume_changes");
+    Metrics::count("jamyxer_volume_notifications", "", c.volume_listeners.size());
+    for (int fd : c.volume_listeners) {
         ::send(fd, noti.c_str(), noti.length()-1, 0);
-        std::cout << "sent response to listener on fd: " << fd << "\n";
+        LOG_DEBUG("sent response to listener on fd: %d", fd);
     }
-    m_input_volume_listeners[i] = {};
+    c.volume_listeners = {};
 }
 
 ///
-/// Set volume of output
+/// Set volume of input
 ///
-void Settings::set_output_volume(const std::string& output, float new_vol) {
-    const std::string o = get_output_name(output);
+void Settings::set_input_volume(const std::string& input, float new_vol) {
+    const channel_id_t i = find_input(input);
+    if (i == NO_CHANNEL)
+        throw InputNotFound(input);
 
-    if (!is_output(o))
-        throw OutputNotFound(o);
+    set_volume(i, new_vol);
+}
 
-    new_vol = new_vol > 1 ? 1 : new_vol;
-    new_vol = new_vol < 0 ? 0 : new_vol;
-    m_output_volumes[o] = new_vol;
+///
+/// Set volume of output
+///
+void Settings::set_output_volume(const std::string& output, float new_vol) {
+    const channel_id_t o = find_output(output);
+    if (o == NO_CHANNEL)
+        throw OutputNotFound(output);
 
-    std::string noti = std::to_string(new_vol*100);
-    for (int fd : m_output_volume_listeners[o]) {
-        ::send(fd, noti.c_str(), noti.length()-1, 0);
-        std::cout << "sent response to listener on fd: " << fd << "\n";
-    }
-    m_output_volume_listeners[o] = {};
+    set_volume(o, new_vol);
 }
 
 ///
 /// Connect input with output if not already connected
 ///
 void Settings::connect(const std::string& input, const std::string& output) {
-    const std::string i = get_input_name(input);
-    const std::string o = get_output_name(output);
+    TRACE_SCOPE("settings connect");
+    const channel_id_t i = find_input(input);
+    const channel_id_t o = find_output(output);
+
+    if (i == NO_CHANNEL)
+        throw InputNotFound(input);
+    if (o == NO_CHANNEL)
+        throw OutputNotFound(output);
 
-    if (!is_input(i))
-        throw InputNotFound(i);
-    if (!is_output(o))
-        throw OutputNotFound(o);
+    m_routing.set(i, o);
+    m_revision++;
 
-    std::vector<std::string> output_connections = m_connections[o];
-    if (find(begin(output_connections), end(output_connections), i) == end(output_connections))
-        m_connections[o].push_back(i);
+    Json::Value record;
+    record["op"] = "con"; record["name"] = m_channels[i].name; record["out"] = m_channels[o].name;
+    journal(record);
 }
 
 ///
 /// Disconnect input and output if not already disconnected
 ///
 void Settings::disconnect(const std::string& input, const std::string& output) {
-    const std::string i = get_input_name(input);
-    const std::string o = get_output_name(output);
+    TRACE_SCOPE("settings disconnect");
+    const channel_id_t i = find_input(input);
+    const channel_id_t o = find_output(output);
+
+    if (i == NO_CHANNEL)
+        throw InputNotFound(input);
+    if (o == NO_CHANNEL)
+        throw OutputNotFound(output);
+
+    m_routing.clear(i, o);
+    m_revision++;
+
+    Json::Value record;
+    record["op"] = "dcon"; record["name"] = m_channels[i].name; record["out"] = m_channels[o].name;
+    journal(record);
+}
+
+///
+/// Connect input to every output
+///
+void Settings::connect_all(const std::string& input) {
+    TRACE_SCOPE("settings connect all");
+    const channel_id_t i = find_input(input);
+    if (i == NO_CHANNEL)
+        throw InputNotFound(input);
+
+    for (const auto& p : m_output_ids)
+        m_routing.set(i, p.second);
+    m_revision++;
+
+    Json::Value record;
+    record["op"] = "con_all"; record["name"] = m_channels[i].name;
+    journal(record);
+}
 
-    if (!is_input(i))
-        throw InputNotFound(i);
-    if (!is_output(o))
-        throw OutputNotFound(o);
+///
+/// Disconnect input from every output
+///
+void Settings::disconnect_all(const std::string& input) {
+    TRACE_SCOPE("settings disconnect all");
+    const channel_id_t i = find_input(input);
+    if (i == NO_CHANNEL)
+        throw InputNotFound(input);
+
+    m_routing.clear_column(i);
+    m_revision++;
+
+    Json::Value record;
+    record["op"] = "dcon_all"; record["name"] = m_channels[i].name;
+    journal(record);
+}
+
+///
+/// Disconnect every input from output
+///
+void Settings::clear_connections(const std::string& output) {
+    TRACE_SCOPE("settings clear connections");
+    const channel_id_t o = find_output(output);
+    if (o == NO_CHANNEL)
+        throw OutputNotFound(output);
+
+    m_routing.clear_row(o);
+    m_revision++;
+    journal_row(o);
+}
+
+///
+/// Connect output `dst` to exactly the inputs connected to output `src`
+///
+void Settings::copy_connections(const std::string& src, const std::string& dst) {
+    TRACE_SCOPE("settings copy connections");
+    const channel_id_t s = find_output(src);
+    const channel_id_t d = find_output(dst);
+
+    if (s == NO_CHANNEL)
+        throw OutputNotFound(src);
+    if (d == NO_CHANNEL)
+        throw OutputNotFound(dst);
+
+    m_routing.copy_row(s, d);
+    m_revision++;
+    journal_row(d);
+}
+
+///
+/// Replace the connections of several outputs at once from
+/// (output, hex) pairs (see `get_matrix`). Nothing is changed if any
+/// row is invalid, or not as long as a row of the matrix (a row cut short
+/// would shift every bit).
+///
+void Settings::set_matrix(const std::vector<std::pair<std::string, std::string>>& rows) {
+    TRACE_SCOPE("settings set matrix");
+    std::vector<std::pair<channel_id_t, std::vector<RoutingMatrix::word_t>>> parsed;
+
+    for (const auto& r : rows) {
+        const channel_id_t o = find_output(r.first);
+        if (o == NO_CHANNEL)
+            throw OutputNotFound(r.first);
+
+        std::vector<RoutingMatrix::word_t> bits;
+        if (r.second.size() != m_routing.hex_digits() || !RoutingMatrix::parse_hex(r.second, bits))
+            throw InvalidMatrix(r.first+"="+r.second);
+
+        // only keep bits of existing inputs
+        for (size_t w=0; w<bits.size(); w++) {
+            for (RoutingMatrix::word_t b = bits[w]; b; b &= b - 1) {
+                const size_t i = w*RoutingMatrix::WORD_BITS + __builtin_ctzll(b);
+                if (i >= m_channels.size() || !m_channels[i].active || !m_channels[i].input)
+                    throw InvalidMatrix(r.first+"="+r.second);
+            }
+        }
+        parsed.push_back({o, bits});
+    }
+
+    for (const auto& p : parsed) {
+        m_routing.assign_row(p.first, p.second);
+        journal_row(p.first);
+    }
+    m_revision++;
+}
+
+///
+/// Connect output to exactly `inputs` (unknown inputs are ignored)
+///
+void Settings::set_connections(const std::string& output, const std::vector<std::string>& inputs) {
+    TRACE_SCOPE("settings set connections");
+    const channel_id_t o = find_output(output);
+    if (o == NO_CHANNEL)
+        throw OutputNotFound(output);
 
-    m_connections[o].erase(std::find(m_connections[o].begin(), m_connections[o].end(), i));
+    m_routing.clear_row(o);
+    for (const std::string& input : inputs) {
+        const channel_id_t i = find_input(input);
+        if (i != NO_CHANNEL)
+            m_routing.set(i, o);
+    }
+    m_revision++;
+    journal_row(o);
 }
 
 
@@ -348,35 +1462,426 @@ void Settings::disconnect(const std::string& input, const std::string& output) {
 /// Return true if input and output are connected
 ///
 const bool Settings::is_connected(const std::string& input, const std::string& output) {
-    const std::string i = get_input_name(input);
-    const std::string o = get_output_name(output);
+    const channel_id_t i = find_input(input);
+    const channel_id_t o = find_output(output);
 
-    if (!is_input(i))
-        throw InputNotFound(i);
-    if (!is_output(o))
-        throw OutputNotFound(o);
+    if (i == NO_CHANNEL)
+        throw InputNotFound(input);
+    if (o == NO_CHANNEL)
+        throw OutputNotFound(output);
 
-    return (std::find(m_connections[o].begin(), m_connections[o].end(), i) != m_connections[o].end());
+    return m_routing.get(i, o);
 }
 
 ///
 /// Add an input volume listener
 ///
 void Settings::add_input_volume_listener(const std::string& input, const int file_descriptor) {
-    const std::string i = get_input_name(input);
-    if (!is_input(i))
-        throw InputNotFound(i);
+    const channel_id_t i = find_input(input);
+    if (i == NO_CHANNEL)
+        throw InputNotFound(input);
 
-    m_input_volume_listeners[i].push_back(file_descriptor);
+    m_channels[i].volume_listeners.push_back(file_descriptor);
 }
 
 ///
 /// Add an output volume listener
 ///
 void Settings::add_output_volume_listener(const std::string& output, const int file_descriptor) {
-    const std::string o = get_output_name(output);
-    if (!is_output(o))
-        throw OutputNotFound(o);
+    const channel_id_t o = find_output(output);
+    if (o == NO_CHANNEL)
+        throw OutputNotFound(output);
+
+    m_channels[o].volume_listeners.push_back(file_descriptor);
+}
+
+///
+/// Get a copy of the current state as a scene
+///
+const Scene Settings::snapshot() {
+    Scene scene;
+    for (const Channel& c : m_channels) {
+        if (!c.active)
+            continue;
+        if (c.input) {
+            scene.input_volumes[c.name] = c.volume;
+        } else {
+            scene.output_volumes[c.name] = c.volume;
+            if (!m_routing.row_empty(&c - &m_channels[0]))
+                scene.connections[c.name] = get_connections(c.name);
+        }
+    }
+    scene.monitor_channel  = get_monitor();
+    scene.monitoring_input = monitoring_input();
+    return scene;
+}
+
+///
+/// Get stored scene by name
+///
+const Scene& Settings::get_scene(const std::string& name) {
+    if (!is_scene(name))
+        throw SceneNotFound(name);
+
+    return m_scenes[name];
+}
+
+///
+/// Get vector containing the names of all scenes
+///
+const std::vector<std::string> Settings::get_scenes() {
+    return get_map_keys(m_scenes);
+}
+
+///
+/// Return true if scene exists
+///
+const bool Settings::is_scene(const std::string& name) {
+    return (m_scenes.find(name) != m_scenes.end());
+}
+
+///
+/// Store current state as scene `name` (overwrites existing scene)
+///
+void Settings::store_scene(const std::string& name) {
+    store_scene(name, snapshot());
+}
 
-    m_output_volume_listeners[o].push_back(file_descriptor);
+///
+/// Store `scene` as scene `name` (overwrites existing scene)
+///
+void Settings::store_scene(const std::string& name, const Scene& scene) {
+    TRACE_SCOPE("settings store scene");
+    m_scenes[name] = scene;
+
+    Json::Value record;
+    record["op"] = "scene"; record["name"] = name; record["scene"] = SETTINGS_BACKEND::save_scene(m_scenes[name]);
+    journal(record);
+}
+
+///
+/// Remove scene
+///
+void Settings::remove_scene(const std::string& name) {
+    TRACE_SCOPE("settings remove scene");
+    if (!is_scene(name))
+        throw SceneNotFound(name);
+
+    m_scenes.erase(name);
+
+    Json::Value record;
+    record["op"] = "scene_rm"; record["name"] = name;
+    journal(record);
+}
+
+///
+/// Get the number of bus shards (0: everything in one jack client)
+///
+const unsigned int Settings::shard_count() {
+    return m_shard_count;
+}
+
+///
+/// Set the number of bus shards (used on the next connection to jack)
+///
+void Settings::set_shard_count(const unsigned int count) {
+    TRACE_SCOPE("settings set shard count");
+    m_shard_count = count;
+
+    Json::Value record;
+    record["op"] = "shards"; record["count"] = count;
+    journal(record);
+}
+
+///
+/// Get the shard an output is pinned to (-1: automatic)
+///
+const int Settings::get_output_shard(const std::string& output) {
+    const channel_id_t o = find_output(output);
+    if (o == NO_CHANNEL)
+        throw OutputNotFound(output);
+
+    return m_channels[o].shard;
+}
+
+///
+/// Pin an output to a shard, -1 for automatic (used on the next
+/// connection to jack)
+///
+void Settings::set_output_shard(const std::string& output, const int shard) {
+    TRACE_SCOPE("settings set output shard");
+    const channel_id_t o = find_output(output);
+    if (o == NO_CHANNEL)
+        throw OutputNotFound(output);
+
+    m_channels[o].shard = shard;
+
+    Json::Value record;
+    record["op"] = "shard"; record["name"] = m_channels[o].name; record["shard"] = shard;
+    journal(record);
+}
+
+///
+/// Get the insert chain of a channel
+///
+const InsertChain& Settings::get_inserts(const std::string& name, const bool input) {
+    const channel_id_t id = input ? find_input(name) : find_output(name);
+    if (id == NO_CHANNEL) {
+        if (input) throw InputNotFound(name);
+        else       throw OutputNotFound(name);
+    }
+    return m_channels[id].inserts;
+}
+
+///
+/// Replace the insert chain of a channel (processor state is kept for
+/// inserts whose position and type don't change)
+///
+void Settings::set_inserts(const std::string& name, const bool input, const InsertChain& chain) {
+    TRACE_SCOPE("settings set inserts");
+    const channel_id_t id = input ? find_input(name) : find_output(name);
+    if (id == NO_CHANNEL) {
+        if (input) throw InputNotFound(name);
+        else       throw OutputNotFound(name);
+    }
+    m_channels[id].inserts = chain;
+    m_revision++;
+
+    Json::Value record;
+    record["op"] = "inserts"; record["name"] = m_channels[id].name; record["in"] = input;
+    record["chain"] = SETTINGS_BACKEND::save_inserts(chain);
+    journal(record);
+}
+
+///
+/// Get the tags of a channel
+///
+const std::set<std::string>& Settings::get_tags(const std::string& name, const bool input) {
+    const channel_id_t id = input ? find_input(name) : find_output(name);
+    if (id == NO_CHANNEL) {
+        if (input) throw InputNotFound(name);
+        else       throw OutputNotFound(name);
+    }
+    return m_channels[id].tags;
+}
+
+///
+/// Replace the tags of a channel (selected with `@tag`)
+///
+void Settings::set_tags(const std::string& name, const bool input, const std::set<std::string>& tags) {
+    TRACE_SCOPE("settings set tags");
+    const channel_id_t id = input ? find_input(name) : find_output(name);
+    if (id == NO_CHANNEL) {
+        if (input) throw InputNotFound(name);
+        else       throw OutputNotFound(name);
+    }
+    // (the engine only sees the low priority and loudness tags of buses)
+    const std::set<std::string>& old = m_channels[id].tags;
+    for (const char* tag : {WATCHDOG_LOW_PRIORITY_TAG, LOUDNESS_TAG})
+        if (!input && old.count(tag) != tags.count(tag))
+            m_revision++;
+    m_channels[id].tags = tags;
+
+    Json::Value record;
+    record["op"] = "tags"; record["name"] = m_channels[id].name; record["in"] = input;
+    record["tags"] = Json::Value(Json::arrayValue);
+    for (const std::string& tag : tags)
+        record["tags"].append(tag);
+    journal(record);
+}
+
+///
+/// Get the ducking rules by name
+///
+const std::map<std::string, DuckRule>& Settings::get_ducks() {
+    return m_ducks;
+}
+
+///
+/// Add or replace a ducking rule
+///
+void Settings::set_duck(const std::string& name, const DuckRule& rule) {
+    TRACE_SCOPE("settings set duck");
+    m_ducks[name] = rule;
+    m_revision++;
+
+    Json::Value record;
+    record["op"] = "duck"; record["name"] = name; record["rule"] = SETTINGS_BACKEND::save_duck(rule);
+    journal(record);
+}
+
+///
+/// Remove a ducking rule
+///
+void Settings::remove_duck(const std::string& name) {
+    TRACE_SCOPE("settings remove duck");
+    if (!m_ducks.erase(name))
+        throw DuckNotFound(name);
+    m_revision++;
+
+    Json::Value record;
+    record["op"] = "duck_rm"; record["name"] = name;
+    journal(record);
+}
+
+///
+/// Get the mix-minus groups by name
+///
+const std::map<std::string, MixMinusGroup>& Settings::get_mix_minus() {
+    return m_mix_minus;
+}
+
+///
+/// Add or replace a mix-minus group (the returns of participants that
+/// left forget their external connections)
+///
+void Settings::set_mix_minus(const std::string& name, const MixMinusGroup& group) {
+    TRACE_SCOPE("settings set mix minus");
+    const auto old = m_mix_minus.find(name);
+    if (old != m_mix_minus.end()) {
+        for (const std::string& p : old->second.participants)
+            if (std::find(group.participants.begin(), group.participants.end(), p) == group.participants.end())
+                forget_return(name, p);
+    }
+    m_mix_minus[name] = group;
+    m_revision++;
+
+    Json::Value record;
+    record["op"] = "mm"; record["name"] = name; record["group"] = SETTINGS_BACKEND::save_mix_minus(group);
+    journal(record);
+}
+
+///
+/// Remove a mix-minus group
+///
+void Settings::remove_mix_minus(const std::string& name) {
+    TRACE_SCOPE("settings remove mix minus");
+    const auto it = m_mix_minus.find(name);
+    if (it == m_mix_minus.end())
+        throw MixMinusNotFound(name);
+    for (const std::string& p : it->second.participants)
+        forget_return(name, p);
+    m_mix_minus.erase(it);
+    m_revision++;
+
+    Json::Value record;
+    record["op"] = "mm_rm"; record["name"] = name;
+    journal(record);
+}
+
+///
+/// Get the MIDI mappings by control
+///
+const std::map<std::string, MidiMapping>& Settings::get_midi() {
+    return m_midi;
+}
+
+///
+/// Map a MIDI control (replaces its mapping)
+///
+void Settings::set_midi(const std::string& control, const MidiMapping& mapping) {
+    TRACE_SCOPE("settings set midi");
+    m_midi[control] = mapping;
+    m_revision++;
+
+    Json::Value record;
+    record["op"] = "midi"; record["name"] = control; record["mapping"] = SETTINGS_BACKEND::save_midi(mapping);
+    journal(record);
+}
+
+///
+/// Remove the mapping of a MIDI control
+///
+void Settings::remove_midi(const std::string& control) {
+    TRACE_SCOPE("settings remove midi");
+    if (!m_midi.erase(control))
+        throw MidiNotFound(control);
+    m_revision++;
+
+    Json::Value record;
+    record["op"] = "midi_rm"; record["name"] = control;
+    journal(record);
+}
+
+///
+/// Jack port name (without client and channel suffix) of the return of
+/// `participant` in mix-minus group `group`
+///
+const std::string Settings::return_name(const std::string& group, const std::string& participant) {
+    return group + MIX_MINUS_SEPARATOR + participant;
+}
+
+///
+/// Get the ports of other clients connected to each of our ports
+///
+const std::map<std::string, std::set<std::string>>& Settings::get_external() {
+    return m_external;
+}
+
+///
+/// Record that our port `port` got connected to (or disconnected from)
+/// `other`, a full port name of another client
+///
+void Settings::set_external(const std::string& port, const std::string& other, const bool connected) {
+    TRACE_SCOPE("settings set external");
+    if (connected) {
+        if (!m_external[port].insert(other).second)
+            return;
+    } else {
+        auto it = m_external.find(port);
+        if (it == m_external.end() || !it->second.erase(other))
+            return;
+        if (it->second.empty())
+            m_external.erase(it);
+    }
+
+    Json::Value record;
+    record["op"] = "ext"; record["name"] = port; record["other"] = other; record["on"] = connected;
+    journal(record);
+}
+
+///
+/// Overlay scene on the current state.
+/// Channels unknown to the scene keep their current values,
+/// channels unknown to the settings are ignored.
+///
+void Settings::apply_scene(const std::string& name) {
+    TRACE_SCOPE("settings apply scene");
+    const Scene scene = get_scene(name);
+
+    for (const auto& p : scene.input_volumes)
+        if (is_input(p.first))
+            set_input_volume(p.first, p.second);
+
+    for (const auto& p : scene.output_volumes)
+        if (is_output(p.first))
+            set_output_volume(p.first, p.second);
+
+    for (const auto& p : scene.output_volumes) {
+        const channel_id_t o = find_output(p.first);
+        if (o == NO_CHANNEL || m_channels[o].name != p.first)
+            continue;
+
+        m_routing.clear_row(o);
+        const auto c = scene.connections.find(p.first);
+        if (c != scene.connections.end())
+            for (const std::string& i : c->second)
+                if (is_input(i))
+                    m_routing.set(m_input_ids[i], o);
+        journal_row(o);
+    }
+
+    if (scene.monitoring_input && is_input(scene.monitor_channel))
+        monitor_input(scene.monitor_channel);
+    else if (!scene.monitoring_input && is_output(scene.monitor_channel))
+        monitor_output(scene.monitor_channel);
+
+    m_revision++;
+}
+
+///
+/// Get revision counter (incremented on every state change)
+///
+const unsigned long Settings::revision() {
+    return m_revision;
 }
@@ -4,9 +4,20 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <set>
+#include <unordered_map>
+#include <chrono>
 #include <exception>
 
 #include "package_config.h"
+#include "scene.h"
+#include "routing_matrix.h"
+#include "journal.h"
+#include "binary_config.h"
+#include "insert.h"
+#include "ducking.h"
+#include "mix_minus.h"
+#include "midi.h"
 
 #include "json_config.cpp"
 #define SETTINGS_BACKEND JSONWriter
@@ -24,21 +35,86 @@
 
 #define JACK_CLIENT_NAME "jamyxer"
 
+#define NO_CHANNEL ((channel_id_t) -1)
+
+typedef unsigned int channel_id_t;
+
+///
+/// Input or output channel. Its id (index in Settings::m_channels) and
+/// alias are assigned once and never reused.
+///
+struct Channel {
+    std::string name;
+    std::string alias;
+    bool input;
+    bool active;
+    float volume;
+    int shard;      // bus shard pinned in the config (-1: automatic)
+    InsertChain inserts;
+    std::set<std::string> tags;
+    std::vector<int> volume_listeners;
+};
+
 class Settings{
     private:
-        std::string m_monitor_channel;
-        bool m_monitoring_input;
+        channel_id_t m_monitor = NO_CHANNEL;
+
+        std::vector<Channel> m_channels;
+        RoutingMatrix m_routing; // row: output id, column: input id
+
+        std::unordered_map<std::string, channel_id_t> m_input_ids;
+        std::unordered_map<std::string, channel_id_t> m_output_ids;
+        std::unordered_map<std::string, channel_id_t> m_input_alias_ids;
+        std::unordered_map<std::string, channel_id_t> m_output_alias_ids;
 
-        std::map<std::string, std::string> m_input_aliases;
-        std::map<std::string, std::string> m_output_aliases;
+        unsigned int m_next_input_alias = 0;
+        unsigned int m_next_output_alias = 0;
 
-        std::map<std::string, float> m_input_volumes;
-        std::map<std::string, float> m_output_volumes;
-        std::map<std::string, std::vector<std::string>> m_connections;
         std::string m_filename;
 
-        std::map<std::string, std::vector<int>> m_input_volume_listeners;
-        std::map<std::string, std::vector<int>> m_output_volume_listeners;
+        std::map<std::string, Scene> m_scenes;
+
+        unsigned int m_shard_count = 0;
+
+        std::map<std::string, DuckRule> m_ducks;
+
+        std::map<std::string, MixMinusGroup> m_mix_minus;
+
+        std::map<std::string, MidiMapping> m_midi;
+
+        // jack ports of other clients connected to our ports (by short name)
+        std::map<std::string, std::set<std::string>> m_external;
+
+        unsigned long m_revision = 0;
+
+        // === persistence (see journal.h) ===
+        Journal m_journal;
+        unsigned long m_journal_seq = 0;
+        unsigned long m_compacted_seq = 0;
+        std::chrono::steady_clock::time_point m_compacted_at;
+        bool m_replaying = false;
+
+        void journal(Json::Value record);
+        void journal_row(const channel_id_t output);
+        void replay(const Json::Value& record);
+        void compact();
+
+        // === binary snapshot (see binary_config.h) ===
+        const std::string binary_filename();
+        const std::string compile_binary();
+        const bool load_binary(const BinaryConfig& snapshot);
+        void load_json(SETTINGS_BACKEND& backend);
+
+        const channel_id_t add_channel(const std::string& name, const bool input, float vol);
+        void remove_channel(const channel_id_t id);
+        void set_volume(const channel_id_t id, float new_vol);
+        const std::vector<std::string> get_names(const std::unordered_map<std::string, channel_id_t>& ids);
+        const std::vector<std::string> channel_ports(const std::string& name, const bool input);
+        void move_external(const std::string& name, const std::string& new_name, const bool input);
+        void move_ducks(const std::string& name, const std::string& new_name, const bool input);
+        void move_mix_minus(const std::string& name, const std::string& new_name);
+        void move_midi(const std::string& name, const std::string& new_name, const bool input);
+        void forget_return(const std::string& group, const std::string& participant);
 
     public:
         class SettingsException : public std::exception {
@@ -65,11 +141,84 @@ class Settings{
                 }
         };
 
+        class InputExists : public SettingsException {
+            public:
+                InputExists(const std::string& input) {
+                    os = "Input already exists: `"+input+"`";
+                }
+        };
+
+        class OutputExists : public SettingsException {
+            public:
+                OutputExists(const std::string& output) {
+                    os = "Output already exists: `"+output+"`";
+                }
+        };
+
+        class InvalidMatrix : public SettingsException {
+            public:
+                InvalidMatrix(const std::string& row) {
+                    os = "Invalid matrix row: `"+row+"`";
+                }
+        };
+
+        class NoMatch : public SettingsException {
+            public:
+                NoMatch(const std::string& selector, const bool input) {
+                    os = std::string("No ")+(input ? "input" : "output")+" matches `"+selector+"`";
+                }
+        };
+
+        class InvalidSelector : public SettingsException {
+            public:
+                InvalidSelector(const std::string& selector) {
+                    os = "Invalid selector: `"+selector+"`";
+                }
+        };
+
+        class DuckNotFound : public SettingsException {
+            public:
+                DuckNotFound(const std::string& duck) {
+                    os = "Ducking rule not found: `"+duck+"`";
+                }
+        };
+
+        class MixMinusNotFound : public SettingsException {
+            public:
+                MixMinusNotFound(const std::string& group) {
+                    os = "Mix-minus group not found: `"+group+"`";
+                }
+        };
+
+        class MidiNotFound : public SettingsException {
+            public:
+                MidiNotFound(const std::string& control) {
+                    os = "MIDI control not mapped: `"+control+"`";
+                }
+        };
+
+        class SceneNotFound : public SettingsException {
+            const std::string m_scene;
+            public:
+                SceneNotFound(const std::string& scene) : m_scene(scene) {
+                    os = "Scene not found: `"+m_scene+"`";
+                }
+        };
+
         explicit Settings(const std::string filename);
         ~Settings();
 
         void load();
-        void save(); // TODO
+        void save();
+        void flush();
+        const std::string filename();
+        const bool changed_on_disk();
+
+        // === channel ids ===
+        const channel_id_t find_input(const std::string& input);
+        const channel_id_t find_output(const std::string& output);
+        const Channel& channel(const channel_id_t id);
+        const size_t channel_count();
 
         // === name aliases ===
         void gen_aliases();
@@ -83,6 +232,14 @@ class Settings{
         const std::vector<std::string> get_input_aliases();
         const std::vector<std::string> get_output_aliases();
 
+        // === selectors (name or alias, glob, /regex/ or @tag) ===
+        static const bool is_selector(const std::string& selector);
+        const std::vector<std::string> select(const std::string& selector, const bool input);
+
+        // === tags ===
+        const std::set<std::string>& get_tags(const std::string& name, const bool input);
+        void set_tags(const std::string& name, const bool input, const std::set<std::string>& tags);
+
         // === get ===
         const std::string get_monitor();
         const bool monitoring_input();
@@ -101,6 +258,9 @@ class Settings{
 
         const bool is_connected(const std::string& input, const std::string& output);
 
+        const std::vector<channel_id_t> get_sources(const channel_id_t output);
+        const std::string get_matrix();
+
         // === set ===
         void monitor_input(const std::string input);
         void monitor_output(const std::string output);
@@ -111,13 +271,66 @@ class Settings{
         void remove_input(const std::string& input);
         void remove_output(const std::string& output);
 
+        void rename_input(const std::string& input, const std::string& new_name);
+        void rename_output(const std::string& output, const std::string& new_name);
+
         void set_input_volume(const std::string& input, float new_vol);
         void set_output_volume(const std::string& output, float new_vol);
 
         void connect(const std::string& input, const std::string& output);
         void disconnect(const std::string& input, const std::string& output);
 
+        void connect_all(const std::string& input);
+        void disconnect_all(const std::string& input);
+        void clear_connections(const std::string& output);
+        void copy_connections(const std::string& src, const std::string& dst);
+        void set_matrix(const std::vector<std::pair<std::string, std::string>>& rows);
+        void set_connections(const std::string& output, const std::vector<std::string>& inputs);
+
+        // === scenes ===
+        const Scene snapshot();
+        const Scene& get_scene(const std::string& name);
+        const std::vector<std::string> get_scenes();
+        const bool is_scene(const std::string& name);
+
+        void store_scene(const std::string& name);
+        void store_scene(const std::string& name, const Scene& scene);
+        void remove_scene(const std::string& name);
+        void apply_scene(const std::string& name);
+
+        // === external jack connections ===
+        const std::map<std::string, std::set<std::string>>& get_external();
+        void set_external(const std::string& port, const std::string& other, const bool connected);
+
+        // === shards ===
+        const unsigned int shard_count();
+        void set_shard_count(const unsigned int count);
+        const int get_output_shard(const std::string& output);
+        void set_output_shard(const std::string& output, const int shard);
+
+        // === insert chains ===
+        const InsertChain& get_inserts(const std::string& name, const bool input);
+        void set_inserts(const std::string& name, const bool input, const InsertChain& chain);
+
+        // === ducking ===
+        const std::map<std::string, DuckRule>& get_ducks();
+        void set_duck(const std::string& name, const DuckRule& rule);
+        void remove_duck(const std::string& name);
+
+        // === mix-minus ===
+        const std::map<std::string, MixMinusGroup>& get_mix_minus();
+        void set_mix_minus(const std::string& name, const MixMinusGroup& group);
+        void remove_mix_minus(const std::string& name);
+        static const std::string return_name(const std::string& group, const std::string& participant);
+
+        // === MIDI mappings ===
+        const std::map<std::string, MidiMapping>& get_midi();
+        void set_midi(const std::string& control, const MidiMapping& mapping);
+        void remove_midi(const std::string& control);
+
         // === misc ===
+        const unsigned long revision();
+
         void add_input_volume_listener(const std::string& input, const int file_descriptor);
         void add_output_volume_listener(const std::string& output, const int file_descriptor);
 };
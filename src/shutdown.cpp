@@ -0,0 +1,92 @@
+#include "shutdown.h"
+#include "log.h"
+
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+
+namespace {
+    std::atomic<const char*> g_reason(nullptr);
+
+    sigset_t shutdown_signals() {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGINT);
+        sigaddset(&set, SIGTERM);
+        return set;
+    }
+}
+
+///
+/// The shutdown eventfd (never read, so it stays readable once written)
+///
+int Shutdown::fd() {
+    static const int fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    return fd;
+}
+
+///
+/// Ask every thread to stop (the first reason is kept)
+///
+void Shutdown::request(const char* reason) {
+    const char* none = nullptr;
+    g_reason.compare_exchange_strong(none, reason);
+    const uint64_t one = 1;
+    if (::write(fd(), &one, sizeof one) < 0)
+        LOG_ERROR("Could not request shutdown: %s", std::strerror(errno));
+}
+
+///
+/// Whether a shutdown was requested
+///
+const bool Shutdown::requested() {
+    return g_reason.load() != nullptr;
+}
+
+///
+/// Block SIGINT and SIGTERM so that `wait()` can take them. Call before
+/// starting any thread (they inherit the mask).
+///
+void Shutdown::block_signals() {
+    const sigset_t set = shutdown_signals();
+    ::pthread_sigmask(SIG_BLOCK, &set, NULL);
+    fd();
+}
+
+///
+/// Wait for a shutdown request or signal and return its reason (from the
+/// thread that called `block_signals()`)
+///
+const std::string Shutdown::wait() {
+    const sigset_t set = shutdown_signals();
+    const int sfd = ::signalfd(-1, &set, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (sfd < 0)
+        LOG_WARN("signalfd: %s (SIGINT and SIGTERM are blocked)", std::strerror(errno));
+
+    struct ::pollfd pfds[2] = {{fd(), POLLIN, 0}, {sfd, POLLIN, 0}};
+    while (!requested()) {
+        if (::poll(pfds, sfd < 0 ? 1 : 2, -1) < 0 && errno != EINTR)
+            break;
+
+        struct ::signalfd_siginfo info;
+        if (sfd >= 0 && ::read(sfd, &info, sizeof info) == sizeof info)
+            request(info.ssi_signo == SIGINT ? "interrupted" : "terminated");
+    }
+
+    if (sfd >= 0)
+        ::close(sfd);
+    if (!requested())
+        request("signal wait failed");
+
+    // a second signal during the drain kills the process
+    ::pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+    return g_reason.load();
+}
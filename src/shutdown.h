@@ -0,0 +1,22 @@
+#ifndef SHUTDOWN_H
+#define SHUTDOWN_H
+
+#include <string>
+
+///
+/// Process-wide shutdown request. Every thread that waits on file
+/// descriptors polls `fd()` along with them: it becomes (and stays)
+/// readable once a shutdown is requested, so all of them wake at once.
+/// SIGINT and SIGTERM are taken through a signalfd by `wait()`.
+///
+class Shutdown {
+    public:
+        static int fd();
+        static void request(const char* reason);
+        static const bool requested();
+
+        static void block_signals();
+        static const std::string wait();
+};
+
+#endif
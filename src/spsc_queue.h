@@ -0,0 +1,58 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+///
+/// Fixed size lock-free queue for exactly one producer thread and one
+/// consumer thread (used to hand events to the jack callback).
+///
+template<typename T, size_t N>
+class SpscQueue {
+    private:
+        T m_items[N];
+        std::atomic<size_t> m_head; // next slot to read  (consumer)
+        std::atomic<size_t> m_tail; // next slot to write (producer)
+
+    public:
+        SpscQueue() : m_head(0), m_tail(0) { }
+
+        ///
+        /// Producer: append `item`. Return false if the queue is full.
+        ///
+        const bool push(const T& item) {
+            const size_t tail = m_tail.load(std::memory_order_relaxed);
+            if (tail - m_head.load(std::memory_order_acquire) == N)
+                return false;
+            m_items[tail % N] = item;
+            m_tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        ///
+        /// Consumer: oldest item (nullptr if the queue is empty)
+        ///
+        const T* front() const {
+            const size_t head = m_head.load(std::memory_order_relaxed);
+            if (head == m_tail.load(std::memory_order_acquire))
+                return nullptr;
+            return &m_items[head % N];
+        }
+
+        ///
+        /// Consumer: drop the oldest item
+        ///
+        void pop() {
+            m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        ///
+        /// Either thread: true if the consumer has popped everything pushed
+        ///
+        const bool empty() const {
+            return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+        }
+};
+
+#endif
@@ -0,0 +1,219 @@
+#include "trace.h"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+std::atomic<bool> Trace::enabled(false);
+
+namespace {
+    ///
+    /// Events of one thread. Only the owner writes `events` and `head`;
+    /// a reader copies them and keeps what was not overwritten meanwhile.
+    ///
+    struct Ring {
+        std::string thread;
+        std::vector<Trace::Event> events;
+        std::atomic<uint64_t> head;             // events recorded this generation
+        std::atomic<unsigned long> generation;  // of the tracing run they belong to
+        std::atomic<bool> owned;
+
+        Ring() : events(TRACE_RING_EVENTS), head(0), generation(0), owned(true) { }
+    };
+
+    ///
+    /// Gives the ring of a thread back when the thread exits
+    ///
+    struct RingHolder {
+        Ring* ring = nullptr;
+        ~RingHolder() {
+            if (ring)
+                ring->owned.store(false, std::memory_order_release);
+        }
+    };
+
+    std::mutex g_rings_lock;
+    std::vector<std::unique_ptr<Ring>> g_rings;
+    std::atomic<unsigned long> g_generation(0);
+
+    // clocks at start and stop, to convert ticks to microseconds
+    uint64_t g_start_ticks = 0, g_stop_ticks = 0;
+    std::chrono::steady_clock::time_point g_start_time, g_stop_time;
+
+    thread_local Ring* t_ring = nullptr;
+
+    inline uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    ///
+    /// Ring of the calling thread (reuses the ring of an exited thread)
+    ///
+    Ring* acquire(const std::string& name) {
+        thread_local RingHolder holder;
+        std::lock_guard<std::mutex> lock(g_rings_lock);
+        if (holder.ring) {
+            // (`write` reads the name)
+            holder.ring->thread = name;
+            return holder.ring;
+        }
+
+        size_t t = 0;
+        for (; t<g_rings.size(); t++) {
+            bool owned = false;
+            if (g_rings[t]->owned.compare_exchange_strong(owned, true))
+                break;
+        }
+        if (t == g_rings.size())
+            g_rings.push_back(std::unique_ptr<Ring>(new Ring()));
+        Ring* ring = g_rings[t].get();
+        ring->thread = name.empty() ? "thread " + std::to_string(t) : name;
+        ring->head.store(0, std::memory_order_relaxed);
+        ring->generation.store(0, std::memory_order_relaxed);
+        holder.ring = ring;
+        t_ring = ring;
+        return ring;
+    }
+
+    const std::string escape(const std::string& s) {
+        std::string os;
+        for (char c : s) {
+            if (c == '"' || c == '\\')
+                os += '\\';
+            if ((unsigned char) c < 0x20)
+                continue;
+            os += c;
+        }
+        return os;
+    }
+}
+
+///
+/// Name the calling thread in traces and give it its ring now, so that
+/// recording from it never allocates
+///
+void Trace::register_thread(const std::string& name) {
+    acquire(name);
+}
+
+///
+/// Record an event on the calling thread's ring (call through the
+/// TRACE_* macros)
+///
+void Trace::record(const char phase, const char* name, const char* arg_name, const int64_t arg) {
+    Ring* ring = t_ring;
+    if (!ring)
+        ring = acquire("");
+
+    const unsigned long generation = g_generation.load(std::memory_order_relaxed);
+    if (ring->generation.load(std::memory_order_relaxed) != generation) {
+        ring->head.store(0, std::memory_order_relaxed);
+        ring->generation.store(generation, std::memory_order_release);
+    }
+
+    const uint64_t head = ring->head.load(std::memory_order_relaxed);
+    ring->events[head % TRACE_RING_EVENTS] = {ticks(), name, arg_name, arg, phase};
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+///
+/// Start a tracing run (forgets the events of the previous one)
+///
+void Trace::start() {
+    g_generation.fetch_add(1);
+    g_start_ticks = ticks();
+    g_start_time = std::chrono::steady_clock::now();
+    enabled.store(true);
+}
+
+///
+/// Stop recording (events stay in the rings until the next start)
+///
+void Trace::stop() {
+    if (!enabled.exchange(false))
+        return;
+    g_stop_ticks = ticks();
+    g_stop_time = std::chrono::steady_clock::now();
+}
+
+///
+/// Write the events of the last run as Chrome trace JSON to the file
+/// `name` of TRACE_DIR (a plain file name: the control socket is open to
+/// any local client) and return its path
+///
+const std::string Trace::write(const std::string& name) {
+    if (name.empty() || name[0] == '.' || name.find('/') != std::string::npos) {
+        TraceException e;
+        e.os = "Invalid trace name: `" + name + "` (a file name, written in " TRACE_DIR ")";
+        throw e;
+    }
+    ::mkdir(TRACE_DIR, 0755);
+    const std::string filename = std::string(TRACE_DIR) + "/" + name;
+
+    const double us = std::chrono::duration<double, std::micro>(g_stop_time - g_start_time).count();
+    const double us_per_tick = g_stop_ticks > g_start_ticks ? us / (g_stop_ticks - g_start_ticks) : 0;
+    const unsigned long generation = g_generation.load();
+    const int pid = ::getpid();
+
+    std::ofstream file(filename);
+    if (!file) {
+        TraceException e;
+        e.os = "Could not write trace `" + filename + "`";
+        throw e;
+    }
+    file << std::fixed << std::setprecision(3);
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    std::lock_guard<std::mutex> lock(g_rings_lock);
+    bool first = true;
+    for (size_t t=0; t<g_rings.size(); t++) {
+        Ring& ring = *g_rings[t];
+        if (ring.generation.load(std::memory_order_acquire) != generation)
+            continue;
+
+        // copy, then drop what the owner overwrote while we were copying
+        const uint64_t head = ring.head.load(std::memory_order_acquire);
+        const uint64_t begin = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+        std::vector<Event> events;
+        for (uint64_t i=begin; i<head; i++)
+            events.push_back(ring.events[i % TRACE_RING_EVENTS]);
+        const uint64_t after = ring.head.load(std::memory_order_acquire);
+        // (the slot of event `after` may be half written)
+        const size_t lost = after + 1 > begin + TRACE_RING_EVENTS ? after + 1 - begin - TRACE_RING_EVENTS : 0;
+        events.erase(events.begin(), events.begin() + std::min(lost, events.size()));
+
+        file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+             << ",\"tid\":" << t << ",\"args\":{\"name\":\"" << escape(ring.thread) << "\"}}";
+        first = false;
+
+        for (const Event& e : events) {
+            const double ts = e.ts > g_start_ticks ? (e.ts - g_start_ticks) * us_per_tick : 0;
+            file << ",\n{\"name\":\"" << escape(e.name) << "\",\"ph\":\"" << e.phase
+                 << "\",\"ts\":" << ts << ",\"pid\":" << pid << ",\"tid\":" << t;
+            if (e.phase == 'i')
+                file << ",\"s\":\"t\"";
+            if (e.arg_name)
+                file << ",\"args\":{\"" << escape(e.arg_name) << "\":" << e.arg << "}";
+            file << "}";
+        }
+    }
+    file << "\n]}\n";
+    return filename;
+}
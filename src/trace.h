@@ -0,0 +1,84 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string>
+#include <atomic>
+#include <exception>
+#include <cstdint>
+
+// events kept per thread while tracing (the oldest ones are overwritten)
+#define TRACE_RING_EVENTS 16384
+// traces are only ever written in this directory (created if missing)
+#define TRACE_DIR "traces"
+
+///
+/// Event tracing for finding what made a period overrun. Every thread
+/// records into its own ring of fixed-size events stamped with the TSC;
+/// recording never locks or allocates once the thread has its ring (jack
+/// threads get theirs from the thread init callback). Tracepoints are
+/// the TRACE_* macros: while tracing is off they cost one branch.
+///
+/// `write` dumps the rings as Chrome trace JSON (opens in Perfetto) to a
+/// file of TRACE_DIR.
+///
+class Trace {
+    public:
+        class TraceException : public std::exception {
+            public:
+                std::string os;
+            const char* what() const throw() {
+                return os.c_str();
+            }
+        };
+
+        struct Event {
+            uint64_t ts;            // TSC ticks
+            const char* name;       // string literals only
+            const char* arg_name;   // (nullptr: no argument)
+            int64_t arg;
+            char phase;             // 'B'egin, 'E'nd, 'i'nstant
+        };
+
+        static std::atomic<bool> enabled;
+
+        static void register_thread(const std::string& name);
+        static void record(const char phase, const char* name, const char* arg_name=nullptr, const int64_t arg=0);
+
+        static void start();
+        static void stop();
+        static const std::string write(const std::string& name);
+};
+
+///
+/// Begin event now and end event when leaving the scope
+///
+class TraceScope {
+    private:
+        const char* m_name;
+        const bool m_on;
+
+    public:
+        TraceScope(const char* name, const char* arg_name=nullptr, const int64_t arg=0)
+            : m_name(name), m_on(Trace::enabled.load(std::memory_order_relaxed)) {
+            if (__builtin_expect(m_on, 0))
+                Trace::record('B', name, arg_name, arg);
+        }
+        ~TraceScope() {
+            if (__builtin_expect(m_on, 0))
+                Trace::record('E', m_name);
+        }
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+// TRACE_SCOPE(name[, arg_name, arg]): trace the rest of the enclosing scope
+#define TRACE_SCOPE(...) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(__VA_ARGS__)
+
+// TRACE_EVENT(name[, arg_name, arg]): instant event
+#define TRACE_EVENT(...) do { \
+        if (__builtin_expect(Trace::enabled.load(std::memory_order_relaxed), 0)) \
+            Trace::record('i', __VA_ARGS__); \
+    } while (0)
+
+#endif
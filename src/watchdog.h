@@ -0,0 +1,43 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+// a period is over budget when its callback takes more than this share
+// of it, and has headroom when it takes less than this one
+#define WATCHDOG_SHED_LOAD 0.7
+#define WATCHDOG_RESTORE_LOAD 0.4
+// periods over budget in a row before shedding one more stage (an xrun
+// sheds at once)...
+#define WATCHDOG_SHED_PERIODS 4
+// ...and time with headroom before restoring the last one shed
+#define WATCHDOG_RESTORE_MS 3000
+
+// while metering is shed, peaks are taken from every this many frames
+#define WATCHDOG_METER_STRIDE 16
+// buses with this tag go silent while low priority buses are shed
+#define WATCHDOG_LOW_PRIORITY_TAG "low-priority"
+
+// optional work, in the order it is shed (restored the other way round)
+#define WATCHDOG_SHED_ORDER { Shed::METERING, Shed::ANALYSIS, Shed::IMPLICIT_OUTPUTS, Shed::LOW_PRIORITY_BUSES }
+
+///
+/// Optional work an engine drops while its callback runs out of time (see
+/// `Backend::watchdog`): coarser peak meters, the blocks handed to the
+/// loudness meters, the implicit outputs that only other clients read (a
+/// shard tap or the monitor keeps them) and the buses tagged
+/// WATCHDOG_LOW_PRIORITY_TAG (unless monitored).
+///
+struct Shed {
+    enum Stage { METERING, ANALYSIS, IMPLICIT_OUTPUTS, LOW_PRIORITY_BUSES, STAGES };
+
+    static const char* name(const Stage stage) {
+        switch (stage) {
+            case METERING:           return "metering";
+            case ANALYSIS:           return "analysis";
+            case IMPLICIT_OUTPUTS:   return "implicit outputs";
+            case LOW_PRIORITY_BUSES: return "low priority buses";
+            default:                 return "?";
+        }
+    }
+};
+
+#endif
@@ -83,7 +83,7 @@ class YAMLWriter : public ConfigWriter {
 
         }
 
-        void save() {}
+        void save(std::function<void(const std::string&)> before_rename = nullptr) {}
 };
 
 #endif